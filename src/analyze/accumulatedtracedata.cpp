@@ -5,6 +5,7 @@
 */
 
 #include "accumulatedtracedata.h"
+#include "analysiscache.h"
 #include "analyze_config.h"
 #include "peaktracker.h"
 
@@ -14,67 +15,99 @@
 #include <memory>
 
 #include <boost/algorithm/string/predicate.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
-#if ZSTD_FOUND
-#if BOOST_IOSTREAMS_HAS_ZSTD
-#include <boost/iostreams/filter/zstd.hpp>
-#else
-#include <boost-zstd/zstd.hpp>
-#endif
-#endif
-#include <boost/iostreams/filtering_stream.hpp>
 
 #include <boost/filesystem.hpp>
 
+#include "util/allocationsampler.h"
 #include "util/config.h"
 #include "util/linereader.h"
 #include "util/macroutils.h"
 #include "util/pointermap.h"
 
 #include "suppressions.h"
+#include "tracefilereader.h"
 
 using namespace std;
 
 namespace {
 
+// the minimum distance between two time checkpoints in the uncompressed data
+constexpr const uint64_t CHECKPOINT_INTERVAL = 1024 * 1024;
+
+/**
+ * Sums up the estimated number of sampled allocations
+ *
+ * Rounding the weight of every single allocation would bias the counts, so only whole allocations get
+ * reported and the remaining fraction is carried over to the next one.
+ */
+struct WeightedCounter
+{
+    double remainder = 0;
+
+    int64_t add(float weight)
+    {
+        const auto count = remainder + weight;
+        const auto whole = llround(count);
+        remainder = count - static_cast<double>(whole);
+        return whole;
+    }
+};
+
+struct WeightedCounters
+{
+    WeightedCounter allocations;
+    WeightedCounter temporary;
+};
+
 template <typename Base>
 bool operator>>(LineReader& reader, Index<Base>& index)
 {
     return reader.readHex(index.index);
 }
 
-template <typename Base>
-ostream& operator<<(ostream& out, const Index<Base> index)
+/**
+ * Read the function, file and line of a frame of an 'i' or 'f' line
+ *
+ * Frames without debug information only have a function, which gets read nonetheless.
+ *
+ * @return true when the frame was complete
+ */
+bool readFrame(LineReader& reader, Frame* frame)
 {
-    out << index.index;
-    return out;
+    uint64_t fields[3] = {};
+    const auto numFields = reader.parseHexFields(fields, 3);
+    if (numFields > 0) {
+        frame->functionIndex.index = static_cast<uint32_t>(fields[0]);
+    }
+    if (numFields > 1) {
+        frame->fileIndex.index = static_cast<uint32_t>(fields[1]);
+    }
+    if (numFields > 2) {
+        frame->line = static_cast<int>(fields[2]);
+    }
+    return numFields == 3;
 }
 
-// boost's counter filter uses an int for the count which overflows for large streams; so replace it with a work alike.
-class byte_counter
+/// add the builtin suppressions and the ones of @p filterParameters
+void addSuppressions(const FilterParameters& filterParameters, vector<Suppression>* suppressions)
 {
-public:
-    using char_type = char;
-    using category = boost::iostreams::multichar_input_filter_tag;
-
-    uint64_t bytes() const
-    {
-        return m_bytes;
+    if (!filterParameters.disableBuiltinSuppressions) {
+        *suppressions = builtinSuppressions();
     }
 
-    template <typename Source>
-    std::streamsize read(Source& src, char* str, std::streamsize size)
-    {
-        auto const readsize = boost::iostreams::read(src, str, size);
-        if (readsize == -1)
-            return -1;
-        m_bytes += readsize;
-        return readsize;
-    }
+    const auto builtins = suppressions->size();
+    suppressions->resize(builtins + filterParameters.suppressions.size());
+    std::transform(filterParameters.suppressions.begin(), filterParameters.suppressions.end(),
+                   suppressions->begin() + builtins,
+                   [](const std::string& pattern) { return Suppression {pattern, 0, 0}; });
+}
 
-private:
-    uint64_t m_bytes = 0;
-};
+template <typename Base>
+ostream& operator<<(ostream& out, const Index<Base> index)
+{
+    out << index.index;
+    return out;
+}
 }
 
 AccumulatedTraceData::AccumulatedTraceData()
@@ -149,37 +182,40 @@ bool AccumulatedTraceData::read(const string& inputFile, bool isReparsing)
 
 bool AccumulatedTraceData::read(const string& inputFile, const ParsePass pass, bool isReparsing)
 {
-    const bool isGzCompressed = boost::algorithm::ends_with(inputFile, ".gz");
-    const bool isZstdCompressed = boost::algorithm::ends_with(inputFile, ".zst");
-    const bool isCompressed = isGzCompressed || isZstdCompressed;
-    ifstream file(inputFile, isCompressed ? ios_base::in | ios_base::binary : ios_base::in);
-
-    if (!file.is_open()) {
-        cerr << "Failed to open heaptrack log file: " << inputFile << endl;
-        return false;
+    const bool isCacheable = useAnalysisCache && pass == FirstPass && !isReparsing
+        && !filterParameters.isFilteredByTime(numeric_limits<int64_t>::max());
+    if (isCacheable && AnalysisCache::load(inputFile, this)) {
+        addSuppressions(filterParameters, &suppressions);
+        if (!filterParameters.disableEmbeddedSuppressions) {
+            for (const auto& suppression : embeddedSuppressions) {
+                suppressions.push_back({suppression, 0, 0});
+            }
+        }
+        if (!debuggeeCommand.empty()) {
+            handleDebuggee(debuggeeCommand.c_str());
+        }
+        filterParameters.maxTime = totalTime;
+        handleTimeStamp(totalTime - 1, totalTime, true, pass);
+        return true;
     }
 
-    boost::iostreams::filtering_istream in;
-    in.push(byte_counter()); // caution, ::read dependant on filter order
-    if (isGzCompressed) {
-        in.push(boost::iostreams::gzip_decompressor());
-    } else if (isZstdCompressed) {
-#if ZSTD_FOUND
-        in.push(boost::iostreams::zstd_decompressor());
-#else
-        cerr << "Heaptrack was built without zstd support, cannot decompressed data file: " << inputFile << endl;
+    auto in = openTraceFile(inputFile);
+    if (!in) {
         return false;
-#endif
     }
-    in.push(byte_counter()); // caution, ::read dependant on filter order
-    in.push(file);
 
     parsingState.fileSize = boost::filesystem::file_size(inputFile);
 
-    return read(in, pass, isReparsing);
+    if (!read(*in, pass, isReparsing)) {
+        return false;
+    }
+    if (isCacheable) {
+        AnalysisCache::save(inputFile, *this);
+    }
+    return true;
 }
 
-bool AccumulatedTraceData::read(boost::iostreams::filtering_istream& in, const ParsePass pass, bool isReparsing)
+bool AccumulatedTraceData::read(BlockReader& in, const ParsePass pass, bool isReparsing)
 {
     LineReader reader;
     int64_t timeStamp = 0;
@@ -202,16 +238,8 @@ bool AccumulatedTraceData::read(boost::iostreams::filtering_istream& in, const P
     auto peakTracker = PeakTracker(*this);
 
     if (pass == FirstPass) {
-        if (!filterParameters.disableBuiltinSuppressions) {
-            suppressions = builtinSuppressions();
-        }
-
-        const auto builtins = suppressions.size();
-        suppressions.resize(builtins + filterParameters.suppressions.size());
-        std::transform(filterParameters.suppressions.begin(), filterParameters.suppressions.end(),
-                       suppressions.begin() + builtins, [](const std::string& pattern) {
-                           return Suppression {pattern, 0, 0};
-                       });
+        addSuppressions(filterParameters, &suppressions);
+        embeddedSuppressions.clear();
     }
     peakRSS = 0;
     for (auto& allocation : allocations) {
@@ -220,6 +248,8 @@ bool AccumulatedTraceData::read(boost::iostreams::filtering_istream& in, const P
     unsigned int fileVersion = 0;
     bool debuggeeEncountered = false;
     bool inFilteredTime = !filterParameters.minTime;
+    // the RSS from the last 'R' line, which also applies to the time stamps after it
+    int64_t rss = 0;
 
     // required for backwards compatibility
     // newer versions handle this in heaptrack_interpret already
@@ -230,15 +260,27 @@ bool AccumulatedTraceData::read(boost::iostreams::filtering_istream& in, const P
     // allocations, i.e. when a deallocation follows with the same data
     uint64_t lastAllocationPtr = 0;
 
-    const auto uncompressedCount = in.component<byte_counter>(0);
-    const auto compressedCount = in.component<byte_counter>(in.size() - 2);
+    // the fractions of the estimated allocations per trace, only used when sampling
+    vector<WeightedCounters> weightedCounters;
+    auto weightedCountersOf = [&](AllocationIndex index) -> WeightedCounters& {
+        if (index.index >= weightedCounters.size()) {
+            weightedCounters.resize(allocations.size());
+        }
+        return weightedCounters[index.index];
+    };
 
     parsingState.pass = pass;
     parsingState.reparsing = isReparsing;
 
+    // reparsing a time range skips the data before it, using the checkpoints of the first pass
+    const bool recordCheckpoints = pass == FirstPass && !isReparsing;
+    if (recordCheckpoints) {
+        timeCheckpoints.clear();
+    }
+
     while (timeStamp < filterParameters.maxTime && reader.getLine(in)) {
-        parsingState.readCompressedByte = compressedCount->bytes();
-        parsingState.readUncompressedByte = uncompressedCount->bytes();
+        parsingState.readCompressedByte = in.readInputBytes();
+        parsingState.readUncompressedByte = in.readBytes();
         parsingState.timestamp = timeStamp;
 
         if (reader.mode() == 's') {
@@ -252,7 +294,7 @@ bool AccumulatedTraceData::read(boost::iostreams::filtering_istream& in, const P
                 strings.push_back(std::move(string));
             } else {
                 // read remaining line as string, possibly including white spaces
-                strings.push_back(reader.line().substr(2));
+                strings.emplace_back(reader.line().substr(2));
             }
 
             StringIndex index;
@@ -273,9 +315,11 @@ bool AccumulatedTraceData::read(boost::iostreams::filtering_istream& in, const P
             if (pass != FirstPass || isReparsing) {
                 continue;
             }
+            uint64_t fields[2] = {};
+            reader.parseHexFields(fields, 2);
             TraceNode node;
-            reader >> node.ipIndex;
-            reader >> node.parentIndex;
+            node.ipIndex.index = static_cast<uint32_t>(fields[0]);
+            node.parentIndex.index = static_cast<uint32_t>(fields[1]);
             // skip operator new and operator new[] at the beginning of traces
             while (find(opNewIpIndices.begin(), opNewIpIndices.end(), node.ipIndex) != opNewIpIndices.end()) {
                 node = findTrace(node.parentIndex);
@@ -285,15 +329,14 @@ bool AccumulatedTraceData::read(boost::iostreams::filtering_istream& in, const P
             if (pass != FirstPass || isReparsing) {
                 continue;
             }
+            uint64_t fields[2] = {};
+            reader.parseHexFields(fields, 2);
             InstructionPointer ip;
-            reader >> ip.instructionPointer;
-            reader >> ip.moduleIndex;
-            auto readFrame = [&reader](Frame* frame) {
-                return (reader >> frame->functionIndex) && (reader >> frame->fileIndex) && (reader >> frame->line);
-            };
-            if (readFrame(&ip.frame)) {
+            ip.instructionPointer = fields[0];
+            ip.moduleIndex.index = static_cast<uint32_t>(fields[1]);
+            if (readFrame(reader, &ip.frame)) {
                 Frame inlinedFrame;
-                while (readFrame(&inlinedFrame)) {
+                while (readFrame(reader, &inlinedFrame)) {
                     ip.inlined.push_back(inlinedFrame);
                 }
             }
@@ -304,6 +347,31 @@ bool AccumulatedTraceData::read(boost::iostreams::filtering_istream& in, const P
                 index.index = instructionPointers.size();
                 opNewIpIndices.push_back(index);
             }
+        } else if (reader.mode() == 'f') {
+            // debug information of an instruction pointer, resolved after the fact by heaptrack_interpret --symbolize lazy
+            if (pass != FirstPass || isReparsing) {
+                continue;
+            }
+            IpIndex index;
+            if (!(reader >> index.index)) {
+                cerr << "failed to parse line: " << reader.line() << ' ' << __LINE__ << endl;
+                continue;
+            } else if (!index.index || index.index > instructionPointers.size()) {
+                cerr << "instruction pointer index out of bounds: " << index.index
+                     << ", maximum is: " << instructionPointers.size() << endl;
+                continue;
+            }
+            auto& ip = instructionPointers[index.index - 1];
+            Frame frame;
+            vector<Frame> inlined;
+            if (readFrame(reader, &frame)) {
+                Frame inlinedFrame;
+                while (readFrame(reader, &inlinedFrame)) {
+                    inlined.push_back(inlinedFrame);
+                }
+            }
+            ip.frame = frame;
+            ip.inlined = std::move(inlined);
         } else if (reader.mode() == '+') {
             if (!inFilteredTime) {
                 continue;
@@ -336,14 +404,18 @@ bool AccumulatedTraceData::read(boost::iostreams::filtering_istream& in, const P
                 lastAllocationPtr = ptr;
             }
 
+            const auto count =
+                info.weight == 1 ? 1 : weightedCountersOf(info.allocationIndex).allocations.add(info.weight);
+            const auto size = info.weightedSize();
+
             auto& allocation = allocations[info.allocationIndex.index];
-            allocation.leaked += info.size;
-            ++allocation.allocations;
+            allocation.leaked += size;
+            allocation.allocations += count;
 
             handleAllocation(info, allocationIndex);
 
-            ++totalCost.allocations;
-            totalCost.leaked += info.size;
+            totalCost.allocations += count;
+            totalCost.leaked += size;
             if (totalCost.leaked > totalCost.peak) {
                 totalCost.peak = totalCost.leaked;
             }
@@ -380,13 +452,16 @@ bool AccumulatedTraceData::read(boost::iostreams::filtering_istream& in, const P
             lastAllocationPtr = 0;
 
             const auto& info = allocationInfos[allocationInfoIndex.index];
-            totalCost.leaked -= info.size;
+            const auto size = info.weightedSize();
+            totalCost.leaked -= size;
 
             auto& allocation = allocations[info.allocationIndex.index];
-            allocation.leaked -= info.size;
+            allocation.leaked -= size;
             if (temporary) {
-                ++totalCost.temporary;
-                ++allocation.temporary;
+                const auto count =
+                    info.weight == 1 ? 1 : weightedCountersOf(info.allocationIndex).temporary.add(info.weight);
+                totalCost.temporary += count;
+                allocation.temporary += count;
             }
 
             if (pass == FirstPass) {
@@ -396,13 +471,19 @@ bool AccumulatedTraceData::read(boost::iostreams::filtering_istream& in, const P
             if (pass != FirstPass || isReparsing) {
                 continue;
             }
-            AllocationInfo info;
-            TraceIndex traceIndex;
-            if (!(reader >> info.size) || !(reader >> traceIndex)) {
+            uint64_t fields[2];
+            if (reader.parseHexFields(fields, 2) != 2) {
                 cerr << "failed to parse line: " << reader.line() << endl;
                 continue;
             }
+            AllocationInfo info;
+            info.size = fields[0];
+            TraceIndex traceIndex;
+            traceIndex.index = static_cast<uint32_t>(fields[1]);
             info.allocationIndex = mapToAllocationIndex(traceIndex);
+            if (samplingPeriod) {
+                info.weight = static_cast<float>(AllocationSampler::weight(info.size, samplingPeriod));
+            }
             allocationInfos.push_back(info);
 
         } else if (reader.mode() == '#') {
@@ -422,15 +503,46 @@ bool AccumulatedTraceData::read(boost::iostreams::filtering_istream& in, const P
             inFilteredTime = newStamp >= filterParameters.minTime && newStamp <= filterParameters.maxTime;
             if (inFilteredTime) {
                 handleTimeStamp(timeStamp, newStamp, false, pass);
+                // the RSS read before the time range is still current, even when no 'R' line follows within it
+                if (rss > peakRSS) {
+                    peakRSS = rss;
+                }
             }
             timeStamp = newStamp;
-        } else if (reader.mode() == 'R') { // RSS timestamp
-            if (!inFilteredTime) {
-                continue;
+
+            if (recordCheckpoints) {
+                const auto offset = in.readBytes();
+                if (offset - (timeCheckpoints.empty() ? 0 : timeCheckpoints.back().offset) >= CHECKPOINT_INTERVAL) {
+                    TimeCheckpoint checkpoint;
+                    checkpoint.offset = offset;
+                    checkpoint.timeStamp = newStamp;
+                    checkpoint.rss = rss;
+                    std::copy(reader.deltaHistories(), reader.deltaHistories() + BinaryRecord::NumChannels,
+                              checkpoint.deltaHistories);
+                    timeCheckpoints.push_back(checkpoint);
+                }
+            } else if (newStamp < filterParameters.minTime) {
+                // nothing gets parsed before the time range, so continue from the last checkpoint before it
+                const auto minTime = filterParameters.minTime;
+                auto it = partition_point(timeCheckpoints.begin(), timeCheckpoints.end(),
+                                          [minTime](const TimeCheckpoint& checkpoint) {
+                                              return checkpoint.timeStamp < minTime;
+                                          });
+                // the binary records after a checkpoint can only be decoded with its delta histories
+                if (it != timeCheckpoints.begin() && prev(it)->offset > in.readBytes()) {
+                    const auto& checkpoint = *prev(it);
+                    if (!in.skipTo(checkpoint.offset)) {
+                        cerr << "failed to skip to offset " << checkpoint.offset << " of the data file" << endl;
+                        return false;
+                    }
+                    reader.setDeltaHistories(checkpoint.deltaHistories);
+                    timeStamp = checkpoint.timeStamp;
+                    rss = checkpoint.rss;
+                }
             }
-            int64_t rss = 0;
+        } else if (reader.mode() == 'R') { // RSS timestamp
             reader >> rss;
-            if (rss > peakRSS) {
+            if (inFilteredTime && rss > peakRSS) {
                 peakRSS = rss;
             }
         } else if (reader.mode() == 'X') {
@@ -440,7 +552,8 @@ bool AccumulatedTraceData::read(boost::iostreams::filtering_istream& in, const P
             }
             debuggeeEncountered = true;
             if (!isReparsing) {
-                handleDebuggee(reader.line().c_str() + 2);
+                debuggeeCommand = reader.line().substr(2);
+                handleDebuggee(debuggeeCommand.c_str());
             }
         } else if (reader.mode() == 'A') {
             if (pass != FirstPass || isReparsing)
@@ -468,15 +581,21 @@ bool AccumulatedTraceData::read(boost::iostreams::filtering_istream& in, const P
             if (fileVersion >= 3) {
                 reader.setExpectedSizedStrings(true);
             }
+        } else if (reader.mode() == 'P') { // sampling period
+            reader >> samplingPeriod;
         } else if (reader.mode() == 'I') { // system information
             reader >> systemInfo.pageSize;
             reader >> systemInfo.pages;
         } else if (reader.mode() == 'S') { // embedded suppression
-            if (pass != FirstPass || filterParameters.disableEmbeddedSuppressions) {
+            if (pass != FirstPass) {
+                continue;
+            }
+            auto suppression = parseSuppression(string(reader.line().substr(2)));
+            if (suppression.empty()) {
                 continue;
             }
-            auto suppression = parseSuppression(reader.line().substr(2));
-            if (!suppression.empty()) {
+            embeddedSuppressions.push_back(suppression);
+            if (!filterParameters.disableEmbeddedSuppressions) {
                 suppressions.push_back({std::move(suppression), 0, 0});
             }
         } else if (reader.mode() == 'x' || reader.mode() == 'm') {
@@ -7,18 +7,20 @@
 #ifndef ACCUMULATEDTRACEDATA_H
 #define ACCUMULATEDTRACEDATA_H
 
+#include <cmath>
 #include <iosfwd>
 #include <tuple>
 #include <vector>
 
 #include <fstream>
 
-#include <boost/iostreams/filtering_stream.hpp>
-
 #include "allocationdata.h"
 #include "filterparameters.h"
+#include "util/binaryrecord.h"
 #include "util/indices.h"
 
+class BlockReader;
+
 struct Frame
 {
     FunctionIndex functionIndex;
@@ -74,6 +76,21 @@ struct AllocationInfo
     uint64_t size = 0;
     // index into AccumulatedTraceData::allocations
     AllocationIndex allocationIndex;
+    // number of allocations a single recorded one stands for, see AccumulatedTraceData::samplingPeriod
+    float weight = 1;
+
+    /// estimated number of allocations that @p count recorded ones stand for
+    int64_t weightedCount(int64_t count) const
+    {
+        return weight == 1 ? count : std::llround(static_cast<double>(count) * weight);
+    }
+
+    /// estimated number of bytes allocated by @p count recorded allocations
+    int64_t weightedSize(int64_t count = 1) const
+    {
+        return weight == 1 ? static_cast<int64_t>(size) * count
+                           : std::llround(static_cast<double>(size) * count * weight);
+    }
 
     bool operator==(const AllocationInfo& rhs) const
     {
@@ -106,12 +123,20 @@ struct AccumulatedTraceData
 
     bool read(const std::string& inputFile, bool isReparsing);
     bool read(const std::string& inputFile, const ParsePass pass, bool isReparsing);
-    bool read(boost::iostreams::filtering_istream& in, const ParsePass pass, bool isReparsing);
+    bool read(BlockReader& in, const ParsePass pass, bool isReparsing);
 
     void diff(const AccumulatedTraceData& base);
 
     bool shortenTemplates = false;
     bool fromAttached = false;
+    /**
+     * Read the first pass from the analysis cache next to the data file when it is up to date, or write it
+     * after parsing the data file otherwise, see analysiscache.h.
+     *
+     * Only handleDebuggee and the final handleTimeStamp get called for cached data, so this is not
+     * suitable when the other callbacks are needed.
+     */
+    bool useAnalysisCache = false;
     FilterParameters filterParameters;
 
     std::vector<Allocation> allocations;
@@ -119,6 +144,8 @@ struct AccumulatedTraceData
     int64_t totalTime = 0;
     int64_t peakTime = 0;
     int64_t peakRSS = 0;
+    // mean number of bytes between sampled allocations, zero when all allocations got recorded
+    uint64_t samplingPeriod = 0;
 
     struct SystemInfo
     {
@@ -169,8 +196,24 @@ struct AccumulatedTraceData
 
     ParsingState parsingState;
 
+    /// a time stamp in the data file, reparsing a time range can continue from there
+    struct TimeCheckpoint
+    {
+        // the offset in the uncompressed data, directly after the time stamp
+        uint64_t offset = 0;
+        int64_t timeStamp = 0;
+        // the last RSS before the time stamp
+        int64_t rss = 0;
+        BinaryRecord::DeltaHistory deltaHistories[BinaryRecord::NumChannels];
+    };
+    // recorded periodically while the data file gets parsed for the first time
+    std::vector<TimeCheckpoint> timeCheckpoints;
+
     void applyLeakSuppressions();
     std::vector<Suppression> suppressions;
+    // the suppressions and debuggee command found in the data file, kept for the analysis cache
+    std::vector<std::string> embeddedSuppressions;
+    std::string debuggeeCommand;
     int64_t totalLeakedSuppressed = 0;
 };
 
@@ -0,0 +1,437 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#include "analysiscache.h"
+
+#include "accumulatedtracedata.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util/blockreader.h"
+#include "util/config.h"
+
+using namespace std;
+
+namespace {
+// bump this whenever the file layout or the results of the first pass change
+const uint32_t CACHE_VERSION = 1;
+const char CACHE_MAGIC[4] = {'H', 'T', 'A', 'C'};
+const char CACHE_SUFFIX[] = ".htcache";
+
+struct FileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t heaptrackVersion;
+    uint32_t fromAttached;
+    // identifies the data file
+    uint64_t dataSize;
+    int64_t dataModificationTime;
+    // the results of the first pass
+    int64_t totalAllocations;
+    int64_t totalTemporary;
+    int64_t totalLeaked;
+    int64_t totalPeak;
+    int64_t totalTime;
+    int64_t peakTime;
+    int64_t peakRSS;
+    uint64_t samplingPeriod;
+    int64_t pages;
+    int64_t pageSize;
+    uint32_t maxAllocationTraceIndex;
+    uint32_t maxAllocationIndex;
+    // the sizes of the columns
+    uint64_t numStrings;
+    uint64_t numEmbeddedSuppressions;
+    uint64_t numInstructionPointers;
+    uint64_t numInlinedFrames;
+    uint64_t numTraces;
+    uint64_t numAllocationInfos;
+    uint64_t numAllocations;
+    uint64_t numTraceIndexMappings;
+    uint64_t numStopIndices;
+    uint64_t numOpNewIpIndices;
+    uint64_t stringsSize;
+};
+static_assert(sizeof(FileHeader) % sizeof(uint64_t) == 0, "the columns after the header must stay aligned");
+
+/// @return the size and modification time of the data file at @p inputFile
+bool identify(const string& inputFile, uint64_t* size, int64_t* modificationTime)
+{
+    struct stat info;
+    if (stat(inputFile.c_str(), &info) != 0) {
+        return false;
+    }
+    *size = static_cast<uint64_t>(info.st_size);
+    *modificationTime = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    return true;
+}
+
+template <typename T>
+bool write(FILE* file, const vector<T>& column)
+{
+    return column.empty() || fwrite(column.data(), sizeof(T), column.size(), file) == column.size();
+}
+
+/// @return a column with the value of @p member for all of @p items
+template <typename T, typename Item, typename Member>
+vector<T> column(const vector<Item>& items, Member member)
+{
+    vector<T> column;
+    column.reserve(items.size());
+    for (const auto& item : items) {
+        column.push_back(static_cast<T>(member(item)));
+    }
+    return column;
+}
+}
+
+string AnalysisCache::path(const string& inputFile)
+{
+    return inputFile + CACHE_SUFFIX;
+}
+
+bool AnalysisCache::load(const string& inputFile, AccumulatedTraceData* data)
+{
+    uint64_t dataSize = 0;
+    int64_t dataModificationTime = 0;
+    if (!identify(inputFile, &dataSize, &dataModificationTime)) {
+        return false;
+    }
+
+    const auto fd = open(path(inputFile).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return false;
+    }
+    MappedFileReader file(fd, static_cast<uint64_t>(info.st_size));
+    close(fd);
+    const auto fileSize = static_cast<uint64_t>(file.end() - file.begin());
+
+    uint64_t offset = 0;
+    bool fits = true;
+    auto next = [&](auto* type, uint64_t count) {
+        using T = remove_pointer_t<decltype(type)>;
+        if (!fits || offset > fileSize || count > (fileSize - offset) / sizeof(T)) {
+            fits = false;
+            return static_cast<const T*>(nullptr);
+        }
+        const auto* column = reinterpret_cast<const T*>(file.begin() + offset);
+        offset += count * sizeof(T);
+        return column;
+    };
+    auto next64 = [&](uint64_t count) { return next(static_cast<uint64_t*>(nullptr), count); };
+    auto next32 = [&](uint64_t count) { return next(static_cast<uint32_t*>(nullptr), count); };
+
+    const auto* header = next(static_cast<FileHeader*>(nullptr), 1);
+    if (!header || memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header->version != CACHE_VERSION
+        || header->heaptrackVersion != HEAPTRACK_VERSION || header->dataSize != dataSize
+        || header->dataModificationTime != dataModificationTime) {
+        return false;
+    }
+
+    // the embedded suppressions and the debuggee command follow the strings of the data file
+    const auto numStrings = header->numStrings + header->numEmbeddedSuppressions + 1;
+    const auto* stringEnds = next64(numStrings);
+    const auto* ipAddresses = next64(header->numInstructionPointers);
+    const auto* ipInlinedEnds = next64(header->numInstructionPointers);
+    const auto* infoSizes = next64(header->numAllocationInfos);
+    const auto* allocationCounts = next64(header->numAllocations);
+    const auto* temporaryCounts = next64(header->numAllocations);
+    const auto* leakedBytes = next64(header->numAllocations);
+    const auto* peakBytes = next64(header->numAllocations);
+    const auto* ipModules = next32(header->numInstructionPointers);
+    const auto* ipFunctions = next32(header->numInstructionPointers);
+    const auto* ipFiles = next32(header->numInstructionPointers);
+    const auto* ipLines = next32(header->numInstructionPointers);
+    const auto* inlinedFunctions = next32(header->numInlinedFrames);
+    const auto* inlinedFiles = next32(header->numInlinedFrames);
+    const auto* inlinedLines = next32(header->numInlinedFrames);
+    const auto* traceIps = next32(header->numTraces);
+    const auto* traceParents = next32(header->numTraces);
+    const auto* infoAllocationIndices = next32(header->numAllocationInfos);
+    const auto* infoWeights = next(static_cast<float*>(nullptr), header->numAllocationInfos);
+    const auto* allocationTraces = next32(header->numAllocations);
+    const auto* mappedTraces = next32(header->numTraceIndexMappings);
+    const auto* mappedAllocations = next32(header->numTraceIndexMappings);
+    const auto* stopIndices = next32(header->numStopIndices);
+    const auto* opNewIpIndices = next32(header->numOpNewIpIndices);
+    const auto* strings = next(static_cast<char*>(nullptr), header->stringsSize);
+    if (!fits || offset != fileSize) {
+        return false;
+    }
+
+    // validate all indices, such that a damaged cache cannot make us crash later on
+    auto isValidIndex = [](uint32_t index, uint64_t size) { return index <= size; };
+    for (uint64_t i = 0; i < numStrings; ++i) {
+        if (stringEnds[i] > header->stringsSize || (i && stringEnds[i] < stringEnds[i - 1])) {
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < header->numInstructionPointers; ++i) {
+        if (ipInlinedEnds[i] > header->numInlinedFrames || (i && ipInlinedEnds[i] < ipInlinedEnds[i - 1])
+            || !isValidIndex(ipModules[i], header->numStrings) || !isValidIndex(ipFunctions[i], header->numStrings)
+            || !isValidIndex(ipFiles[i], header->numStrings)) {
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < header->numInlinedFrames; ++i) {
+        if (!isValidIndex(inlinedFunctions[i], header->numStrings)
+            || !isValidIndex(inlinedFiles[i], header->numStrings)) {
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < header->numTraces; ++i) {
+        if (!isValidIndex(traceIps[i], header->numInstructionPointers)
+            || !isValidIndex(traceParents[i], header->numTraces)) {
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < header->numAllocationInfos; ++i) {
+        if (infoAllocationIndices[i] >= header->numAllocations) {
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < header->numAllocations; ++i) {
+        if (!isValidIndex(allocationTraces[i], header->numTraces)) {
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < header->numTraceIndexMappings; ++i) {
+        if (mappedAllocations[i] >= header->numAllocations) {
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < header->numStopIndices; ++i) {
+        if (!isValidIndex(stopIndices[i], header->numStrings)) {
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < header->numOpNewIpIndices; ++i) {
+        if (!isValidIndex(opNewIpIndices[i], header->numInstructionPointers)) {
+            return false;
+        }
+    }
+    if (header->numAllocations && header->maxAllocationIndex >= header->numAllocations) {
+        return false;
+    }
+
+    auto string = [&](uint64_t i) {
+        const auto start = i ? stringEnds[i - 1] : 0;
+        return std::string(strings + start, stringEnds[i] - start);
+    };
+
+    data->strings.clear();
+    data->strings.reserve(header->numStrings);
+    for (uint64_t i = 0; i < header->numStrings; ++i) {
+        data->strings.push_back(string(i));
+    }
+    data->embeddedSuppressions.clear();
+    for (uint64_t i = 0; i < header->numEmbeddedSuppressions; ++i) {
+        data->embeddedSuppressions.push_back(string(header->numStrings + i));
+    }
+    data->debuggeeCommand = string(numStrings - 1);
+
+    data->instructionPointers.resize(header->numInstructionPointers);
+    for (uint64_t i = 0; i < header->numInstructionPointers; ++i) {
+        auto& ip = data->instructionPointers[i];
+        ip.instructionPointer = ipAddresses[i];
+        ip.moduleIndex.index = ipModules[i];
+        ip.frame.functionIndex.index = ipFunctions[i];
+        ip.frame.fileIndex.index = ipFiles[i];
+        ip.frame.line = static_cast<int>(ipLines[i]);
+        ip.inlined.clear();
+        for (auto j = i ? ipInlinedEnds[i - 1] : 0; j < ipInlinedEnds[i]; ++j) {
+            Frame frame;
+            frame.functionIndex.index = inlinedFunctions[j];
+            frame.fileIndex.index = inlinedFiles[j];
+            frame.line = static_cast<int>(inlinedLines[j]);
+            ip.inlined.push_back(frame);
+        }
+    }
+
+    data->traces.resize(header->numTraces);
+    for (uint64_t i = 0; i < header->numTraces; ++i) {
+        data->traces[i].ipIndex.index = traceIps[i];
+        data->traces[i].parentIndex.index = traceParents[i];
+    }
+
+    data->allocationInfos.resize(header->numAllocationInfos);
+    for (uint64_t i = 0; i < header->numAllocationInfos; ++i) {
+        auto& info = data->allocationInfos[i];
+        info.size = infoSizes[i];
+        info.allocationIndex.index = infoAllocationIndices[i];
+        info.weight = infoWeights[i];
+    }
+
+    data->allocations.resize(header->numAllocations);
+    for (uint64_t i = 0; i < header->numAllocations; ++i) {
+        auto& allocation = data->allocations[i];
+        allocation.traceIndex.index = allocationTraces[i];
+        allocation.allocations = static_cast<int64_t>(allocationCounts[i]);
+        allocation.temporary = static_cast<int64_t>(temporaryCounts[i]);
+        allocation.leaked = static_cast<int64_t>(leakedBytes[i]);
+        allocation.peak = static_cast<int64_t>(peakBytes[i]);
+    }
+
+    data->traceIndexToAllocationIndex.resize(header->numTraceIndexMappings);
+    for (uint64_t i = 0; i < header->numTraceIndexMappings; ++i) {
+        data->traceIndexToAllocationIndex[i].first.index = mappedTraces[i];
+        data->traceIndexToAllocationIndex[i].second.index = mappedAllocations[i];
+    }
+
+    data->stopIndices.resize(header->numStopIndices);
+    for (uint64_t i = 0; i < header->numStopIndices; ++i) {
+        data->stopIndices[i].index = stopIndices[i];
+    }
+    data->opNewIpIndices.resize(header->numOpNewIpIndices);
+    for (uint64_t i = 0; i < header->numOpNewIpIndices; ++i) {
+        data->opNewIpIndices[i].index = opNewIpIndices[i];
+    }
+
+    data->fromAttached = header->fromAttached;
+    data->totalCost.allocations = header->totalAllocations;
+    data->totalCost.temporary = header->totalTemporary;
+    data->totalCost.leaked = header->totalLeaked;
+    data->totalCost.peak = header->totalPeak;
+    data->totalTime = header->totalTime;
+    data->peakTime = header->peakTime;
+    data->peakRSS = header->peakRSS;
+    data->samplingPeriod = header->samplingPeriod;
+    data->systemInfo.pages = header->pages;
+    data->systemInfo.pageSize = header->pageSize;
+    data->m_maxAllocationTraceIndex.index = header->maxAllocationTraceIndex;
+    data->m_maxAllocationIndex.index = header->maxAllocationIndex;
+    // the cache does not know where the time stamps are in the data file
+    data->timeCheckpoints.clear();
+    return true;
+}
+
+bool AnalysisCache::save(const string& inputFile, const AccumulatedTraceData& data)
+{
+    FileHeader header = {};
+    if (!identify(inputFile, &header.dataSize, &header.dataModificationTime)) {
+        return false;
+    }
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.heaptrackVersion = HEAPTRACK_VERSION;
+    header.fromAttached = data.fromAttached;
+    header.totalAllocations = data.totalCost.allocations;
+    header.totalTemporary = data.totalCost.temporary;
+    header.totalLeaked = data.totalCost.leaked;
+    header.totalPeak = data.totalCost.peak;
+    header.totalTime = data.totalTime;
+    header.peakTime = data.peakTime;
+    header.peakRSS = data.peakRSS;
+    header.samplingPeriod = data.samplingPeriod;
+    header.pages = data.systemInfo.pages;
+    header.pageSize = data.systemInfo.pageSize;
+    header.maxAllocationTraceIndex = data.m_maxAllocationTraceIndex.index;
+    header.maxAllocationIndex = data.m_maxAllocationIndex.index;
+    header.numStrings = data.strings.size();
+    header.numEmbeddedSuppressions = data.embeddedSuppressions.size();
+    header.numInstructionPointers = data.instructionPointers.size();
+    header.numTraces = data.traces.size();
+    header.numAllocationInfos = data.allocationInfos.size();
+    header.numAllocations = data.allocations.size();
+    header.numTraceIndexMappings = data.traceIndexToAllocationIndex.size();
+    header.numStopIndices = data.stopIndices.size();
+    header.numOpNewIpIndices = data.opNewIpIndices.size();
+
+    std::string strings;
+    vector<uint64_t> stringEnds;
+    stringEnds.reserve(data.strings.size() + data.embeddedSuppressions.size() + 1);
+    auto addString = [&](const std::string& string) {
+        strings += string;
+        stringEnds.push_back(strings.size());
+    };
+    for (const auto& string : data.strings) {
+        addString(string);
+    }
+    for (const auto& suppression : data.embeddedSuppressions) {
+        addString(suppression);
+    }
+    addString(data.debuggeeCommand);
+    header.stringsSize = strings.size();
+
+    vector<uint64_t> ipInlinedEnds;
+    vector<uint32_t> inlinedFunctions;
+    vector<uint32_t> inlinedFiles;
+    vector<uint32_t> inlinedLines;
+    ipInlinedEnds.reserve(data.instructionPointers.size());
+    for (const auto& ip : data.instructionPointers) {
+        for (const auto& frame : ip.inlined) {
+            inlinedFunctions.push_back(frame.functionIndex.index);
+            inlinedFiles.push_back(frame.fileIndex.index);
+            inlinedLines.push_back(static_cast<uint32_t>(frame.line));
+        }
+        ipInlinedEnds.push_back(inlinedFunctions.size());
+    }
+    header.numInlinedFrames = inlinedFunctions.size();
+
+    const auto& ips = data.instructionPointers;
+    const auto& infos = data.allocationInfos;
+    const auto& allocations = data.allocations;
+    const auto& mappings = data.traceIndexToAllocationIndex;
+    using Mapping = pair<TraceIndex, AllocationIndex>;
+
+    // write to a temporary file first, other processes may read the same file concurrently
+    const auto filePath = path(inputFile);
+    auto tmpPath = filePath + ".XXXXXX";
+    const int fd = mkstemp(&tmpPath[0]);
+    if (fd == -1) {
+        cerr << "WARNING: failed to write analysis cache file " << filePath << ": " << strerror(errno) << endl;
+        return false;
+    }
+    // mkstemp creates the file for the current user only, share the cache like the data file instead
+    struct stat info;
+    if (stat(inputFile.c_str(), &info) == 0) {
+        fchmod(fd, info.st_mode & 0666);
+    }
+    auto* file = fdopen(fd, "w");
+    bool written = file && fwrite(&header, sizeof(header), 1, file) == 1 && write(file, stringEnds)
+        && write(file, column<uint64_t>(ips, [](const InstructionPointer& ip) { return ip.instructionPointer; }))
+        && write(file, ipInlinedEnds)
+        && write(file, column<uint64_t>(infos, [](const AllocationInfo& info) { return info.size; }))
+        && write(file, column<uint64_t>(allocations, [](const Allocation& a) { return a.allocations; }))
+        && write(file, column<uint64_t>(allocations, [](const Allocation& a) { return a.temporary; }))
+        && write(file, column<uint64_t>(allocations, [](const Allocation& a) { return a.leaked; }))
+        && write(file, column<uint64_t>(allocations, [](const Allocation& a) { return a.peak; }))
+        && write(file, column<uint32_t>(ips, [](const InstructionPointer& ip) { return ip.moduleIndex.index; }))
+        && write(file, column<uint32_t>(ips, [](const InstructionPointer& ip) { return ip.frame.functionIndex.index; }))
+        && write(file, column<uint32_t>(ips, [](const InstructionPointer& ip) { return ip.frame.fileIndex.index; }))
+        && write(file, column<uint32_t>(ips, [](const InstructionPointer& ip) { return ip.frame.line; }))
+        && write(file, inlinedFunctions) && write(file, inlinedFiles) && write(file, inlinedLines)
+        && write(file, column<uint32_t>(data.traces, [](const TraceNode& trace) { return trace.ipIndex.index; }))
+        && write(file, column<uint32_t>(data.traces, [](const TraceNode& trace) { return trace.parentIndex.index; }))
+        && write(file, column<uint32_t>(infos, [](const AllocationInfo& info) { return info.allocationIndex.index; }))
+        && write(file, column<float>(infos, [](const AllocationInfo& info) { return info.weight; }))
+        && write(file, column<uint32_t>(allocations, [](const Allocation& a) { return a.traceIndex.index; }))
+        && write(file, column<uint32_t>(mappings, [](const Mapping& mapping) { return mapping.first.index; }))
+        && write(file, column<uint32_t>(mappings, [](const Mapping& mapping) { return mapping.second.index; }))
+        && write(file, column<uint32_t>(data.stopIndices, [](StringIndex index) { return index.index; }))
+        && write(file, column<uint32_t>(data.opNewIpIndices, [](IpIndex index) { return index.index; }))
+        && fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+    written = (file ? fclose(file) == 0 : close(fd) == 0) && written;
+    if (!written || rename(tmpPath.c_str(), filePath.c_str()) != 0) {
+        cerr << "WARNING: failed to write analysis cache file " << filePath << ": " << strerror(errno) << endl;
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#ifndef ANALYSISCACHE_H
+#define ANALYSISCACHE_H
+
+#include <string>
+
+struct AccumulatedTraceData;
+
+/**
+ * A cache of the state of AccumulatedTraceData after the first pass over a data file, stored next to it.
+ *
+ * The file starts with a versioned header that identifies the data file by its size and modification time,
+ * followed by the scalar results of the first pass. Then come fixed-width columns for the strings, instruction
+ * pointers, traces, allocation infos and allocations. The columns are sorted by their width, such that they
+ * can be read in place from the mapped file, and end with the character data of the strings.
+ *
+ * Caches that were written for another version of the data file or by another version of heaptrack get ignored.
+ */
+namespace AnalysisCache {
+/// @return the path of the cache of the data file at @p inputFile
+std::string path(const std::string& inputFile);
+
+/**
+ * Restore the first pass over @p inputFile into @p data, including its embedded suppressions.
+ *
+ * @return false when there is no up-to-date cache, @p data is unchanged then
+ */
+bool load(const std::string& inputFile, AccumulatedTraceData* data);
+
+/// write the cache of @p inputFile after the first pass over it, @return false on error after reporting it
+bool save(const std::string& inputFile, const AccumulatedTraceData& data);
+}
+
+#endif // ANALYSISCACHE_H
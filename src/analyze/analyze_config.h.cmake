@@ -7,7 +7,6 @@
 #ifndef HEAPTRACK_ANALYZE_CONFIG_H
 #define HEAPTRACK_ANALYZE_CONFIG_H
 
-#cmakedefine01 BOOST_IOSTREAMS_HAS_ZSTD
 #cmakedefine01 ZSTD_FOUND
 
 #endif // HEAPTRACK_ANALYZE_CONFIG_H
@@ -584,6 +584,9 @@ HistogramData buildSizeHistogram(ParserData& data, std::shared_ptr<const ResultD
         }
     };
     for (const auto& info : data.allocationInfoCounter) {
+        // scale the recorded allocations when the data got sampled
+        const auto allocations = info.info.weightedCount(info.allocations);
+        const auto totalAllocated = info.info.weightedSize(info.allocations);
         if (info.info.size > row.size) {
             insertColumns();
             columnData.clear();
@@ -591,11 +594,11 @@ HistogramData buildSizeHistogram(ParserData& data, std::shared_ptr<const ResultD
             ++bucketIndex;
             row.size = buckets[bucketIndex].first;
             row.sizeLabel = buckets[bucketIndex].second;
-            row.columns[0] = {info.allocations, static_cast<qint64>(info.info.size * info.allocations), {}};
+            row.columns[0] = {allocations, totalAllocated, {}};
         } else {
             auto& column = row.columns[0];
-            column.allocations += info.allocations;
-            column.totalAllocated += info.info.size * info.allocations;
+            column.allocations += allocations;
+            column.totalAllocated += totalAllocated;
         }
         const auto& allocation = data.allocations[info.info.allocationIndex.index];
         const auto& ipIndex = data.findTrace(allocation.traceIndex).ipIndex;
@@ -603,10 +606,10 @@ HistogramData buildSizeHistogram(ParserData& data, std::shared_ptr<const ResultD
         const auto& sym = symbol(ip);
         auto it = lower_bound(columnData.begin(), columnData.end(), sym);
         if (it == columnData.end() || it->symbol != sym) {
-            columnData.insert(it, {sym, info.allocations, static_cast<qint64>(info.info.size * info.allocations)});
+            columnData.insert(it, {sym, allocations, totalAllocated});
         } else {
-            it->allocations += info.allocations;
-            it->totalAllocated += static_cast<qint64>(info.info.size * info.allocations);
+            it->allocations += allocations;
+            it->totalAllocated += totalAllocated;
         }
     }
     insertColumns();
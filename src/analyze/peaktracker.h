@@ -8,6 +8,7 @@
 
 #include <algorithm>
 #include <array>
+#include <cassert>
 #include <memory>
 
 #include "accumulatedtracedata.h"
@@ -142,7 +143,8 @@ class PeakTracker
                     peakAllocations.resize(allocIdx.index + 1, 0);
                 }
 
-                peakAllocations[allocIdx.index] += m_isAlloc[idx] ? alloc_info.size : -alloc_info.size;
+                const auto size = alloc_info.weightedSize();
+                peakAllocations[allocIdx.index] += m_isAlloc[idx] ? size : -size;
             }
             return peakAllocations;
         }
@@ -506,7 +506,7 @@ struct Printer final : public AccumulatedTraceData
     void handleAllocation(const AllocationInfo& info, const AllocationInfoIndex /*index*/) override
     {
         if (printHistogram) {
-            ++sizeHistogram[info.size];
+            sizeHistogram[info.size] += info.weight;
         }
 
         if (totalCost.leaked > 0 && static_cast<size_t>(totalCost.leaked) > lastMassifPeak && massifOut.is_open()) {
@@ -538,7 +538,8 @@ struct Printer final : public AccumulatedTraceData
 
     vector<MergedAllocation> mergedAllocations;
 
-    std::map<uint64_t, uint64_t> sizeHistogram;
+    // estimated number of allocations per size, fractional when the data got sampled
+    std::map<uint64_t, double> sizeHistogram;
 
     uint64_t massifSnapshotId = 0;
     uint64_t lastMassifPeak = 0;
@@ -616,6 +617,10 @@ int main(int argc, char** argv)
             "known leaks from common system libraries.")
         ("print-suppressions", po::value<bool>()->default_value(false)->implicit_value(true),
             "Show statistics for matched suppressions.")
+        ("analysis-cache", po::value<bool>()->default_value(false)->implicit_value(true),
+            "Read the results of the first pass over the data file from a cache next to it, or write that cache when it is missing "
+            "or outdated. This speeds up repeated analyses of the same file. The cache is not used together with "
+            "--print-histogram or --print-massif.")
         ("help,h", "Show this help message.")
         ("version,v", "Displays version information.");
     // clang-format on
@@ -690,12 +695,15 @@ int main(int argc, char** argv)
     if (!suppressionsOk) {
         return 1;
     }
+    // the histogram and massif output need the allocations and time stamps that the cache does not store
+    data.useAnalysisCache = vm["analysis-cache"].as<bool>() && printHistogram.empty() && printMassif.empty();
 
     cout << "reading file \"" << inputFile << "\" - please wait, this might take some time..." << endl;
 
     if (!diffFile.empty()) {
         cout << "reading diff file \"" << diffFile << "\" - please wait, this might take some time..." << endl;
         Printer diffData;
+        diffData.useAnalysisCache = data.useAnalysisCache;
         auto diffRead = async(launch::async, [&diffData, diffFile]() { return diffData.read(diffFile, false); });
 
         if (!data.read(inputFile, false) || !diffRead.get()) {
@@ -778,6 +786,10 @@ int main(int argc, char** argv)
          << "peak heap memory consumption: " << formatBytes(data.totalCost.peak) << '\n'
          << "peak RSS (including heaptrack overhead): " << formatBytes(data.peakRSS * data.systemInfo.pageSize) << '\n'
          << "total memory leaked: " << formatBytes(data.totalCost.leaked) << '\n';
+    if (data.samplingPeriod) {
+        cout << "allocations were sampled every " << formatBytes(data.samplingPeriod)
+             << " on average, all costs are estimates\n";
+    }
     if (data.totalLeakedSuppressed) {
         cout << "suppressed leaks: " << formatBytes(data.totalLeakedSuppressed) << '\n';
 
@@ -801,7 +813,7 @@ int main(int argc, char** argv)
             cerr << "Failed to open histogram output file \"" << printHistogram << "\"." << endl;
         } else {
             for (auto entry : data.sizeHistogram) {
-                histogram << entry.first << '\t' << entry.second << '\n';
+                histogram << entry.first << '\t' << llround(entry.second) << '\n';
             }
         }
     }
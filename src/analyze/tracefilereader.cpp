@@ -0,0 +1,457 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#include "tracefilereader.h"
+#include "analyze_config.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <zlib.h>
+#if ZSTD_FOUND
+#include <zstd.h>
+#include <zstd_errors.h>
+
+#include "util/linereader.h"
+#include "util/zstdframeindex.h"
+#endif
+
+using namespace std;
+
+namespace {
+/**
+ * Decompresses the data of another BlockReader, i.e. of the mapped compressed file
+ */
+class DecompressingReader : public BufferedBlockReader
+{
+public:
+    explicit DecompressingReader(unique_ptr<BlockReader> input)
+        : m_input(std::move(input))
+    {
+        m_isCompressed = true;
+    }
+
+protected:
+    /**
+     * Decompress as much of @p input as fits into @p output.
+     *
+     * @return false on error, after reporting it
+     */
+    virtual bool decompress(const char** input, size_t* inputSize, char** output, size_t* outputSize) = 0;
+
+    /// @return true when the last call to decompress ended in the middle of a compressed frame
+    virtual bool isWithinFrame() const = 0;
+
+    ssize_t readBlock(char* buffer, size_t size) final
+    {
+        auto* output = buffer;
+        auto outputSize = size;
+        while (outputSize == size) {
+            const auto* input = m_input->begin();
+            auto inputSize = static_cast<size_t>(m_input->end() - input);
+            if (!decompress(&input, &inputSize, &output, &outputSize)) {
+                return -1;
+            }
+            m_input->advance(input);
+            m_inputBytes = m_input->readBytes();
+
+            if (outputSize != size || inputSize) {
+                // we either got some data or the output is pending, which the next call will flush
+                continue;
+            } else if (!m_input->refill()) {
+                if (m_input->hasError()) {
+                    cerr << "failed to read compressed data: " << strerror(errno) << endl;
+                    return -1;
+                } else if (isWithinFrame()) {
+                    // the data file is incomplete, e.g. when the profiled application crashed
+                    cerr << "unexpected end of compressed data" << endl;
+                }
+                break;
+            }
+        }
+        return static_cast<ssize_t>(size - outputSize);
+    }
+
+private:
+    unique_ptr<BlockReader> m_input;
+};
+
+class GzipReader final : public DecompressingReader
+{
+public:
+    explicit GzipReader(unique_ptr<BlockReader> input)
+        : DecompressingReader(std::move(input))
+    {
+        // only accept gzip headers
+        if (inflateInit2(&m_stream, 15 + 16) != Z_OK) {
+            cerr << "failed to initialize the gzip decompression" << endl;
+            m_hasError = true;
+        }
+    }
+
+    ~GzipReader()
+    {
+        inflateEnd(&m_stream);
+    }
+
+protected:
+    bool decompress(const char** input, size_t* inputSize, char** output, size_t* outputSize) override
+    {
+        // zlib uses 32bit sizes, our blocks are smaller than that but the mapped input may not be
+        const auto availableInput = static_cast<uInt>(min<size_t>(*inputSize, numeric_limits<uInt>::max()));
+        m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(*input));
+        m_stream.avail_in = availableInput;
+        m_stream.next_out = reinterpret_cast<Bytef*>(*output);
+        m_stream.avail_out = static_cast<uInt>(*outputSize);
+
+        const auto ret = inflate(&m_stream, Z_NO_FLUSH);
+        *input += availableInput - m_stream.avail_in;
+        *inputSize -= availableInput - m_stream.avail_in;
+        *output = reinterpret_cast<char*>(m_stream.next_out);
+        *outputSize = m_stream.avail_out;
+
+        if (ret == Z_STREAM_END) {
+            // there may be another gzip member after this one
+            m_isWithinFrame = false;
+            inflateReset(&m_stream);
+        } else if (ret == Z_OK) {
+            m_isWithinFrame = true;
+        } else if (ret != Z_BUF_ERROR) {
+            cerr << "failed to decompress gzip data: " << (m_stream.msg ? m_stream.msg : zError(ret)) << endl;
+            m_hasError = true;
+            return false;
+        }
+        return true;
+    }
+
+    bool isWithinFrame() const override
+    {
+        return m_isWithinFrame;
+    }
+
+private:
+    z_stream m_stream = {};
+    bool m_isWithinFrame = false;
+};
+
+#if ZSTD_FOUND
+class ZstdReader final : public DecompressingReader
+{
+public:
+    explicit ZstdReader(unique_ptr<BlockReader> input)
+        : DecompressingReader(std::move(input))
+        , m_stream(ZSTD_createDStream())
+    {
+    }
+
+    ~ZstdReader()
+    {
+        ZSTD_freeDStream(m_stream);
+    }
+
+protected:
+    bool decompress(const char** input, size_t* inputSize, char** output, size_t* outputSize) override
+    {
+        ZSTD_inBuffer in = {*input, *inputSize, 0};
+        ZSTD_outBuffer out = {*output, *outputSize, 0};
+        const auto ret = ZSTD_decompressStream(m_stream, &out, &in);
+        if (ZSTD_isError(ret)) {
+            cerr << "failed to decompress zstd data: " << ZSTD_getErrorName(ret) << endl;
+            m_hasError = true;
+            return false;
+        }
+        *input += in.pos;
+        *inputSize -= in.pos;
+        *output += out.pos;
+        *outputSize -= out.pos;
+        if (in.pos || out.pos) {
+            // zero means that a frame got completely decoded and flushed
+            m_isWithinFrame = ret != 0;
+        }
+        return true;
+    }
+
+    bool isWithinFrame() const override
+    {
+        return m_isWithinFrame;
+    }
+
+private:
+    ZSTD_DStream* m_stream;
+    bool m_isWithinFrame = false;
+};
+
+/**
+ * Decompresses and tokenizes the independent frames of a file written by heaptrack_interpret --zstd in parallel
+ *
+ * The frames get handed out in order, see zstdframeindex.h. Only a few frames are kept in memory ahead of the
+ * one that is currently being read.
+ */
+class ParallelZstdReader final : public BlockReader
+{
+public:
+    ParallelZstdReader(unique_ptr<BlockReader> file, vector<ZstdFrameIndex::Frame> frames, unsigned numThreads)
+        : m_file(std::move(file))
+        , m_frames(std::move(frames))
+        , m_slots(min<size_t>(m_frames.size(), 2 * numThreads))
+    {
+        m_isCompressed = true;
+        m_isTokenized = true;
+
+        m_frameOffsets.reserve(m_frames.size());
+        m_frameDataOffsets.reserve(m_frames.size());
+        uint64_t offset = 0;
+        uint64_t dataOffset = 0;
+        for (const auto& frame : m_frames) {
+            m_frameOffsets.push_back(offset);
+            m_frameDataOffsets.push_back(dataOffset);
+            offset += frame.compressedSize;
+            dataOffset += frame.decompressedSize;
+        }
+
+        numThreads = min<size_t>(numThreads, m_frames.size());
+        m_threads.reserve(numThreads);
+        for (unsigned i = 0; i < numThreads; ++i) {
+            m_threads.emplace_back([this]() { decompressFrames(); });
+        }
+    }
+
+    ~ParallelZstdReader()
+    {
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_condition.notify_all();
+        for (auto& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    bool refill() override
+    {
+        if (m_hasError) {
+            return false;
+        }
+        m_bufferOffset += static_cast<uint64_t>(m_begin - m_bufferStart);
+        m_bufferStart = m_begin = m_end = nullptr;
+        m_nextRecord = m_recordsEnd = nullptr;
+        m_nextField = nullptr;
+
+        unique_lock<mutex> lock(m_mutex);
+        if (m_hasCurrentFrame) {
+            // the previous frame got read completely, which makes room for another one
+            m_slots[m_nextFrameToRead % m_slots.size()] = {};
+            ++m_nextFrameToRead;
+            m_hasCurrentFrame = false;
+            m_condition.notify_all();
+        }
+        if (m_nextFrameToRead == m_frames.size()) {
+            return false;
+        }
+
+        auto& slot = m_slots[m_nextFrameToRead % m_slots.size()];
+        m_condition.wait(lock, [this, &slot]() { return slot.isReady && slot.frameIndex == m_nextFrameToRead; });
+        m_hasCurrentFrame = true;
+        // hand out the records up to an error, the next refill fails then
+        m_hasError = slot.hasError;
+
+        const auto& block = slot.block;
+        m_bufferStart = m_begin = block.data.get();
+        m_end = m_begin + block.size;
+        m_nextRecord = block.records.data();
+        m_recordsEnd = m_nextRecord + block.records.size();
+        m_nextField = block.fields.data();
+        m_inputBytes = m_frameOffsets[m_nextFrameToRead] + m_frames[m_nextFrameToRead].compressedSize;
+        return true;
+    }
+
+    bool skipTo(uint64_t offset) override
+    {
+        // the frames before the one that contains the offset do not need to be decompressed at all
+        const auto frameIndex = static_cast<size_t>(
+            upper_bound(m_frameDataOffsets.begin(), m_frameDataOffsets.end(), offset) - m_frameDataOffsets.begin() - 1);
+        if (!m_hasError && frameIndex > m_nextFrameToRead) {
+            {
+                lock_guard<mutex> lock(m_mutex);
+                m_nextFrameToRead = frameIndex;
+                m_nextFrameToDecompress = max(m_nextFrameToDecompress, frameIndex);
+                m_hasCurrentFrame = false;
+                // keep the frames that got decompressed ahead of time already
+                for (auto& slot : m_slots) {
+                    if (slot.frameIndex < frameIndex) {
+                        slot = {};
+                    }
+                }
+            }
+            m_condition.notify_all();
+
+            m_bufferOffset = m_frameDataOffsets[frameIndex];
+            m_bufferStart = m_begin = m_end = nullptr;
+            m_nextRecord = m_recordsEnd = nullptr;
+            m_nextField = nullptr;
+        }
+        return BlockReader::skipTo(offset);
+    }
+
+private:
+    /// buffer size we start with for frames that do not store their decompressed size,
+    /// large enough for the frames of the default --zstd-frame-size
+    static constexpr uint64_t INITIAL_FRAME_BUFFER_SIZE = 8 * 1024 * 1024;
+
+    struct Slot
+    {
+        TokenizedBlock block;
+        size_t frameIndex = 0;
+        bool isReady = false;
+        bool hasError = false;
+    };
+
+    void decompressFrames()
+    {
+        auto* context = ZSTD_createDCtx();
+        while (true) {
+            size_t frameIndex = 0;
+            {
+                unique_lock<mutex> lock(m_mutex);
+                m_condition.wait(lock, [this]() {
+                    return m_stop || m_nextFrameToDecompress == m_frames.size()
+                        || m_nextFrameToDecompress < m_nextFrameToRead + m_slots.size();
+                });
+                if (m_stop || m_nextFrameToDecompress == m_frames.size()) {
+                    break;
+                }
+                frameIndex = m_nextFrameToDecompress++;
+            }
+
+            Slot slot;
+            slot.hasError = !decompressFrame(context, frameIndex, &slot.block);
+            slot.frameIndex = frameIndex;
+            slot.isReady = true;
+            {
+                lock_guard<mutex> lock(m_mutex);
+                // the frame may have been skipped in the meantime, see skipTo
+                if (frameIndex >= m_nextFrameToRead) {
+                    m_slots[frameIndex % m_slots.size()] = std::move(slot);
+                }
+            }
+            m_condition.notify_all();
+        }
+        ZSTD_freeDCtx(context);
+    }
+
+    bool decompressFrame(ZSTD_DCtx* context, size_t frameIndex, TokenizedBlock* block) const
+    {
+        const auto& frame = m_frames[frameIndex];
+        const auto* compressed = m_file->begin() + m_frameOffsets[frameIndex];
+        auto unexpectedSize = [&](uint64_t size) {
+            cerr << "unexpected size of zstd frame " << frameIndex << ": " << size << ", expected "
+                 << frame.decompressedSize << endl;
+            return false;
+        };
+
+        // the index isn't validated by zstd, so don't trust it for the allocation size: frames that store their
+        // size must agree with it, otherwise retry with twice the buffer whenever the frame turns out to be larger
+        const auto contentSize = ZSTD_getFrameContentSize(compressed, frame.compressedSize);
+        if (contentSize == ZSTD_CONTENTSIZE_ERROR) {
+            cerr << "invalid zstd frame " << frameIndex << endl;
+            return false;
+        } else if (contentSize != ZSTD_CONTENTSIZE_UNKNOWN && contentSize != frame.decompressedSize) {
+            return unexpectedSize(contentSize);
+        }
+        uint64_t capacity = contentSize == ZSTD_CONTENTSIZE_UNKNOWN
+            ? min<uint64_t>(frame.decompressedSize, INITIAL_FRAME_BUFFER_SIZE)
+            : frame.decompressedSize;
+        size_t size = 0;
+        while (true) {
+            block->data.reset(new char[capacity]);
+            size = ZSTD_decompressDCtx(context, block->data.get(), capacity, compressed, frame.compressedSize);
+            if (ZSTD_getErrorCode(size) == ZSTD_error_dstSize_tooSmall && capacity < frame.decompressedSize) {
+                capacity = min<uint64_t>(2 * capacity, frame.decompressedSize);
+                continue;
+            } else if (ZSTD_isError(size)) {
+                cerr << "failed to decompress zstd frame " << frameIndex << ": " << ZSTD_getErrorName(size) << endl;
+                return false;
+            }
+            break;
+        }
+        if (size != frame.decompressedSize) {
+            return unexpectedSize(size);
+        }
+        block->size = size;
+
+        // each frame starts with a record and has no delta encoded fields, see zstdframeindex.h
+        LineReader reader;
+        MemoryReader in(block->data.get(), block->size);
+        block->records.reserve(block->size / 8);
+        block->fields.reserve(block->size / 4);
+        // the modes of the lines that AccumulatedTraceData::read parses as hex numbers only
+        return reader.tokenize(in, "+-acfitR", block);
+    }
+
+    unique_ptr<BlockReader> m_file;
+    vector<ZstdFrameIndex::Frame> m_frames;
+    vector<uint64_t> m_frameOffsets;
+    // the offsets of the frames in the decompressed data
+    vector<uint64_t> m_frameDataOffsets;
+    vector<thread> m_threads;
+
+    mutex m_mutex;
+    condition_variable m_condition;
+    // the decompressed frames, frame i is stored at i % m_slots.size()
+    vector<Slot> m_slots;
+    size_t m_nextFrameToDecompress = 0;
+    size_t m_nextFrameToRead = 0;
+    bool m_hasCurrentFrame = false;
+    bool m_stop = false;
+};
+#endif
+}
+
+unique_ptr<BlockReader> openTraceFile(const string& inputFile, unsigned numThreads)
+{
+    const bool isGzCompressed = boost::algorithm::ends_with(inputFile, ".gz");
+    const bool isZstdCompressed = boost::algorithm::ends_with(inputFile, ".zst");
+#if !ZSTD_FOUND
+    // only zstd compressed files get read in parallel
+    (void)numThreads;
+    if (isZstdCompressed) {
+        cerr << "Heaptrack was built without zstd support, cannot decompressed data file: " << inputFile << endl;
+        return {};
+    }
+#endif
+
+    auto file = openBlockReader(inputFile);
+    if (!file) {
+        cerr << "Failed to open heaptrack log file: " << inputFile << endl;
+        return {};
+    }
+
+    if (isGzCompressed) {
+        return make_unique<GzipReader>(std::move(file));
+    }
+#if ZSTD_FOUND
+    if (isZstdCompressed) {
+        if (!numThreads) {
+            numThreads = thread::hardware_concurrency();
+        }
+        // only files written by heaptrack_interpret --zstd have an index, and they need to be mapped to use it
+        auto frames = ZstdFrameIndex::parse(file->begin(), static_cast<uint64_t>(file->end() - file->begin()));
+        if (numThreads > 1 && !frames.empty()) {
+            return make_unique<ParallelZstdReader>(std::move(file), std::move(frames), numThreads);
+        }
+        return make_unique<ZstdReader>(std::move(file));
+    }
+#endif
+    return file;
+}
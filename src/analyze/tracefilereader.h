@@ -0,0 +1,26 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#ifndef TRACEFILEREADER_H
+#define TRACEFILEREADER_H
+
+#include <memory>
+#include <string>
+
+#include "util/blockreader.h"
+
+/**
+ * Open the heaptrack data file at @p inputFile for reading
+ *
+ * Files ending in .gz or .zst get decompressed block-wise, other files get mapped into memory.
+ * Files written by heaptrack_interpret --zstd get decompressed and tokenized by up to @p numThreads
+ * threads in parallel, zero uses one thread per core.
+ *
+ * @return nullptr on error, after reporting it on stderr
+ */
+std::unique_ptr<BlockReader> openTraceFile(const std::string& inputFile, unsigned numThreads = 0);
+
+#endif // TRACEFILEREADER_H
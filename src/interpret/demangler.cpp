@@ -11,14 +11,116 @@
 #include <cxxabi.h>
 #include <dlfcn.h>
 
+#include <tsl/robin_map.h>
+
 #include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <mutex>
+#include <thread>
+
+namespace {
+/// demangled names shared by all threads, see demangleInterned
+class DemangleCache
+{
+public:
+    static DemangleCache& instance()
+    {
+        static DemangleCache cache;
+        return cache;
+    }
+
+    /// @return true and set @p demangledName when @p mangledName was demangled before
+    bool find(std::string_view mangledName, std::string_view* demangledName)
+    {
+        const auto hash = std::hash<std::string_view>()(mangledName);
+        auto& shard = m_shards[hash % NUM_SHARDS];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.names.find(mangledName, hash);
+        if (it == shard.names.end()) {
+            return false;
+        }
+        *demangledName = it->second;
+        return true;
+    }
+
+    /**
+     * Intern @p demangledName for @p mangledName and store the view in @p interned, or the one that got
+     * inserted concurrently. @return false and leave @p demangledName alone when the cache is full.
+     */
+    bool insert(std::string_view mangledName, std::string& demangledName, std::string_view* interned)
+    {
+        const auto hash = std::hash<std::string_view>()(mangledName);
+        auto& shard = m_shards[hash % NUM_SHARDS];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.names.find(mangledName, hash);
+        if (it != shard.names.end()) {
+            *interned = it->second;
+            return true;
+        }
+
+        // roughly the strings, their deque entries and the bucket of the hash map
+        const uint64_t size = mangledName.size() + (demangledName != mangledName ? demangledName.size() : 0)
+            + 2 * sizeof(std::string) + 2 * sizeof(std::pair<std::string_view, std::string_view>);
+        if (m_size + size > m_maxSize) {
+            return false;
+        }
+        m_size += size;
+
+        // the deque never moves its elements, so the views stay valid
+        std::string_view key = shard.strings.emplace_back(mangledName);
+        std::string_view value = key;
+        if (demangledName != mangledName) {
+            value = shard.strings.emplace_back(std::move(demangledName));
+        }
+        shard.names.insert({key, value});
+        *interned = value;
+        return true;
+    }
+
+    void setMaxSize(uint64_t maxSize)
+    {
+        m_maxSize = maxSize;
+    }
+
+    uint64_t size() const
+    {
+        return m_size;
+    }
+
+private:
+    // the demangling happens outside of the lock, but multiple shards reduce the contention of the lookups
+    static constexpr size_t NUM_SHARDS = 16;
+    struct Shard
+    {
+        std::mutex mutex;
+        std::deque<std::string> strings;
+        tsl::robin_map<std::string_view, std::string_view, std::hash<std::string_view>, std::equal_to<std::string_view>,
+                       std::allocator<std::pair<std::string_view, std::string_view>>, true>
+            names;
+    };
+    Shard m_shards[NUM_SHARDS];
+    // the names are never removed again, as the views into them must stay valid
+    std::atomic<uint64_t> m_size {0};
+    std::atomic<uint64_t> m_maxSize {256 * 1024 * 1024};
+};
+
+Demangler& threadDemangler()
+{
+    // the demangler is not thread safe, see --threads of heaptrack_interpret
+    thread_local Demangler demangler;
+    return demangler;
+}
+
+std::string_view prefix(const std::string& mangledName)
+{
+    return std::string_view(mangledName).substr(0, 2);
+}
+}
 
 Demangler::Demangler()
+    : m_demanglers(externalDemanglers())
 {
-    loadDemanglers(
-        {{"librustc_demangle.so", "rustc_demangle", "_R", "Rust", "https://github.com/rust-lang/rustc-demangle"},
-         {"libd_demangle.so", "demangle_symbol", "_D", "D", "https://github.com/lievenhey/d_demangler"}});
 }
 
 Demangler::~Demangler()
@@ -27,6 +129,11 @@ Demangler::~Demangler()
 }
 
 std::string Demangler::demangle(const std::string& mangledName)
+{
+    return demangle(mangledName, findDemangler(mangledName));
+}
+
+std::string Demangler::demangle(const std::string& mangledName, const DemangleLib* demangler)
 {
     if (mangledName.length() < 3) {
         return mangledName;
@@ -34,7 +141,7 @@ std::string Demangler::demangle(const std::string& mangledName)
 
     // Try external demanglers first, as __cxa_demangle will happily try to demangle symbols emitted by e.g. Rust.
     // rustc_demangle on the other hand will return an error if the symbol did not originate from Rust.
-    if (tryExternalDemanglers(mangledName)) {
+    if (tryExternalDemanglers(mangledName, demangler)) {
         return std::string(m_demangleBuffer);
     }
 
@@ -49,13 +156,24 @@ std::string Demangler::demangle(const std::string& mangledName)
     return mangledName;
 }
 
-void Demangler::loadDemanglers(std::initializer_list<Demangler::DemangleLibSpec> specifiers)
+const std::vector<Demangler::DemangleLib>& Demangler::externalDemanglers()
 {
+    // only dlopen the libraries and report failures once, not for every thread
+    static const auto demanglers = loadDemanglers(
+        {{"librustc_demangle.so", "rustc_demangle", "_R", "Rust", "https://github.com/rust-lang/rustc-demangle"},
+         {"libd_demangle.so", "demangle_symbol", "_D", "D", "https://github.com/lievenhey/d_demangler"}});
+    return demanglers;
+}
+
+std::vector<Demangler::DemangleLib>
+Demangler::loadDemanglers(std::initializer_list<Demangler::DemangleLibSpec> specifiers)
+{
+    std::vector<DemangleLib> demanglers;
     for (auto specifier : specifiers) {
         if (auto demanglerLib = dlopen(specifier.libName.data(), RTLD_LAZY)) {
             if (auto demangleFnVoid = dlsym(demanglerLib, specifier.functionName.data())) {
                 auto demangle = reinterpret_cast<DemangleFn>(demangleFnVoid);
-                m_demanglers.push_back({demangle, specifier.prefix});
+                demanglers.push_back({demangle, specifier.prefix});
             } else {
                 auto message = "Unknown error!";
                 if (auto errorMessage = (dlerror())) {
@@ -74,18 +192,24 @@ void Demangler::loadDemanglers(std::initializer_list<Demangler::DemangleLibSpec>
             // unnecessary annoyance to always print an error here.
         }
     }
+    return demanglers;
 }
 
-bool Demangler::tryExternalDemanglers(const std::string& mangledName)
+const Demangler::DemangleLib* Demangler::findDemangler(const std::string& mangledName) const
 {
-    // Fast path: check if the mangled name starts with a known prefix (like _R or _D)
-    // Then pick the corresponding demangler.
+    // check if the mangled name starts with a known prefix (like _R or _D)
     auto demangler = std::find_if(m_demanglers.cbegin(), m_demanglers.cend(), [&mangledName](const auto& demangler) {
         // Check if mangledName starts with the prefix of the demangler
         // TODO: Replace with starts_with, once C++20 features are available.
         return mangledName.compare(0, demangler.prefix.size(), demangler.prefix) == 0;
     });
-    if (demangler != m_demanglers.cend()) {
+    return demangler != m_demanglers.cend() ? &(*demangler) : nullptr;
+}
+
+bool Demangler::tryExternalDemanglers(const std::string& mangledName, const DemangleLib* demangler)
+{
+    // Fast path: the mangled name starts with a known prefix, use the corresponding demangler.
+    if (demangler) {
         return demangler->demangle(mangledName.c_str(), m_demangleBuffer, m_demangleBufferLength);
     }
 
@@ -98,3 +222,92 @@ bool Demangler::tryExternalDemanglers(const std::string& mangledName)
 
     return false;
 }
+
+std::string demangle(const std::string& mangledName)
+{
+    std::deque<std::string> overflow;
+    return std::string(demangleInterned(mangledName, &overflow));
+}
+
+std::string_view demangleInterned(const std::string& mangledName, std::deque<std::string>* overflow)
+{
+    auto& cache = DemangleCache::instance();
+    std::string_view demangledName;
+    if (cache.find(mangledName, &demangledName)) {
+        return demangledName;
+    }
+    auto name = threadDemangler().demangle(mangledName);
+    if (cache.insert(mangledName, name, &demangledName)) {
+        return demangledName;
+    }
+    return overflow->emplace_back(std::move(name));
+}
+
+std::vector<std::string_view> demangleBatch(const std::vector<std::string>& mangledNames, unsigned numThreads,
+                                            std::deque<std::string>* overflow)
+{
+    auto& cache = DemangleCache::instance();
+    std::vector<std::string_view> ret(mangledNames.size());
+    std::vector<size_t> missing;
+    for (size_t i = 0; i < mangledNames.size(); ++i) {
+        if (!cache.find(mangledNames[i], &ret[i])) {
+            missing.push_back(i);
+        }
+    }
+
+    // group the names by their prefix, which determines the demangler that handles them
+    std::stable_sort(missing.begin(), missing.end(), [&mangledNames](size_t lhs, size_t rhs) {
+        return prefix(mangledNames[lhs]) < prefix(mangledNames[rhs]);
+    });
+
+    // the names that don't fit into the cache anymore, only the calling thread may append them to overflow
+    using Uninterned = std::vector<std::pair<size_t, std::string>>;
+    auto demangleRange = [&](size_t begin, size_t end, Uninterned* uninterned) {
+        auto& demangler = threadDemangler();
+        const Demangler::DemangleLib* demangleLib = nullptr;
+        for (size_t i = begin; i < end; ++i) {
+            const auto index = missing[i];
+            const auto& mangledName = mangledNames[index];
+            if (i == begin || prefix(mangledName) != prefix(mangledNames[missing[i - 1]])) {
+                demangleLib = demangler.findDemangler(mangledName);
+            }
+            auto name = demangler.demangle(mangledName, demangleLib);
+            if (!cache.insert(mangledName, name, &ret[index])) {
+                uninterned->push_back({index, std::move(name)});
+            }
+        }
+    };
+
+    // spawning threads only pays off for larger batches
+    const size_t minNamesPerThread = 256;
+    const auto numChunks = std::max<size_t>(1, std::min<size_t>(numThreads, missing.size() / minNamesPerThread));
+    const auto chunkSize = (missing.size() + numChunks - 1) / numChunks;
+    std::vector<Uninterned> uninterned(numChunks);
+    std::vector<std::thread> threads;
+    threads.reserve(numChunks - 1);
+    for (size_t chunk = 1; chunk < numChunks; ++chunk) {
+        threads.emplace_back(demangleRange, chunk * chunkSize, std::min(missing.size(), (chunk + 1) * chunkSize),
+                             &uninterned[chunk]);
+    }
+    demangleRange(0, std::min(missing.size(), chunkSize), &uninterned[0]);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (auto& names : uninterned) {
+        for (auto& name : names) {
+            ret[name.first] = overflow->emplace_back(std::move(name.second));
+        }
+    }
+    return ret;
+}
+
+void setDemangleCacheLimit(uint64_t maxSize)
+{
+    DemangleCache::instance().setMaxSize(maxSize);
+}
+
+uint64_t demangleCacheMemoryUsage()
+{
+    return DemangleCache::instance().size();
+}
@@ -10,8 +10,11 @@
 #ifndef DEMANGLER_H
 #define DEMANGLER_H
 
+#include <cstdint>
 #include <cstdlib>
+#include <deque>
 #include <string>
+#include <string_view>
 #include <vector>
 
 class Demangler
@@ -23,7 +26,6 @@ public:
 
     std::string demangle(const std::string& mangledName);
 
-private:
     using DemangleFn = int (*)(const char*, char*, size_t);
     struct DemangleLib
     {
@@ -31,6 +33,18 @@ private:
         std::string_view prefix;
     };
 
+    /**
+     * @return the external demangler for the prefix of @p mangledName, or nullptr if all of them need to be tried
+     *
+     * All prefixes are two characters long, so names that share their first two characters share the result.
+     */
+    const DemangleLib* findDemangler(const std::string& mangledName) const;
+
+    /// demangle @p mangledName with the external demangler @p demangler as returned by findDemangler
+    std::string demangle(const std::string& mangledName, const DemangleLib* demangler);
+
+private:
+
     struct DemangleLibSpec
     {
         std::string_view libName;
@@ -40,15 +54,46 @@ private:
         std::string_view repository;
     };
 
-    void loadDemanglers(std::initializer_list<DemangleLibSpec> specifiers);
+    /// @return the external demanglers, which get loaded once and are shared by all instances
+    static const std::vector<DemangleLib>& externalDemanglers();
+
+    static std::vector<DemangleLib> loadDemanglers(std::initializer_list<DemangleLibSpec> specifiers);
 
-    bool tryExternalDemanglers(const std::string& mangledName);
+    bool tryExternalDemanglers(const std::string& mangledName, const DemangleLib* demangler);
 
     size_t m_demangleBufferLength = 1024;
     // We must use malloc here instead of new or unique_ptr, as __cxa_demangle requires this.
     // Make sure this buffer is free'd in the destructor!
     char* m_demangleBuffer = reinterpret_cast<char*>(std::malloc(m_demangleBufferLength * sizeof(char)));
-    std::vector<DemangleLib> m_demanglers;
+    const std::vector<DemangleLib>& m_demanglers;
 };
 
+/// @return the demangled symbol name
+std::string demangle(const std::string& mangledName);
+
+/**
+ * @return the demangled symbol name, interned in a cache that is shared by all threads
+ *
+ * The same names show up in many modules and DWARF scopes, so we only demangle them once.
+ * The returned view stays valid until the program exits. Once the cache is full, see
+ * setDemangleCacheLimit, new names get appended to @p overflow instead and the view is
+ * only valid as long as that.
+ */
+std::string_view demangleInterned(const std::string& mangledName, std::deque<std::string>* overflow);
+
+/**
+ * Demangle all @p mangledNames, distributed across up to @p numThreads threads
+ *
+ * The names get grouped by their prefix, such that the demangler is picked once per group.
+ * @return the names interned like by demangleInterned, in the same order as @p mangledNames
+ */
+std::vector<std::string_view> demangleBatch(const std::vector<std::string>& mangledNames, unsigned numThreads,
+                                            std::deque<std::string>* overflow);
+
+/// limit the names interned by demangleInterned to about @p maxSize bytes
+void setDemangleCacheLimit(uint64_t maxSize);
+
+/// @return the approximate number of bytes used by the names interned by demangleInterned
+uint64_t demangleCacheMemoryUsage();
+
 #endif // DEMANGLER_H
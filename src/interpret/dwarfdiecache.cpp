@@ -90,6 +90,33 @@ bool mayHaveScopes(Dwarf_Die* die)
     return false;
 }
 
+/// add all DW_TAG_inlined_subroutine DIEs below @p die, like findInlineScopes would visit them
+void collectInlineScopes(Dwarf_Die* die, uint32_t parent, uint32_t depth, std::vector<InlineScope>* scopes,
+                         std::vector<std::pair<DwarfRange, uint32_t>>* ranges, std::vector<uint32_t>* depths)
+{
+    Dwarf_Die childDie;
+    if (dwarf_child(die, &childDie) != 0)
+        return;
+
+    do {
+        if (dwarf_tag(&childDie) != DW_TAG_inlined_subroutine) {
+            collectInlineScopes(&childDie, parent, depth, scopes, ranges, depths);
+            continue;
+        }
+
+        const auto scope = static_cast<uint32_t>(scopes->size());
+        scopes->push_back({childDie, parent, false, {}});
+        depths->push_back(depth);
+        walkRanges(
+            [ranges, scope](DwarfRange range) {
+                ranges->push_back({range, scope});
+                return true;
+            },
+            &childDie);
+        collectInlineScopes(&childDie, scope, depth + 1, scopes, ranges, depths);
+    } while (dwarf_siblingof(&childDie, &childDie) == 0);
+}
+
 bool dieContainsAddress(Dwarf_Die* die, Dwarf_Addr address)
 {
     bool contained = false;
@@ -214,12 +241,6 @@ std::string qualifiedDieName(Dwarf_Die* die, tsl::robin_map<Dwarf_Off, std::stri
     return name;
 }
 
-std::string demangle(const std::string& mangledName)
-{
-    static Demangler demangler;
-    return demangler.demangle(mangledName);
-}
-
 std::string absoluteSourcePath(const char* path, Dwarf_Die* cuDie)
 {
     if (!path)
@@ -301,6 +322,27 @@ CuDieRangeMapping::CuDieRangeMapping(Dwarf_Die cudie, Dwarf_Addr bias)
         &cudie);
 }
 
+CuDieRangeMapping::CuDieRangeMapping(Dwarf_Die cudie, Dwarf_Addr bias, const std::vector<DwarfRange>& ranges)
+    : m_bias {bias}
+    , m_cuDieRanges {cudie, {}}
+{
+    m_cuDieRanges.ranges.reserve(ranges.size());
+    for (const auto& range : ranges) {
+        m_cuDieRanges.ranges.push_back({range.low + bias, range.high + bias});
+    }
+}
+
+CuDieRanges CuDieRangeMapping::cuDieRanges() const
+{
+    CuDieRanges ret;
+    ret.offset = dwarf_dieoffset(const_cast<Dwarf_Die*>(&m_cuDieRanges.die));
+    ret.ranges.reserve(m_cuDieRanges.ranges.size());
+    for (const auto& range : m_cuDieRanges.ranges) {
+        ret.ranges.push_back({range.low - m_bias, range.high - m_bias});
+    }
+    return ret;
+}
+
 SubProgramDie* CuDieRangeMapping::findSubprogramDie(Dwarf_Addr offset)
 {
     if (m_subPrograms.empty())
@@ -333,6 +375,97 @@ void CuDieRangeMapping::addSubprograms()
         cudie());
 }
 
+void CuDieRangeMapping::addInlineScopes()
+{
+    if (m_subPrograms.empty())
+        addSubprograms();
+
+    // the address ranges of all scopes, in the order they are visited by findSubprogramDie and findInlineScopes
+    std::vector<std::pair<DwarfRange, uint32_t>> ranges;
+    std::vector<uint32_t> depths;
+    for (auto& subprogram : m_subPrograms) {
+        const auto scope = static_cast<uint32_t>(m_inlineScopes.size());
+        m_inlineScopes.push_back({*subprogram.die(), InlineScope::NO_PARENT, false, {}});
+        depths.push_back(0);
+        walkRanges(
+            [&ranges, scope](DwarfRange range) {
+                ranges.push_back({range, scope});
+                return true;
+            },
+            subprogram.die());
+        collectInlineScopes(subprogram.die(), scope, 1, &m_inlineScopes, &ranges, &depths);
+    }
+
+    std::vector<Dwarf_Addr> boundaries;
+    boundaries.reserve(ranges.size() * 2);
+    for (const auto& range : ranges) {
+        boundaries.push_back(range.first.low);
+        boundaries.push_back(range.first.high);
+    }
+    std::sort(boundaries.begin(), boundaries.end());
+    boundaries.erase(std::unique(boundaries.begin(), boundaries.end()), boundaries.end());
+
+    // paint the innermost scope onto the segments between the boundaries, outer scopes first
+    // a scope only applies where its parent applies, and the first subprogram wins, just like
+    // a lookup via findSubprogramDie and findInlineScopes
+    std::stable_sort(ranges.begin(), ranges.end(),
+                     [&depths](const std::pair<DwarfRange, uint32_t>& lhs, const std::pair<DwarfRange, uint32_t>& rhs) {
+                         return depths[lhs.second] < depths[rhs.second];
+                     });
+    std::vector<uint32_t> segmentScopes(boundaries.size(), InlineScope::NO_PARENT);
+    for (const auto& range : ranges) {
+        if (range.first.low >= range.first.high)
+            continue;
+        const auto parent = m_inlineScopes[range.second].parent;
+        auto segment = std::lower_bound(boundaries.begin(), boundaries.end(), range.first.low) - boundaries.begin();
+        for (; boundaries[segment] < range.first.high; ++segment) {
+            if (segmentScopes[segment] == parent)
+                segmentScopes[segment] = range.second;
+        }
+    }
+
+    // always start with a segment, even when there are no scopes, so that we don't build the table again
+    m_inlineSegments.push_back({0, InlineScope::NO_PARENT});
+    for (size_t i = 0; i < boundaries.size(); ++i) {
+        if (segmentScopes[i] != m_inlineSegments.back().scope)
+            m_inlineSegments.push_back({boundaries[i], segmentScopes[i]});
+    }
+}
+
+std::vector<InlineScope*> CuDieRangeMapping::findInlineScopeChain(Dwarf_Addr offset)
+{
+    if (m_inlineSegments.empty())
+        addInlineScopes();
+
+    auto it = std::upper_bound(m_inlineSegments.begin(), m_inlineSegments.end(), offset,
+                               [](Dwarf_Addr offset, const InlineSegment& segment) { return offset < segment.start; });
+    // the first segment starts at zero, so we always find one
+    --it;
+
+    std::vector<InlineScope*> chain;
+    for (auto scope = it->scope; scope != InlineScope::NO_PARENT; scope = m_inlineScopes[scope].parent)
+        chain.push_back(&m_inlineScopes[scope]);
+    std::reverse(chain.begin(), chain.end());
+    return chain;
+}
+
+const SourceLocation& CuDieRangeMapping::callSourceLocation(InlineScope* scope)
+{
+    if (!scope->hasCallLocation) {
+        if (!m_files)
+            dwarf_getsrcfiles(cudie(), &m_files, nullptr);
+        scope->callLocation = ::callSourceLocation(&scope->die, m_files, cudie());
+        scope->hasCallLocation = true;
+    }
+    return scope->callLocation;
+}
+
+void CuDieRangeMapping::clearInlineScopes()
+{
+    m_inlineScopes = {};
+    m_inlineSegments = {};
+}
+
 const std::string& CuDieRangeMapping::dieName(Dwarf_Die* die)
 {
     const auto offset = dwarf_dieoffset(die);
@@ -343,6 +476,28 @@ const std::string& CuDieRangeMapping::dieName(Dwarf_Die* die)
     return it->second;
 }
 
+void CuDieRangeMapping::demangleDieNames(std::vector<Dwarf_Die>& dies, unsigned numThreads)
+{
+    // many addresses share their scopes, so only look at every DIE once
+    std::sort(dies.begin(), dies.end(),
+              [](Dwarf_Die& lhs, Dwarf_Die& rhs) { return dwarf_dieoffset(&lhs) < dwarf_dieoffset(&rhs); });
+
+    std::vector<Dwarf_Off> offsets;
+    std::vector<std::string> names;
+    for (auto& die : dies) {
+        const auto offset = dwarf_dieoffset(&die);
+        if ((!offsets.empty() && offsets.back() == offset) || m_dieNameCache.contains(offset))
+            continue;
+        offsets.push_back(offset);
+        names.push_back(qualifiedDieName(&die, m_dieNameCache));
+    }
+
+    std::deque<std::string> overflow;
+    const auto demangledNames = demangleBatch(names, numThreads, &overflow);
+    for (std::size_t i = 0; i < offsets.size(); ++i)
+        m_dieNameCache.insert({offsets[i], std::string(demangledNames[i])});
+}
+
 DwarfDieCache::DwarfDieCache(Dwfl_Module* mod)
 {
     if (!mod)
@@ -357,6 +512,76 @@ DwarfDieCache::DwarfDieCache(Dwfl_Module* mod)
     }
 }
 
+DwarfDieCache::DwarfDieCache(Dwfl_Module* mod, const std::vector<CuDieRanges>& cuDieRanges)
+{
+    if (!mod)
+        return;
+
+    Dwarf_Addr bias = 0;
+    auto* dwarf = dwfl_module_getdwarf(mod, &bias);
+    if (!dwarf)
+        return;
+
+    m_cuDieRanges.reserve(cuDieRanges.size());
+    for (const auto& cu : cuDieRanges) {
+        Dwarf_Die die;
+        if (!dwarf_offdie(dwarf, cu.offset, &die)) {
+            // the cached data doesn't match the module, start over
+            *this = DwarfDieCache(mod);
+            return;
+        }
+        m_cuDieRanges.emplace_back(die, bias, cu.ranges);
+    }
+}
+
+size_t CuDieRangeMapping::memoryUsage() const
+{
+    auto ret = m_cuDieRanges.ranges.capacity() * sizeof(DwarfRange);
+    ret += m_subPrograms.capacity() * sizeof(SubProgramDie);
+    for (const auto& subProgram : m_subPrograms)
+        ret += subProgram.memoryUsage();
+    ret += m_dieNameCache.bucket_count() * (sizeof(std::pair<Dwarf_Off, std::string>) + sizeof(size_t));
+    for (const auto& name : m_dieNameCache)
+        ret += name.second.capacity();
+    ret += m_inlineScopes.capacity() * sizeof(InlineScope);
+    ret += m_inlineSegments.capacity() * sizeof(InlineSegment);
+    return ret;
+}
+
+size_t DwarfDieCache::memoryUsage() const
+{
+    auto ret = m_cuDieRanges.capacity() * sizeof(CuDieRangeMapping) + m_inlineScopeTables.capacity() * sizeof(size_t);
+    for (const auto& cuDieMapping : m_cuDieRanges)
+        ret += cuDieMapping.memoryUsage();
+    return ret;
+}
+
+std::vector<CuDieRanges> DwarfDieCache::cuDieRanges() const
+{
+    std::vector<CuDieRanges> ret;
+    ret.reserve(m_cuDieRanges.size());
+    for (const auto& cuDieMapping : m_cuDieRanges) {
+        ret.push_back(cuDieMapping.cuDieRanges());
+    }
+    return ret;
+}
+
+std::vector<InlineScope*> DwarfDieCache::findInlineScopeChain(CuDieRangeMapping* cuDie, Dwarf_Addr offset)
+{
+    const auto index = static_cast<size_t>(cuDie - m_cuDieRanges.data());
+    auto it = std::find(m_inlineScopeTables.begin(), m_inlineScopeTables.end(), index);
+    if (it != m_inlineScopeTables.end()) {
+        std::rotate(it, std::next(it), m_inlineScopeTables.end());
+    } else {
+        if (m_inlineScopeTables.size() == MAX_INLINE_SCOPE_TABLES) {
+            m_cuDieRanges[m_inlineScopeTables.front()].clearInlineScopes();
+            m_inlineScopeTables.erase(m_inlineScopeTables.begin());
+        }
+        m_inlineScopeTables.push_back(index);
+    }
+    return cuDie->findInlineScopeChain(offset);
+}
+
 CuDieRangeMapping* DwarfDieCache::findCuDie(Dwarf_Addr addr)
 {
     auto it = std::find_if(m_cuDieRanges.begin(), m_cuDieRanges.end(),
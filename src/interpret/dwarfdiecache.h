@@ -18,9 +18,6 @@
 #include <string>
 #include <vector>
 
-/// @return the demangled symbol name
-std::string demangle(const std::string& mangledName);
-
 /// @return the absolute source path for the potential @p path in the given @p cuDie
 std::string absoluteSourcePath(const char* path, Dwarf_Die* cuDie);
 
@@ -44,6 +41,13 @@ struct DwarfRange
     }
 };
 
+/// the offset of a CU DIE and its ranges, not bias-corrected
+struct CuDieRanges
+{
+    Dwarf_Off offset;
+    std::vector<DwarfRange> ranges;
+};
+
 /// cache of dwarf ranges for a given Dwarf_Die
 struct DieRanges
 {
@@ -76,16 +80,39 @@ public:
     {
         return &m_ranges.die;
     }
+    /// @return the approximate number of bytes used on the heap
+    size_t memoryUsage() const
+    {
+        return m_ranges.ranges.capacity() * sizeof(DwarfRange);
+    }
 
 private:
     DieRanges m_ranges;
 };
 
+/// a DW_TAG_subprogram DIE or one of the DW_TAG_inlined_subroutine DIEs within it
+struct InlineScope
+{
+    enum : uint32_t
+    {
+        NO_PARENT = UINT32_MAX
+    };
+
+    Dwarf_Die die;
+    /// index of the scope this one got inlined into, NO_PARENT for the subprogram
+    uint32_t parent = NO_PARENT;
+    /// the DW_AT_call_{file,line} data of an inlined subroutine, resolved on demand
+    bool hasCallLocation = false;
+    SourceLocation callLocation;
+};
+
 /// cache of dwarf ranges for a CU DIE and child sub programs
 class CuDieRangeMapping
 {
 public:
     CuDieRangeMapping(Dwarf_Die cudie, Dwarf_Addr bias);
+    /// @p ranges as returned by @c cuDieRanges() before, i.e. not bias-corrected
+    CuDieRangeMapping(Dwarf_Die cudie, Dwarf_Addr bias, const std::vector<DwarfRange>& ranges);
 
     bool isEmpty() const
     {
@@ -103,22 +130,65 @@ public:
     {
         return &m_cuDieRanges.die;
     }
+    /// @return the offset and ranges of the CU DIE, e.g. to store them in a persistent cache
+    CuDieRanges cuDieRanges() const;
 
     /// On first call this will visit the CU DIE to cache all subprograms
     /// @return the DW_TAG_subprogram DIE that contains @p offset
     /// @p offset a bias-corrected address to find a subprogram for
     SubProgramDie* findSubprogramDie(Dwarf_Addr offset);
 
+    /**
+     * On first call this will visit all subprograms of the CU DIE to build a table of the inline scopes
+     * for every address, which makes subsequent lookups a binary search.
+     *
+     * @return the subprogram and the inlined subroutines that contain @p offset, from the outermost to
+     *         the innermost one, or an empty vector when no subprogram contains @p offset
+     * @p offset a bias-corrected address to find the scopes for
+     */
+    std::vector<InlineScope*> findInlineScopeChain(Dwarf_Addr offset);
+
+    /// @return the location @p scope got inlined at, @p scope must be an inlined subroutine
+    const SourceLocation& callSourceLocation(InlineScope* scope);
+
+    bool hasInlineScopes() const
+    {
+        return !m_inlineSegments.empty();
+    }
+    /// free the table built by @c findInlineScopeChain, it gets rebuilt on demand
+    void clearInlineScopes();
+
     /// @return a fully qualified, demangled symbol name for @p die
     const std::string& dieName(Dwarf_Die* die);
 
+    /**
+     * Demangle the names of all @p dies at once, such that @c dieName only needs to look them up
+     *
+     * This distributes the work across up to @p numThreads threads, see demangleBatch.
+     */
+    void demangleDieNames(std::vector<Dwarf_Die>& dies, unsigned numThreads);
+
+    /// @return the approximate number of bytes used on the heap
+    size_t memoryUsage() const;
+
 private:
     void addSubprograms();
+    void addInlineScopes();
 
     Dwarf_Addr m_bias = 0;
     DieRanges m_cuDieRanges;
     std::vector<SubProgramDie> m_subPrograms;
     tsl::robin_map<Dwarf_Off, std::string> m_dieNameCache;
+
+    struct InlineSegment
+    {
+        Dwarf_Addr start;
+        /// the innermost scope from start up to the start of the next segment, or NO_PARENT
+        uint32_t scope;
+    };
+    std::vector<InlineScope> m_inlineScopes;
+    std::vector<InlineSegment> m_inlineSegments;
+    Dwarf_Files* m_files = nullptr;
 };
 
 /**
@@ -136,12 +206,36 @@ class DwarfDieCache
 {
 public:
     DwarfDieCache(Dwfl_Module* mod = nullptr);
+    /**
+     * Restore the cache from @p cuDieRanges, as returned by @c cuDieRanges() for the same module before.
+     * This is much faster than visiting all CU DIEs, which takes a while for large modules.
+     */
+    DwarfDieCache(Dwfl_Module* mod, const std::vector<CuDieRanges>& cuDieRanges);
+
+    std::vector<CuDieRanges> cuDieRanges() const;
 
     /// @p addr absolute address, not bias-corrected
     CuDieRangeMapping* findCuDie(Dwarf_Addr addr);
 
+    /**
+     * @return the inline scope chain of @p offset within @p cuDie, see CuDieRangeMapping::findInlineScopeChain
+     *
+     * Only the tables of the most recently used CUs are kept around, to bound the memory usage.
+     */
+    std::vector<InlineScope*> findInlineScopeChain(CuDieRangeMapping* cuDie, Dwarf_Addr offset);
+
+    /// @return the approximate number of bytes used on the heap, excluding the data of libdw itself
+    size_t memoryUsage() const;
+
+    /// the number of CUs for which the inline scope tables are kept
+    static constexpr size_t MAX_INLINE_SCOPE_TABLES = 64;
+
 public:
     std::vector<CuDieRangeMapping> m_cuDieRanges;
+
+private:
+    /// indices into m_cuDieRanges of the CUs with an inline scope table, the most recently used one last
+    std::vector<size_t> m_inlineScopeTables;
 };
 
 #endif // DWARFDIECACHE_H
@@ -11,31 +11,47 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <cinttypes>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <numeric>
 #include <sstream>
 #ifdef __linux__
 #include <stdio_ext.h>
 #endif
 #include <memory>
+#include <thread>
 #include <tuple>
 #include <vector>
 
+#include "demangler.h"
 #include "dwarfdiecache.h"
+#include "modulefragmentindex.h"
+#include "persistentcache.h"
 #include "symbolcache.h"
 
+#include "util/allocationsampler.h"
 #include "util/config.h"
 #include "util/linereader.h"
 #include "util/linewriter.h"
 #include "util/pointermap.h"
 
+#if ZSTD_FOUND
+#include "zstdframewriter.h"
+#endif
+
 #include <boost/program_options.hpp>
 
 #include <csignal>
 #include <cstring>
 #include <dwarf.h>
 #include <elfutils/libdwelf.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -43,6 +59,9 @@ using namespace std;
 namespace po = boost::program_options;
 
 namespace {
+
+// first file format version in which "m 1 - <address>" removes a single module, before it removed all of them
+constexpr unsigned INCREMENTAL_MODULES_FILE_FORMAT_VERSION = 5;
 bool isArmArch()
 {
 #ifdef __arm__
@@ -86,7 +105,7 @@ static SymbolCache::Symbols extractSymbols(Dwfl_Module* module, uint64_t elfStar
         const auto symbol = dwfl_module_getsym_info(module, i, &sym, &symAddr, nullptr, nullptr, nullptr);
         if (symbol) {
             const uint64_t start = alignedAddress(sym.st_value, isArmArch);
-            symbols.push_back({symAddr - elfStart, start, sym.st_size, symbol});
+            symbols.add(symAddr - elfStart, start, sym.st_size, symbol);
         }
     }
     return symbols;
@@ -149,12 +168,6 @@ struct ModuleFragment
     {
     }
 
-    bool operator<(const ModuleFragment& module) const
-    {
-        return tie(addressStart, fragmentStart, fragmentEnd, moduleIndex)
-            < tie(module.addressStart, module.fragmentStart, module.fragmentEnd, module.moduleIndex);
-    }
-
     bool operator!=(const ModuleFragment& module) const
     {
         return tie(addressStart, fragmentStart, fragmentEnd, moduleIndex)
@@ -168,23 +181,62 @@ struct ModuleFragment
     size_t moduleIndex;
 };
 
+/// @return a 64bit hash of @p str, also on 32bit platforms
+static uint64_t hash64(const string& str)
+{
+    if (sizeof(size_t) >= sizeof(uint64_t)) {
+        return std::hash<string>()(str);
+    }
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (const auto c : str) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+/// @return the build-id of @p module as a hex string, or an empty string if it has none
+static string buildId(Dwfl_Module* module)
+{
+    GElf_Addr bias = 0;
+    auto* elf = dwfl_module_getelf(module, &bias);
+    const void* id = nullptr;
+    const auto size = elf ? dwelf_elf_gnu_build_id(elf, &id) : -1;
+    if (size <= 0) {
+        return {};
+    }
+
+    string ret;
+    ret.reserve(size * 2);
+    const auto* bytes = static_cast<const unsigned char*>(id);
+    for (ssize_t i = 0; i < size; ++i) {
+        const char hex[] = "0123456789abcdef";
+        ret.push_back(hex[bytes[i] >> 4]);
+        ret.push_back(hex[bytes[i] & 0xf]);
+    }
+    return ret;
+}
+
 struct Module
 {
-    Module(string fileName, uintptr_t addressStart, Dwfl_Module* module, SymbolCache* symbolCache)
+    Module(string fileName, uintptr_t addressStart, Dwfl_Module* module, SymbolCache* symbolCache,
+           PersistentCache* persistentCache, PersistentCache::Entry* cacheEntry)
         : fileName(std::move(fileName))
         , addressStart(addressStart)
         , module(module)
-        , dieCache(module)
         , symbolCache(symbolCache)
+        , persistentCache(persistentCache)
+        , cacheEntry(cacheEntry)
     {
     }
 
     Module()
-        : Module({}, 0, nullptr, nullptr)
+        : Module({}, 0, nullptr, nullptr, nullptr, nullptr)
     {
     }
 
-    AddressInformation resolveAddress(uintptr_t address) const
+    /// when @p resolveDebugInfo is false, only the symbol name is looked up, which is much cheaper
+    AddressInformation resolveAddress(uintptr_t address, bool resolveDebugInfo) const
     {
         AddressInformation info;
 
@@ -192,11 +244,27 @@ struct Module
             return info;
         }
 
+        if (cacheEntry) {
+            // the entry may have been released to stay within the memory budget
+            persistentCache->load(cacheEntry);
+            if (resolveDebugInfo) {
+                validateCacheEntry();
+            }
+        }
+
         if (!symbolCache->hasSymbols(fileName)) {
-            // cache all symbols in a sorted lookup table and demangle them on-demand
-            // note that the symbols within the symtab aren't necessarily sorted,
-            // which makes searching repeatedly via dwfl_module_addrinfo potentially very slow
-            symbolCache->setSymbols(fileName, extractSymbols(module, addressStart, isArmArch()));
+            SymbolCache::Symbols symbols;
+            if (cacheEntry && persistentCache->loadSymbols(*cacheEntry, &symbols)) {
+                symbolCache->setSymbols(fileName, std::move(symbols));
+            } else {
+                // cache all symbols in a sorted lookup table and demangle them on-demand
+                // note that the symbols within the symtab aren't necessarily sorted,
+                // which makes searching repeatedly via dwfl_module_addrinfo potentially very slow
+                symbolCache->setSymbols(fileName, extractSymbols(module, addressStart, isArmArch()));
+                if (cacheEntry) {
+                    persistentCache->setSymbols(cacheEntry, symbolCache->symbols(fileName));
+                }
+            }
         }
 
         auto cachedAddrInfo = symbolCache->findSymbol(fileName, address - addressStart);
@@ -204,6 +272,124 @@ struct Module
             info.frame.function = std::move(cachedAddrInfo.symname);
         }
 
+        if (!resolveDebugInfo) {
+            return info;
+        }
+
+        if (!cacheEntry) {
+            return resolveDebugInformation(address, std::move(info));
+        }
+
+        const auto relAddr = address - addressStart;
+        if (const auto* frames = cacheEntry->findFrames(relAddr)) {
+            auto toFrame = [](const PersistentCache::Frame& frame) {
+                return Frame(frame.function, frame.file, frame.line);
+            };
+            info.frame = toFrame(frames->front());
+            std::transform(std::next(frames->begin()), frames->end(), std::back_inserter(info.inlined), toFrame);
+            return info;
+        }
+
+        info = resolveDebugInformation(address, std::move(info));
+
+        PersistentCache::Frames frames;
+        frames.reserve(info.inlined.size() + 1);
+        auto toCachedFrame = [](const Frame& frame) {
+            return PersistentCache::Frame {frame.function, frame.file, frame.line};
+        };
+        frames.push_back(toCachedFrame(info.frame));
+        std::transform(info.inlined.begin(), info.inlined.end(), std::back_inserter(frames), toCachedFrame);
+        cacheEntry->addFrames(relAddr, std::move(frames));
+        return info;
+    }
+
+    /**
+     * Forget what the cache entry recorded without DWARF data, when that is available by now,
+     * e.g. after installing debug packages. Entries that were recorded with DWARF data can be
+     * used as they are, without loading the DWARF data at all.
+     */
+    void validateCacheEntry() const
+    {
+        if (hasValidatedCacheEntry) {
+            return;
+        }
+        hasValidatedCacheEntry = true;
+        if (!cacheEntry->hasCuDieRanges || cacheEntry->hasDwarf) {
+            return;
+        }
+        Dwarf_Addr bias = 0;
+        if (dwfl_module_getdwarf(module, &bias)) {
+            cacheEntry->reset();
+            // the symbols may have been taken from a separate debug file
+            symbolCache->removeSymbols(fileName);
+        }
+    }
+
+    void ensureDieCache() const
+    {
+        if (hasDieCache) {
+            return;
+        }
+        // only look at the DWARF data of modules we need to, this can take a while for large modules
+        if (cacheEntry && cacheEntry->hasCuDieRanges) {
+            dieCache = DwarfDieCache(module, cacheEntry->cuDieRanges);
+        } else {
+            dieCache = DwarfDieCache(module);
+            if (cacheEntry) {
+                // the DWARF data got loaded by now if there is any
+                Dwarf_Addr bias = 0;
+                cacheEntry->setCuDieRanges(dieCache.cuDieRanges(), dwfl_module_getdwarf(module, &bias));
+            }
+        }
+        hasDieCache = true;
+    }
+
+    /**
+     * Demangle the function names of the inline frames of all @p addresses at once
+     *
+     * This is much cheaper than demangling them one after the other while resolving the addresses,
+     * see demangleBatch.
+     */
+    void demangleFunctionNames(const vector<uintptr_t>& addresses, unsigned numThreads) const
+    {
+        if (!module) {
+            return;
+        }
+
+        if (cacheEntry) {
+            persistentCache->load(cacheEntry);
+            validateCacheEntry();
+        }
+
+        ensureDieCache();
+
+        // the inline scope tables of the CUs may get evicted while we look up the chains, so copy the DIEs
+        tsl::robin_map<CuDieRangeMapping*, vector<Dwarf_Die>> cuDies;
+        for (const auto address : addresses) {
+            if (cacheEntry && cacheEntry->findFrames(address - addressStart)) {
+                // nothing to demangle for addresses whose frames got cached
+                continue;
+            }
+            auto cuDie = dieCache.findCuDie(address);
+            if (!cuDie) {
+                continue;
+            }
+            auto& dies = cuDies[cuDie];
+            for (const auto* scope : dieCache.findInlineScopeChain(cuDie, address - cuDie->bias())) {
+                dies.push_back(scope->die);
+            }
+        }
+
+        for (auto it = cuDies.begin(); it != cuDies.end(); ++it) {
+            it->first->demangleDieNames(it.value(), numThreads);
+        }
+    }
+
+    /// resolve the file, line and inline frames of @p address on top of the symbol name in @p info
+    AddressInformation resolveDebugInformation(uintptr_t address, AddressInformation info) const
+    {
+        ensureDieCache();
+
         auto cuDie = dieCache.findCuDie(address);
         if (!cuDie) {
             return info;
@@ -220,88 +406,684 @@ struct Module
             }
         }
 
-        auto* subprogram = cuDie->findSubprogramDie(offset);
-        if (!subprogram) {
+        // the subprogram followed by the inline chain, if any
+        const auto scopes = dieCache.findInlineScopeChain(cuDie, offset);
+        if (scopes.empty()) {
             return info;
         }
 
-        // resolve the inline chain if possible
-        auto scopes = findInlineScopes(subprogram->die(), offset);
+        // use name of the last inlined function as symbol
+        info.frame.function = cuDie->dieName(&scopes.back()->die);
+
+        // iterate in reverse, to properly rebuild the inline stack
+        // note that we need to take the DW_AT_call_{file,line} from the previous scope DIE
+        // the very last frame is the one where all the code got inlined into
+        for (std::size_t scopeIndex = scopes.size() - 1; scopeIndex >= 1; --scopeIndex) {
+            const auto& call = cuDie->callSourceLocation(scopes[scopeIndex]);
+            info.inlined.push_back({cuDie->dieName(&scopes[scopeIndex - 1]->die), call.file, call.line});
+        }
+
+        return info;
+    }
 
-        if (scopes.empty()) {
-            // no inline frames, use subprogram name directly and return
-            info.frame.function = cuDie->dieName(subprogram->die());
+    /// @return the approximate number of bytes used for the symbols, the DWARF data and the cache entry of this module
+    uint64_t memoryUsage() const
+    {
+        uint64_t ret = hasDieCache ? dieCache.memoryUsage() : 0;
+        if (symbolCache && symbolCache->hasSymbols(fileName)) {
+            ret += symbolCache->symbols(fileName).memoryUsage();
+        }
+        if (cacheEntry) {
+            ret += cacheEntry->memoryUsage();
+        }
+        return ret;
+    }
+
+    /// free the symbols, the DWARF data and the cache entry, they get loaded again on demand
+    void evictCaches()
+    {
+        dieCache = {};
+        hasDieCache = false;
+        if (symbolCache) {
+            symbolCache->removeSymbols(fileName);
+        }
+        if (cacheEntry) {
+            persistentCache->release(cacheEntry);
+            // other resolvers may have written the entry in the meantime, which needs to be validated again
+            hasValidatedCacheEntry = false;
+        }
+    }
+
+    string fileName;
+    uintptr_t addressStart;
+    Dwfl_Module* module;
+    mutable DwarfDieCache dieCache;
+    mutable bool hasDieCache = false;
+    SymbolCache* symbolCache;
+    PersistentCache* persistentCache;
+    PersistentCache::Entry* cacheEntry;
+    mutable bool hasValidatedCacheEntry = false;
+    uint64_t lastUse = 0;
+};
+
+/**
+ * The state required to resolve addresses, most notably the Dwfl session with all the
+ * debug information it loaded so far.
+ *
+ * libdwfl is not thread safe, so every thread that resolves addresses needs its own Resolver.
+ */
+class Resolver
+{
+public:
+    /**
+     * @p removedModules the start addresses of the modules that got unloaded in the current generation
+     * @p memoryBudget the number of bytes the symbols and DWARF data of all modules may use, or zero
+     */
+    Resolver(char** debugPath, const string& cacheDirectory, uint64_t cacheSize,
+             const vector<uintptr_t>* removedModules, uint64_t memoryBudget)
+        : m_persistentCache(cacheDirectory, cacheSize)
+        , m_removedModules(removedModules)
+        , m_memoryBudget(memoryBudget)
+    {
+        m_callbacks = {
+            &dwfl_build_id_find_elf,
+            &dwfl_standard_find_debuginfo,
+            &dwfl_offline_section_address,
+            debugPath,
+        };
+
+        m_dwfl = dwfl_begin(&m_callbacks);
+    }
+
+    ~Resolver()
+    {
+        dwfl_end(m_dwfl);
+    }
+
+    Resolver(const Resolver&) = delete;
+    Resolver& operator=(const Resolver&) = delete;
+
+    /**
+     * Resolve @p ip within @p fragment
+     *
+     * @p generation identifies the module map the fragment belongs to, all modules
+     * get reported anew once that changes. Within a generation, only the modules that
+     * got unloaded are removed, all others keep their state.
+     */
+    AddressInformation resolve(const ModuleFragment& fragment, uintptr_t ip, uint64_t generation,
+                               bool resolveDebugInfo)
+    {
+        if (auto module = findModule(fragment, generation)) {
+            auto info = module->resolveAddress(ip, resolveDebugInfo);
+            module->lastUse = ++m_clock;
+            if (m_clock % MEMORY_CHECK_INTERVAL == 0) {
+                checkMemoryUsage();
+            }
             return info;
         }
+        return {};
+    }
 
-        // use name of the last inlined function as symbol
-        info.frame.function = cuDie->dieName(&scopes.back());
+    /// demangle the function names of the inline frames of all @p ips within @p fragment at once, see resolve
+    void demangleFunctionNames(const ModuleFragment& fragment, const vector<uintptr_t>& ips, uint64_t generation,
+                               unsigned numThreads)
+    {
+        if (auto module = findModule(fragment, generation)) {
+            module->demangleFunctionNames(ips, numThreads);
+            module->lastUse = ++m_clock;
+        }
+    }
+
+    /// @return the peak number of bytes used by the symbols and DWARF data of all modules
+    uint64_t peakMemoryUsage()
+    {
+        checkMemoryUsage();
+        return m_peakMemoryUsage;
+    }
+
+private:
+    enum : uint64_t
+    {
+        // summing up the memory usage of all modules isn't free, so only do it every so often
+        MEMORY_CHECK_INTERVAL = 256,
+    };
+
+    /// @return the module of @p fragment, after updating the modules to @p generation
+    Module* findModule(const ModuleFragment& fragment, uint64_t generation)
+    {
+        if (generation != m_generation) {
+            // reset dwfl state
+            m_modules.clear();
 
-        Dwarf_Files* files = nullptr;
-        dwarf_getsrcfiles(cuDie->cudie(), &files, nullptr);
+            dwfl_report_begin(m_dwfl);
+            dwfl_report_end(m_dwfl, nullptr, nullptr);
+
+            m_generation = generation;
+            m_numRemovedModules = m_removedModules->size();
+        } else if (m_numRemovedModules < m_removedModules->size()) {
+            bool removed = false;
+            for (auto i = m_numRemovedModules; i < m_removedModules->size(); ++i) {
+                removed |= m_modules.erase((*m_removedModules)[i]) > 0;
+            }
+            m_numRemovedModules = m_removedModules->size();
+            if (removed) {
+                reportModules();
+            }
+        }
+
+        return reportModule(fragment);
+    }
+
+    /// evict the caches of the least recently used modules when we exceed the memory budget
+    void checkMemoryUsage()
+    {
+        uint64_t memoryUsage = 0;
+        vector<std::pair<uint64_t, Module*>> modules;
+        modules.reserve(m_modules.size());
+        for (auto it = m_modules.begin(); it != m_modules.end(); ++it) {
+            auto& module = it.value();
+            const auto moduleMemoryUsage = module.memoryUsage();
+            memoryUsage += moduleMemoryUsage;
+            if (moduleMemoryUsage) {
+                modules.push_back({module.lastUse, &module});
+            }
+        }
+        m_peakMemoryUsage = std::max(m_peakMemoryUsage, memoryUsage);
+
+        if (!m_memoryBudget || memoryUsage <= m_memoryBudget) {
+            return;
+        }
 
-        auto handleDie = [&](Dwarf_Die *scope, Dwarf_Die *prevScope) {
-            const auto tag = dwarf_tag(prevScope);
-            if (tag != DW_TAG_inlined_subroutine) {
-                error_out << "unexpected prev scope tag: " << std::hex << tag << '\n';
+        // evict a bit more than necessary, to not do this for every other address
+        sort(modules.begin(), modules.end());
+        const auto targetMemoryUsage = m_memoryBudget / 4 * 3;
+        for (const auto& module : modules) {
+            if (memoryUsage <= targetMemoryUsage) {
+                break;
+            }
+            memoryUsage -= std::min(memoryUsage, module.second->memoryUsage());
+            module.second->evictCaches();
+        }
+    }
+
+    Module* reportModule(const ModuleFragment& module)
+    {
+        if (startsWith(module.fileName, "linux-vdso.so")) {
+            return nullptr;
+        }
+
+        auto it = m_modules.find(module.addressStart);
+        if (it != m_modules.end() && it->second.module) {
+            if (it->second.fileName == module.fileName) {
+                return &it.value();
+            }
+            // a different module got loaded at the same address, e.g. when we resolve the addresses
+            // of an unloaded module at the end with --symbolize lazy
+            m_modules.erase(it);
+            reportModules();
+        }
+
+        auto& ret = m_modules[module.addressStart];
+        dwfl_report_begin_add(m_dwfl);
+        auto dwflModule = dwfl_report_elf(m_dwfl, module.fileName.c_str(), module.fileName.c_str(), -1,
+                                          module.addressStart, false);
+        dwfl_report_end(m_dwfl, nullptr, nullptr);
+
+        if (!dwflModule) {
+            error_out << "Failed to report module for " << module.fileName << ": " << dwfl_errmsg(dwfl_errno())
+                      << endl;
+            return nullptr;
+        }
+
+        ret = Module(module.fileName, module.addressStart, dwflModule, &m_symbolCache, &m_persistentCache,
+                     cacheEntry(dwflModule));
+        return &ret;
+    }
+
+    /// report all modules in m_modules again, which removes all other modules from dwfl
+    void reportModules()
+    {
+        dwfl_report_begin(m_dwfl);
+        for (auto it = m_modules.begin(); it != m_modules.end(); ++it) {
+            auto& module = it.value();
+            if (!module.module) {
+                continue;
+            }
+            // reporting a module with the same name and addresses again keeps its state
+            Dwarf_Addr low = 0;
+            Dwarf_Addr high = 0;
+            const auto* name = dwfl_module_info(module.module, nullptr, &low, &high, nullptr, nullptr, nullptr, nullptr);
+            auto* dwflModule = dwfl_report_module(m_dwfl, name, low, high);
+            if (dwflModule != module.module) {
+                module = Module(module.fileName, module.addressStart, dwflModule, &m_symbolCache, &m_persistentCache,
+                                dwflModule ? cacheEntry(dwflModule) : nullptr);
+            }
+        }
+        dwfl_report_end(m_dwfl, nullptr, nullptr);
+    }
+
+    PersistentCache::Entry* cacheEntry(Dwfl_Module* module)
+    {
+        // whether DWARF data is available only gets checked lazily, see Module::validateCacheEntry
+        const auto key = buildId(module);
+        if (key.empty()) {
+            return nullptr;
+        }
+        return m_persistentCache.entry(key);
+    }
+
+    Dwfl* m_dwfl = nullptr;
+    Dwfl_Callbacks m_callbacks;
+    SymbolCache m_symbolCache;
+    PersistentCache m_persistentCache;
+    uint64_t m_generation = 0;
+    const vector<uintptr_t>* m_removedModules;
+    size_t m_numRemovedModules = 0;
+    /// by their start address
+    tsl::robin_map<uintptr_t, Module> m_modules;
+    uint64_t m_memoryBudget = 0;
+    uint64_t m_peakMemoryUsage = 0;
+    uint64_t m_clock = 0;
+};
+
+/**
+ * An encountered instruction pointer whose 'i' line could not be written yet.
+ *
+ * All output that follows the 'i' line gets deferred along with it, to keep
+ * the output in the same order as the input.
+ */
+struct PendingIp
+{
+    struct DeferredLine
+    {
+        // zero for raw data
+        char type = 0;
+        int numArgs = 0;
+        uint64_t args[2] = {};
+        string raw;
+    };
+
+    uintptr_t ip = 0;
+    size_t moduleIndex = 0;
+    /// non-zero when this updates the frames of an 'i' line written earlier, see --symbolize lazy
+    size_t ipId = 0;
+    bool resolveDebugInfo = true;
+    AddressInformation info;
+    std::atomic<bool> resolved {false};
+    vector<DeferredLine> deferred;
+};
+
+/**
+ * A worker thread resolving instruction pointers in the background, see --threads.
+ *
+ * Every module gets resolved by the same thread, which thus is the only one that
+ * loads its debug information and fills its DwarfDieCache.
+ */
+class ResolverThread
+{
+public:
+    ResolverThread(char** debugPath, const string& cacheDirectory, uint64_t cacheSize,
+                   const vector<uintptr_t>* removedModules, uint64_t memoryBudget, std::mutex* resolvedMutex,
+                   std::condition_variable* resolvedCondition)
+        : m_resolver(debugPath, cacheDirectory, cacheSize, removedModules, memoryBudget)
+        , m_resolvedMutex(resolvedMutex)
+        , m_resolvedCondition(resolvedCondition)
+        , m_thread([this]() { run(); })
+    {
+    }
+
+    ~ResolverThread()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_condition.notify_one();
+        m_thread.join();
+    }
+
+    /// resolve @p pending within @p fragment, which must stay valid until @p pending got resolved
+    void enqueue(PendingIp* pending, const ModuleFragment* fragment, uint64_t generation)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back({pending, fragment, generation, {}, 0});
+        }
+        m_condition.notify_one();
+    }
+
+    /// demangle the function names of @p ips within @p fragment at once, before their addresses get enqueued
+    void enqueueDemangling(vector<uintptr_t> ips, const ModuleFragment* fragment, uint64_t generation,
+                           unsigned numThreads)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back({nullptr, fragment, generation, std::move(ips), numThreads});
+        }
+        m_condition.notify_one();
+    }
+
+    /// NOTE: all enqueued addresses must have been resolved already
+    uint64_t peakMemoryUsage()
+    {
+        return m_resolver.peakMemoryUsage();
+    }
+
+private:
+    struct Job
+    {
+        // nullptr when the function names of ips should be demangled, see enqueueDemangling
+        PendingIp* pending;
+        const ModuleFragment* fragment;
+        uint64_t generation;
+        vector<uintptr_t> ips;
+        unsigned numThreads;
+    };
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_condition.wait(lock, [this]() { return m_stop || !m_jobs.empty(); });
+            if (m_jobs.empty()) {
                 return;
             }
+            const auto job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            lock.unlock();
+
+            if (!job.pending) {
+                m_resolver.demangleFunctionNames(*job.fragment, job.ips, job.generation, job.numThreads);
+                lock.lock();
+                continue;
+            }
+
+            job.pending->info =
+                m_resolver.resolve(*job.fragment, job.pending->ip, job.generation, job.pending->resolveDebugInfo);
+            job.pending->resolved.store(true, std::memory_order_release);
+            {
+                // prevent a lost wakeup of the main thread that checks the flag while holding this lock
+                std::lock_guard<std::mutex> resolvedLock(*m_resolvedMutex);
+            }
+            m_resolvedCondition->notify_one();
+
+            lock.lock();
+        }
+    }
+
+    Resolver m_resolver;
+    std::mutex* m_resolvedMutex;
+    std::condition_variable* m_resolvedCondition;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<Job> m_jobs;
+    bool m_stop = false;
+    // must come last, the thread starts running right away
+    std::thread m_thread;
+};
+
+/**
+ * The costs of every backtrace, used to find the instruction pointers that are worth
+ * resolving with --symbolize lazy.
+ *
+ * The costs are weighted like the analyzers do when the data got sampled, see AllocationSampler.
+ */
+class TraceCosts
+{
+public:
+    void setSamplingPeriod(uint64_t samplingPeriod)
+    {
+        m_samplingPeriod = samplingPeriod;
+    }
+
+    void addTrace(size_t ipId, size_t parentIndex)
+    {
+        m_traces.push_back({ipId, parentIndex});
+        m_costs.emplace_back();
+    }
+
+    void addAllocationInfo(uint64_t size, TraceIndex trace)
+    {
+        m_allocationInfos.push_back({size, trace.index, AllocationSampler::weight(size, m_samplingPeriod)});
+    }
+
+    void addAllocation(AllocationInfoIndex index)
+    {
+        const auto& info = m_allocationInfos[index.index];
+        if (auto* cost = findCost(info.trace)) {
+            cost->allocations += info.weight;
+            cost->current += info.weight * info.size;
+            cost->peak = std::max(cost->peak, cost->current);
+        }
+    }
+
+    void addDeallocation(AllocationInfoIndex index, bool temporary)
+    {
+        const auto& info = m_allocationInfos[index.index];
+        if (auto* cost = findCost(info.trace)) {
+            cost->current -= info.weight * info.size;
+            if (temporary) {
+                cost->temporary += info.weight;
+            }
+        }
+    }
 
-            auto call = callSourceLocation(prevScope, files, cuDie->cudie());
-            info.inlined.push_back({cuDie->dieName(scope), std::move(call.file), call.line});
+    /**
+     * @return the sorted ids of all instruction pointers of the @p topN most costly backtraces,
+     *         for any of the costs shown by the analyzers
+     *
+     * The backtraces get picked by their self cost, as shown in the bottom-up views, as well as by
+     * their inclusive cost, i.e. including all the backtraces they called, as shown in the top-down views.
+     *
+     * NOTE: we use the peak of every backtrace on its own, which is an upper bound of its
+     *       contribution to the peak of the whole application, and likewise sum up these peaks
+     *       for the inclusive cost
+     */
+    vector<size_t> costlyIps(size_t topN) const
+    {
+        // the parents are always written before their children, so we can sum up the costs back to front
+        auto inclusiveCosts = m_costs;
+        for (auto i = m_traces.size(); i > 0; --i) {
+            const auto parentIndex = m_traces[i - 1].parentIndex;
+            if (parentIndex && parentIndex < i) {
+                inclusiveCosts[parentIndex - 1] += inclusiveCosts[i - 1];
+            }
+        }
+
+        vector<bool> selected(m_traces.size());
+        auto selectTop = [&](const vector<Cost>& costs, auto costOf) {
+            vector<uint32_t> indices(costs.size());
+            std::iota(indices.begin(), indices.end(), 0);
+            const auto n = std::min(topN, indices.size());
+            std::nth_element(indices.begin(), indices.begin() + n, indices.end(),
+                             [&](uint32_t lhs, uint32_t rhs) { return costOf(costs[lhs]) > costOf(costs[rhs]); });
+            for (size_t i = 0; i < n; ++i) {
+                if (costOf(costs[indices[i]]) > 0) {
+                    selected[indices[i]] = true;
+                }
+            }
         };
+        auto selectTopCosts = [&](const vector<Cost>& costs) {
+            selectTop(costs, [](const Cost& cost) { return cost.allocations; });
+            selectTop(costs, [](const Cost& cost) { return cost.temporary; });
+            selectTop(costs, [](const Cost& cost) { return cost.peak; });
+            selectTop(costs, [](const Cost& cost) { return cost.current; });
+        };
+        selectTopCosts(m_costs);
+        selectTopCosts(inclusiveCosts);
+
+        // the parents of the selected backtraces need to get resolved too
+        vector<bool> visited(m_traces.size());
+        vector<size_t> ipIds;
+        for (size_t i = 0; i < m_traces.size(); ++i) {
+            if (!selected[i]) {
+                continue;
+            }
+            for (auto index = i + 1; index && index <= m_traces.size() && !visited[index - 1];
+                 index = m_traces[index - 1].parentIndex) {
+                visited[index - 1] = true;
+                ipIds.push_back(m_traces[index - 1].ipId);
+            }
+        }
 
-        // iterate in reverse, to properly rebuild the inline stack
-        // note that we need to take the DW_AT_call_{file,line} from the previous scope DIE
-        const auto numScopes = scopes.size();
-        for (std::size_t scopeIndex = numScopes - 1; scopeIndex >= 1; --scopeIndex) {
-            handleDie(&scopes[scopeIndex - 1], &scopes[scopeIndex]);
+        std::sort(ipIds.begin(), ipIds.end());
+        ipIds.erase(std::unique(ipIds.begin(), ipIds.end()), ipIds.end());
+        return ipIds;
+    }
+
+private:
+    struct Cost
+    {
+        double allocations = 0;
+        double temporary = 0;
+        double current = 0;
+        double peak = 0;
+
+        Cost& operator+=(const Cost& rhs)
+        {
+            allocations += rhs.allocations;
+            temporary += rhs.temporary;
+            current += rhs.current;
+            peak += rhs.peak;
+            return *this;
         }
+    };
 
-        // the very last frame is the one where all the code got inlined into
-        handleDie(subprogram->die(), &scopes.front());
+    struct Trace
+    {
+        size_t ipId;
+        size_t parentIndex;
+    };
 
-        return info;
+    struct AllocationInfo
+    {
+        uint64_t size;
+        uint32_t trace;
+        // the number of allocations a recorded one stands for, see AllocationSampler::weight
+        double weight;
+    };
+
+    Cost* findCost(uint32_t trace)
+    {
+        return trace && trace <= m_costs.size() ? &m_costs[trace - 1] : nullptr;
     }
 
-    string fileName;
-    uintptr_t addressStart;
-    Dwfl_Module* module;
-    mutable DwarfDieCache dieCache;
-    SymbolCache* symbolCache;
+    vector<Trace> m_traces;
+    vector<Cost> m_costs;
+    vector<AllocationInfo> m_allocationInfos;
+    uint64_t m_samplingPeriod = 0;
 };
 
 struct AccumulatedTraceData
 {
+    enum : size_t
+    {
+        // wait for the resolver threads once this many lines got deferred, to bound our memory consumption
+        MAX_DEFERRED_LINES = 1024 * 1024,
+    };
+
+    /**
+     * @p memoryBudget the number of bytes the debug information may use across all resolvers, or zero
+     *
+     * On a budget, the written strings are only remembered by their hash.
+     */
     AccumulatedTraceData(const std::string& sysroot, const std::vector<std::string>& debugPaths,
-                         const std::vector<std::string>& extraPaths)
+                         const std::vector<std::string>& extraPaths, const std::string& cacheDirectory,
+                         uint64_t cacheSize, unsigned numThreads, bool lazySymbolization, size_t lazySymbolizationTopN,
+                         uint64_t memoryBudget)
         : out(fileno(stdout))
         , m_sysroot(sysroot)
         , m_debugPaths(debugPaths)
         , m_extraPaths(extraPaths)
     {
+        if (lazySymbolization) {
+            m_traceCosts = std::make_unique<TraceCosts>();
+            m_lazySymbolizationTopN = lazySymbolizationTopN;
+        }
+
         initializePaths();
         m_moduleFragments.reserve(256);
-        m_internedData.reserve(4096);
+        m_internHashesOnly = memoryBudget != 0;
+        if (m_internHashesOnly) {
+            m_internedHashes.reserve(4096);
+        } else {
+            m_internedData.reserve(4096);
+        }
         m_encounteredIps.reserve(32768);
 
-        m_callbacks = {
-            &dwfl_build_id_find_elf,
-            &dwfl_standard_find_debuginfo,
-            &dwfl_offline_section_address,
-            &m_debugPath,
-        };
-
-        m_dwfl = dwfl_begin(&m_callbacks);
+        if (numThreads) {
+            m_resolverThreads.reserve(numThreads);
+            for (unsigned i = 0; i < numThreads; ++i) {
+                m_resolverThreads.push_back(std::make_unique<ResolverThread>(
+                    &m_debugPath, cacheDirectory, cacheSize, &m_removedModules, memoryBudget / numThreads,
+                    &m_resolvedMutex, &m_resolvedCondition));
+            }
+        } else {
+            m_resolver = std::make_unique<Resolver>(&m_debugPath, cacheDirectory, cacheSize, &m_removedModules,
+                                                    memoryBudget);
+        }
     }
 
     ~AccumulatedTraceData()
     {
-        out.write("# strings: %zu\n# ips: %zu\n", m_internedData.size(), m_encounteredIps.size());
+        writeResolvedIps(true);
+        m_resolverThreads.clear();
+        m_resolver.reset();
+
+        out.write("# strings: %zu\n# ips: %zu\n", m_internedData.size() + m_internedHashes.size(),
+                  m_encounteredIps.size());
         out.flush();
+#if ZSTD_FOUND
+        if (m_frameWriter) {
+            m_frameWriter->finish();
+            out.setSink(nullptr);
+        }
+#endif
 
         delete[] m_debugPath;
-        dwfl_end(m_dwfl);
+    }
+
+    /**
+     * Print the peak memory usage of our data structures to stderr, see --memory-budget
+     *
+     * @p pointers, @p spillFile and @p allocationInfos are the ones used for the live allocations
+     */
+    void printMemoryUsage(const PointerMap& pointers, const SpillFile* spillFile,
+                          const AllocationInfoSet& allocationInfos)
+    {
+        writeResolvedIps(true);
+
+        uint64_t debugInformation = m_resolver ? m_resolver->peakMemoryUsage() : 0;
+        for (auto& resolverThread : m_resolverThreads) {
+            debugInformation += resolverThread->peakMemoryUsage();
+        }
+        // these only ever grow, so their current size is their peak size
+        auto mapSize = [](const auto& map) {
+            using Map = std::decay_t<decltype(map)>;
+            return static_cast<uint64_t>(map.bucket_count() * (sizeof(typename Map::value_type) + sizeof(size_t)));
+        };
+
+        const auto strings = std::accumulate(m_internedData.begin(), m_internedData.end(),
+                                             mapSize(m_internedData) + mapSize(m_internedHashes),
+                                             [](uint64_t size, const auto& entry) { return size + entry.first.capacity(); });
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        const auto KiB = [](uint64_t bytes) { return bytes / 1024; };
+        fprintf(stderr,
+                "heaptrack_interpret peak memory usage:\n"
+                "\tstrings:              \t%" PRIu64 "KiB\n"
+                "\tinstruction pointers: \t%" PRIu64 "KiB\n"
+                "\tdebug information:    \t%" PRIu64 "KiB\n"
+                "\tdemangled names:      \t%" PRIu64 "KiB\n"
+                "\tallocation infos:     \t%" PRIu64 "KiB\n"
+                "\tlive allocations:     \t%" PRIu64 "KiB\n"
+                "\tspilled allocations:  \t%" PRIu64 "KiB\n"
+                "\tresident set size:    \t%ldKiB\n",
+                KiB(strings), KiB(mapSize(m_encounteredIps)), KiB(debugInformation),
+                KiB(demangleCacheMemoryUsage()), KiB(allocationInfos.memoryUsage()), KiB(pointers.peakHeapSize()),
+                KiB(spillFile ? spillFile->peakUsedSize() : 0), usage.ru_maxrss);
     }
 
     /// find a file in the sysroot or extra path
@@ -352,78 +1134,60 @@ struct AccumulatedTraceData
         return insertIntoCache(m_sysroot + fileName)->second;
     }
 
-    ResolvedIP resolve(const uintptr_t ip)
+    /// @return the module fragment containing @p ip or nullptr
+    const ModuleFragment* findFragment(const uintptr_t ip)
     {
         if (m_modulesDirty) {
-            // sort by addresses, required for binary search below
-            sort(m_moduleFragments.begin(), m_moduleFragments.end());
-
 #ifndef NDEBUG
-            for (size_t i = 0; i < m_moduleFragments.size(); ++i) {
-                const auto& m1 = m_moduleFragments[i];
-                for (size_t j = i + 1; j < m_moduleFragments.size(); ++j) {
-                    if (i == j) {
-                        continue;
-                    }
-                    const auto& m2 = m_moduleFragments[j];
-                    if ((m1.fragmentStart <= m2.fragmentStart && m1.fragmentEnd > m2.fragmentStart)
-                        || (m1.fragmentStart < m2.fragmentEnd && m1.fragmentEnd >= m2.fragmentEnd)) {
-                        cerr << "OVERLAPPING MODULES: " << hex << m1.moduleIndex << " (" << m1.fragmentStart << " to "
-                             << m1.fragmentEnd << ") and " << m1.moduleIndex << " (" << m2.fragmentStart << " to "
-                             << m2.fragmentEnd << ")\n"
-                             << dec;
-                    } else if (m2.fragmentStart >= m1.fragmentEnd) {
-                        break;
-                    }
+            const ModuleFragment* previous = nullptr;
+            m_fragmentIndex.forEach([&](uintptr_t /*start*/, uintptr_t /*end*/, uint32_t id) {
+                const auto& fragment = m_moduleFragments[id];
+                if (previous && previous->fragmentEnd > fragment.fragmentStart) {
+                    cerr << "OVERLAPPING MODULES: " << hex << previous->moduleIndex << " (" << previous->fragmentStart
+                         << " to " << previous->fragmentEnd << ") and " << fragment.moduleIndex << " ("
+                         << fragment.fragmentStart << " to " << fragment.fragmentEnd << ")\n"
+                         << dec;
                 }
-            }
+                previous = &fragment;
+            });
 #endif
 
-            // reset dwfl state
-            m_modules.clear();
-
-            dwfl_report_begin(m_dwfl);
-            dwfl_report_end(m_dwfl, nullptr, nullptr);
-
+            if (m_modulesCleared) {
+                // the resolvers reset their dwfl state once they see the new generation
+                ++m_modulesGeneration;
+                m_removedModules.clear();
+                m_modulesCleared = false;
+            }
             m_modulesDirty = false;
+            m_lazyModuleRefs.clear();
         }
 
-        auto resolveFrame = [this](const Frame& frame) {
-            return ResolvedFrame {intern(frame.function), intern(frame.file), frame.line};
-        };
-
-        ResolvedIP data;
         // find module for this instruction pointer
-        auto fragment = lower_bound(
-            m_moduleFragments.begin(), m_moduleFragments.end(), ip,
-            [](const ModuleFragment& fragment, const uintptr_t ip) -> bool { return fragment.fragmentEnd < ip; });
-        if (fragment != m_moduleFragments.end() && fragment->fragmentStart <= ip && fragment->fragmentEnd >= ip) {
-            data.moduleIndex = fragment->moduleIndex;
-
-            if (auto module = reportModule(*fragment)) {
-                const auto info = module->resolveAddress(ip);
-                data.frame = resolveFrame(info.frame);
-                std::transform(info.inlined.begin(), info.inlined.end(), std::back_inserter(data.inlined),
-                               resolveFrame);
-            }
-        }
-        return data;
+        const auto id = m_fragmentIndex.find(ip);
+        return id == ModuleFragmentIndex::NOT_FOUND ? nullptr : &m_moduleFragments[id];
     }
 
-    size_t intern(const string& str, const char** internedString = nullptr)
+    size_t intern(const string& str)
     {
         if (str.empty()) {
             return 0;
         }
 
-        const size_t id = m_internedData.size() + 1;
-        auto inserted = m_internedData.insert({str, id});
-        if (internedString) {
-            *internedString = inserted.first->first.data();
-        }
-
-        if (!inserted.second) {
-            return inserted.first->second;
+        size_t id = 0;
+        if (m_internHashesOnly) {
+            // we don't need the strings again once they got written, so only remember their hash
+            // collisions of 64bit hashes are practically impossible for the number of strings we see
+            id = m_internedHashes.size() + 1;
+            auto inserted = m_internedHashes.insert({hash64(str), static_cast<uint32_t>(id)});
+            if (!inserted.second) {
+                return inserted.first->second;
+            }
+        } else {
+            id = m_internedData.size() + 1;
+            auto inserted = m_internedData.insert({str, id});
+            if (!inserted.second) {
+                return inserted.first->second;
+            }
         }
 
         out.write("s ");
@@ -432,18 +1196,45 @@ struct AccumulatedTraceData
         return id;
     }
 
+    /// NOTE: the resolver threads access the module fragments, call writeResolvedIps(true) first
     void addModule(const string& fileName, const size_t moduleIndex, const uintptr_t addressStart,
                    const uintptr_t fragmentStart, const uintptr_t fragmentEnd)
     {
+        assert(m_pendingIps.empty());
+        m_fragmentIndex.add(fragmentStart, fragmentEnd, m_moduleFragments.size());
         m_moduleFragments.emplace_back(fileName, addressStart, fragmentStart, fragmentEnd, moduleIndex);
         m_modulesDirty = true;
     }
 
+    /// NOTE: the resolver threads access the module fragments, call writeResolvedIps(true) first
+    void removeModule(const uintptr_t addressStart)
+    {
+        assert(m_pendingIps.empty());
+        vector<uint32_t> newIds(m_moduleFragments.size(), ModuleFragmentIndex::NOT_FOUND);
+        uint32_t numKept = 0;
+        for (uint32_t id = 0; id < m_moduleFragments.size(); ++id) {
+            if (m_moduleFragments[id].addressStart == addressStart) {
+                continue;
+            }
+            if (id != numKept) {
+                m_moduleFragments[numKept] = std::move(m_moduleFragments[id]);
+            }
+            newIds[id] = numKept++;
+        }
+        m_moduleFragments.erase(m_moduleFragments.begin() + numKept, m_moduleFragments.end());
+        m_fragmentIndex.remap(newIds);
+        m_removedModules.push_back(addressStart);
+        m_modulesDirty = true;
+    }
+
+    /// NOTE: the resolver threads access the module fragments, call writeResolvedIps(true) first
     void clearModules()
     {
-        // TODO: optimize this, reuse modules that are still valid
+        assert(m_pendingIps.empty());
         m_moduleFragments.clear();
+        m_fragmentIndex.clear();
         m_modulesDirty = true;
+        m_modulesCleared = true;
     }
 
     size_t addIp(const uintptr_t instructionPointer)
@@ -452,56 +1243,297 @@ struct AccumulatedTraceData
             return 0;
         }
 
-        const size_t ipId = m_encounteredIps.size() + 1;
+        const auto ipId = static_cast<uint32_t>(m_encounteredIps.size() + 1);
         auto inserted = m_encounteredIps.insert({instructionPointer, ipId});
         if (!inserted.second) {
             return inserted.first->second;
         }
 
-        const auto ip = resolve(instructionPointer);
-        out.write("i %zx %zx", instructionPointer, ip.moduleIndex);
-        if (ip.frame.functionIndex || ip.frame.fileIndex) {
-            out.write(" %zx", ip.frame.functionIndex);
-            if (ip.frame.fileIndex) {
-                out.write(" %zx %x", ip.frame.fileIndex, ip.frame.line);
-                for (const auto& inlined : ip.inlined) {
-                    out.write(" %zx %zx %x", inlined.functionIndex, inlined.fileIndex, inlined.line);
-                }
+        const auto* fragment = findFragment(instructionPointer);
+        const auto moduleIndex = fragment ? fragment->moduleIndex : 0;
+        const bool resolveDebugInfo = !m_traceCosts;
+        if (m_traceCosts) {
+            // remember the module, it may be gone once we resolve the debug information
+            m_lazyIps.push_back({instructionPointer, fragment ? lazyModuleRef(fragment) : LazyIp::NO_MODULE});
+        }
+
+        if (m_resolverThreads.empty() || !fragment) {
+            // nothing to resolve in the background
+            AddressInformation info;
+            if (fragment && m_resolver) {
+                info = m_resolver->resolve(*fragment, instructionPointer, m_modulesGeneration, resolveDebugInfo);
             }
+            if (m_pendingIps.empty()) {
+                writeIp(instructionPointer, moduleIndex, info);
+            } else {
+                auto pending = std::make_unique<PendingIp>();
+                pending->ip = instructionPointer;
+                pending->moduleIndex = moduleIndex;
+                pending->info = std::move(info);
+                pending->resolved.store(true, std::memory_order_relaxed);
+                m_pendingIps.push_back(std::move(pending));
+            }
+            return ipId;
         }
-        out.write("\n");
+
+        auto pending = std::make_unique<PendingIp>();
+        pending->ip = instructionPointer;
+        pending->moduleIndex = moduleIndex;
+        pending->resolveDebugInfo = resolveDebugInfo;
+        enqueue(std::move(pending), fragment, m_modulesGeneration);
         return ipId;
     }
 
+    void setSamplingPeriod(uint64_t samplingPeriod)
+    {
+        if (m_traceCosts) {
+            m_traceCosts->setSamplingPeriod(samplingPeriod);
+        }
+    }
+
+    void addTrace(size_t ipId, size_t parentIndex)
+    {
+        if (m_traceCosts) {
+            m_traceCosts->addTrace(ipId, parentIndex);
+        }
+    }
+
+    void addAllocationInfo(uint64_t size, TraceIndex trace)
+    {
+        if (m_traceCosts) {
+            m_traceCosts->addAllocationInfo(size, trace);
+        }
+    }
+
+    void addAllocation(AllocationInfoIndex index)
+    {
+        if (m_traceCosts) {
+            m_traceCosts->addAllocation(index);
+        }
+    }
+
+    void addDeallocation(AllocationInfoIndex index, bool temporary)
+    {
+        if (m_traceCosts) {
+            m_traceCosts->addDeallocation(index, temporary);
+        }
+    }
+
+    /**
+     * Resolve the debug information of the instruction pointers in the most costly backtraces
+     *
+     * With --symbolize lazy, we only look up the symbol names of the instruction pointers while
+     * streaming through the data. Once we know all the costs, we write 'f' lines with the
+     * file, line and inline frames of the instruction pointers that matter.
+     */
+    void resolveCostlyIps()
+    {
+        if (!m_traceCosts) {
+            return;
+        }
+
+        writeResolvedIps(true);
+
+        auto ipIds = m_traceCosts->costlyIps(m_lazySymbolizationTopN);
+        ipIds.erase(std::remove_if(ipIds.begin(), ipIds.end(),
+                                   [this](size_t ipId) { return m_lazyIps[ipId - 1].moduleRef == LazyIp::NO_MODULE; }),
+                    ipIds.end());
+        // minimize the resets of the resolvers by handling one module map after the other,
+        // and group the addresses by their module to demangle their function names at once
+        std::stable_sort(ipIds.begin(), ipIds.end(), [this](size_t lhs, size_t rhs) {
+            const auto lhsRef = m_lazyIps[lhs - 1].moduleRef;
+            const auto rhsRef = m_lazyIps[rhs - 1].moduleRef;
+            return std::make_pair(m_lazyModules[lhsRef].generation, lhsRef)
+                < std::make_pair(m_lazyModules[rhsRef].generation, rhsRef);
+        });
+
+        // large batches get demangled across as many threads as we resolve addresses with, see --threads
+        const auto numDemangleThreads = std::max<unsigned>(1, m_resolverThreads.size());
+        for (size_t i = 0; i < ipIds.size(); ++i) {
+            const auto& lazyIp = m_lazyIps[ipIds[i] - 1];
+            const auto& module = m_lazyModules[lazyIp.moduleRef];
+            if (i == 0 || m_lazyIps[ipIds[i - 1] - 1].moduleRef != lazyIp.moduleRef) {
+                vector<uintptr_t> ips;
+                for (auto j = i; j < ipIds.size() && m_lazyIps[ipIds[j] - 1].moduleRef == lazyIp.moduleRef; ++j) {
+                    ips.push_back(m_lazyIps[ipIds[j] - 1].ip);
+                }
+                if (m_resolverThreads.empty()) {
+                    m_resolver->demangleFunctionNames(module.fragment, ips, module.generation, numDemangleThreads);
+                } else {
+                    resolverThread(&module.fragment)
+                        ->enqueueDemangling(std::move(ips), &module.fragment, module.generation, numDemangleThreads);
+                }
+            }
+
+            const auto ipId = ipIds[i];
+            auto pending = std::make_unique<PendingIp>();
+            pending->ip = lazyIp.ip;
+            pending->ipId = ipId;
+            if (m_resolverThreads.empty()) {
+                pending->info = m_resolver->resolve(module.fragment, lazyIp.ip, module.generation, true);
+                pending->resolved.store(true, std::memory_order_relaxed);
+                m_pendingIps.push_back(std::move(pending));
+            } else {
+                enqueue(std::move(pending), &module.fragment, module.generation);
+            }
+        }
+
+        writeResolvedIps(true);
+        out.write("# lazily resolved ips: %zu\n", ipIds.size());
+    }
+
+#if ZSTD_FOUND
+    /// compress the output into independent zstd frames of about @p frameSize bytes, see --zstd
+    void compressOutput(uint64_t frameSize)
+    {
+        m_frameWriter = std::make_unique<ZstdFrameWriter>(fileno(stdout), frameSize);
+        out.setSink(m_frameWriter.get());
+    }
+#endif
+
+    /// start a new zstd frame once the current one is full, this must only be called between two records
+    void endFullFrame()
+    {
+#if ZSTD_FOUND
+        if (m_frameWriter && m_frameWriter->isFrameFull()) {
+            out.flush();
+            m_frameWriter->endFrame();
+        }
+#endif
+    }
+
+    /// write a line now or, when we are still waiting for instruction pointers to get resolved, once that's done
+    template <typename... T>
+    void writeHexLine(const char type, T... args)
+    {
+        static_assert(sizeof...(T) <= 2, "too many arguments for a deferred line");
+        if (m_pendingIps.empty()) {
+            out.writeHexLine(type, args...);
+            return;
+        }
+        PendingIp::DeferredLine line;
+        line.type = type;
+        line.numArgs = sizeof...(T);
+        int i = 0;
+        ((line.args[i++] = args), ...);
+        deferLine(std::move(line));
+    }
+
+    /// like writeHexLine but for data that gets passed through verbatim
+    void writeRaw(std::string_view data)
+    {
+        if (m_pendingIps.empty()) {
+            out.writeRaw(data);
+            return;
+        }
+        PendingIp::DeferredLine line;
+        line.raw.assign(data.data(), data.size());
+        deferLine(std::move(line));
+    }
+
+    /**
+     * Write the output of the instruction pointers that got resolved in the meantime
+     *
+     * When @p waitForAll is true or too much output got deferred, this waits for the
+     * resolver threads.
+     */
+    void writeResolvedIps(bool waitForAll = false)
+    {
+        while (!m_pendingIps.empty()) {
+            auto& pending = *m_pendingIps.front();
+            if (!pending.resolved.load(std::memory_order_acquire)) {
+                if (!waitForAll && m_numDeferredLines < MAX_DEFERRED_LINES) {
+                    return;
+                }
+                std::unique_lock<std::mutex> lock(m_resolvedMutex);
+                m_resolvedCondition.wait(lock,
+                                         [&pending]() { return pending.resolved.load(std::memory_order_acquire); });
+            }
+
+            writeIp(pending);
+            for (const auto& line : pending.deferred) {
+                if (!line.type) {
+                    out.writeRaw(line.raw);
+                } else if (line.numArgs == 1) {
+                    out.writeHexLine(line.type, line.args[0]);
+                } else {
+                    out.writeHexLine(line.type, line.args[0], line.args[1]);
+                }
+            }
+            m_numDeferredLines -= pending.deferred.size();
+            m_pendingIps.pop_front();
+        }
+    }
+
     LineWriter out;
 
 private:
-    Module* reportModule(const ModuleFragment& module)
+    /// @return the thread that resolves all addresses within @p fragment
+    ResolverThread* resolverThread(const ModuleFragment* fragment) const
     {
-        if (startsWith(module.fileName, "linux-vdso.so")) {
-            return nullptr;
+        return m_resolverThreads[std::hash<string>()(fragment->fileName) % m_resolverThreads.size()].get();
+    }
+
+    void enqueue(std::unique_ptr<PendingIp> pending, const ModuleFragment* fragment, uint64_t generation)
+    {
+        resolverThread(fragment)->enqueue(pending.get(), fragment, generation);
+        m_pendingIps.push_back(std::move(pending));
+    }
+
+    uint32_t lazyModuleRef(const ModuleFragment* fragment)
+    {
+        auto it = m_lazyModuleRefs.find(fragment);
+        if (it != m_lazyModuleRefs.end()) {
+            return it->second;
         }
+        const auto ref = static_cast<uint32_t>(m_lazyModules.size());
+        m_lazyModules.push_back({*fragment, m_modulesGeneration});
+        m_lazyModuleRefs.insert({fragment, ref});
+        return ref;
+    }
 
-        auto& ret = m_modules[module.fileName];
-        if (ret.module)
-            return &ret;
+    void writeIp(const PendingIp& pending)
+    {
+        if (pending.ipId && pending.info.frame.file.empty()) {
+            // we know nothing beyond the symbol name that got written with the 'i' line already
+            return;
+        }
+        writeIp(pending.ip, pending.moduleIndex, pending.info, pending.ipId);
+    }
 
-        auto dwflModule = dwfl_addrmodule(m_dwfl, module.addressStart);
-        if (!dwflModule) {
-            dwfl_report_begin_add(m_dwfl);
-            dwflModule = dwfl_report_elf(m_dwfl, module.fileName.c_str(), module.fileName.c_str(), -1,
-                                         module.addressStart, false);
-            dwfl_report_end(m_dwfl, nullptr, nullptr);
+    void writeIp(uintptr_t instructionPointer, size_t moduleIndex, const AddressInformation& info, size_t ipId = 0)
+    {
+        // NOTE: strings are only interned here to keep their indices in the order of the output
+        auto resolveFrame = [this](const Frame& frame) {
+            return ResolvedFrame {intern(frame.function), intern(frame.file), frame.line};
+        };
 
-            if (!dwflModule) {
-                error_out << "Failed to report module for " << module.fileName << ": " << dwfl_errmsg(dwfl_errno())
-                          << endl;
-                return nullptr;
+        ResolvedIP ip;
+        ip.moduleIndex = moduleIndex;
+        ip.frame = resolveFrame(info.frame);
+        std::transform(info.inlined.begin(), info.inlined.end(), std::back_inserter(ip.inlined), resolveFrame);
+
+        if (ipId) {
+            out.write("f %zx", ipId);
+        } else {
+            out.write("i %zx %zx", instructionPointer, ip.moduleIndex);
+        }
+        if (ip.frame.functionIndex || ip.frame.fileIndex) {
+            out.write(" %zx", ip.frame.functionIndex);
+            if (ip.frame.fileIndex) {
+                out.write(" %zx %x", ip.frame.fileIndex, ip.frame.line);
+                for (const auto& inlined : ip.inlined) {
+                    out.write(" %zx %zx %x", inlined.functionIndex, inlined.fileIndex, inlined.line);
+                }
             }
         }
+        out.write("\n");
+    }
 
-        ret = Module(module.fileName, module.addressStart, dwflModule, &m_symbolCache);
-        return &ret;
+    void deferLine(PendingIp::DeferredLine line)
+    {
+        m_pendingIps.back()->deferred.push_back(std::move(line));
+        ++m_numDeferredLines;
     }
 
     void initializePaths()
@@ -520,20 +1552,58 @@ private:
         std::strcpy(m_debugPath, path.c_str());
     }
 
+    /// by their id in m_fragmentIndex
     vector<ModuleFragment> m_moduleFragments;
-    Dwfl* m_dwfl = nullptr;
+    ModuleFragmentIndex m_fragmentIndex;
     char* m_debugPath = nullptr;
-    Dwfl_Callbacks m_callbacks;
-    SymbolCache m_symbolCache;
     bool m_modulesDirty = false;
+    // whether all modules got cleared, which starts a new generation
+    bool m_modulesCleared = false;
+    uint64_t m_modulesGeneration = 0;
+    // the start addresses of the modules that got unloaded since the generation started
+    vector<uintptr_t> m_removedModules;
+
+    /// resolves the instruction pointers on the main thread when we don't use any resolver threads
+    std::unique_ptr<Resolver> m_resolver;
+    vector<std::unique_ptr<ResolverThread>> m_resolverThreads;
+    std::deque<std::unique_ptr<PendingIp>> m_pendingIps;
+    size_t m_numDeferredLines = 0;
+    std::mutex m_resolvedMutex;
+    std::condition_variable m_resolvedCondition;
+
+    /// see --symbolize lazy
+    struct LazyIp
+    {
+        enum : uint32_t
+        {
+            NO_MODULE = std::numeric_limits<uint32_t>::max()
+        };
+        uintptr_t ip;
+        uint32_t moduleRef;
+    };
+    struct LazyModule
+    {
+        ModuleFragment fragment;
+        uint64_t generation;
+    };
+#if ZSTD_FOUND
+    std::unique_ptr<ZstdFrameWriter> m_frameWriter;
+#endif
+    std::unique_ptr<TraceCosts> m_traceCosts;
+    size_t m_lazySymbolizationTopN = 0;
+    vector<LazyIp> m_lazyIps;
+    vector<LazyModule> m_lazyModules;
+    tsl::robin_map<const ModuleFragment*, uint32_t> m_lazyModuleRefs;
 
     std::string m_sysroot;
     std::vector<std::string> m_debugPaths;
     std::vector<std::string> m_extraPaths;
 
     tsl::robin_map<string, size_t> m_internedData;
-    tsl::robin_map<uintptr_t, size_t> m_encounteredIps;
-    tsl::robin_map<string, Module> m_modules;
+    /// the ids of the strings by their hash, used instead of m_internedData on a memory budget
+    tsl::robin_map<uint64_t, uint32_t> m_internedHashes;
+    bool m_internHashesOnly = false;
+    tsl::robin_map<uintptr_t, uint32_t> m_encounteredIps;
     tsl::robin_map<string, string> m_resolvedFiles;
 };
 
@@ -568,6 +1638,35 @@ int main(int argc, char** argv)
             "Paths to folders containing extra debug symbols\nSee e.g. https://sourceware.org/gdb/current/onlinedocs/gdb.html/Separate-Debug-Files.html")
         ("extra-paths", po::value<std::vector<std::string>>()->multitoken(),
             "Paths to folders containing additional executables or libraries with debug symbols, e.g. for side loading")
+        ("threads", po::value<unsigned>()->default_value(std::clamp(std::thread::hardware_concurrency(), 1u, 4u)),
+            "Number of threads that resolve debug information in the background, while the events keep getting "
+            "forwarded. Zero resolves everything on the main thread.")
+        ("cache", "Enable the symbol cache, which stores the symbols and debug information of every module "
+            "by its build-id to speed up subsequent runs. It is stored in $XDG_CACHE_HOME/heaptrack, "
+            "or ~/.cache/heaptrack, unless --cache-dir is given.")
+        ("cache-dir", po::value<std::string>(),
+            "Enable the symbol cache and store it in this directory instead.")
+        ("cache-size", po::value<uint64_t>()->default_value(256),
+            "Maximum size of the symbol cache in MiB, the least recently used modules get evicted first.")
+        ("no-cache", "Disable the symbol cache, even when --cache or --cache-dir is given.")
+        ("symbolize", po::value<std::string>()->default_value("full"),
+            "Either 'full' to resolve the file, line and inline frames of every instruction pointer, or 'lazy' to "
+            "only look up symbol names while streaming and resolve the debug information of the instruction pointers "
+            "in the most costly backtraces at the end.")
+        ("memory-budget", po::value<uint64_t>()->default_value(0),
+            "Bound the memory used for debug information, demangled names and live allocations to about this many "
+            "MiB, evicting debug information and spilling live allocations to a temporary file. Strings are only "
+            "remembered by their hash once they got written. The peak memory usage gets printed at exit. Zero "
+            "disables the budget.")
+        ("lazy-symbolize-top", po::value<size_t>()->default_value(1000),
+            "Number of backtraces per cost type whose debug information gets resolved with --symbolize lazy, "
+            "picked once by their self cost and once by their inclusive cost.")
+#if ZSTD_FOUND
+        ("zstd", "Compress the output with zstd, split into independent frames that get decompressed and parsed "
+            "in parallel by heaptrack_print.")
+        ("zstd-frame-size", po::value<uint64_t>()->default_value(4),
+            "Uncompressed size of the zstd frames in MiB, see --zstd.")
+#endif
         ("help,h", "Show this help message.")
         ("version,v", "Displays version information.");
     // clang-format on
@@ -611,6 +1710,23 @@ int main(int argc, char** argv)
     if (vm.count("extra-paths")) {
         extraPaths = vm["extra-paths"].as<std::vector<std::string>>();
     }
+    const auto numThreads = vm["threads"].as<unsigned>();
+    const auto symbolize = vm["symbolize"].as<std::string>();
+    if (symbolize != "full" && symbolize != "lazy") {
+        std::cerr << "ERROR: unhandled symbolization mode: " << symbolize << std::endl;
+        std::cerr << desc << std::endl;
+        return 1;
+    }
+    const auto lazySymbolizationTopN = vm["lazy-symbolize-top"].as<size_t>();
+    // the symbol cache is opt-in, it would otherwise silently fill up the home directory of every user
+    std::string cacheDirectory;
+    if (vm.count("cache-dir") && !vm.count("no-cache")) {
+        cacheDirectory = vm["cache-dir"].as<std::string>();
+    } else if (vm.count("cache") && !vm.count("no-cache")) {
+        cacheDirectory = PersistentCache::defaultDirectory();
+    }
+    const auto cacheSize = vm["cache-size"].as<uint64_t>() * 1024 * 1024;
+    const auto memoryBudget = vm["memory-budget"].as<uint64_t>() * 1024 * 1024;
 
     [] {
         // NOTE: we disable debuginfod by default as it can otherwise lead to
@@ -632,7 +1748,7 @@ int main(int argc, char** argv)
         }
     }();
 
-    // optimize: we only have a single thread
+    // optimize: only the main thread reads the input and writes the output
     ios_base::sync_with_stdio(false);
 #ifdef __linux__
     __fsetlocking(stdout, FSETLOCKING_BYCALLER);
@@ -642,26 +1758,59 @@ int main(int argc, char** argv)
     // output data at end, even when we get terminated
     std::atexit(exitHandler);
 
-    AccumulatedTraceData data(sysroot, debugPaths, extraPaths);
+    // split the budget evenly between the debug information and the live allocations,
+    // the demangled names are shared by all modules and cannot be evicted, so limit them to a part of the former
+    const auto demangledNamesBudget = memoryBudget / 8;
+    if (memoryBudget) {
+        setDemangleCacheLimit(demangledNamesBudget);
+    }
+    AccumulatedTraceData data(sysroot, debugPaths, extraPaths, cacheDirectory, cacheSize, numThreads,
+                              symbolize == "lazy", lazySymbolizationTopN, memoryBudget / 2 - demangledNamesBudget);
+#if ZSTD_FOUND
+    if (vm.count("zstd")) {
+        data.compressOutput(std::max<uint64_t>(1, vm["zstd-frame-size"].as<uint64_t>()) * 1024 * 1024);
+    }
+#endif
 
     LineReader reader;
 
     string exe;
 
     PointerMap ptrToIndex;
+    std::unique_ptr<SpillFile> spillFile;
+    if (memoryBudget) {
+        spillFile = std::make_unique<SpillFile>();
+        if (!spillFile->isValid()) {
+            error_out << "failed to create a file to spill the live allocations to: " << strerror(errno) << endl;
+        }
+        ptrToIndex.setMemoryBudget(memoryBudget / 2, spillFile.get());
+    }
     uint64_t lastPtr = 0;
-    AllocationInfoSet allocationInfos;
+    // don't reserve lots of memory up front when we are on a budget
+    AllocationInfoSet allocationInfos(memoryBudget ? 0 : static_cast<size_t>(AllocationInfoSet::DEFAULT_RESERVED_SIZE));
+
+    unsigned int fileVersion = 0;
+    FileDescriptorReader input(STDIN_FILENO);
+    while (reader.getLine(input)) {
+        data.writeResolvedIps();
+        data.endFullFrame();
 
-    while (reader.getLine(cin)) {
         if (reader.mode() == 'v') {
             unsigned int heaptrackVersion = 0;
             reader >> heaptrackVersion;
-            unsigned int fileVersion = 0;
             reader >> fileVersion;
+            if (fileVersion > HEAPTRACK_FILE_FORMAT_VERSION) {
+                // e.g. the module lines of newer versions mean something else to us
+                error_out << "the data has file format version " << fileVersion << " but this build of heaptrack "
+                          << "can only interpret version " << HEAPTRACK_FILE_FORMAT_VERSION << " and below" << endl;
+                return 1;
+            }
             if (fileVersion >= 3) {
                 reader.setExpectedSizedStrings(true);
             }
-            data.out.write("%s\n", reader.line().c_str());
+            data.out.write("%.*s\n", static_cast<int>(reader.line().size()), reader.line().data());
+            // the output has the same file version as the input, so we can use binary records too
+            data.out.setBinaryRecords(fileVersion >= BinaryRecord::FIRST_FILE_FORMAT_VERSION);
         } else if (reader.mode() == 'x') {
             if (!exe.empty()) {
                 error_out << "received duplicate exe event - child process tracking is not yet supported" << endl;
@@ -669,16 +1818,25 @@ int main(int argc, char** argv)
             }
             reader >> exe;
         } else if (reader.mode() == 'm') {
+            // module changes are rare, so simply wait for all addresses in the old modules to get resolved
+            data.writeResolvedIps(true);
             string fileName;
             reader >> fileName;
             if (fileName == "-") {
-                data.clearModules();
+                uintptr_t addressStart = 0;
+                if (fileVersion < INCREMENTAL_MODULES_FILE_FORMAT_VERSION) {
+                    data.clearModules();
+                } else if (reader >> addressStart) {
+                    data.removeModule(addressStart);
+                } else {
+                    error_out << "failed to parse line: " << reader.line() << endl;
+                    return 1;
+                }
             } else {
                 if (fileName == "x") {
                     fileName = exe;
                 }
-                const char* internedString = nullptr;
-                const auto moduleIndex = data.intern(fileName, &internedString);
+                const auto moduleIndex = data.intern(fileName);
                 uintptr_t addressStart = 0;
                 if (!(reader >> addressStart)) {
                     error_out << "failed to parse line: " << reader.line() << endl;
@@ -701,8 +1859,9 @@ int main(int argc, char** argv)
             }
             // ensure ip is encountered
             const auto ipId = data.addIp(instructionPointer);
+            data.addTrace(ipId, parentIndex);
             // trace point, map current output index to parent index
-            data.out.writeHexLine('t', ipId, parentIndex);
+            data.writeHexLine('t', ipId, parentIndex);
         } else if (reader.mode() == '+') {
             ++c_stats.allocations;
             ++c_stats.leakedAllocations;
@@ -716,11 +1875,13 @@ int main(int argc, char** argv)
 
             AllocationInfoIndex index;
             if (allocationInfos.add(size, traceId, &index)) {
-                data.out.writeHexLine('a', size, traceId.index);
+                data.addAllocationInfo(size, traceId);
+                data.writeHexLine('a', size, traceId.index);
             }
+            data.addAllocation(index);
             ptrToIndex.addPointer(ptr, index);
             lastPtr = ptr;
-            data.out.writeHexLine('+', index.index);
+            data.writeHexLine('+', index.index);
         } else if (reader.mode() == '-') {
             uint64_t ptr = 0;
             if (!(reader >> ptr)) {
@@ -733,15 +1894,33 @@ int main(int argc, char** argv)
             if (!allocation.second) {
                 continue;
             }
-            data.out.writeHexLine('-', allocation.first.index);
+            data.addDeallocation(allocation.first, temporary);
+            data.writeHexLine('-', allocation.first.index);
             if (temporary) {
                 ++c_stats.temporaryAllocations;
             }
             --c_stats.leakedAllocations;
         } else {
-            data.out.write("%s\n", reader.line().c_str());
+            if (reader.mode() == 'P') {
+                // the sampling period weighs the costs for --symbolize lazy, otherwise we just pass it through
+                uint64_t samplingPeriod = 0;
+                if (reader >> samplingPeriod) {
+                    data.setSamplingPeriod(samplingPeriod);
+                }
+            }
+            if (reader.isBinary()) {
+                data.writeRaw(reader.line());
+            } else {
+                data.writeRaw(string(reader.line()) + '\n');
+            }
         }
     }
 
+    data.resolveCostlyIps();
+
+    if (memoryBudget) {
+        data.printMemoryUsage(ptrToIndex, spillFile.get(), allocationInfos);
+    }
+
     return 0;
 }
@@ -0,0 +1,162 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#ifndef MODULEFRAGMENTINDEX_H
+#define MODULEFRAGMENTINDEX_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+/**
+ * An interval index over the address ranges of the loaded module fragments
+ *
+ * The ranges are stored in flat, sorted arrays, everything else about the fragments is
+ * referenced by an id and has to be looked up separately. Consecutive lookups usually hit
+ * the same fragment, which is checked first before falling back to a binary search.
+ *
+ * New ranges are appended and only merged into the sorted arrays on the next lookup,
+ * which keeps incremental updates linear in the number of ranges.
+ */
+class ModuleFragmentIndex
+{
+public:
+    enum : uint32_t
+    {
+        NOT_FOUND = UINT32_MAX
+    };
+
+    size_t size() const
+    {
+        return m_starts.size();
+    }
+
+    bool empty() const
+    {
+        return m_starts.empty();
+    }
+
+    /// add the range from @p start to @p end, including both, for the fragment identified by @p id
+    void add(uintptr_t start, uintptr_t end, uint32_t id)
+    {
+        m_starts.push_back(start);
+        m_ends.push_back(end);
+        m_ids.push_back(id);
+    }
+
+    void clear()
+    {
+        m_starts.clear();
+        m_ends.clear();
+        m_ids.clear();
+        m_numSorted = 0;
+        m_lastHit = 0;
+    }
+
+    /**
+     * Change the ids of all ranges to @p newIds[id], dropping the ones that are mapped to NOT_FOUND
+     *
+     * This allows the fragments to be stored compactly by their id elsewhere.
+     */
+    void remap(const std::vector<uint32_t>& newIds)
+    {
+        sort();
+        size_t numKept = 0;
+        for (size_t i = 0; i < size(); ++i) {
+            assert(m_ids[i] < newIds.size());
+            const auto newId = newIds[m_ids[i]];
+            if (newId == NOT_FOUND) {
+                continue;
+            }
+            m_starts[numKept] = m_starts[i];
+            m_ends[numKept] = m_ends[i];
+            m_ids[numKept] = newId;
+            ++numKept;
+        }
+        m_starts.resize(numKept);
+        m_ends.resize(numKept);
+        m_ids.resize(numKept);
+        m_numSorted = numKept;
+        m_lastHit = 0;
+    }
+
+    /// @return the id of the range that contains @p address, or NOT_FOUND
+    uint32_t find(uintptr_t address)
+    {
+        if (m_numSorted != size()) {
+            sort();
+        }
+
+        if (m_lastHit < size() && m_starts[m_lastHit] <= address && m_ends[m_lastHit] >= address) {
+            return m_ids[m_lastHit];
+        }
+
+        // the ranges don't overlap, so the ends are sorted too
+        const auto it = std::lower_bound(m_ends.begin(), m_ends.end(), address);
+        const auto index = static_cast<size_t>(std::distance(m_ends.begin(), it));
+        if (it != m_ends.end() && m_starts[index] <= address) {
+            m_lastHit = index;
+            return m_ids[index];
+        }
+        return NOT_FOUND;
+    }
+
+    /// visit all ranges in sorted order, @p callback gets called with the start, end and id of each range
+    template <typename Callback>
+    void forEach(Callback callback)
+    {
+        sort();
+        for (size_t i = 0; i < size(); ++i) {
+            callback(m_starts[i], m_ends[i], m_ids[i]);
+        }
+    }
+
+private:
+    struct Range
+    {
+        uintptr_t start;
+        uintptr_t end;
+        uint32_t id;
+
+        bool operator<(const Range& other) const
+        {
+            return start < other.start || (start == other.start && end < other.end);
+        }
+    };
+
+    /// sort the ranges added since the last call and merge them into the already sorted ones
+    void sort()
+    {
+        if (m_numSorted == size()) {
+            return;
+        }
+
+        std::vector<Range> ranges(size());
+        for (size_t i = 0; i < size(); ++i) {
+            ranges[i] = {m_starts[i], m_ends[i], m_ids[i]};
+        }
+        const auto middle = ranges.begin() + m_numSorted;
+        std::sort(middle, ranges.end());
+        std::inplace_merge(ranges.begin(), middle, ranges.end());
+
+        for (size_t i = 0; i < size(); ++i) {
+            m_starts[i] = ranges[i].start;
+            m_ends[i] = ranges[i].end;
+            m_ids[i] = ranges[i].id;
+        }
+        m_numSorted = size();
+        m_lastHit = 0;
+    }
+
+    std::vector<uintptr_t> m_starts;
+    std::vector<uintptr_t> m_ends;
+    std::vector<uint32_t> m_ids;
+    size_t m_numSorted = 0;
+    size_t m_lastHit = 0;
+};
+
+#endif // MODULEFRAGMENTINDEX_H
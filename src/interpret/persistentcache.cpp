@@ -0,0 +1,625 @@
+/*
+    persistentcache.cpp
+
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+   SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include "persistentcache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+// bump this whenever the file layout or the way we resolve addresses changes
+const uint32_t CACHE_VERSION = 2;
+const char CACHE_MAGIC[4] = {'H', 'T', 'S', 'C'};
+const char CACHE_SUFFIX[] = ".htsym";
+// temporary files that are older than this were left behind by crashed writers
+const auto STALE_TEMPORARY_FILE_AGE = std::chrono::hours(1);
+
+struct FileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t numSymbols;
+    uint64_t numCus;
+    uint64_t numRanges;
+    uint64_t numAddresses;
+    uint64_t numFrames;
+    uint64_t stringsSize;
+    uint32_t hasSymbols;
+    uint32_t hasCuDieRanges;
+    uint32_t hasDwarf;
+    uint32_t padding;
+};
+
+struct SymbolRecord
+{
+    uint64_t offset;
+    uint64_t value;
+    uint64_t size;
+    uint64_t name;
+};
+
+struct CuRecord
+{
+    uint64_t offset;
+    uint64_t firstRange;
+    uint64_t numRanges;
+};
+
+struct RangeRecord
+{
+    uint64_t low;
+    uint64_t high;
+};
+
+struct AddressRecord
+{
+    uint64_t address;
+    uint64_t firstFrame;
+    uint64_t numFrames;
+};
+
+struct FrameRecord
+{
+    uint64_t function;
+    uint64_t file;
+    int64_t line;
+};
+
+class StringTable
+{
+public:
+    uint64_t intern(const std::string& string)
+    {
+        auto it = m_offsets.find(string);
+        if (it != m_offsets.end()) {
+            return it->second;
+        }
+        const auto offset = m_data.size();
+        m_data.append(string);
+        m_data.push_back('\0');
+        m_offsets.insert({string, offset});
+        return offset;
+    }
+
+    const std::string& data() const
+    {
+        return m_data;
+    }
+
+private:
+    tsl::robin_map<std::string, uint64_t> m_offsets;
+    std::string m_data;
+};
+
+template <typename T>
+bool writeRecords(FILE* file, const std::vector<T>& records)
+{
+    return records.empty() || fwrite(records.data(), sizeof(T), records.size(), file) == records.size();
+}
+
+uint64_t memoryUsage(const PersistentCache::Frames& frames)
+{
+    uint64_t ret = frames.capacity() * sizeof(PersistentCache::Frame);
+    for (const auto& frame : frames) {
+        ret += frame.function.capacity() + frame.file.capacity();
+    }
+    return ret;
+}
+
+/// serializes the writers of a cache directory, be it in other threads or in other processes
+class DirectoryLock
+{
+public:
+    explicit DirectoryLock(int fd)
+        : m_fd(fd)
+    {
+        if (m_fd != -1) {
+            flock(m_fd, LOCK_EX);
+        }
+    }
+
+    ~DirectoryLock()
+    {
+        if (m_fd != -1) {
+            flock(m_fd, LOCK_UN);
+        }
+    }
+
+    DirectoryLock(const DirectoryLock&) = delete;
+    DirectoryLock& operator=(const DirectoryLock&) = delete;
+
+private:
+    int m_fd;
+};
+
+/// read-only view on a mapped cache file, which validates all accesses
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path)
+    {
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            auto* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                m_data = static_cast<const char*>(data);
+                m_size = info.st_size;
+            }
+        }
+        close(fd);
+    }
+
+    ~MappedFile()
+    {
+        if (m_data) {
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /// @return @p count records of type T at @p offset, or nullptr when the file is too small
+    template <typename T>
+    const T* records(uint64_t offset, uint64_t count) const
+    {
+        if (offset > m_size || count > (m_size - offset) / sizeof(T)) {
+            return nullptr;
+        }
+        return reinterpret_cast<const T*>(m_data + offset);
+    }
+
+    uint64_t size() const
+    {
+        return m_size;
+    }
+
+private:
+    const char* m_data = nullptr;
+    uint64_t m_size = 0;
+};
+}
+
+void PersistentCache::Entry::setCuDieRanges(std::vector<CuDieRanges> newCuDieRanges, bool newHasDwarf)
+{
+    cuDieRanges = std::move(newCuDieRanges);
+    hasCuDieRanges = true;
+    hasDwarf = newHasDwarf;
+    dirty = true;
+}
+
+const PersistentCache::Frames* PersistentCache::Entry::findFrames(uint64_t relAddr) const
+{
+    auto it = frames.find(relAddr);
+    return it == frames.end() ? nullptr : &it->second;
+}
+
+void PersistentCache::Entry::addFrames(uint64_t relAddr, Frames newFrames)
+{
+    auto& addressFrames = frames[relAddr];
+    framesMemoryUsage -= ::memoryUsage(addressFrames);
+    addressFrames = std::move(newFrames);
+    framesMemoryUsage += ::memoryUsage(addressFrames);
+    dirty = true;
+}
+
+void PersistentCache::Entry::reset()
+{
+    auto entryKey = std::move(key);
+    *this = {};
+    key = std::move(entryKey);
+    isLoaded = true;
+    dirty = true;
+}
+
+uint64_t PersistentCache::Entry::memoryUsage() const
+{
+    uint64_t ret = cuDieRanges.capacity() * sizeof(CuDieRanges);
+    for (const auto& cu : cuDieRanges) {
+        ret += cu.ranges.capacity() * sizeof(DwarfRange);
+    }
+    ret += frames.bucket_count() * sizeof(std::pair<uint64_t, Frames>) + framesMemoryUsage;
+    return ret;
+}
+
+PersistentCache::PersistentCache(std::string directory, uint64_t maxSize)
+    : m_directory(std::move(directory))
+    , m_maxSize(maxSize)
+{
+    if (m_directory.empty()) {
+        return;
+    }
+
+    std::error_code error;
+    fs::create_directories(m_directory, error);
+    if (error) {
+        std::cerr << "WARNING: failed to create symbol cache directory " << m_directory << ": " << error.message()
+                  << std::endl;
+        m_directory.clear();
+        return;
+    }
+    m_directoryFd = open(m_directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+PersistentCache::~PersistentCache()
+{
+    bool changed = false;
+    for (const auto& entry : m_entries) {
+        if (entry.second->dirty) {
+            changed |= save(*entry.second, nullptr);
+        }
+    }
+    if (changed) {
+        evict();
+    }
+    if (m_directoryFd != -1) {
+        close(m_directoryFd);
+    }
+}
+
+PersistentCache::Entry* PersistentCache::entry(const std::string& key)
+{
+    if (m_directory.empty() || key.empty()) {
+        return nullptr;
+    }
+
+    auto& entry = m_entries[key];
+    if (!entry) {
+        entry = std::make_unique<Entry>();
+        entry->key = key;
+    }
+    load(entry.get());
+    return entry.get();
+}
+
+void PersistentCache::load(Entry* entry)
+{
+    if (entry->isLoaded) {
+        return;
+    }
+    if (read(entry->key, entry, nullptr)) {
+        entry->isLoaded = true;
+    } else {
+        entry->reset();
+        entry->dirty = false;
+    }
+}
+
+void PersistentCache::release(Entry* entry)
+{
+    if (!entry->isLoaded) {
+        return;
+    }
+    if (entry->dirty) {
+        save(*entry, nullptr);
+    }
+    auto key = std::move(entry->key);
+    *entry = {};
+    entry->key = std::move(key);
+}
+
+bool PersistentCache::loadSymbols(const Entry& entry, SymbolCache::Symbols* symbols) const
+{
+    return entry.hasSymbols && read(entry.key, nullptr, symbols);
+}
+
+void PersistentCache::setSymbols(Entry* entry, const SymbolCache::Symbols& symbols)
+{
+    entry->hasSymbols = true;
+    if (save(*entry, &symbols)) {
+        entry->dirty = false;
+    } else {
+        // we do not keep a copy of the symbols, so we cannot write them later on
+        entry->hasSymbols = false;
+    }
+}
+
+std::string PersistentCache::defaultDirectory()
+{
+    if (const auto* cacheHome = getenv("XDG_CACHE_HOME")) {
+        if (*cacheHome) {
+            return std::string(cacheHome) + "/heaptrack";
+        }
+    }
+    if (const auto* home = getenv("HOME")) {
+        if (*home) {
+            return std::string(home) + "/.cache/heaptrack";
+        }
+    }
+    return {};
+}
+
+std::string PersistentCache::path(const std::string& key) const
+{
+    return m_directory + '/' + key + CACHE_SUFFIX;
+}
+
+bool PersistentCache::read(const std::string& key, Entry* entry, SymbolCache::Symbols* symbols) const
+{
+    const auto filePath = path(key);
+    MappedFile file(filePath);
+
+    const auto* header = file.records<FileHeader>(0, 1);
+    if (!header || memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0
+        || header->version != CACHE_VERSION) {
+        return false;
+    }
+
+    uint64_t offset = sizeof(FileHeader);
+    auto next = [&](auto* type, uint64_t count) {
+        using T = std::remove_pointer_t<decltype(type)>;
+        const auto* records = file.records<T>(offset, count);
+        offset += count * sizeof(T);
+        return records;
+    };
+    const auto* symbolRecords = next(static_cast<SymbolRecord*>(nullptr), header->numSymbols);
+    const auto* cus = symbolRecords ? next(static_cast<CuRecord*>(nullptr), header->numCus) : nullptr;
+    const auto* ranges = cus ? next(static_cast<RangeRecord*>(nullptr), header->numRanges) : nullptr;
+    const auto* addresses = ranges ? next(static_cast<AddressRecord*>(nullptr), header->numAddresses) : nullptr;
+    const auto* frames = addresses ? next(static_cast<FrameRecord*>(nullptr), header->numFrames) : nullptr;
+    const auto* strings = frames ? next(static_cast<char*>(nullptr), header->stringsSize) : nullptr;
+    if (!strings || offset != file.size() || (header->stringsSize && strings[header->stringsSize - 1] != '\0')) {
+        return false;
+    }
+
+    bool valid = true;
+    auto string = [&](uint64_t stringOffset) -> std::string {
+        if (stringOffset >= header->stringsSize) {
+            valid = false;
+            return {};
+        }
+        return strings + stringOffset;
+    };
+
+    if (symbols && !header->hasSymbols && !entry) {
+        return false;
+    } else if (symbols && header->hasSymbols) {
+        *symbols = {};
+        symbols->reserve(header->numSymbols);
+        for (uint64_t i = 0; i < header->numSymbols; ++i) {
+            const auto& symbol = symbolRecords[i];
+            if (symbol.name >= header->stringsSize) {
+                return false;
+            }
+            symbols->add(symbol.offset, symbol.value, symbol.size, strings + symbol.name);
+        }
+        symbols->finalize();
+    }
+
+    if (!entry) {
+        return true;
+    }
+
+    entry->hasSymbols = header->hasSymbols;
+    entry->hasDwarf = header->hasDwarf;
+    entry->hasCuDieRanges = header->hasCuDieRanges;
+    entry->cuDieRanges.reserve(header->numCus);
+    for (uint64_t i = 0; i < header->numCus; ++i) {
+        const auto& cu = cus[i];
+        if (cu.firstRange > header->numRanges || cu.numRanges > header->numRanges - cu.firstRange) {
+            return false;
+        }
+        CuDieRanges cuDieRanges;
+        cuDieRanges.offset = cu.offset;
+        cuDieRanges.ranges.reserve(cu.numRanges);
+        for (uint64_t j = 0; j < cu.numRanges; ++j) {
+            const auto& range = ranges[cu.firstRange + j];
+            cuDieRanges.ranges.push_back({range.low, range.high});
+        }
+        entry->cuDieRanges.push_back(std::move(cuDieRanges));
+    }
+
+    entry->frames.reserve(header->numAddresses);
+    for (uint64_t i = 0; i < header->numAddresses; ++i) {
+        const auto& address = addresses[i];
+        if (address.firstFrame > header->numFrames || address.numFrames > header->numFrames - address.firstFrame) {
+            return false;
+        }
+        Frames addressFrames;
+        addressFrames.reserve(address.numFrames);
+        for (uint64_t j = 0; j < address.numFrames; ++j) {
+            const auto& frame = frames[address.firstFrame + j];
+            addressFrames.push_back({string(frame.function), string(frame.file), static_cast<int>(frame.line)});
+        }
+        entry->framesMemoryUsage += ::memoryUsage(addressFrames);
+        entry->frames.insert({address.address, std::move(addressFrames)});
+    }
+
+    if (!valid) {
+        return false;
+    }
+
+    // the modification time tells us which files were used least recently, see evict()
+    utimensat(AT_FDCWD, filePath.c_str(), nullptr, 0);
+    return true;
+}
+
+bool PersistentCache::save(const Entry& entry, const SymbolCache::Symbols* entrySymbols) const
+{
+    // other resolver threads and processes write the same file when they see the same module,
+    // so merge with what they wrote instead of overwriting it
+    DirectoryLock lock(m_directoryFd);
+
+    Entry merged;
+    SymbolCache::Symbols existingSymbols;
+    if (!read(entry.key, &merged, &existingSymbols)) {
+        merged = {};
+        existingSymbols = {};
+    }
+    merged.key = entry.key;
+
+    // the symbols are not kept in memory, take them from the file when we do not have them at hand
+    if (entrySymbols) {
+        merged.hasSymbols = true;
+    } else if (merged.hasSymbols) {
+        entrySymbols = &existingSymbols;
+    }
+
+    // results recorded with and without DWARF data must not be mixed, the ones with DWARF data win
+    const bool isConflicting =
+        entry.hasCuDieRanges && merged.hasCuDieRanges && entry.hasDwarf != merged.hasDwarf;
+    if (!isConflicting || entry.hasDwarf) {
+        if (isConflicting) {
+            merged.frames.clear();
+        }
+        if (entry.hasCuDieRanges) {
+            merged.cuDieRanges = entry.cuDieRanges;
+            merged.hasCuDieRanges = true;
+            merged.hasDwarf = entry.hasDwarf;
+        }
+        for (const auto& address : entry.frames) {
+            merged.frames[address.first] = address.second;
+        }
+    }
+
+    return write(merged, entrySymbols);
+}
+
+bool PersistentCache::write(const Entry& entry, const SymbolCache::Symbols* entrySymbols) const
+{
+    StringTable strings;
+
+    const bool hasSymbols = entry.hasSymbols && entrySymbols;
+    std::vector<SymbolRecord> symbols;
+    if (hasSymbols) {
+        symbols.reserve(entrySymbols->size());
+        for (size_t i = 0; i < entrySymbols->size(); ++i) {
+            symbols.push_back({entrySymbols->offset(i), entrySymbols->value(i), entrySymbols->symbolSize(i),
+                               strings.intern(entrySymbols->name(i))});
+        }
+    }
+
+    std::vector<CuRecord> cus;
+    std::vector<RangeRecord> ranges;
+    cus.reserve(entry.cuDieRanges.size());
+    for (const auto& cu : entry.cuDieRanges) {
+        cus.push_back({cu.offset, ranges.size(), cu.ranges.size()});
+        for (const auto& range : cu.ranges) {
+            ranges.push_back({range.low, range.high});
+        }
+    }
+
+    // sort the addresses to make the output reproducible
+    std::vector<uint64_t> sortedAddresses;
+    sortedAddresses.reserve(entry.frames.size());
+    for (const auto& address : entry.frames) {
+        sortedAddresses.push_back(address.first);
+    }
+    std::sort(sortedAddresses.begin(), sortedAddresses.end());
+
+    std::vector<AddressRecord> addresses;
+    std::vector<FrameRecord> frames;
+    addresses.reserve(sortedAddresses.size());
+    for (const auto address : sortedAddresses) {
+        const auto& addressFrames = entry.frames.at(address);
+        addresses.push_back({address, frames.size(), addressFrames.size()});
+        for (const auto& frame : addressFrames) {
+            frames.push_back({strings.intern(frame.function), strings.intern(frame.file), frame.line});
+        }
+    }
+
+    FileHeader header;
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.numSymbols = symbols.size();
+    header.numCus = cus.size();
+    header.numRanges = ranges.size();
+    header.numAddresses = addresses.size();
+    header.numFrames = frames.size();
+    header.stringsSize = strings.data().size();
+    header.hasSymbols = hasSymbols;
+    header.hasCuDieRanges = entry.hasCuDieRanges;
+    header.hasDwarf = entry.hasDwarf;
+    header.padding = 0;
+
+    // write to a temporary file first, other processes may read or write the same file concurrently
+    const auto filePath = path(entry.key);
+    auto tmpPath = filePath + ".XXXXXX";
+    const int fd = mkstemp(&tmpPath[0]);
+    if (fd == -1) {
+        std::cerr << "WARNING: failed to write symbol cache file " << filePath << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    auto* file = fdopen(fd, "w");
+    bool written = file && fwrite(&header, sizeof(header), 1, file) == 1 && writeRecords(file, symbols)
+        && writeRecords(file, cus) && writeRecords(file, ranges) && writeRecords(file, addresses)
+        && writeRecords(file, frames)
+        && fwrite(strings.data().data(), 1, strings.data().size(), file) == strings.data().size();
+    written = (file ? fclose(file) == 0 : close(fd) == 0) && written;
+    if (!written || rename(tmpPath.c_str(), filePath.c_str()) != 0) {
+        std::cerr << "WARNING: failed to write symbol cache file " << filePath << ": " << strerror(errno) << std::endl;
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+void PersistentCache::evict() const
+{
+    struct CacheFile
+    {
+        fs::path path;
+        fs::file_time_type lastUse;
+        uint64_t size;
+    };
+    std::vector<CacheFile> files;
+    uint64_t totalSize = 0;
+
+    std::error_code error;
+    const auto staleTime = fs::file_time_type::clock::now() - STALE_TEMPORARY_FILE_AGE;
+    for (const auto& file : fs::directory_iterator(m_directory, error)) {
+        if (file.path().extension() != CACHE_SUFFIX) {
+            // the temporary files of save() are named <key>.htsym.XXXXXX
+            const auto name = file.path().filename().string();
+            if (name.find(std::string(CACHE_SUFFIX) + '.') != std::string::npos
+                && file.last_write_time(error) < staleTime && !error) {
+                fs::remove(file.path(), error);
+            }
+            error.clear();
+            continue;
+        }
+        const auto size = file.file_size(error);
+        const auto lastUse = file.last_write_time(error);
+        if (error) {
+            // most likely removed concurrently
+            continue;
+        }
+        files.push_back({file.path(), lastUse, size});
+        totalSize += size;
+    }
+    if (totalSize <= m_maxSize) {
+        return;
+    }
+
+    std::sort(files.begin(), files.end(),
+              [](const CacheFile& lhs, const CacheFile& rhs) { return lhs.lastUse < rhs.lastUse; });
+    for (const auto& file : files) {
+        if (totalSize <= m_maxSize) {
+            break;
+        }
+        fs::remove(file.path, error);
+        totalSize -= file.size;
+    }
+}
@@ -0,0 +1,117 @@
+/*
+    persistentcache.h
+
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+   SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#ifndef PERSISTENTCACHE_H
+#define PERSISTENTCACHE_H
+
+#include "dwarfdiecache.h"
+#include "symbolcache.h"
+
+#include <tsl/robin_map.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * An on-disk cache of the symbols, CU DIE ranges and resolved addresses of modules, keyed by their build-id.
+ *
+ * Every module gets its own file in the cache directory. It starts with a versioned header, followed by
+ * fixed-size records for the sorted symbol table, the CU DIE ranges and the resolved addresses, which
+ * reference a trailing string table. Files with an unexpected version are ignored and replaced.
+ *
+ * Symbols get written as soon as they are known and are read from the file on demand, the SymbolCache
+ * holds the only copy in memory. Other changes are written back when an entry gets released or when the
+ * cache gets destroyed. Afterwards, the files that were used least recently get removed until the cache
+ * directory fits into the configured size again.
+ *
+ * Every resolver thread has its own cache, and other processes may use the same directory. Writers lock the
+ * directory and merge their entry with the file that is there already, such that nothing gets lost.
+ */
+class PersistentCache
+{
+public:
+    struct Frame
+    {
+        std::string function;
+        std::string file;
+        int line = 0;
+    };
+    /// the frame of an address, followed by its inlined frames
+    using Frames = std::vector<Frame>;
+
+    struct Entry
+    {
+        std::string key;
+        /// false after PersistentCache::release, until PersistentCache::load reads the entry again
+        bool isLoaded = false;
+        /// whether the file contains the symbols, see PersistentCache::loadSymbols
+        bool hasSymbols = false;
+        bool hasCuDieRanges = false;
+        /// whether DWARF data was available when the CU DIE ranges and frames were recorded
+        bool hasDwarf = false;
+        std::vector<CuDieRanges> cuDieRanges;
+        /// resolved frames by address, relative to the start of the module
+        tsl::robin_map<uint64_t, Frames> frames;
+        /// the approximate number of bytes used by the frames
+        uint64_t framesMemoryUsage = 0;
+        bool dirty = false;
+
+        void setCuDieRanges(std::vector<CuDieRanges> cuDieRanges, bool hasDwarf);
+        const Frames* findFrames(uint64_t relAddr) const;
+        void addFrames(uint64_t relAddr, Frames frames);
+        /// forget everything about the module, e.g. when it got recorded without DWARF data that is available now
+        void reset();
+        /// @return the approximate number of bytes used by the CU DIE ranges and the frames
+        uint64_t memoryUsage() const;
+    };
+
+    /// an empty @p directory disables the cache, @p maxSize is in bytes
+    PersistentCache(std::string directory, uint64_t maxSize);
+    ~PersistentCache();
+
+    PersistentCache(const PersistentCache&) = delete;
+    PersistentCache& operator=(const PersistentCache&) = delete;
+
+    /// @return the entry for @p key, loaded from disk if possible, or nullptr when the cache is disabled
+    Entry* entry(const std::string& key);
+
+    /// load @p entry from disk again after it got released, does nothing when it is loaded already
+    void load(Entry* entry);
+
+    /// write @p entry when it changed and free its memory, see load
+    void release(Entry* entry);
+
+    /// read the symbols of @p entry from disk into @p symbols, @return false when they are not available
+    bool loadSymbols(const Entry& entry, SymbolCache::Symbols* symbols) const;
+
+    /// write @p symbols along with the rest of @p entry right away, such that they do not have to be kept in memory
+    void setSymbols(Entry* entry, const SymbolCache::Symbols& symbols);
+
+    /// @return $XDG_CACHE_HOME/heaptrack or ~/.cache/heaptrack
+    static std::string defaultDirectory();
+
+private:
+    std::string path(const std::string& key) const;
+    /// read the file of @p key into @p entry and @p symbols, either of which may be null to skip it
+    bool read(const std::string& key, Entry* entry, SymbolCache::Symbols* symbols) const;
+    /// merge @p entry and @p symbols into the existing file, or keep its symbols when @p symbols is null
+    bool save(const Entry& entry, const SymbolCache::Symbols* symbols) const;
+    /// replace the file of @p entry, which gets written with @p symbols when it has any
+    bool write(const Entry& entry, const SymbolCache::Symbols* symbols) const;
+    void evict() const;
+
+    std::string m_directory;
+    /// locked while writing, see save
+    int m_directoryFd = -1;
+    uint64_t m_maxSize = 0;
+    tsl::robin_map<std::string, std::unique_ptr<Entry>> m_entries;
+};
+
+#endif // PERSISTENTCACHE_H
@@ -9,23 +9,145 @@
 
 #include "symbolcache.h"
 
-#include "dwarfdiecache.h"
+#include "demangler.h"
 
 #include <algorithm>
+#include <cstring>
+#include <numeric>
 
-static bool operator<(const SymbolCache::SymbolCacheEntry& lhs, const SymbolCache::SymbolCacheEntry& rhs)
+namespace {
+template <typename T>
+std::vector<T> permuted(const std::vector<T>& data, const std::vector<size_t>& permutation)
 {
-    return lhs.offset < rhs.offset;
+    std::vector<T> ret;
+    ret.reserve(permutation.size());
+    for (auto index : permutation) {
+        ret.push_back(data[index]);
+    }
+    return ret;
+}
+}
+
+void SymbolCache::Symbols::reserve(size_t numSymbols)
+{
+    m_offsets.reserve(numSymbols);
+    m_values.reserve(numSymbols);
+    m_sizes.reserve(numSymbols);
+    m_nameOffsets.reserve(numSymbols);
+}
+
+void SymbolCache::Symbols::add(uint64_t offset, uint64_t value, uint64_t size, const char* name)
+{
+    m_offsets.push_back(offset);
+    m_values.push_back(value);
+    m_sizes.push_back(size);
+    m_nameOffsets.push_back(m_names.size());
+    m_names.append(name, strlen(name) + 1);
+}
+
+void SymbolCache::Symbols::finalize()
+{
+    /*
+     * use stable_sort to produce results that are comparable to what addr2line would
+     * return when we have entries like this in the symtab:
+     *
+     * 000000000045a130 l     F .text  0000000000000033 .hidden __memmove_avx_unaligned
+     * 000000000045a180 l     F .text  00000000000003d8 .hidden __memmove_avx_unaligned_erms
+     * 000000000045a180 l     F .text  00000000000003d8 .hidden __memcpy_avx_unaligned_erms
+     * 000000000045a130 l     F .text  0000000000000033 .hidden __memcpy_avx_unaligned
+     *
+     * here, addr2line would always find the first entry. we want to do the same
+     */
+    std::vector<size_t> permutation(size());
+    std::iota(permutation.begin(), permutation.end(), 0);
+    std::stable_sort(permutation.begin(), permutation.end(),
+                     [this](size_t lhs, size_t rhs) { return m_offsets[lhs] < m_offsets[rhs]; });
+    permutation.erase(std::unique(permutation.begin(), permutation.end(),
+                                  [this](size_t lhs, size_t rhs) {
+                                      return m_offsets[lhs] == m_offsets[rhs] && m_sizes[lhs] == m_sizes[rhs];
+                                  }),
+                      permutation.end());
+
+    if (permutation.size() != size() || !std::is_sorted(permutation.begin(), permutation.end())) {
+        m_offsets = permuted(m_offsets, permutation);
+        m_values = permuted(m_values, permutation);
+        m_sizes = permuted(m_sizes, permutation);
+        m_nameOffsets = permuted(m_nameOffsets, permutation);
+    }
+
+    m_searchTree.resize(size() + 1);
+    m_searchTreeIndices.resize(size() + 1);
+    size_t sortedIndex = 0;
+    buildSearchTree(&sortedIndex, 1);
+
+    m_demangledNames.clear();
+    m_uninternedNames.clear();
+}
+
+void SymbolCache::Symbols::buildSearchTree(size_t* sortedIndex, size_t node)
+{
+    // an in-order traversal of the implicit tree visits the nodes in sorted order
+    if (node > size()) {
+        return;
+    }
+    buildSearchTree(sortedIndex, 2 * node);
+    m_searchTree[node] = m_offsets[*sortedIndex];
+    m_searchTreeIndices[node] = *sortedIndex;
+    ++(*sortedIndex);
+    buildSearchTree(sortedIndex, 2 * node + 1);
+}
+
+size_t SymbolCache::Symbols::lowerBound(uint64_t relAddr) const
+{
+    const auto numSymbols = size();
+    const auto* tree = m_searchTree.data();
+    size_t node = 1;
+    while (node <= numSymbols) {
+        // the grand-grand-children of this node share one or two cache lines
+        __builtin_prefetch(reinterpret_cast<const char*>(tree) + 16 * node * sizeof(uint64_t));
+        node = 2 * node + (tree[node] < relAddr);
+    }
+    // go back up to the last node where we went left
+    node >>= __builtin_ffsll(~node);
+    return node ? m_searchTreeIndices[node] : numSymbols;
+}
+
+size_t SymbolCache::Symbols::find(uint64_t relAddr) const
+{
+    auto index = lowerBound(relAddr);
+
+    if (index != size() && m_offsets[index] == relAddr)
+        return index;
+    if (index == 0)
+        return NOT_FOUND;
+
+    --index;
+
+    if (m_offsets[index] <= relAddr && (m_offsets[index] + m_sizes[index] > relAddr || (m_sizes[index] == 0))) {
+        return index;
+    }
+    return NOT_FOUND;
 }
 
-static bool operator==(const SymbolCache::SymbolCacheEntry& lhs, const SymbolCache::SymbolCacheEntry& rhs)
+std::string_view SymbolCache::Symbols::demangledName(size_t index)
 {
-    return lhs.offset == rhs.offset && lhs.size == rhs.size;
+    const auto key = static_cast<uint32_t>(index);
+    auto it = m_demangledNames.find(key);
+    if (it == m_demangledNames.end()) {
+        it = m_demangledNames.insert({key, demangleInterned(name(index), &m_uninternedNames)}).first;
+    }
+    return it->second;
 }
 
-static bool operator<(const SymbolCache::SymbolCacheEntry& lhs, uint64_t addr)
+size_t SymbolCache::Symbols::memoryUsage() const
 {
-    return lhs.offset < addr;
+    return (m_offsets.capacity() + m_values.capacity() + m_sizes.capacity() + m_nameOffsets.capacity()
+            + m_searchTree.capacity())
+        * sizeof(uint64_t)
+        + m_searchTreeIndices.capacity() * sizeof(uint32_t) + m_names.capacity()
+        + m_demangledNames.bucket_count() * (sizeof(std::pair<uint32_t, std::string_view>) + sizeof(size_t))
+        + std::accumulate(m_uninternedNames.begin(), m_uninternedNames.end(), size_t(0),
+                          [](size_t size, const std::string& name) { return size + sizeof(name) + name.capacity(); });
 }
 
 bool SymbolCache::hasSymbols(const std::string& filePath) const
@@ -36,46 +158,28 @@ bool SymbolCache::hasSymbols(const std::string& filePath) const
 SymbolCache::SymbolCacheEntry SymbolCache::findSymbol(const std::string& filePath, uint64_t relAddr)
 {
     auto& symbols = m_symbolCache[filePath];
-    auto it = std::lower_bound(symbols.begin(), symbols.end(), relAddr);
+    const auto index = symbols.find(relAddr);
+    if (index == Symbols::NOT_FOUND)
+        return {};
 
     // demangle symbols on demand instead of demangling all symbols directly
     // hopefully most of the symbols we won't ever encounter after all
-    auto lazyDemangle = [](SymbolCache::SymbolCacheEntry& entry) {
-        if (!entry.demangled) {
-            entry.symname = demangle(entry.symname);
-            entry.demangled = true;
-        }
-        return entry;
-    };
-
-    if (it != symbols.end() && it->offset == relAddr)
-        return lazyDemangle(*it);
-    if (it == symbols.begin())
-        return {};
-
-    --it;
-
-    if (it->offset <= relAddr && (it->offset + it->size > relAddr || (it->size == 0))) {
-        return lazyDemangle(*it);
-    }
-    return {};
+    return {symbols.offset(index), symbols.value(index), symbols.symbolSize(index),
+            std::string(symbols.demangledName(index))};
 }
 
 void SymbolCache::setSymbols(const std::string& filePath, Symbols symbols)
 {
-    /*
-     * use stable_sort to produce results that are comparable to what addr2line would
-     * return when we have entries like this in the symtab:
-     *
-     * 000000000045a130 l     F .text  0000000000000033 .hidden __memmove_avx_unaligned
-     * 000000000045a180 l     F .text  00000000000003d8 .hidden __memmove_avx_unaligned_erms
-     * 000000000045a180 l     F .text  00000000000003d8 .hidden __memcpy_avx_unaligned_erms
-     * 000000000045a130 l     F .text  0000000000000033 .hidden __memcpy_avx_unaligned
-     *
-     * here, addr2line would always find the first entry. we want to do the same
-     */
-
-    std::stable_sort(symbols.begin(), symbols.end());
-    symbols.erase(std::unique(symbols.begin(), symbols.end()), symbols.end());
+    symbols.finalize();
     m_symbolCache[filePath] = std::move(symbols);
 }
+
+const SymbolCache::Symbols& SymbolCache::symbols(const std::string& filePath) const
+{
+    return m_symbolCache.at(filePath);
+}
+
+void SymbolCache::removeSymbols(const std::string& filePath)
+{
+    m_symbolCache.erase(filePath);
+}
@@ -12,7 +12,10 @@
 
 #include <tsl/robin_map.h>
 
+#include <cstdint>
+#include <deque>
 #include <string>
+#include <string_view>
 #include <vector>
 
 class SymbolCache
@@ -39,14 +42,96 @@ public:
         uint64_t value;
         uint64_t size;
         std::string symname;
-        bool demangled = false;
     };
-    using Symbols = std::vector<SymbolCacheEntry>;
+
+    /**
+     * The symbols of a module in a struct-of-arrays layout
+     *
+     * Large modules have hundreds of thousands of symbols, so we don't allocate anything per symbol.
+     * Instead, all names are stored in a single blob and referenced by their offset. Lookups search
+     * through a copy of the sorted offsets in Eytzinger layout, which is much more cache friendly
+     * than a binary search over the sorted array.
+     */
+    class Symbols
+    {
+    public:
+        enum : size_t
+        {
+            NOT_FOUND = SIZE_MAX
+        };
+
+        void reserve(size_t numSymbols);
+        /// see SymbolCacheEntry for the meaning of the arguments
+        void add(uint64_t offset, uint64_t value, uint64_t size, const char* name);
+
+        /// sort the symbols by their offset, remove duplicates and build the lookup index
+        void finalize();
+
+        size_t size() const
+        {
+            return m_offsets.size();
+        }
+        bool empty() const
+        {
+            return m_offsets.empty();
+        }
+
+        uint64_t offset(size_t index) const
+        {
+            return m_offsets[index];
+        }
+        uint64_t value(size_t index) const
+        {
+            return m_values[index];
+        }
+        uint64_t symbolSize(size_t index) const
+        {
+            return m_sizes[index];
+        }
+        /// @return the mangled name
+        const char* name(size_t index) const
+        {
+            return m_names.data() + m_nameOffsets[index];
+        }
+        /// @return the demangled name, which is cached after the first call
+        std::string_view demangledName(size_t index);
+
+        /// @return the index of the symbol that encompasses @p relAddr, or NOT_FOUND
+        size_t find(uint64_t relAddr) const;
+
+        /// @return the approximate number of bytes used on the heap
+        size_t memoryUsage() const;
+
+    private:
+        /// @return the index of the first symbol with an offset of at least @p relAddr, or size()
+        size_t lowerBound(uint64_t relAddr) const;
+        void buildSearchTree(size_t* sortedIndex, size_t node);
+
+        std::vector<uint64_t> m_offsets;
+        std::vector<uint64_t> m_values;
+        std::vector<uint64_t> m_sizes;
+        std::vector<uint64_t> m_nameOffsets;
+        std::string m_names;
+
+        // the sorted offsets in Eytzinger layout, starting at index 1, and the indices they belong to
+        std::vector<uint64_t> m_searchTree;
+        std::vector<uint32_t> m_searchTreeIndices;
+
+        // we only encounter a small fraction of the symbols, so they get demangled on demand
+        // the demangled names are interned globally, as many modules share them, see demangleInterned
+        tsl::robin_map<uint32_t, std::string_view> m_demangledNames;
+        // the names that did not fit into the global cache anymore
+        std::deque<std::string> m_uninternedNames;
+    };
 
     /// check if @c setSymbolCache was called for @p filePath already
     bool hasSymbols(const std::string& filePath) const;
     /// take @p cache, sort it and use it for symbol lookups in @p filePath
     void setSymbols(const std::string& filePath, Symbols symbols);
+    /// @return the sorted symbols of @p filePath, as passed to @c setSymbols before
+    const Symbols& symbols(const std::string& filePath) const;
+    /// drop the symbols of @p filePath, to free their memory
+    void removeSymbols(const std::string& filePath);
     /// find the symbol that encompasses @p relAddr in @p filePath
     /// if the found symbol wasn't yet demangled, it will be demangled now
     SymbolCacheEntry findSymbol(const std::string& filePath, uint64_t relAddr);
@@ -0,0 +1,117 @@
+/*
+    zstdframewriter.cpp
+
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+   SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#include "zstdframewriter.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <unistd.h>
+
+#include <zstd.h>
+
+namespace {
+bool writeAll(int fd, const char* data, size_t size)
+{
+    while (size) {
+        const auto ret = ::write(fd, data, size);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += ret;
+        size -= static_cast<size_t>(ret);
+    }
+    return true;
+}
+}
+
+ZstdFrameWriter::ZstdFrameWriter(int fd, uint64_t frameSize)
+    : m_fd(fd)
+    , m_frameSize(frameSize)
+    , m_context(ZSTD_createCCtx())
+    , m_output(ZSTD_CStreamOutSize())
+{
+    ZSTD_CCtx_setParameter(m_context, ZSTD_c_compressionLevel, ZSTD_CLEVEL_DEFAULT);
+    // compress in the background like a separate zstd process would, this fails when zstd was built without threads
+    ZSTD_CCtx_setParameter(m_context, ZSTD_c_nbWorkers, 1);
+}
+
+ZstdFrameWriter::~ZstdFrameWriter()
+{
+    ZSTD_freeCCtx(m_context);
+}
+
+bool ZstdFrameWriter::write(const char* data, size_t size)
+{
+    m_frame.decompressedSize += size;
+    return compress(data, size, false);
+}
+
+bool ZstdFrameWriter::endFrame()
+{
+    if (!m_frame.decompressedSize) {
+        return !m_hasError;
+    }
+    if (!compress(nullptr, 0, true)) {
+        return false;
+    }
+    m_frames.push_back(m_frame);
+    m_frame = {};
+    return true;
+}
+
+bool ZstdFrameWriter::finish()
+{
+    if (m_frame.decompressedSize) {
+        if (!compress(nullptr, 0, true)) {
+            return false;
+        }
+        m_frames.push_back(m_frame);
+        m_frame = {};
+    }
+    const auto index = ZstdFrameIndex::serialize(m_frames);
+    if (!writeAll(m_fd, index.data(), index.size())) {
+        std::cerr << "failed to write zstd frame index: " << strerror(errno) << std::endl;
+        m_hasError = true;
+        return false;
+    }
+    return true;
+}
+
+bool ZstdFrameWriter::compress(const char* data, size_t size, bool endFrame)
+{
+    if (m_hasError) {
+        return false;
+    }
+
+    ZSTD_inBuffer input = {data, size, 0};
+    const auto mode = endFrame ? ZSTD_e_end : ZSTD_e_continue;
+    while (true) {
+        ZSTD_outBuffer output = {m_output.data(), m_output.size(), 0};
+        const auto remaining = ZSTD_compressStream2(m_context, &output, &input, mode);
+        if (ZSTD_isError(remaining)) {
+            std::cerr << "failed to compress output: " << ZSTD_getErrorName(remaining) << std::endl;
+            m_hasError = true;
+            return false;
+        }
+        if (!writeAll(m_fd, m_output.data(), output.pos)) {
+            std::cerr << "failed to write compressed output: " << strerror(errno) << std::endl;
+            m_hasError = true;
+            return false;
+        }
+        m_frame.compressedSize += output.pos;
+        // without endFrame, zstd may keep data buffered until the next call
+        if (endFrame ? remaining == 0 : input.pos == input.size) {
+            return true;
+        }
+    }
+}
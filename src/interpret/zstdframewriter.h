@@ -0,0 +1,66 @@
+/*
+    zstdframewriter.h
+
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+   SPDX-License-Identifier: GPL-2.0-or-later
+*/
+
+#ifndef ZSTDFRAMEWRITER_H
+#define ZSTDFRAMEWRITER_H
+
+#include "util/linewriter.h"
+#include "util/zstdframeindex.h"
+
+#include <cstdint>
+#include <vector>
+
+struct ZSTD_CCtx_s;
+
+/**
+ * Compresses the output of a LineWriter into independent zstd frames, followed by their index.
+ *
+ * The frames only end when endFrame is called, which must happen at a record boundary.
+ * Readers can then decompress and tokenize the frames in parallel, see zstdframeindex.h.
+ */
+class ZstdFrameWriter final : public LineWriter::Sink
+{
+public:
+    /// write to @p fd, frames should end after about @p frameSize bytes of uncompressed data
+    ZstdFrameWriter(int fd, uint64_t frameSize);
+    ~ZstdFrameWriter();
+
+    ZstdFrameWriter(const ZstdFrameWriter&) = delete;
+    ZstdFrameWriter& operator=(const ZstdFrameWriter&) = delete;
+
+    bool write(const char* data, size_t size) override;
+
+    /// @return true once the current frame reached the requested frame size
+    bool isFrameFull() const
+    {
+        return m_frame.decompressedSize >= m_frameSize;
+    }
+
+    /**
+     * End the current frame.
+     *
+     * All data written so far must have been passed to write, i.e. the LineWriter must be flushed.
+     */
+    bool endFrame();
+
+    /// end the last frame and append the index
+    bool finish();
+
+private:
+    bool compress(const char* data, size_t size, bool endFrame);
+
+    int m_fd;
+    uint64_t m_frameSize;
+    ZSTD_CCtx_s* m_context;
+    bool m_hasError = false;
+    std::vector<char> m_output;
+    ZstdFrameIndex::Frame m_frame;
+    std::vector<ZstdFrameIndex::Frame> m_frames;
+};
+
+#endif // ZSTDFRAMEWRITER_H
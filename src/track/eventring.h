@@ -0,0 +1,256 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#ifndef EVENTRING_H
+#define EVENTRING_H
+
+/**
+ * @file eventring.h
+ * @brief Per-thread event buffers for the lock-free recording mode.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "tracecache.h"
+#include "tracetree.h"
+
+/**
+ * A single allocation event, recorded by an application thread and later
+ * serialized by the writer thread.
+ */
+struct ThreadEvent
+{
+    // global sequence number, used to restore the order of events across threads
+    uint64_t sequence;
+    // '+': allocation size, 't': instruction pointer
+    uint64_t value;
+    // '+' and '-': the (de)allocated pointer
+    uint64_t pointer;
+    // '+': thread-local trace index, 't': thread-local parent trace index
+    uint32_t index;
+    char type;
+};
+
+/**
+ * Single-producer/single-consumer ring buffer of ThreadEvents.
+ *
+ * The producer is the thread that currently owns the ring, the consumer is
+ * the writer thread. Rings are never freed, a ring of an exited thread gets
+ * reused by the next thread that needs one.
+ */
+class EventRing
+{
+public:
+    enum : uint64_t
+    {
+        CAPACITY = 4096,
+        NO_PENDING = std::numeric_limits<uint64_t>::max()
+    };
+
+    bool tryAcquire()
+    {
+        bool expected = false;
+        return inUse.compare_exchange_strong(expected, true);
+    }
+
+    void release()
+    {
+        inUse.store(false);
+    }
+
+    /**
+     * Append @p event to the ring, waiting for the writer when the ring is full.
+     *
+     * @return false when @p stopCheck returns true while waiting for free space
+     */
+    template <typename StopCheck>
+    bool push(ThreadEvent event, std::atomic<uint64_t>& sequence, StopCheck stopCheck)
+    {
+        event.sequence = sequence.fetch_add(1);
+
+        const auto position = head.load(std::memory_order_relaxed);
+        if (position - tail.load(std::memory_order_acquire) == CAPACITY) {
+            // all previous events of this thread are published now, allow the writer to drain them
+            pending.store(event.sequence);
+            while (position - tail.load(std::memory_order_acquire) == CAPACITY) {
+                if (stopCheck()) {
+                    return false;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(1));
+            }
+        }
+
+        events[position % CAPACITY] = event;
+        head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// drop all buffered events and thread-local trace data, only call while no producer is active
+    void reset()
+    {
+        traceTree.clear();
+        traceCache.clear();
+        localToGlobal.clear();
+        tail.store(head.load());
+    }
+
+    /// lowest sequence number this thread may still publish, or NO_PENDING
+    std::atomic<uint64_t> pending {NO_PENDING};
+    std::atomic<uint64_t> head {0};
+    std::atomic<uint64_t> tail {0};
+    std::atomic<bool> inUse {false};
+
+    /// thread-local shard of the trace tree, only accessed by the producer
+    TraceTree traceTree;
+    /// shortcut into traceTree, only accessed by the producer
+    TraceCache traceCache;
+    /// maps thread-local trace indices to the indices in the output stream, only accessed by the consumer
+    std::vector<uint32_t> localToGlobal;
+
+    EventRing* next = nullptr;
+    ThreadEvent events[CAPACITY];
+};
+
+/**
+ * Registry of all event rings together with the global event sequence.
+ */
+class EventRings
+{
+public:
+    /// find an unused ring or allocate a new one
+    EventRing* acquire()
+    {
+        for (auto* ring = rings.load(); ring; ring = ring->next) {
+            if (ring->tryAcquire()) {
+                return ring;
+            }
+        }
+
+        auto* ring = new EventRing;
+        ring->inUse.store(true);
+        ring->next = rings.load();
+        while (!rings.compare_exchange_weak(ring->next, ring)) {
+        }
+        return ring;
+    }
+
+    /**
+     * Start recording a group of events on @p ring.
+     *
+     * Every event pushed until the matching end() call is guaranteed to get
+     * a sequence number that the writer has not yet passed.
+     */
+    void begin(EventRing* ring)
+    {
+        ring->pending.store(sequence.load());
+    }
+
+    void end(EventRing* ring)
+    {
+        ring->pending.store(EventRing::NO_PENDING);
+    }
+
+    /// @return true when no producer is inside a begin()/end() block
+    bool isQuiescent() const
+    {
+        for (auto* ring = rings.load(); ring; ring = ring->next) {
+            if (ring->pending.load() != EventRing::NO_PENDING) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// @return true when none of the rings holds any events that still need to be drained
+    bool isEmpty() const
+    {
+        for (auto* ring = rings.load(); ring; ring = ring->next) {
+            if (ring->head.load(std::memory_order_relaxed) != ring->tail.load(std::memory_order_relaxed)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <typename Callback>
+    void forEachRing(Callback callback)
+    {
+        for (auto* ring = rings.load(); ring; ring = ring->next) {
+            callback(*ring);
+        }
+    }
+
+    struct Cursor
+    {
+        EventRing* ring;
+        uint64_t position;
+        uint64_t end;
+
+        const ThreadEvent& event() const
+        {
+            return ring->events[position % EventRing::CAPACITY];
+        }
+    };
+
+    /**
+     * Hand all published events to @p callback, ordered by their global sequence number.
+     *
+     * Only events that are known to precede any event that might still get published
+     * are handed out, the rest is kept for the next call.
+     *
+     * @p cursors is scratch space that can be reused between calls
+     */
+    template <typename Callback>
+    void drain(std::vector<Cursor>& cursors, Callback callback)
+    {
+        // the order of these loads is important, see begin()
+        auto bound = sequence.load();
+        for (auto* ring = rings.load(); ring; ring = ring->next) {
+            bound = std::min(bound, ring->pending.load());
+        }
+
+        cursors.clear();
+        for (auto* ring = rings.load(); ring; ring = ring->next) {
+            const auto tail = ring->tail.load(std::memory_order_relaxed);
+            const auto head = ring->head.load(std::memory_order_acquire);
+            Cursor cursor = {ring, tail, head};
+            if (tail != head && cursor.event().sequence < bound) {
+                cursors.push_back(cursor);
+            }
+        }
+
+        // k-way merge of the per-thread event streams, smallest sequence number on top
+        const auto compare = [](const Cursor& lhs, const Cursor& rhs) {
+            return lhs.event().sequence > rhs.event().sequence;
+        };
+        std::make_heap(cursors.begin(), cursors.end(), compare);
+        while (!cursors.empty()) {
+            std::pop_heap(cursors.begin(), cursors.end(), compare);
+            auto& cursor = cursors.back();
+            callback(*cursor.ring, cursor.event());
+            ++cursor.position;
+            if (cursor.position != cursor.end && cursor.event().sequence < bound) {
+                std::push_heap(cursors.begin(), cursors.end(), compare);
+            } else {
+                cursor.ring->tail.store(cursor.position, std::memory_order_release);
+                cursors.pop_back();
+            }
+        }
+    }
+
+    std::atomic<uint64_t> sequence {0};
+
+private:
+    std::atomic<EventRing*> rings {nullptr};
+};
+
+#endif // EVENTRING_H
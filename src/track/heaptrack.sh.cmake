@@ -42,6 +42,36 @@ usage() {
     echo " --asan          Enables running heaptrack on binaries built with gcc's address sanitizer enabled."
     echo "                 Implies --use-inject."
     echo " --record-only   Only record and interpret the data, do not attempt to analyze it."
+    echo " --thread-buffers Record allocations into per-thread buffers instead of serializing all threads"
+    echo "                 on a global lock. This can greatly reduce the overhead for heavily multi-threaded"
+    echo "                 applications. Only supported when starting a new process."
+    echo " --unwinder=dwarf|dwarf-incremental|fp|shadow-stack"
+    echo "                 Select how backtraces get unwound. 'dwarf' uses the DWARF call frame information and works"
+    echo "                 for any binary. 'dwarf-incremental' stops unwinding once it reaches a frame of the previous"
+    echo "                 backtrace of the same thread, which is only supported on x86 without libunwind."
+    echo "                 'fp' follows the frame pointers, which is much faster but only gives"
+    echo "                 complete backtraces when everything was compiled with -fno-omit-frame-pointer."
+    echo "                 'shadow-stack' copies a shadow stack maintained by the -finstrument-functions hooks,"
+    echo "                 which requires the debuggee to be compiled with -finstrument-functions and linked with"
+    echo "                 -Wl,--unresolved-symbols=ignore-in-object-files. Uninstrumented frames are missing."
+    echo "                 The hooks are only available when starting a new process."
+    echo " --sampling-period BYTES"
+    echo "                 Only record a random sample of allocations, one per BYTES allocated bytes on average."
+    echo "                 Costs are scaled back up during analysis. This greatly reduces the overhead"
+    echo "                 at the price of only getting statistical estimates."
+    echo " --timer-interval USEC"
+    echo "                 Record timestamps and the RSS every USEC microseconds, defaults to 10000. The interval"
+    echo "                 shrinks while the debuggee allocates a lot and grows while it is idle, within a factor"
+    echo "                 of 16 of the configured one. Timestamps have a resolution of one millisecond."
+    echo " --fixed-timer-interval"
+    echo "                 Never adapt the interval of the timestamps to the allocation rate."
+    echo " --lazy-symbolization"
+    echo "                 Only look up symbol names while recording and resolve file names, line numbers"
+    echo "                 and inline frames for the most costly backtraces once the debuggee finished."
+    echo "                 This reduces the load on the system while recording."
+    echo " --symbol-cache  Store the symbols and debug information of every module by its build-id in"
+    echo "                 \$XDG_CACHE_HOME/heaptrack, which speeds up interpreting later runs that use the"
+    echo "                 same binaries. The least recently used modules get evicted beyond 256 MiB."
     echo "  ARGUMENT       Any number of arguments that will be passed verbatim"
     echo "                 to the debuggee."
     echo "  -h, --help     Show this help message and exit."
@@ -73,6 +103,8 @@ client=
 use_inject_lib=
 write_raw_data=
 record_only=
+lazy_symbolization=
+symbol_cache=
 asan=
 asan_ld_preload=
 quiet=
@@ -105,6 +137,20 @@ if [ "@ZSTD_FOUND@" = "TRUE" ] && [ ! -z "$(command -v zstd 2> /dev/null)" ]; th
     UNCOMPRESSOR="$ZSTD_UNCOMPRESSOR"
 fi
 
+# run the interpreter with the remaining arguments and compress its output into the file $1
+# with zstd, the interpreter compresses the output itself, split into independent frames that
+# heaptrack_print can then decompress and parse in parallel
+interpretAndCompress() {
+    interpreter_output="$1"
+    shift 1
+
+    if [ "$COMPRESSOR" = "$ZSTD_COMPRESSOR" ]; then
+        "$INTERPRETER" --zstd "$@" > "$interpreter_output"
+    else
+        "$INTERPRETER" "$@" | $COMPRESSOR > "$interpreter_output"
+    fi
+}
+
 interpretRawHeaptrackDataFile() {
     input="$1"
     shift 1
@@ -125,13 +171,13 @@ interpretRawHeaptrackDataFile() {
 
     case "$input" in
         *.gz)
-            $GZ_UNCOMPRESSOR < "$input" | "$INTERPRETER" "$@" | $COMPRESSOR > "$output"
+            $GZ_UNCOMPRESSOR < "$input" | interpretAndCompress "$output" "$@"
             ;;
         *.zst)
-            $ZSTD_UNCOMPRESSOR < "$input" | "$INTERPRETER" "$@" | $COMPRESSOR > "$output"
+            $ZSTD_UNCOMPRESSOR < "$input" | interpretAndCompress "$output" "$@"
             ;;
         *)
-            "$INTERPRETER" "$@" | $COMPRESSOR > "$output"
+            interpretAndCompress "$output" "$@"
             ;;
     esac
 
@@ -178,6 +224,50 @@ while true; do
             record_only=1
             shift 1
             ;;
+        "--thread-buffers")
+            export HEAPTRACK_THREAD_BUFFERS=1
+            shift 1
+            ;;
+        "--unwinder")
+            if [ -z "$2" ]; then
+                echo "Missing unwinder argument."
+                exit 1
+            fi
+            export HEAPTRACK_UNWINDER="$2"
+            shift 2
+            ;;
+        "--unwinder="*)
+            export HEAPTRACK_UNWINDER="${1#--unwinder=}"
+            shift 1
+            ;;
+        "--sampling-period")
+            if [ -z "$2" ]; then
+                echo "Missing sampling period argument."
+                exit 1
+            fi
+            export HEAPTRACK_SAMPLING_PERIOD="$2"
+            shift 2
+            ;;
+        "--timer-interval")
+            if [ -z "$2" ]; then
+                echo "Missing timer interval argument."
+                exit 1
+            fi
+            export HEAPTRACK_TIMER_INTERVAL="$2"
+            shift 2
+            ;;
+        "--fixed-timer-interval")
+            export HEAPTRACK_TIMER_ADAPTIVE=0
+            shift 1
+            ;;
+        "--lazy-symbolization")
+            lazy_symbolization=1
+            shift 1
+            ;;
+        "--symbol-cache")
+            symbol_cache=1
+            shift 1
+            ;;
         "-h" | "--help")
             usage
             exit 0
@@ -304,6 +394,16 @@ if [ ! -f "$LIBHEAPTRACK_PRELOAD" ]; then
 fi
 LIBHEAPTRACK_PRELOAD=$(readlink -f "$LIBHEAPTRACK_PRELOAD")
 
+# the -finstrument-functions hooks are only preloaded when they are used, see heaptrack_shadowstack.cpp
+if [ "$HEAPTRACK_UNWINDER" = "shadow-stack" ]; then
+    LIBHEAPTRACK_SHADOWSTACK="$EXE_PATH/$LIB_REL_PATH/libheaptrack_shadowstack.so"
+    if [ ! -f "$LIBHEAPTRACK_SHADOWSTACK" ]; then
+        echo "Could not find heaptrack shadow stack library $LIBHEAPTRACK_SHADOWSTACK"
+        exit 1
+    fi
+    LIBHEAPTRACK_PRELOAD="$(readlink -f "$LIBHEAPTRACK_SHADOWSTACK"):$LIBHEAPTRACK_PRELOAD"
+fi
+
 LIBHEAPTRACK_INJECT="$EXE_PATH/$LIB_REL_PATH/libheaptrack_inject.so"
 if [ ! -f "$LIBHEAPTRACK_INJECT" ]; then
     echo "Could not find heaptrack inject library $LIBHEAPTRACK_INJECT"
@@ -345,13 +445,13 @@ if [ ! -z "$pid" ]; then
 fi
 
 output_suffix="gz"
-COMPRESSOR="gzip -c"
-UNCOMPRESSOR="gzip -dc"
+COMPRESSOR="$GZ_COMPRESSOR"
+UNCOMPRESSOR="$GZ_UNCOMPRESSOR"
 
 if [ "@ZSTD_FOUND@" = "TRUE" ] && [ ! -z "$(command -v zstd 2> /dev/null)" ]; then
     output_suffix="zst"
-    COMPRESSOR="zstd -c"
-    UNCOMPRESSOR="zstd -dc"
+    COMPRESSOR="$ZSTD_COMPRESSOR"
+    UNCOMPRESSOR="$ZSTD_UNCOMPRESSOR"
 fi
 
 output_no_suffix="$output"
@@ -368,7 +468,14 @@ if [ -z "$write_raw_data" ]; then
         echo "Could not find heaptrack interpreter executable: $INTERPRETER"
         exit 1
     fi
-    "$INTERPRETER" < $pipe | $COMPRESSOR > "$output" &
+    interpreter_args=
+    if [ ! -z "$lazy_symbolization" ]; then
+        interpreter_args="--symbolize lazy"
+    fi
+    if [ ! -z "$symbol_cache" ]; then
+        interpreter_args="$interpreter_args --cache"
+    fi
+    interpretAndCompress "$output" $interpreter_args < $pipe &
 else
     $COMPRESSOR < $pipe > "$output" &
 fi
@@ -198,6 +198,7 @@ struct dlclose
 
     static int hook(void* handle) noexcept
     {
+        heaptrack_drain_events();
         auto ret = original(handle);
         if (!ret) {
             heaptrack_invalidate_module_cache(nullptr);
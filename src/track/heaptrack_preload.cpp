@@ -378,6 +378,8 @@ int dlclose(void* handle) LIBC_FUN_ATTRS
         hooks::init();
     }
 
+    heaptrack_drain_events();
+
     int ret = hooks::dlclose(handle);
 
     if (!ret) {
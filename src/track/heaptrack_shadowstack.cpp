@@ -0,0 +1,50 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+/**
+ * @file heaptrack_shadowstack.cpp
+ * @brief The -finstrument-functions hooks for the shadow stack unwinder.
+ *
+ * Applications compiled with -finstrument-functions call __cyg_profile_func_enter
+ * and __cyg_profile_func_exit on every function entry and exit. This small library
+ * provides these hooks and maintains a per-thread stack of the call sites with them.
+ *
+ * It is only preloaded for --unwinder=shadow-stack, such that other processes neither
+ * pay for the hooks nor get the hooks of other tools overridden by ours.
+ *
+ * The instrumented application must not provide the hooks itself but leave them
+ * to be resolved at runtime, e.g. by linking with
+ * -Wl,--unresolved-symbols=ignore-in-object-files.
+ */
+
+#include "shadowstack.h"
+
+namespace {
+thread_local ShadowStack t_shadowStack;
+}
+
+extern "C" {
+__attribute__((no_instrument_function)) void __cyg_profile_func_enter(void* /*function*/, void* callSite)
+{
+    auto& stack = t_shadowStack;
+    stack.callSites[stack.depth % ShadowStack::CAPACITY] = callSite;
+    ++stack.depth;
+}
+
+__attribute__((no_instrument_function)) void __cyg_profile_func_exit(void* /*function*/, void* /*callSite*/)
+{
+    auto& stack = t_shadowStack;
+    // we may get loaded while some instrumented functions are already running
+    if (stack.depth) {
+        --stack.depth;
+    }
+}
+
+__attribute__((no_instrument_function)) ShadowStack* heaptrack_shadow_stack()
+{
+    return &t_shadowStack;
+}
+}
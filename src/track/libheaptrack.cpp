@@ -31,6 +31,7 @@
 #endif
 #include <sys/file.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cinttypes>
 #include <memory>
@@ -38,8 +39,13 @@
 #include <sstream>
 #include <string>
 #include <thread>
+#include <vector>
 
+#include "eventring.h"
+#include "timerinterval.h"
+#include "tracecache.h"
 #include "tracetree.h"
+#include "util/allocationsampler.h"
 #include "util/config.h"
 #include "util/libunwind_config.h"
 #include "util/linewriter.h"
@@ -61,9 +67,7 @@ __attribute__((weak)) extern void __freeres();
  */
 // #define DEBUG_MALLOC_PTRS
 
-#ifdef DEBUG_MALLOC_PTRS
 #include <tsl/robin_set.h>
-#endif
 
 using namespace std;
 
@@ -179,6 +183,164 @@ atomic<bool> s_atexit {false};
  */
 atomic<bool> s_forceCleanup {false};
 
+/**
+ * Per-thread event rings used when recording with HEAPTRACK_THREAD_BUFFERS=1
+ *
+ * In that mode, application threads never take the global lock for allocations.
+ * Instead, each thread indexes its backtraces in its own TraceTree shard and
+ * appends the events to its own ring, which the timer thread drains in the
+ * global event order.
+ */
+EventRings s_eventRings;
+
+/**
+ * Set while the lock-free recording mode is active.
+ */
+atomic<bool> s_threadBuffersActive {false};
+
+/**
+ * The event ring of the current thread.
+ *
+ * NOTE: we use a pthread key instead of a thread_local with a destructor to give the ring
+ *       back once the thread exits, as the latter allocates memory behind our back
+ */
+thread_local EventRing* t_eventRing = nullptr;
+pthread_key_t s_eventRingKey;
+
+/**
+ * Mean number of bytes between two sampled allocations, or zero when all allocations get recorded.
+ *
+ * Configured via HEAPTRACK_SAMPLING_PERIOD.
+ */
+atomic<uint64_t> s_samplingPeriod {0};
+
+thread_local AllocationSampler t_allocationSampler;
+
+/**
+ * The pointers of the sampled allocations that are still alive, frees of other pointers are not recorded
+ *
+ * This gets checked before taking the global lock, such that the frees of the many allocations that were
+ * not sampled stay cheap. The pointers are sharded by their address to keep the contention low.
+ */
+class SampledPointers
+{
+public:
+    void add(void* ptr)
+    {
+        auto& shard = shardOf(ptr);
+        lock_guard<std::mutex> lock(shard.lock);
+        if (shard.pointers.insert(reinterpret_cast<uintptr_t>(ptr)).second) {
+            m_size.fetch_add(1, memory_order_relaxed);
+        }
+    }
+
+    /// @return true when @p ptr was sampled, it is removed then
+    bool take(void* ptr)
+    {
+        if (!m_size.load(memory_order_relaxed)) {
+            return false;
+        }
+        auto& shard = shardOf(ptr);
+        lock_guard<std::mutex> lock(shard.lock);
+        if (!shard.pointers.erase(reinterpret_cast<uintptr_t>(ptr))) {
+            return false;
+        }
+        m_size.fetch_sub(1, memory_order_relaxed);
+        return true;
+    }
+
+    void clear()
+    {
+        for (auto& shard : m_shards) {
+            lock_guard<std::mutex> lock(shard.lock);
+            shard.pointers.clear();
+        }
+        m_size.store(0);
+    }
+
+private:
+    enum : size_t
+    {
+        NUM_SHARDS = 64
+    };
+
+    struct alignas(64) Shard
+    {
+        std::mutex lock;
+        tsl::robin_set<uintptr_t> pointers;
+    };
+
+    Shard& shardOf(const void* ptr)
+    {
+        // the lower bits are mostly zero due to the alignment of allocations
+        const auto address = reinterpret_cast<uintptr_t>(ptr);
+        return m_shards[((address >> 4) ^ (address >> 12)) % NUM_SHARDS];
+    }
+
+    Shard m_shards[NUM_SHARDS];
+    atomic<uint64_t> m_size {0};
+};
+
+/**
+ * Created on the first initialization with a sampling period and leaked intentionally,
+ * such that frees during static destruction never see a destroyed set.
+ */
+SampledPointers* s_sampledPointers = nullptr;
+
+/**
+ * @return true when an allocation of @p size bytes should be recorded
+ */
+bool isSampled(size_t size)
+{
+    const auto period = s_samplingPeriod.load(memory_order_relaxed);
+    return !period || t_allocationSampler.sample(size, period);
+}
+
+/// remember @p ptr of a recorded allocation when sampling, such that its deallocation gets recorded too
+void addSampledPointer(void* ptr)
+{
+    if (s_samplingPeriod.load(memory_order_relaxed)) {
+        s_sampledPointers->add(ptr);
+    }
+}
+
+/// @return true when the deallocation of @p ptr should be recorded, this does not require any lock
+bool takeSampledPointer(void* ptr)
+{
+    return !s_samplingPeriod.load(memory_order_relaxed) || s_sampledPointers->take(ptr);
+}
+
+EventRing* threadEventRing()
+{
+    if (!t_eventRing) {
+        t_eventRing = s_eventRings.acquire();
+        pthread_setspecific(s_eventRingKey, t_eventRing);
+    }
+    return t_eventRing;
+}
+
+// pointers, trace indices and instruction pointers are delta encoded in binary records,
+// consecutive values often only differ in their lower bits
+BinaryRecord::Delta pointerDelta(const void* ptr)
+{
+    return {BinaryRecord::PointerChannel, reinterpret_cast<uintptr_t>(ptr)};
+}
+
+BinaryRecord::Delta pointerDelta(uint64_t ptr)
+{
+    return {BinaryRecord::PointerChannel, ptr};
+}
+
+BinaryRecord::Delta traceDelta(uint32_t index)
+{
+    return {BinaryRecord::TraceChannel, index};
+}
+
+BinaryRecord::Delta ipDelta(uint64_t ip)
+{
+    return {BinaryRecord::IpChannel, ip};
+}
+
 // based on: https://stackoverflow.com/a/24315631/35250
 void replaceAll(string& str, const string& search, const string& replace)
 {
@@ -304,6 +466,11 @@ public:
 
             Trace::setup();
 
+            pthread_key_create(&s_eventRingKey, [](void* ring) {
+                static_cast<EventRing*>(ring)->release();
+                t_eventRing = nullptr;
+            });
+
             // do not trace forked child processes
             // TODO: make this configurable
             pthread_atfork(&prepare_fork, &parent_fork, &child_fork);
@@ -334,12 +501,50 @@ public:
             return;
         }
 
-        s_data = new LockedData(out, stopCallback);
+        const auto threadBuffers = getenv("HEAPTRACK_THREAD_BUFFERS");
+        const bool useThreadBuffers = threadBuffers && atoi(threadBuffers);
+
+        if (const auto unwinder = getenv("HEAPTRACK_UNWINDER")) {
+            if (!strcmp(unwinder, "fp")) {
+                if (!Trace::setUnwinder(Trace::Unwinder::FramePointer)) {
+                    fprintf(stderr, "WARNING: The frame pointer unwinder is not supported on this platform.\n");
+                }
+            } else if (!strcmp(unwinder, "dwarf")) {
+                Trace::setUnwinder(Trace::Unwinder::Dwarf);
+            } else if (!strcmp(unwinder, "dwarf-incremental")) {
+                if (!Trace::setUnwinder(Trace::Unwinder::IncrementalDwarf)) {
+                    fprintf(stderr, "WARNING: Incremental unwinding is not supported by this build.\n");
+                }
+            } else if (!strcmp(unwinder, "shadow-stack")) {
+                if (!Trace::setUnwinder(Trace::Unwinder::ShadowStack)) {
+                    fprintf(stderr, "WARNING: The shadow stack unwinder is not supported on this platform "
+                                    "or libheaptrack_shadowstack.so was not preloaded.\n");
+                }
+            } else {
+                fprintf(stderr,
+                        "WARNING: Unknown unwinder \"%s\", expected \"fp\", \"dwarf\", \"dwarf-incremental\" or "
+                        "\"shadow-stack\".\n",
+                        unwinder);
+            }
+        }
+
+        const auto samplingPeriodEnv = getenv("HEAPTRACK_SAMPLING_PERIOD");
+        const auto samplingPeriod = samplingPeriodEnv ? strtoull(samplingPeriodEnv, nullptr, 10) : 0;
+
+        const auto timerIntervalEnv = getenv("HEAPTRACK_TIMER_INTERVAL");
+        const auto timerIntervalUs = timerIntervalEnv ? strtoull(timerIntervalEnv, nullptr, 10) : 0;
+        const auto timerAdaptiveEnv = getenv("HEAPTRACK_TIMER_ADAPTIVE");
+        const bool timerAdaptive = !timerAdaptiveEnv || atoi(timerAdaptiveEnv);
+        const auto timerInterval = TimerInterval(
+            timerIntervalUs ? chrono::microseconds(timerIntervalUs) : chrono::milliseconds(10), timerAdaptive);
+
+        s_data = new LockedData(out, stopCallback, useThreadBuffers, samplingPeriod, timerInterval);
 
         writeVersion();
         writeExe();
         writeCommandLine();
         writeSystemInfo();
+        writeSamplingPeriod();
         writeSuppressions();
 
         if (initAfterCallback) {
@@ -348,6 +553,21 @@ public:
             debugLog<MinimalOutput>("%s", "calling initAfterCallback done");
         }
 
+        if (samplingPeriod) {
+            if (!s_sampledPointers) {
+                s_sampledPointers = new SampledPointers;
+            } else {
+                s_sampledPointers->clear();
+            }
+        }
+        s_samplingPeriod.store(samplingPeriod);
+
+        if (useThreadBuffers) {
+            // rings from a previous session are reused, but their trace indices are meaningless now
+            s_eventRings.forEachRing([](EventRing& ring) { ring.reset(); });
+            s_threadBuffersActive.store(true);
+        }
+
         debugLog<MinimalOutput>("%s", "initialization done");
     }
 
@@ -359,8 +579,20 @@ public:
 
         debugLog<MinimalOutput>("%s", "shutdown()");
 
+        s_samplingPeriod.store(0);
+
+        if (s_data->threadBuffers) {
+            // wait for all threads to leave the recording code, then flush what they left behind
+            s_threadBuffersActive.store(false);
+            while (!s_eventRings.isQuiescent()) {
+                this_thread::sleep_for(chrono::microseconds(1));
+            }
+            drainEventRings();
+        }
+
         writeTimestamp();
         writeRSS();
+        writeTraceCacheStats();
 
         s_data->out.flush();
         s_data->out.close();
@@ -383,14 +615,29 @@ public:
         s_data->moduleCacheDirty = true;
     }
 
+    /**
+     * Write the events buffered by the threads while all modules they reference are still loaded,
+     * they could not be symbolized anymore once the module cache got updated after unloading one.
+     */
+    void drainEventRingsBeforeUnload()
+    {
+        if (!s_data || !s_data->threadBuffers) {
+            return;
+        }
+        drainEventRings();
+    }
+
     void writeTimestamp()
+    {
+        writeTimestamp(elapsedTime());
+    }
+
+    void writeTimestamp(chrono::milliseconds elapsed)
     {
         if (!s_data || !s_data->out.canWrite()) {
             return;
         }
 
-        auto elapsed = elapsedTime();
-
         debugLog<VeryVerboseOutput>("writeTimestamp(%" PRIx64 ")", elapsed.count());
 
         s_data->out.writeHexLine('c', static_cast<size_t>(elapsed.count()));
@@ -398,45 +645,18 @@ public:
 
     void writeRSS()
     {
-        if (!s_data || !s_data->out.canWrite()) {
-            return;
-        }
-
         size_t rss = 0;
-
-#ifdef __linux__
-        if (s_data->procStatm == -1) {
-            return;
-        }
-        // read RSS in pages from statm, then rewind for next read
-        // NOTE: don't use fscanf here, it could potentially deadlock us
-        const int BUF_SIZE = 512;
-        char buf[BUF_SIZE + 1];
-        if (read(s_data->procStatm, buf, BUF_SIZE) <= 0) {
-            fprintf(stderr, "WARNING: Failed to read RSS value from /proc/self/statm.\n");
-            close(s_data->procStatm);
-            s_data->procStatm = -1;
-            return;
+        if (s_data && s_data->readRSS(&rss)) {
+            writeRSS(rss);
         }
-        lseek(s_data->procStatm, 0, SEEK_SET);
+    }
 
-        if (sscanf(buf, "%*u %zu", &rss) != 1) {
-            fprintf(stderr, "WARNING: Failed to read RSS value from /proc/self/statm.\n");
-            close(s_data->procStatm);
-            s_data->procStatm = -1;
-            return;
-        }
-#elif defined(__FreeBSD__)
-        auto proc_info = kinfo_getproc(getpid());
-        if (proc_info == nullptr) {
+    void writeRSS(size_t rss)
+    {
+        if (!s_data || !s_data->out.canWrite()) {
             return;
         }
 
-        rss = proc_info->ki_rssize;
-
-        free(proc_info);
-#endif
-
         // TODO: compare to rusage.ru_maxrss (getrusage) to find "real" peak?
         // TODO: use custom allocators with known page sizes to prevent tainting
         //       the RSS numbers with heaptrack-internal data
@@ -448,6 +668,8 @@ public:
     {
         s_data->out.writeHexLine('v', static_cast<size_t>(HEAPTRACK_VERSION),
                                  static_cast<size_t>(HEAPTRACK_FILE_FORMAT_VERSION));
+        // everything after the version line uses the compact binary encoding where possible
+        s_data->out.setBinaryRecords(true);
     }
 
     void writeExe()
@@ -501,6 +723,27 @@ public:
                                  static_cast<size_t>(sysconf(_SC_PHYS_PAGES)));
     }
 
+    void writeSamplingPeriod()
+    {
+        if (s_data->samplingPeriod) {
+            s_data->out.writeHexLine('P', s_data->samplingPeriod);
+        }
+    }
+
+    void writeTraceCacheStats()
+    {
+        auto hits = s_data->traceCache.hits();
+        auto misses = s_data->traceCache.misses();
+        if (s_data->threadBuffers) {
+            // all producers are quiescent by now
+            s_eventRings.forEachRing([&](const EventRing& ring) {
+                hits += ring.traceCache.hits();
+                misses += ring.traceCache.misses();
+            });
+        }
+        s_data->out.write("# trace cache hits: %" PRIu64 "\n# trace cache misses: %" PRIu64 "\n", hits, misses);
+    }
+
     void writeSuppressions()
     {
         if (!__lsan_default_suppressions)
@@ -526,15 +769,22 @@ public:
         }
         updateModuleCache();
 
-        const auto index = s_data->traceTree.index(trace, [](uintptr_t ip, uint32_t index) {
-            // decrement addresses by one - otherwise we misattribute the cost to the wrong instruction
-            // for some reason, it seems like we always get the instruction _after_ the one we are interested in
-            // see also: https://github.com/libunwind/libunwind/issues/287
-            // and https://bugs.kde.org/show_bug.cgi?id=439897
-            --ip;
-
-            return s_data->out.writeHexLine('t', ip, index);
-        });
+        const auto cacheKey = TraceCache::key(trace);
+        auto index = s_data->traceCache.find(cacheKey);
+        if (!index) {
+            index = s_data->traceTree.index(trace, [](uintptr_t ip, uint32_t index) {
+                // decrement addresses by one - otherwise we misattribute the cost to the wrong instruction
+                // for some reason, it seems like we always get the instruction _after_ the one we are interested in
+                // see also: https://github.com/libunwind/libunwind/issues/287
+                // and https://bugs.kde.org/show_bug.cgi?id=439897
+                --ip;
+
+                return s_data->out.writeHexLine('t', ipDelta(ip), traceDelta(index));
+            });
+            if (index) {
+                s_data->traceCache.insert(cacheKey, index);
+            }
+        }
 
 #ifdef DEBUG_MALLOC_PTRS
         auto it = s_data->known.find(ptr);
@@ -542,9 +792,12 @@ public:
         s_data->known.insert(ptr);
 #endif
 
-        s_data->out.writeHexLine('+', size, index, reinterpret_cast<uintptr_t>(ptr));
+        s_data->out.writeHexLine('+', size, traceDelta(index), pointerDelta(ptr));
+        addSampledPointer(ptr);
+        s_data->countEvent();
     }
 
+    /// NOTE: when sampling, only call this for the pointers for which takeSampledPointer returned true
     void handleFree(void* ptr)
     {
         if (!s_data || !s_data->out.canWrite()) {
@@ -557,7 +810,46 @@ public:
         s_data->known.erase(it);
 #endif
 
-        s_data->out.writeHexLine('-', reinterpret_cast<uintptr_t>(ptr));
+        s_data->out.writeHexLine('-', pointerDelta(ptr));
+        s_data->countEvent();
+    }
+
+    /**
+     * Write all events buffered by the threads in the lock-free recording mode
+     */
+    void drainEventRings()
+    {
+        if (!s_data) {
+            return;
+        }
+
+        updateModuleCache();
+
+        // NOTE: we always drain the rings, even when we cannot write anymore, to not block the producers
+        s_eventRings.drain(s_data->drainCursors, [](EventRing& ring, const ThreadEvent& event) {
+            auto& out = s_data->out;
+            auto toGlobalIndex = [&ring](uint32_t localIndex) -> uint32_t {
+                if (!localIndex || localIndex > ring.localToGlobal.size()) {
+                    return 0;
+                }
+                return ring.localToGlobal[localIndex - 1];
+            };
+
+            switch (event.type) {
+            case 't':
+                // the thread-local indices are handed out sequentially, just like the global ones
+                ring.localToGlobal.push_back(++s_data->traceIndex);
+                out.writeHexLine('t', ipDelta(event.value), traceDelta(toGlobalIndex(event.index)));
+                break;
+            case '+':
+                out.writeHexLine('+', event.value, traceDelta(toGlobalIndex(event.index)),
+                                 pointerDelta(event.pointer));
+                break;
+            case '-':
+                out.writeHexLine('-', pointerDelta(event.pointer));
+                break;
+            }
+        });
     }
 
     static bool isPaused()
@@ -571,13 +863,36 @@ public:
     }
 
 private:
-    static int dl_iterate_phdr_callback(struct dl_phdr_info* info, size_t /*size*/, void* data)
+    static const char* moduleFileName(const struct dl_phdr_info* info)
     {
-        auto heaptrack = reinterpret_cast<HeapTrack*>(data);
         const char* fileName = info->dlpi_name;
         if (!fileName || !fileName[0]) {
             fileName = "x";
         }
+        return fileName;
+    }
+
+    static int mark_loaded_module_callback(struct dl_phdr_info* info, size_t /*size*/, void* /*data*/)
+    {
+        auto module = s_data->findReportedModule(info->dlpi_addr);
+        if (module != s_data->reportedModules.end() && module->addressStart == info->dlpi_addr
+            && module->fileName == moduleFileName(info)) {
+            module->loaded = true;
+        }
+        return 0;
+    }
+
+    static int dl_iterate_phdr_callback(struct dl_phdr_info* info, size_t /*size*/, void* data)
+    {
+        auto heaptrack = reinterpret_cast<HeapTrack*>(data);
+        const char* fileName = moduleFileName(info);
+
+        auto module = heaptrack->s_data->findReportedModule(info->dlpi_addr);
+        if (module != heaptrack->s_data->reportedModules.end() && module->addressStart == info->dlpi_addr) {
+            // reported before and still valid, the interpreter knows it already
+            return 0;
+        }
+        heaptrack->s_data->reportedModules.insert(module, {info->dlpi_addr, fileName, true});
 
         debugLog<VerboseOutput>("dlopen_notify_callback: %s %zx", fileName, info->dlpi_addr);
 
@@ -621,18 +936,38 @@ private:
         // but the forked child process cleans up itself
         // this is important to prevent two processes writing to the same file
         s_data = nullptr;
+        s_threadBuffersActive.store(false);
+        s_samplingPeriod.store(0);
         RecursionGuard::isActive = true;
     }
 
+    /**
+     * Report the modules that got loaded or unloaded since the last call
+     *
+     * Unloaded modules are reported first, as their addresses may get reused by the newly loaded ones.
+     * This allows heaptrack_interpret to keep the debug information of all other modules around.
+     */
     void updateModuleCache()
     {
         if (!s_data || !s_data->out.canWrite() || !s_data->moduleCacheDirty) {
             return;
         }
         debugLog<MinimalOutput>("%s", "updateModuleCache()");
-        if (!s_data->out.write("m 1 -\n")) {
-            return;
+
+        auto& modules = s_data->reportedModules;
+        for (auto& module : modules) {
+            module.loaded = false;
         }
+        dl_iterate_phdr(&mark_loaded_module_callback, nullptr);
+        for (const auto& module : modules) {
+            if (!module.loaded && !s_data->out.write("m 1 - %zx\n", module.addressStart)) {
+                return;
+            }
+        }
+        modules.erase(std::remove_if(modules.begin(), modules.end(),
+                                     [](const LockedData::ReportedModule& module) { return !module.loaded; }),
+                      modules.end());
+
         dl_iterate_phdr(&dl_iterate_phdr_callback, this);
         s_data->moduleCacheDirty = false;
     }
@@ -689,8 +1024,12 @@ private:
 
     struct LockedData
     {
-        LockedData(int out, heaptrack_callback_t stopCallback)
+        LockedData(int out, heaptrack_callback_t stopCallback, bool threadBuffers, uint64_t samplingPeriod,
+                   TimerInterval timerInterval)
             : out(out)
+            , threadBuffers(threadBuffers)
+            , samplingPeriod(samplingPeriod)
+            , timerInterval(timerInterval)
             , stopCallback(stopCallback)
         {
 
@@ -721,9 +1060,42 @@ private:
                 debugLog<MinimalOutput>("%s", "timer thread started");
 
                 // now loop and repeatedly print the timestamp and RSS usage to the data stream
+                // in the lock-free recording mode, we additionally drain the event rings every millisecond
+                const auto drainInterval = chrono::milliseconds(1);
+                auto interval = this->timerInterval;
+                auto nextTick = clock::now() + interval.current();
+                uint64_t tickEvents = eventCount();
+                // what we wrote last, to skip the lock when nothing changed in the meantime
+                auto writtenTimestamp = chrono::milliseconds(-1);
                 while (!stopTimerThread) {
-                    // TODO: make interval customizable
-                    this_thread::sleep_for(chrono::milliseconds(10));
+                    auto wakeup = nextTick;
+                    if (this->threadBuffers) {
+                        wakeup = min(wakeup, clock::now() + drainInterval);
+                    }
+                    this_thread::sleep_until(wakeup);
+
+                    const auto now = clock::now();
+                    const auto events = eventCount();
+                    bool writeTick = false;
+                    size_t rss = 0;
+                    bool haveRSS = false;
+                    auto timestamp = chrono::milliseconds(0);
+                    if (now >= nextTick) {
+                        interval.update(events - tickEvents);
+                        tickEvents = events;
+                        nextTick = now + interval.current();
+
+                        // the timestamps only have millisecond resolution, shorter intervals cannot add any
+                        // but idle phases still need them, the analyzers sample the consumed memory at each one
+                        timestamp = elapsedTime();
+                        writeTick = timestamp != writtenTimestamp;
+                        // written with every time stamp, the analyzers only see the RSS within the filtered time range
+                        haveRSS = readRSS(&rss);
+                    }
+                    const bool drain = this->threadBuffers && !s_eventRings.isEmpty();
+                    if (!writeTick && !drain) {
+                        continue;
+                    }
 
                     const auto locked = tryLock([&] { return stopTimerThread.load(); });
                     if (!locked) {
@@ -731,8 +1103,16 @@ private:
                     }
 
                     HeapTrack heaptrack(locked);
-                    heaptrack.writeTimestamp();
-                    heaptrack.writeRSS();
+                    if (drain) {
+                        heaptrack.drainEventRings();
+                    }
+                    if (writeTick) {
+                        heaptrack.writeTimestamp(timestamp);
+                        writtenTimestamp = timestamp;
+                        if (haveRSS) {
+                            heaptrack.writeRSS(rss);
+                        }
+                    }
                 }
             });
 
@@ -769,6 +1149,8 @@ private:
 
         /// /proc/self/statm file descriptor to read RSS value from
         int procStatm = -1;
+        /// set once reading procStatm failed, we don't retry afterwards
+        atomic<bool> procStatmFailed {false};
 
         /**
          * Calls to dlopen/dlclose mark the cache as dirty.
@@ -779,7 +1161,101 @@ private:
          */
         bool moduleCacheDirty = true;
 
+        /// a module written out before, see updateModuleCache
+        struct ReportedModule
+        {
+            uintptr_t addressStart;
+            std::string fileName;
+            bool loaded;
+        };
+        /// sorted by their address
+        std::vector<ReportedModule> reportedModules;
+
+        /// @return the first reported module at or after @p addressStart
+        std::vector<ReportedModule>::iterator findReportedModule(uintptr_t addressStart)
+        {
+            return std::lower_bound(
+                reportedModules.begin(), reportedModules.end(), addressStart,
+                [](const ReportedModule& module, uintptr_t address) { return module.addressStart < address; });
+        }
+
         TraceTree traceTree;
+        /// shortcut into traceTree for recurring backtraces
+        TraceCache traceCache;
+
+        /// see HEAPTRACK_THREAD_BUFFERS
+        const bool threadBuffers = false;
+        /// last trace index handed out for events from the event rings
+        uint32_t traceIndex = 0;
+        /// scratch space for EventRings::drain, only used while locked
+        vector<EventRings::Cursor> drainCursors;
+
+        /// see HEAPTRACK_SAMPLING_PERIOD, zero when all allocations get recorded
+        const uint64_t samplingPeriod = 0;
+
+        /**
+         * Read the current RSS in pages into @p rss
+         *
+         * This does not require the lock, the timer thread calls it before deciding whether it needs to
+         * write anything at all.
+         */
+        bool readRSS(size_t* rss)
+        {
+#ifdef __linux__
+            if (procStatm == -1 || procStatmFailed.load(memory_order_relaxed)) {
+                return false;
+            }
+            // read RSS in pages from statm, pread does not move the file offset so we can read it again later on
+            // NOTE: don't use fscanf here, it could potentially deadlock us
+            const int BUF_SIZE = 512;
+            char buf[BUF_SIZE + 1];
+            const auto bytesRead = pread(procStatm, buf, BUF_SIZE, 0);
+            if (bytesRead > 0) {
+                buf[bytesRead] = '\0';
+            }
+            if (bytesRead <= 0 || sscanf(buf, "%*u %zu", rss) != 1) {
+                // the file descriptor gets closed along with the LockedData, other threads may still read from it
+                if (!procStatmFailed.exchange(true)) {
+                    fprintf(stderr, "WARNING: Failed to read RSS value from /proc/self/statm.\n");
+                }
+                return false;
+            }
+            return true;
+#elif defined(__FreeBSD__)
+            auto proc_info = kinfo_getproc(getpid());
+            if (proc_info == nullptr) {
+                return false;
+            }
+
+            *rss = proc_info->ki_rssize;
+
+            free(proc_info);
+            return true;
+#else
+            (void)rss;
+            return false;
+#endif
+        }
+
+        /// see HEAPTRACK_TIMER_INTERVAL and HEAPTRACK_TIMER_ADAPTIVE
+        const TimerInterval timerInterval;
+        /// number of allocations and deallocations written while holding the lock
+        atomic<uint64_t> recordedEvents {0};
+
+        /// only call while holding the lock
+        void countEvent()
+        {
+            recordedEvents.store(recordedEvents.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        }
+
+        /// @return the number of events recorded so far, can be called without holding the lock
+        uint64_t eventCount() const
+        {
+            if (threadBuffers) {
+                return s_eventRings.sequence.load(memory_order_relaxed);
+            }
+            return recordedEvents.load(memory_order_relaxed);
+        }
 
         atomic<bool> stopTimerThread {false};
         std::thread timerThread;
@@ -801,6 +1277,64 @@ private:
 std::mutex HeapTrack::s_lock;
 HeapTrack::LockedData* HeapTrack::s_data {nullptr};
 std::atomic<bool> HeapTrack::s_paused {false};
+
+/**
+ * Lock-free counterpart to HeapTrack, used with HEAPTRACK_THREAD_BUFFERS=1
+ *
+ * Events are only buffered here, HeapTrack::drainEventRings writes them out.
+ */
+class ThreadBuffers
+{
+public:
+    static bool isActive()
+    {
+        return s_threadBuffersActive.load(memory_order_relaxed);
+    }
+
+    template <typename Op>
+    static void record(const RecursionGuard& /*recursionGuard*/, const Op& op)
+    {
+        auto* ring = threadEventRing();
+        s_eventRings.begin(ring);
+        // check again, heaptrack_stop waits for us to leave this block before it writes the remaining events
+        if (s_threadBuffersActive.load()) {
+            op(ring);
+        }
+        s_eventRings.end(ring);
+    }
+
+    static void handleMalloc(EventRing* ring, void* ptr, size_t size, const Trace& trace)
+    {
+        const auto cacheKey = TraceCache::key(trace);
+        auto index = ring->traceCache.find(cacheKey);
+        if (!index) {
+            index = ring->traceTree.index(trace, [ring](uintptr_t ip, uint32_t parentIndex) {
+                // decrement addresses by one, see HeapTrack::handleMalloc
+                --ip;
+
+                return push(ring, {0, ip, 0, parentIndex, 't'});
+            });
+            if (index) {
+                ring->traceCache.insert(cacheKey, index);
+            }
+        }
+
+        push(ring, {0, size, reinterpret_cast<uintptr_t>(ptr), index, '+'});
+        addSampledPointer(ptr);
+    }
+
+    /// NOTE: when sampling, only call this for the pointers for which takeSampledPointer returned true
+    static void handleFree(EventRing* ring, void* ptr)
+    {
+        push(ring, {0, 0, reinterpret_cast<uintptr_t>(ptr), 0, '-'});
+    }
+
+private:
+    static bool push(EventRing* ring, const ThreadEvent& event)
+    {
+        return ring->push(event, s_eventRings.sequence, [] { return !s_threadBuffersActive.load(); });
+    }
+};
 }
 
 static void heaptrack_realloc_impl(void* ptr_in, size_t size, void* ptr_out)
@@ -810,14 +1344,36 @@ static void heaptrack_realloc_impl(void* ptr_in, size_t size, void* ptr_out)
 
         debugLog<VeryVerboseOutput>("heaptrack_realloc(%p, %zu, %p)", ptr_in, size, ptr_out);
 
+        const bool sampled = isSampled(size);
+        const bool recordFree = ptr_in && takeSampledPointer(ptr_in);
+        if (!sampled && !recordFree) {
+            return;
+        }
+
         Trace trace;
-        trace.fill(2 + HEAPTRACK_DEBUG_BUILD * 3);
+        if (sampled) {
+            trace.fill(2 + HEAPTRACK_DEBUG_BUILD * 3);
+        }
+
+        if (ThreadBuffers::isActive()) {
+            ThreadBuffers::record(guard, [&](EventRing* ring) {
+                if (recordFree) {
+                    ThreadBuffers::handleFree(ring, ptr_in);
+                }
+                if (sampled) {
+                    ThreadBuffers::handleMalloc(ring, ptr_out, size, trace);
+                }
+            });
+            return;
+        }
 
         HeapTrack::op(guard, [&](HeapTrack& heaptrack) {
-            if (ptr_in) {
+            if (recordFree) {
                 heaptrack.handleFree(ptr_in);
             }
-            heaptrack.handleMalloc(ptr_out, size, trace);
+            if (sampled) {
+                heaptrack.handleMalloc(ptr_out, size, trace);
+            }
         });
     }
 }
@@ -874,9 +1430,19 @@ void heaptrack_malloc(void* ptr, size_t size)
 
         debugLog<VeryVerboseOutput>("heaptrack_malloc(%p, %zu)", ptr, size);
 
+        if (!isSampled(size)) {
+            return;
+        }
+
         Trace trace;
         trace.fill(2 + HEAPTRACK_DEBUG_BUILD * 2);
 
+        if (ThreadBuffers::isActive()) {
+            ThreadBuffers::record(guard,
+                                  [&](EventRing* ring) { ThreadBuffers::handleMalloc(ring, ptr, size, trace); });
+            return;
+        }
+
         HeapTrack::op(guard, [&](HeapTrack& heaptrack) { heaptrack.handleMalloc(ptr, size, trace); });
     }
 }
@@ -888,6 +1454,16 @@ void heaptrack_free(void* ptr)
 
         debugLog<VeryVerboseOutput>("heaptrack_free(%p)", ptr);
 
+        // when sampling, most pointers were not sampled and we do not need to take any lock for them
+        if (!takeSampledPointer(ptr)) {
+            return;
+        }
+
+        if (ThreadBuffers::isActive()) {
+            ThreadBuffers::record(guard, [&](EventRing* ring) { ThreadBuffers::handleFree(ring, ptr); });
+            return;
+        }
+
         HeapTrack::op(guard, [&](HeapTrack& heaptrack) { heaptrack.handleFree(ptr); });
     }
 }
@@ -915,6 +1491,15 @@ void heaptrack_invalidate_module_cache(heaptrack_invalidate_module_cache_callbac
     });
 }
 
+void heaptrack_drain_events()
+{
+    RecursionGuard guard;
+
+    debugLog<VerboseOutput>("%s", "heaptrack_drain_events()");
+
+    HeapTrack::op(guard, [&](HeapTrack& heaptrack) { heaptrack.drainEventRingsBeforeUnload(); });
+}
+
 void heaptrack_warning(heaptrack_warning_callback_t callback)
 {
     RecursionGuard guard;
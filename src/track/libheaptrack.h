@@ -37,6 +37,9 @@ void heaptrack_realloc2(uintptr_t ptr_in, size_t size, uintptr_t ptr_out);
 typedef void (*heaptrack_invalidate_module_cache_callback)();
 void heaptrack_invalidate_module_cache(heaptrack_invalidate_module_cache_callback callback);
 
+/// write out the events buffered by the threads, call this before a module gets unloaded
+void heaptrack_drain_events();
+
 typedef void (*heaptrack_warning_callback_t)(FILE*);
 void heaptrack_warning(heaptrack_warning_callback_t callback);
 
@@ -0,0 +1,35 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#ifndef SHADOWSTACK_H
+#define SHADOWSTACK_H
+
+/**
+ * @file shadowstack.h
+ * @brief The per-thread shadow stack shared by libheaptrack_shadowstack and Trace.
+ */
+
+#include <cstdint>
+
+#include "trace.h"
+
+struct ShadowStack
+{
+    enum : uint32_t
+    {
+        // must be a power of two, deeper stacks only keep their innermost frames
+        CAPACITY = Trace::MAX_SIZE,
+    };
+
+    uint32_t depth = 0;
+    void* callSites[CAPACITY];
+};
+
+/// the function exported by libheaptrack_shadowstack, returning the shadow stack of the calling thread
+using ShadowStackAccessor = ShadowStack* (*)();
+#define HEAPTRACK_SHADOW_STACK_ACCESSOR "heaptrack_shadow_stack"
+
+#endif // SHADOWSTACK_H
@@ -0,0 +1,73 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#ifndef TIMERINTERVAL_H
+#define TIMERINTERVAL_H
+
+/**
+ * @file timerinterval.h
+ * @brief The interval of the timer thread, used with HEAPTRACK_TIMER_INTERVAL.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+/**
+ * Decides how long the timer thread sleeps between writing two timestamps and RSS values.
+ *
+ * When adaptive, the interval shrinks while the application allocates a lot, such
+ * that the timeline stays fine grained during the interesting phases. While nothing
+ * gets allocated, the interval grows again to not wake up idle applications needlessly.
+ * The interval always stays within a factor of SCALE of the configured one.
+ */
+class TimerInterval
+{
+public:
+    enum : uint32_t
+    {
+        SCALE = 16,
+        // number of events between two ticks above which we tick faster
+        BUSY_EVENTS = 1024,
+        // never tick faster than this, in microseconds
+        MIN_INTERVAL = 50,
+    };
+
+    explicit TimerInterval(std::chrono::microseconds interval = std::chrono::milliseconds(10), bool adaptive = true)
+        : m_interval(std::max(interval, std::chrono::microseconds(MIN_INTERVAL)))
+        , m_min(adaptive ? std::max(m_interval / SCALE, std::chrono::microseconds(MIN_INTERVAL)) : m_interval)
+        , m_max(adaptive ? m_interval * SCALE : m_interval)
+        , m_current(m_interval)
+    {
+    }
+
+    std::chrono::microseconds current() const
+    {
+        return m_current;
+    }
+
+    /// adapt the interval to the number of @p events recorded during the last tick
+    void update(uint64_t events)
+    {
+        if (events >= BUSY_EVENTS) {
+            m_current = std::max(m_current / 2, m_min);
+        } else if (!events) {
+            m_current = std::min(m_current * 2, m_max);
+        } else if (m_current < m_interval && events < BUSY_EVENTS / 4) {
+            m_current = std::min(m_current * 2, m_interval);
+        } else if (m_current > m_interval) {
+            m_current = std::max(m_current / 2, m_interval);
+        }
+    }
+
+private:
+    std::chrono::microseconds m_interval;
+    std::chrono::microseconds m_min;
+    std::chrono::microseconds m_max;
+    std::chrono::microseconds m_current;
+};
+
+#endif // TIMERINTERVAL_H
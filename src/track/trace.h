@@ -22,6 +22,18 @@ struct Trace
         MAX_SIZE = 64
     };
 
+    enum class Unwinder
+    {
+        /// the backend selected at build time, i.e. libunwind or the unwind tables
+        Dwarf,
+        /// follow the frame pointer chain, only works when all frames have a frame pointer
+        FramePointer,
+        /// like Dwarf, but stop once we reach a frame of the previous backtrace of this thread and reuse the rest
+        IncrementalDwarf,
+        /// copy the shadow stack maintained by the -finstrument-functions hooks of libheaptrack_shadowstack
+        ShadowStack,
+    };
+
     const ip_t* begin() const
     {
         return m_data + m_skip;
@@ -44,7 +56,18 @@ struct Trace
 
     bool fill(int skip)
     {
-        int size = unwind(m_data);
+        int size = 0;
+        switch (s_unwinder) {
+        case Unwinder::FramePointer:
+            size = unwindFramePointers(m_data);
+            break;
+        case Unwinder::ShadowStack:
+            size = unwindShadowStack(m_data, skip);
+            break;
+        default:
+            size = unwind(m_data);
+            break;
+        }
         // filter bogus frames at the end, which sometimes get returned by tracer backend
         // cf.: https://bugs.kde.org/show_bug.cgi?id=379082
         while (size > 0 && !m_data[size - 1]) {
@@ -67,12 +90,42 @@ struct Trace
         m_skip = 0;
     }
 
+    /// fill with the given instruction pointers, ordered from the leaf to the root
+    template <typename It>
+    void fillTestData(It begin, It end)
+    {
+        m_size = 0;
+        m_skip = 0;
+        for (auto it = begin; it != end && m_size < MAX_SIZE; ++it, ++m_size) {
+            m_data[m_size] = reinterpret_cast<ip_t>(*it);
+        }
+    }
+
     static void setup();
 
     static void print();
 
+    /// @return false when @p unwinder is not supported on this platform
+    static bool setUnwinder(Unwinder unwinder);
+
+    static Unwinder unwinder()
+    {
+        return s_unwinder;
+    }
+
 private:
     static int unwind(void** data);
+    static int unwindFramePointers(void** data);
+    /// append the frames starting at @p startFrame to @p data until it contains @p maxSize entries
+    static int walkFramePointers(void** data, int size, void* startFrame, int maxSize);
+    /// @return false when libheaptrack_shadowstack, which maintains the shadow stack, is not loaded
+    static bool findShadowStack();
+    /// only the first @p skip frames and the two frames after those get unwound, the rest comes from the shadow stack
+    static int unwindShadowStack(void** data, int skip);
+    /// @return true when the DWARF based backend supports Unwinder::IncrementalDwarf
+    static bool supportsIncrementalUnwinding();
+
+    static Unwinder s_unwinder;
 
 private:
     int m_size = 0;
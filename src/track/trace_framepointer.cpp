@@ -0,0 +1,187 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+/**
+ * @brief A frame pointer based backtrace.
+ *
+ * This is much cheaper than the DWARF based unwinders, but requires that all
+ * frames of interest are compiled with -fno-omit-frame-pointer. The walk stops
+ * at the first frame that does not look like a valid frame record, or that is
+ * not on the stack of the current thread or its alternate signal stack.
+ */
+
+#include "trace.h"
+
+#include <pthread.h>
+#include <signal.h>
+#ifdef __FreeBSD__
+#include <pthread_np.h>
+#endif
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+// a frame record consists of the caller's frame pointer followed by the return address
+#define HEAPTRACK_HAVE_FRAME_RECORDS 1
+#else
+#define HEAPTRACK_HAVE_FRAME_RECORDS 0
+#endif
+
+#ifdef HEAPTRACK_DEFAULT_UNWINDER_FRAME_POINTER
+Trace::Unwinder Trace::s_unwinder = HEAPTRACK_HAVE_FRAME_RECORDS ? Unwinder::FramePointer : Unwinder::Dwarf;
+#else
+Trace::Unwinder Trace::s_unwinder = Unwinder::Dwarf;
+#endif
+
+namespace {
+struct StackBounds
+{
+    uintptr_t low = 0;
+    uintptr_t high = 0;
+};
+
+/// the stack of the current thread, used to validate the frame pointers
+thread_local StackBounds t_stackBounds;
+/// the stack of a thread never moves, so we only query it once, even when we did not find it
+thread_local bool t_stackBoundsQueried = false;
+
+StackBounds queryStackBounds()
+{
+    pthread_attr_t attr;
+#ifdef __FreeBSD__
+    pthread_attr_init(&attr);
+    const bool haveAttr = pthread_attr_get_np(pthread_self(), &attr) == 0;
+#else
+    const bool haveAttr = pthread_getattr_np(pthread_self(), &attr) == 0;
+#endif
+
+    void* address = nullptr;
+    size_t size = 0;
+    const bool haveStack = haveAttr && pthread_attr_getstack(&attr, &address, &size) == 0;
+#ifdef __FreeBSD__
+    pthread_attr_destroy(&attr);
+#else
+    if (haveAttr) {
+        pthread_attr_destroy(&attr);
+    }
+#endif
+
+    StackBounds bounds;
+    if (haveStack) {
+        bounds.low = reinterpret_cast<uintptr_t>(address);
+        bounds.high = bounds.low + size;
+    }
+    return bounds;
+}
+
+/// @return the alternate signal stack of the current thread, when we are currently running on it
+StackBounds querySignalStackBounds()
+{
+    stack_t stack;
+    StackBounds bounds;
+    if (sigaltstack(nullptr, &stack) == 0 && (stack.ss_flags & SS_ONSTACK)) {
+        bounds.low = reinterpret_cast<uintptr_t>(stack.ss_sp);
+        bounds.high = bounds.low + stack.ss_size;
+    }
+    return bounds;
+}
+
+bool contains(const StackBounds& bounds, uintptr_t frame)
+{
+    return frame >= bounds.low && frame < bounds.high;
+}
+
+/// @return true when @p frame is on the stack of the current thread, whose bounds get stored in @p bounds
+bool findThreadStack(uintptr_t frame, StackBounds* bounds)
+{
+    if (!t_stackBoundsQueried) {
+        t_stackBounds = queryStackBounds();
+        t_stackBoundsQueried = true;
+    }
+    // frames outside of it are on another stack, e.g. of a coroutine, querying again won't change that
+    if (!contains(t_stackBounds, frame)) {
+        return false;
+    }
+    *bounds = t_stackBounds;
+    return true;
+}
+}
+
+bool Trace::setUnwinder(Unwinder unwinder)
+{
+    if (unwinder == Unwinder::FramePointer && !HEAPTRACK_HAVE_FRAME_RECORDS) {
+        return false;
+    }
+    if (unwinder == Unwinder::IncrementalDwarf && !supportsIncrementalUnwinding()) {
+        return false;
+    }
+    // we need to walk our own frames up to the first frame of the application
+    if (unwinder == Unwinder::ShadowStack && (!HEAPTRACK_HAVE_FRAME_RECORDS || !findShadowStack())) {
+        return false;
+    }
+    s_unwinder = unwinder;
+    return true;
+}
+
+int Trace::unwindFramePointers(void** data)
+{
+    // this frame is always skipped, its exact address does not matter
+    data[0] = reinterpret_cast<void*>(&Trace::unwindFramePointers);
+    const auto size = walkFramePointers(data, 1, __builtin_frame_address(0), MAX_SIZE);
+    if (size == 1) {
+        // not even our own frame could be walked, e.g. on a coroutine stack whose bounds we do not know
+        return unwind(data);
+    }
+    return size;
+}
+
+int Trace::walkFramePointers(void** data, int size, void* startFrame, int maxSize)
+{
+#if HEAPTRACK_HAVE_FRAME_RECORDS
+    auto frame = reinterpret_cast<uintptr_t>(startFrame);
+
+    StackBounds bounds;
+    bool onSignalStack = false;
+    if (!findThreadStack(frame, &bounds)) {
+        bounds = querySignalStackBounds();
+        onSignalStack = true;
+        if (!contains(bounds, frame)) {
+            // unknown stack, e.g. a coroutine stack: we cannot tell which memory is safe to read
+            return size;
+        }
+    }
+
+    while (size < maxSize) {
+        if (frame < bounds.low || frame > bounds.high - 2 * sizeof(void*) || frame % alignof(void*)) {
+            break;
+        }
+        const auto* record = reinterpret_cast<void* const*>(frame);
+        const auto ip = record[1];
+        if (!ip) {
+            break;
+        }
+        data[size++] = ip;
+
+        const auto next = reinterpret_cast<uintptr_t>(record[0]);
+        if (!contains(bounds, next)) {
+            // a signal handler returns to the interrupted code on the stack of the thread, but nowhere else
+            if (!onSignalStack || !findThreadStack(next, &bounds)) {
+                break;
+            }
+            onSignalStack = false;
+        } else if (next <= frame) {
+            // the stack grows downwards, so the caller's frame must be above ours
+            break;
+        }
+        frame = next;
+    }
+#else
+    (void)startFrame;
+    (void)maxSize;
+#endif
+
+    return size;
+}
@@ -62,6 +62,12 @@ void Trace::setup()
 #endif
 }
 
+bool Trace::supportsIncrementalUnwinding()
+{
+    // unw_backtrace is already heavily optimized and does not expose the frame addresses
+    return false;
+}
+
 int Trace::unwind(void** data)
 {
     return unw_backtrace(data, MAX_SIZE);
@@ -0,0 +1,52 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+/**
+ * @brief A shadow stack based backtrace.
+ *
+ * The shadow stack gets maintained by the -finstrument-functions hooks of
+ * libheaptrack_shadowstack, see heaptrack_shadowstack.cpp, which turns every
+ * backtrace into a plain copy.
+ *
+ * Functions that are not instrumented, e.g. in system libraries, are missing from
+ * such backtraces. The same goes for the position within their instrumented caller,
+ * e.g. allocations via the operator new of libstdc++ get attributed to the call site
+ * of the function calling new. longjmp leaves the shadow stack in a broken state.
+ */
+
+#include "shadowstack.h"
+#include "trace.h"
+
+#include <dlfcn.h>
+
+namespace {
+ShadowStackAccessor s_shadowStack = nullptr;
+}
+
+bool Trace::findShadowStack()
+{
+    if (!s_shadowStack) {
+        s_shadowStack =
+            reinterpret_cast<ShadowStackAccessor>(dlsym(RTLD_DEFAULT, HEAPTRACK_SHADOW_STACK_ACCESSOR));
+    }
+    return s_shadowStack;
+}
+
+int Trace::unwindShadowStack(void** data, int skip)
+{
+    // our own frames are not instrumented, but all have a frame pointer
+    // the first frame after the skipped ones is the interposed allocation function,
+    // its return address is the leaf frame of the application
+    data[0] = reinterpret_cast<void*>(&Trace::unwindShadowStack);
+    int size = walkFramePointers(data, 1, __builtin_frame_address(0), skip + 2 < MAX_SIZE ? skip + 2 : MAX_SIZE);
+
+    const auto& stack = *s_shadowStack();
+    const auto available = stack.depth < ShadowStack::CAPACITY ? stack.depth : ShadowStack::CAPACITY;
+    for (uint32_t i = 1; i <= available && size < MAX_SIZE; ++i) {
+        data[size++] = stack.callSites[(stack.depth - i) % ShadowStack::CAPACITY];
+    }
+    return size;
+}
@@ -14,6 +14,13 @@
 #include <cstdio>
 #include <unwind.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+// the call instruction always pushes the return address right below the canonical frame address of the callee
+#define HEAPTRACK_HAVE_RETURN_ADDRESS_SLOT 1
+#else
+#define HEAPTRACK_HAVE_RETURN_ADDRESS_SLOT 0
+#endif
+
 namespace {
 
 struct backtrace
@@ -35,6 +42,101 @@ _Unwind_Reason_Code unwind_backtrace_callback(struct _Unwind_Context* context, v
     return _URC_NO_REASON;
 }
 
+/**
+ * The previous backtrace of a thread together with the canonical frame address of every frame.
+ *
+ * NOTE: _Unwind_GetCFA for a frame returns the CFA of its callee, so the instruction pointer
+ *       of a frame is the return address stored right below its CFA.
+ */
+struct CachedStack
+{
+    enum : uintptr_t
+    {
+        // larger gaps between two frames are most likely a switch to a different stack, e.g. of a coroutine
+        MAX_FRAME_SIZE = 1024 * 1024,
+    };
+
+    int size = 0;
+    void* ips[Trace::MAX_SIZE];
+    uintptr_t cfas[Trace::MAX_SIZE];
+
+    /**
+     * @return true when the frames starting at @p frame are still on the stack
+     *
+     * A frame is identified by its address and instruction pointer. When the return
+     * addresses stored in all frames further up did not change either, then the rest
+     * of the backtrace must be the same as before.
+     */
+    bool isTailValid(int frame) const
+    {
+        for (int i = frame + 1; i < size; ++i) {
+            const auto returnAddress = *reinterpret_cast<void* const*>(cfas[i] - sizeof(void*));
+            if (returnAddress != ips[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void update(void* const* newIps, const uintptr_t* newCfas, int newSize)
+    {
+        size = 0;
+        for (int i = 1; i < newSize; ++i) {
+            // we only ever read the frames of the current stack, so never cache anything crossing stacks
+            if (newCfas[i] <= newCfas[i - 1] || newCfas[i] - newCfas[i - 1] > MAX_FRAME_SIZE) {
+                return;
+            }
+        }
+        for (int i = 0; i < newSize; ++i) {
+            ips[i] = newIps[i];
+            cfas[i] = newCfas[i];
+        }
+        size = newSize;
+    }
+};
+
+thread_local CachedStack t_cachedStack;
+
+struct incremental_backtrace : backtrace
+{
+    uintptr_t cfas[Trace::MAX_SIZE];
+    const CachedStack* cached = nullptr;
+    // first frame of the cached stack that may still match, the frames are sorted by their address
+    int cachedFrame = 0;
+};
+
+_Unwind_Reason_Code unwind_incremental_backtrace_callback(struct _Unwind_Context* context, void* arg)
+{
+    auto* trace = static_cast<incremental_backtrace*>(arg);
+
+    const uintptr_t pc = _Unwind_GetIP(context);
+    if (!pc) {
+        return _URC_NO_REASON;
+    }
+    const uintptr_t cfa = _Unwind_GetCFA(context);
+
+    const auto* cached = trace->cached;
+    auto& frame = trace->cachedFrame;
+    while (frame < cached->size && cached->cfas[frame] < cfa) {
+        ++frame;
+    }
+    if (frame < cached->size && cached->cfas[frame] == cfa && cached->ips[frame] == reinterpret_cast<void*>(pc)
+        && cached->isTailValid(frame)) {
+        // splice in the remaining frames of the previous backtrace
+        for (; frame < cached->size && trace->ctr < trace->max_size - 1; ++frame, ++trace->ctr) {
+            trace->data[trace->ctr] = cached->ips[frame];
+            trace->cfas[trace->ctr] = cached->cfas[frame];
+        }
+        return _URC_END_OF_STACK;
+    }
+
+    trace->data[trace->ctr] = reinterpret_cast<void*>(pc);
+    trace->cfas[trace->ctr] = cfa;
+    ++trace->ctr;
+    // any further frames would be ignored anyways
+    return trace->ctr < trace->max_size - 1 ? _URC_NO_REASON : _URC_END_OF_STACK;
+}
+
 }
 
 void Trace::setup()
@@ -50,8 +152,24 @@ void Trace::print()
     }
 }
 
+bool Trace::supportsIncrementalUnwinding()
+{
+    return HEAPTRACK_HAVE_RETURN_ADDRESS_SLOT;
+}
+
 int Trace::unwind(void** data)
 {
+    if (s_unwinder == Unwinder::IncrementalDwarf) {
+        incremental_backtrace trace;
+        trace.data = data;
+        trace.max_size = MAX_SIZE;
+        trace.cached = &t_cachedStack;
+
+        _Unwind_Backtrace(unwind_incremental_backtrace_callback, &trace);
+        t_cachedStack.update(data, trace.cfas, trace.ctr);
+        return trace.ctr;
+    }
+
     backtrace trace;
     trace.data = data;
     trace.max_size = MAX_SIZE;
@@ -0,0 +1,116 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#ifndef TRACECACHE_H
+#define TRACECACHE_H
+
+/**
+ * @file tracecache.h
+ * @brief Shortcut from complete backtraces to their TraceTree index.
+ */
+
+#include <cstdint>
+#include <cstring>
+
+#include "trace.h"
+
+/**
+ * Two-way set associative cache of the TraceTree indices of recently seen backtraces.
+ *
+ * Most allocations of a long running application originate from a limited set
+ * of distinct backtraces. Looking those up here first skips the walk through
+ * the TraceTree, which is linear in the depth of the backtrace.
+ *
+ * Backtraces are identified by a 64bit hash of their instruction pointers
+ * together with their depth, the instruction pointers themselves are not stored.
+ */
+class TraceCache
+{
+public:
+    enum : uint32_t
+    {
+        // number of entries, must be a power of two
+        SIZE = 2048,
+        WAYS = 2,
+        SET_MASK = SIZE / WAYS - 1,
+    };
+
+    struct Key
+    {
+        uint64_t hash;
+        uint32_t depth;
+    };
+
+    static Key key(const Trace& trace)
+    {
+        const auto depth = static_cast<uint32_t>(trace.size());
+        uint64_t hash = depth;
+        for (auto it = trace.begin(), end = trace.end(); it != end; ++it) {
+            hash = ((hash << 5) | (hash >> 59)) ^ reinterpret_cast<uintptr_t>(*it);
+            hash *= 0x9E3779B97F4A7C15ull;
+        }
+        // final avalanche, the lower bits select the entry
+        hash ^= hash >> 33;
+        hash *= 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 33;
+        return {hash, depth};
+    }
+
+    /// @return the cached index for @p key or zero if it's unknown
+    uint32_t find(const Key& key)
+    {
+        const auto* set = m_entries + (key.hash & SET_MASK) * WAYS;
+        for (uint32_t i = 0; i < WAYS; ++i) {
+            if (set[i].index && set[i].hash == key.hash && set[i].depth == key.depth) {
+                ++m_hits;
+                return set[i].index;
+            }
+        }
+        ++m_misses;
+        return 0;
+    }
+
+    /// add @p key which must not be cached yet, evicting the older entry of its set
+    void insert(const Key& key, uint32_t index)
+    {
+        auto* set = m_entries + (key.hash & SET_MASK) * WAYS;
+        set[1] = set[0];
+        set[0] = {key.hash, key.depth, index};
+    }
+
+    /// forget all entries and reset the statistics
+    void clear()
+    {
+        memset(m_entries, 0, sizeof(m_entries));
+        m_hits = 0;
+        m_misses = 0;
+    }
+
+    uint64_t hits() const
+    {
+        return m_hits;
+    }
+
+    uint64_t misses() const
+    {
+        return m_misses;
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t hash;
+        uint32_t depth;
+        // zero for empty entries, the empty trace never gets cached
+        uint32_t index;
+    };
+
+    Entry m_entries[SIZE] = {};
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+};
+
+#endif // TRACECACHE_H
@@ -13,34 +13,101 @@
  */
 
 #include <algorithm>
+#include <cstdint>
 #include <vector>
 
 #include "trace.h"
 
-struct TraceEdge
+/**
+ * A node in the TraceTree, i.e. the backtrace up to a given instruction pointer.
+ *
+ * The index of a node in TraceTree::m_nodes is the index associated with that
+ * backtrace, which the evaluation process can reverse-map to the parent ip to
+ * rebuild the backtrace from the bottom-up. The root node has index 0.
+ *
+ * Most nodes only have very few children, which are kept inline and sorted by their
+ * instruction pointer. Nodes with a wide fan-out, e.g. event loop dispatchers, switch
+ * to an open addressing hash table instead to keep lookups and insertions cheap.
+ */
+struct TraceTreeNode
 {
-    Trace::ip_t instructionPointer;
-    // index associated to the backtrace up to this instruction pointer
-    // the evaluation process can then reverse-map the index to the parent ip
-    // to rebuild the backtrace from the bottom-up
-    uint32_t index;
-    // sorted list of children, assumed to be small
-    std::vector<TraceEdge> children;
+    enum : uint32_t
+    {
+        INLINE_CAPACITY = 4,
+        NO_TABLE = UINT32_MAX,
+    };
+
+    uint32_t numChildren = 0;
+    // index into TraceTree::m_tables once numChildren exceeds INLINE_CAPACITY
+    uint32_t table = NO_TABLE;
+    Trace::ip_t childIps[INLINE_CAPACITY];
+    uint32_t childIndices[INLINE_CAPACITY];
+};
+
+/**
+ * Open addressing hash table with linear probing for the children of a wide TraceTreeNode.
+ */
+struct TraceChildTable
+{
+    struct Entry
+    {
+        // nullptr marks an empty entry, we never index null instruction pointers
+        Trace::ip_t ip;
+        uint32_t index;
+    };
+
+    static uint32_t hash(Trace::ip_t ip)
+    {
+        // fibonacci hashing, the upper bits are well distributed
+        return static_cast<uint32_t>((reinterpret_cast<uintptr_t>(ip) * 0x9E3779B97F4A7C15ull) >> 32);
+    }
+
+    Entry* find(Trace::ip_t ip)
+    {
+        const auto mask = entries.size() - 1;
+        for (auto i = hash(ip) & mask;; i = (i + 1) & mask) {
+            auto* entry = &entries[i];
+            if (entry->ip == ip || !entry->ip) {
+                return entry;
+            }
+        }
+    }
+
+    void rehash(size_t capacity)
+    {
+        std::vector<Entry> old(capacity, Entry {nullptr, 0});
+        old.swap(entries);
+        for (const auto& entry : old) {
+            if (entry.ip) {
+                *find(entry.ip) = entry;
+            }
+        }
+    }
+
+    // power of two, at most half full
+    std::vector<Entry> entries;
 };
 
 /**
  * Top-down tree of backtrace instruction pointers.
  *
  * This is supposed to be a memory efficient storage of all instruction pointers
- * ever encountered in any backtrace.
+ * ever encountered in any backtrace. All nodes live in a single arena and are
+ * referenced by their index.
  */
 class TraceTree
 {
 public:
+    TraceTree()
+    {
+        clear();
+    }
+
     void clear()
     {
-        m_root.children.clear();
-        m_index = 1;
+        m_nodes.clear();
+        m_nodes.emplace_back();
+        m_tables.clear();
     }
 
     /**
@@ -53,31 +120,97 @@ public:
     uint32_t index(const Trace& trace, Fun callback)
     {
         uint32_t index = 0;
-        TraceEdge* parent = &m_root;
         for (int i = trace.size() - 1; i >= 0; --i) {
             const auto ip = trace[i];
             if (!ip) {
                 continue;
             }
-            auto it =
-                std::lower_bound(parent->children.begin(), parent->children.end(), ip,
-                                 [](const TraceEdge& l, const Trace::ip_t ip) { return l.instructionPointer < ip; });
-            if (it == parent->children.end() || it->instructionPointer != ip) {
-                index = m_index++;
-                it = parent->children.insert(it, {ip, index, {}});
-                if (!callback(reinterpret_cast<uintptr_t>(ip), parent->index)) {
-                    return 0;
-                }
+            const auto child = findChild(m_nodes[index], ip);
+            if (child) {
+                index = child;
+                continue;
+            }
+            const auto newChild = insertChild(index, ip);
+            if (!callback(reinterpret_cast<uintptr_t>(ip), index)) {
+                return 0;
             }
-            index = it->index;
-            parent = &(*it);
+            index = newChild;
         }
         return index;
     }
 
 private:
-    TraceEdge m_root = {0, 0, {}};
-    uint32_t m_index = 1;
+    enum : uint32_t
+    {
+        // initial capacity of the hash table, must be a power of two
+        INITIAL_TABLE_CAPACITY = 4 * TraceTreeNode::INLINE_CAPACITY,
+    };
+
+    /// @return the index of the child of @p parent for @p ip, or zero if it's unknown
+    uint32_t findChild(const TraceTreeNode& parent, Trace::ip_t ip)
+    {
+        if (parent.table != TraceTreeNode::NO_TABLE) {
+            const auto* entry = m_tables[parent.table].find(ip);
+            return entry->ip ? entry->index : 0;
+        }
+        // linear search is faster than a binary search for these few children
+        for (uint32_t i = 0; i < parent.numChildren; ++i) {
+            if (parent.childIps[i] >= ip) {
+                return parent.childIps[i] == ip ? parent.childIndices[i] : 0;
+            }
+        }
+        return 0;
+    }
+
+    /// add a new child of @p parentIndex for @p ip which must not be known yet
+    __attribute__((noinline)) uint32_t insertChild(uint32_t parentIndex, Trace::ip_t ip)
+    {
+        const auto child = newNode();
+        auto& parent = m_nodes[parentIndex];
+        ++parent.numChildren;
+
+        if (parent.table != TraceTreeNode::NO_TABLE) {
+            auto& table = m_tables[parent.table];
+            *table.find(ip) = {ip, child};
+            if (parent.numChildren * 2 > table.entries.size()) {
+                table.rehash(table.entries.size() * 2);
+            }
+            return child;
+        }
+
+        if (parent.numChildren <= TraceTreeNode::INLINE_CAPACITY) {
+            // keep the children sorted, which makes the tree layout deterministic
+            auto pos = parent.numChildren - 1;
+            while (pos > 0 && parent.childIps[pos - 1] > ip) {
+                parent.childIps[pos] = parent.childIps[pos - 1];
+                parent.childIndices[pos] = parent.childIndices[pos - 1];
+                --pos;
+            }
+            parent.childIps[pos] = ip;
+            parent.childIndices[pos] = child;
+            return child;
+        }
+
+        // too many children, move them all over into a hash table
+        parent.table = m_tables.size();
+        m_tables.emplace_back();
+        auto& table = m_tables.back();
+        table.rehash(INITIAL_TABLE_CAPACITY);
+        for (uint32_t i = 0; i < TraceTreeNode::INLINE_CAPACITY; ++i) {
+            *table.find(parent.childIps[i]) = {parent.childIps[i], parent.childIndices[i]};
+        }
+        *table.find(ip) = {ip, child};
+        return child;
+    }
+
+    uint32_t newNode()
+    {
+        m_nodes.emplace_back();
+        return m_nodes.size() - 1;
+    }
+
+    std::vector<TraceTreeNode> m_nodes;
+    std::vector<TraceChildTable> m_tables;
 };
 
 #endif // TRACETREE_H
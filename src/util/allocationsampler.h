@@ -0,0 +1,90 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#ifndef ALLOCATIONSAMPLER_H
+#define ALLOCATIONSAMPLER_H
+
+/**
+ * @file allocationsampler.h
+ * @brief Poisson sampling of allocated bytes, used with HEAPTRACK_SAMPLING_PERIOD.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Decides which allocations get recorded when sampling.
+ *
+ * Every allocated byte is sampled with a probability of 1/period, independently of
+ * all other bytes. An allocation is recorded when at least one of its bytes got
+ * sampled, i.e. with a probability of 1 - exp(-size / period). Like tcmalloc, we
+ * implement this by counting down the exponentially distributed number of bytes
+ * until the next sample point.
+ *
+ * This is meant to be used thread-locally and does not allocate any memory.
+ */
+class AllocationSampler
+{
+public:
+    /// @return true when the allocation of @p size bytes should be recorded
+    bool sample(size_t size, uint64_t period)
+    {
+        if (period != m_period) {
+            m_period = period;
+            if (!m_random) {
+                // any non-zero seed that differs between threads works for us
+                m_random = reinterpret_cast<uintptr_t>(this) | 1;
+            }
+            m_bytesUntilSample = nextInterval();
+        }
+
+        if (size < m_bytesUntilSample) {
+            m_bytesUntilSample -= size;
+            return false;
+        }
+
+        m_bytesUntilSample = nextInterval();
+        return true;
+    }
+
+    /**
+     * @return the number of allocations a recorded allocation of @p size bytes stands for
+     *
+     * This is the inverse of the probability with which it got sampled.
+     */
+    static double weight(uint64_t size, uint64_t period)
+    {
+        if (!period) {
+            return 1;
+        }
+        return 1. / -std::expm1(-static_cast<double>(std::max<uint64_t>(size, 1)) / period);
+    }
+
+private:
+    uint64_t nextRandom()
+    {
+        // xorshift64*
+        m_random ^= m_random >> 12;
+        m_random ^= m_random << 25;
+        m_random ^= m_random >> 27;
+        return m_random * 0x2545F4914F6CDD1Dull;
+    }
+
+    uint64_t nextInterval()
+    {
+        // uniform in (0, 1]
+        const double uniform = ((nextRandom() >> 11) + 1) * 0x1.0p-53;
+        return static_cast<uint64_t>(-std::log(uniform) * m_period) + 1;
+    }
+
+    uint64_t m_period = 0;
+    uint64_t m_bytesUntilSample = 0;
+    uint64_t m_random = 0;
+};
+
+#endif // ALLOCATIONSAMPLER_H
@@ -0,0 +1,160 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#ifndef BINARYRECORD_H
+#define BINARYRECORD_H
+
+#include <cstdint>
+
+/**
+ * Definitions for the binary record encoding used since file format version 4.
+ *
+ * A binary record replaces a line written by LineWriter::writeHexLine:
+ *
+ *   - a tag byte: the type char of the line with the highest bit set
+ *   - a header byte: the number of fields in the lower four bits, DELTA_FLAG
+ *     when some fields are delta encoded
+ *   - only with DELTA_FLAG: one descriptor nibble per field, two per byte starting
+ *     with the low nibble. The lower two bits of a nibble are the Channel, the upper
+ *     two bits the slot in the DeltaHistory of that channel
+ *   - every field as an unsigned LEB128 varint
+ *
+ * Text lines always start with an ASCII type char, which allows readers to
+ * distinguish both kinds of records by the first byte. Text lines and binary
+ * records can thus be interleaved freely, e.g. module or string lines stay text.
+ * The initial version line is always written as text.
+ */
+namespace BinaryRecord {
+enum : uint8_t
+{
+    TYPE_FLAG = 0x80,
+    FIELD_COUNT_MASK = 0x0f,
+    DELTA_FLAG = 0x10,
+    MAX_FIELDS = FIELD_COUNT_MASK,
+    // 64 bits in groups of 7 bits
+    MAX_VARINT_BYTES = 10,
+    // tag byte and header byte
+    HEADER_BYTES = 2,
+};
+
+/// first file format version that may contain binary records
+constexpr const unsigned FIRST_FILE_FORMAT_VERSION = 4;
+
+/**
+ * Independent value streams for delta encoding, values of one channel are
+ * only ever encoded relative to earlier values of the same channel.
+ */
+enum Channel : uint8_t
+{
+    NoChannel = 0,
+    PointerChannel,
+    TraceChannel,
+    IpChannel,
+    NumChannels
+};
+
+/**
+ * Wrapper for arguments of LineWriter::writeHexLine that should be delta encoded.
+ *
+ * Text lines and binary records without delta support just contain the plain value.
+ */
+struct Delta
+{
+    Channel channel;
+    uint64_t value;
+};
+
+inline uint64_t zigzag(uint64_t delta)
+{
+    return (delta << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(delta) >> 63);
+}
+
+inline uint64_t unzigzag(uint64_t encoded)
+{
+    return (encoded >> 1) ^ (~(encoded & 1) + 1);
+}
+
+/**
+ * The last few values of a channel, which the next value gets encoded against.
+ *
+ * Keeping more than one value allows us to encode e.g. pointers from different
+ * arenas efficiently. Writer and reader update the history identically.
+ */
+class DeltaHistory
+{
+public:
+    enum : uint64_t
+    {
+        SIZE = 4,
+        SLOT_MASK = SIZE - 1,
+        // encoded deltas below this replace the value they are relative to,
+        // larger ones evict the oldest value instead
+        NEAR_THRESHOLD = 1 << 24,
+    };
+
+    /// @return the zigzag encoded delta of @p value to the closest known value, whose index is stored in @p slot
+    uint64_t encode(uint64_t value, unsigned* slot)
+    {
+        uint64_t best = zigzag(value - values[0]);
+        *slot = 0;
+        for (unsigned i = 1; i < SIZE; ++i) {
+            const auto encoded = zigzag(value - values[i]);
+            if (encoded < best) {
+                best = encoded;
+                *slot = i;
+            }
+        }
+        update(value, best, *slot);
+        return best;
+    }
+
+    uint64_t decode(uint64_t encoded, unsigned slot)
+    {
+        slot &= SLOT_MASK;
+        const auto value = values[slot] + unzigzag(encoded);
+        update(value, encoded, slot);
+        return value;
+    }
+
+    enum : unsigned
+    {
+        STATE_SIZE = SIZE + 1
+    };
+
+    /// store the state of the history in @p state, which allows decoding to resume in the middle of a stream
+    void saveState(uint64_t* state) const
+    {
+        for (unsigned i = 0; i < SIZE; ++i) {
+            state[i] = values[i];
+        }
+        state[SIZE] = oldest;
+    }
+
+    void restoreState(const uint64_t* state)
+    {
+        for (unsigned i = 0; i < SIZE; ++i) {
+            values[i] = state[i];
+        }
+        oldest = static_cast<unsigned>(state[SIZE] & SLOT_MASK);
+    }
+
+private:
+    void update(uint64_t value, uint64_t encoded, unsigned slot)
+    {
+        if (encoded < NEAR_THRESHOLD) {
+            values[slot] = value;
+        } else {
+            values[oldest] = value;
+            oldest = (oldest + 1) & SLOT_MASK;
+        }
+    }
+
+    uint64_t values[SIZE] = {};
+    unsigned oldest = 0;
+};
+}
+
+#endif // BINARYRECORD_H
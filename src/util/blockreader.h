@@ -0,0 +1,357 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#ifndef BLOCKREADER_H
+#define BLOCKREADER_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/**
+ * A line or binary record that got tokenized ahead of time, see LineReader::tokenize
+ */
+struct TokenizedRecord
+{
+    enum : uint32_t
+    {
+        NOT_TOKENIZED = UINT32_MAX
+    };
+
+    uint32_t lineSize;
+    // the number of fields, or NOT_TOKENIZED when the LineReader has to parse the line itself
+    uint32_t numFields;
+    bool isBinary;
+    bool hasNewline;
+};
+
+/**
+ * A block of data along with its records, which got tokenized ahead of time
+ */
+struct TokenizedBlock
+{
+    std::unique_ptr<char[]> data;
+    size_t size = 0;
+    std::vector<TokenizedRecord> records;
+    // the fields of all tokenized records, in order
+    std::vector<uint64_t> fields;
+};
+
+/**
+ * A source of input data for the LineReader that gets read in large blocks
+ *
+ * The LineReader parses the data between begin() and end() in place, i.e. lines
+ * never get copied. Subclasses make more data available in refill(), either by
+ * reading or decompressing the next block into a reusable buffer, or by handing
+ * out a memory mapped file all at once.
+ *
+ * Readers that tokenize the data ahead of time, e.g. on other threads, additionally
+ * hand out the records between begin() and end(), see nextRecord.
+ */
+class BlockReader
+{
+public:
+    virtual ~BlockReader() = default;
+
+    /// @return the start of the unread data
+    const char* begin() const
+    {
+        return m_begin;
+    }
+
+    /// @return the end of the unread data
+    const char* end() const
+    {
+        return m_end;
+    }
+
+    /// mark the data up to @p pos as read
+    void advance(const char* pos)
+    {
+        m_begin = pos;
+    }
+
+    /**
+     * Make more data available after end(), the unread data is kept but may move.
+     *
+     * @return false at the end of the input or on error, see hasError
+     */
+    virtual bool refill() = 0;
+
+    /**
+     * Skip the data up to @p offset, which must be at a record boundary at or after readBytes().
+     *
+     * The skipped data still gets read or decompressed, but does not have to be parsed.
+     *
+     * @return false when the input ends before @p offset
+     */
+    virtual bool skipTo(uint64_t offset)
+    {
+        while (true) {
+            const auto remaining = offset - readBytes();
+            if (remaining <= static_cast<uint64_t>(m_end - m_begin)) {
+                skipRecords(m_begin + remaining);
+                return true;
+            }
+            skipRecords(m_end);
+            if (!refill()) {
+                return false;
+            }
+        }
+    }
+
+    /// @return true when the input could not be read, as opposed to having reached its end
+    bool hasError() const
+    {
+        return m_hasError;
+    }
+
+    /// @return true when the data between begin() and end() was tokenized ahead of time, see nextRecord
+    bool isTokenized() const
+    {
+        return m_isTokenized;
+    }
+
+    /**
+     * @return the next tokenized record that starts at begin(), or nullptr when refill needs to be called
+     *
+     * @p fields points to the fields of the record afterwards, if it has any.
+     */
+    const TokenizedRecord* nextRecord(const uint64_t** fields)
+    {
+        if (m_nextRecord == m_recordsEnd) {
+            return nullptr;
+        }
+        const auto* record = m_nextRecord++;
+        *fields = m_nextField;
+        if (record->numFields != TokenizedRecord::NOT_TOKENIZED) {
+            m_nextField += record->numFields;
+        }
+        return record;
+    }
+
+    /// @return the number of bytes read so far
+    uint64_t readBytes() const
+    {
+        return m_bufferOffset + static_cast<uint64_t>(m_begin - m_bufferStart);
+    }
+
+    /// @return the number of bytes read so far from the underlying file, i.e. before decompression
+    uint64_t readInputBytes() const
+    {
+        return m_isCompressed ? m_inputBytes : readBytes();
+    }
+
+protected:
+    /// advance to @p pos, along with the tokenized records before it
+    void skipRecords(const char* pos)
+    {
+        while (m_begin < pos && m_nextRecord != m_recordsEnd) {
+            const auto* record = m_nextRecord++;
+            if (record->numFields != TokenizedRecord::NOT_TOKENIZED) {
+                m_nextField += record->numFields;
+            }
+            m_begin += record->lineSize + record->hasNewline;
+        }
+        m_begin = pos;
+    }
+
+    // the buffer that begin and end point into, and its offset in the data
+    const char* m_bufferStart = nullptr;
+    uint64_t m_bufferOffset = 0;
+    const char* m_begin = nullptr;
+    const char* m_end = nullptr;
+    bool m_hasError = false;
+    // maintained by decompressing subclasses
+    bool m_isCompressed = false;
+    uint64_t m_inputBytes = 0;
+    // maintained by tokenizing subclasses
+    bool m_isTokenized = false;
+    const TokenizedRecord* m_nextRecord = nullptr;
+    const TokenizedRecord* m_recordsEnd = nullptr;
+    const uint64_t* m_nextField = nullptr;
+};
+
+/**
+ * Base class for BlockReaders that produce their data block-wise into a reusable buffer
+ */
+class BufferedBlockReader : public BlockReader
+{
+public:
+    bool refill() final
+    {
+        const auto unread = static_cast<size_t>(m_end - m_begin);
+        m_bufferOffset += static_cast<uint64_t>(m_begin - m_bufferStart);
+        if (m_capacity < unread + BLOCK_SIZE) {
+            // very long lines need a larger buffer
+            const auto capacity = std::max(2 * m_capacity, unread + BLOCK_SIZE);
+            std::unique_ptr<char[]> buffer(new char[capacity]);
+            if (unread) {
+                memcpy(buffer.get(), m_begin, unread);
+            }
+            m_buffer = std::move(buffer);
+            m_capacity = capacity;
+        } else if (unread) {
+            memmove(m_buffer.get(), m_begin, unread);
+        }
+        m_bufferStart = m_begin = m_buffer.get();
+        m_end = m_begin + unread;
+
+        const auto size = readBlock(m_buffer.get() + unread, m_capacity - unread);
+        if (size <= 0) {
+            m_hasError = m_hasError || size < 0;
+            return false;
+        }
+        m_end += size;
+        return true;
+    }
+
+protected:
+    enum : size_t
+    {
+        BLOCK_SIZE = 1024 * 1024
+    };
+
+    /**
+     * Read the next block of data into @p buffer, which has space for @p size bytes.
+     *
+     * @return the number of bytes read, 0 at the end of the input or -1 on error
+     */
+    virtual ssize_t readBlock(char* buffer, size_t size) = 0;
+
+private:
+    std::unique_ptr<char[]> m_buffer;
+    size_t m_capacity = 0;
+};
+
+/**
+ * Reads a file descriptor that cannot be mapped, like a pipe
+ */
+class FileDescriptorReader : public BufferedBlockReader
+{
+public:
+    /// read from @p fd, which gets closed on destruction when @p closeFd is set
+    explicit FileDescriptorReader(int fd, bool closeFd = false)
+        : m_fd(fd)
+        , m_closeFd(closeFd)
+    {
+    }
+
+    ~FileDescriptorReader()
+    {
+        if (m_closeFd) {
+            close(m_fd);
+        }
+    }
+
+protected:
+    ssize_t readBlock(char* buffer, size_t size) override
+    {
+        ssize_t ret = 0;
+        do {
+            ret = ::read(m_fd, buffer, size);
+        } while (ret < 0 && errno == EINTR);
+        return ret;
+    }
+
+private:
+    int m_fd;
+    bool m_closeFd;
+};
+
+/**
+ * Hands out a memory mapped file as a single block, i.e. without copying it at all
+ */
+class MappedFileReader : public BlockReader
+{
+public:
+    /// map the first @p size bytes of @p fd, which may get closed afterwards
+    MappedFileReader(int fd, uint64_t size)
+    {
+        if (!size) {
+            return;
+        }
+        auto* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            m_hasError = true;
+            return;
+        }
+        madvise(data, size, MADV_SEQUENTIAL);
+        m_data = static_cast<const char*>(data);
+        m_size = size;
+        m_bufferStart = m_begin = m_data;
+        m_end = m_data + m_size;
+    }
+
+    ~MappedFileReader()
+    {
+        if (m_data) {
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+    }
+
+    bool refill() override
+    {
+        return false;
+    }
+
+private:
+    const char* m_data = nullptr;
+    uint64_t m_size = 0;
+};
+
+/**
+ * Hands out data that is in memory already as a single block
+ */
+class MemoryReader : public BlockReader
+{
+public:
+    MemoryReader(const char* data, size_t size)
+    {
+        m_bufferStart = m_begin = data;
+        m_end = data + size;
+    }
+
+    bool refill() override
+    {
+        return false;
+    }
+};
+
+/**
+ * Open the file at @p path for reading, mapping it into memory when possible
+ *
+ * @return nullptr when the file cannot be opened, with errno set accordingly
+ */
+inline std::unique_ptr<BlockReader> openBlockReader(const std::string& path)
+{
+    const auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return {};
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+        auto reader = std::make_unique<MappedFileReader>(fd, static_cast<uint64_t>(info.st_size));
+        if (!reader->hasError()) {
+            close(fd);
+            return reader;
+        }
+    }
+    return std::make_unique<FileDescriptorReader>(fd, true);
+}
+
+#endif // BLOCKREADER_H
@@ -22,4 +22,6 @@
 #cmakedefine01 HAVE_CFREE
 #cmakedefine01 HAVE_VALLOC
 
+#cmakedefine01 ZSTD_FOUND
+
 #endif // HEAPTRACK_CONFIG_H
@@ -7,9 +7,20 @@
 #ifndef LINEREADER_H
 #define LINEREADER_H
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <istream>
 #include <string>
+#include <string_view>
+#include <vector>
+
+#include "binaryrecord.h"
+#include "blockreader.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /**
  * Optimized class to speed up reading of the potentially big data files.
@@ -17,13 +28,22 @@
  * sscanf or istream are just slow when reading plain hex numbers. The
  * below does all we need and thus far less than what the generic functions
  * are capable of. We are not locale aware e.g.
+ *
+ * Binary records (see binaryrecord.h) are detected by their first byte and
+ * decoded transparently, i.e. readHex returns the decoded fields in order.
+ *
+ * Hex numbers of up to 15 chars get parsed with SSE2 when available, see parseHexNumber.
+ *
+ * When reading from a BlockReader, the lines are parsed in place in its buffer.
+ * They are only valid until the next call to getLine then. When the BlockReader
+ * tokenized the data ahead of time, the fields of the records are not parsed again.
  */
 class LineReader
 {
 public:
     LineReader()
     {
-        m_line.reserve(1024);
+        m_buffer.reserve(1024);
     }
 
     bool getLine(std::istream& in)
@@ -31,35 +51,154 @@ public:
         if (!in.good()) {
             return false;
         }
-        std::getline(in, m_line);
-        m_it = m_line.cbegin();
-        if (m_line.length() > 2) {
-            m_it += 2;
+        const auto next = in.peek();
+        if (next != std::istream::traits_type::eof() && (next & BinaryRecord::TYPE_FLAG)) {
+            return readBinaryRecord(in);
+        }
+        m_isBinary = false;
+        m_fieldData = nullptr;
+        if (next == std::istream::traits_type::eof()) {
+            // peek set the eof bit already, which would make getline fail without touching m_buffer
+            m_buffer.clear();
         } else {
-            m_it = m_line.cend();
+            std::getline(in, m_buffer);
         }
+        setLine(m_buffer.data(), m_buffer.data() + m_buffer.size(), m_buffer.data() + m_buffer.size());
         return true;
     }
 
+    bool getLine(BlockReader& in)
+    {
+        if (in.isTokenized()) {
+            return readTokenizedRecord(in);
+        }
+        if (m_hasError || (in.begin() == in.end() && !in.refill())) {
+            return false;
+        }
+        if (*in.begin() & BinaryRecord::TYPE_FLAG) {
+            if (in.end() - in.begin() < MAX_BINARY_RECORD_SIZE) {
+                // the record may cross the end of the block
+                in.refill();
+            }
+            return readBinaryRecord(in);
+        }
+        m_isBinary = false;
+        m_fieldData = nullptr;
+
+        size_t searched = 0;
+        const void* newline = nullptr;
+        while (!(newline = memchr(in.begin() + searched, '\n', static_cast<size_t>(in.end() - in.begin()) - searched))) {
+            searched = static_cast<size_t>(in.end() - in.begin());
+            if (!in.refill()) {
+                // the last line has no trailing newline
+                break;
+            }
+        }
+        const auto* lineEnd = newline ? static_cast<const char*>(newline) : in.end();
+        setLine(in.begin(), lineEnd, in.end());
+        in.advance(newline ? lineEnd + 1 : lineEnd);
+        return true;
+    }
+
+    /**
+     * Tokenize all records of @p in into @p block, such that they can be read from it later on, see
+     * BlockReader::nextRecord. This is used to tokenize data on other threads ahead of time.
+     *
+     * Text lines only get tokenized when their mode is one of @p hexModes, i.e. when they consist of
+     * hex numbers only. The other lines get parsed when they are read.
+     *
+     * @return false when a binary record could not be decoded, @p block contains the records up to it then
+     */
+    bool tokenize(BlockReader& in, std::string_view hexModes, TokenizedBlock* block)
+    {
+        while (getLine(in)) {
+            TokenizedRecord record;
+            record.lineSize = static_cast<uint32_t>(m_line.size());
+            record.isBinary = m_isBinary;
+            record.hasNewline = !m_isBinary && in.begin() != lineEnd();
+            if (m_isBinary) {
+                record.numFields = m_numFields;
+                block->fields.insert(block->fields.end(), m_fields, m_fields + m_numFields);
+            } else if (hexModes.find(mode()) == std::string_view::npos
+                       || !tokenizeHexFields(&block->fields, &record.numFields)) {
+                record.numFields = TokenizedRecord::NOT_TOKENIZED;
+            }
+            block->records.push_back(record);
+        }
+        return !m_hasError;
+    }
+
+    /**
+     * Continue to decode binary records with the given @p deltaHistories
+     *
+     * This is required to decode the data from the middle of a stream, e.g. a frame of a compressed file.
+     */
+    void setDeltaHistories(const BinaryRecord::DeltaHistory* deltaHistories)
+    {
+        std::copy(deltaHistories, deltaHistories + BinaryRecord::NumChannels, m_deltaHistories);
+    }
+
+    /**
+     * @return the state of the delta encoded channels after the current record, see setDeltaHistories
+     *
+     * This is not maintained for records that got tokenized ahead of time.
+     */
+    const BinaryRecord::DeltaHistory* deltaHistories() const
+    {
+        return m_deltaHistories;
+    }
+
     char mode() const
     {
+        if (m_isBinary) {
+            return static_cast<char>(m_line[0] & ~BinaryRecord::TYPE_FLAG);
+        }
         return m_line.empty() ? '#' : m_line[0];
     }
 
-    const std::string& line() const
+    /**
+     * @return the current line, or the raw encoded data for binary records
+     */
+    std::string_view line() const
     {
         return m_line;
     }
 
+    bool isBinary() const
+    {
+        return m_isBinary;
+    }
+
     template <typename T>
     bool readHex(T& in)
     {
+        if (m_fieldData) {
+            if (m_nextField == m_numFields) {
+                return false;
+            }
+            in = static_cast<T>(m_fieldData[m_nextField++]);
+            return true;
+        }
+
         auto it = m_it;
-        const auto end = m_line.cend();
+        const auto end = lineEnd();
         if (it == end) {
             return false;
         }
 
+#ifdef __SSE2__
+        if (m_dataEnd - it >= 16) {
+            uint64_t value = 0;
+            const auto length = parseHexNumber(it, &value);
+            // longer numbers and anything unexpected is handled below
+            if (length && length < 16 && length <= end - it && (it + length == end || it[length] == ' ')) {
+                in = static_cast<T>(value);
+                m_it = it + length == end ? end : it + length + 1;
+                return true;
+            }
+        }
+#endif
+
         T hex = 0;
         do {
             const char c = *it;
@@ -73,7 +212,7 @@ public:
                 ++it;
                 break;
             } else {
-                fprintf(stderr, "unexpected non-hex char: %d %zx\n", c, std::distance(m_line.cbegin(), it));
+                fprintf(stderr, "unexpected non-hex char: %d %zx\n", c, std::distance(m_line.data(), it));
                 return false;
             }
             ++it;
@@ -84,6 +223,20 @@ public:
         return true;
     }
 
+    /**
+     * Read up to @p maxFields hex numbers into @p fields
+     *
+     * @return the number of fields that were read
+     */
+    unsigned parseHexFields(uint64_t* fields, unsigned maxFields)
+    {
+        unsigned numFields = 0;
+        while (numFields < maxFields && readHex(fields[numFields])) {
+            ++numFields;
+        }
+        return numFields;
+    }
+
     bool operator>>(int64_t& hex)
     {
         return readHex(hex);
@@ -111,15 +264,19 @@ public:
 
     bool operator>>(std::string& str)
     {
+        if (m_isBinary) {
+            // binary records only contain numbers
+            return false;
+        }
         if (m_expectSizedStrings) {
             uint64_t size = 0;
-            if (!(*this >> size) || size > static_cast<uint64_t>(std::distance(m_it, m_line.cend()))) {
+            if (!(*this >> size) || size > static_cast<uint64_t>(std::distance(m_it, lineEnd()))) {
                 return false;
             }
             auto start = m_it;
             m_it += size;
             str.assign(start, m_it);
-            if (m_it != m_line.cend()) {
+            if (m_it != lineEnd()) {
                 // eat trailing whitespace
                 ++m_it;
             }
@@ -127,13 +284,13 @@ public:
         }
 
         auto it = m_it;
-        const auto end = m_line.cend();
+        const auto end = lineEnd();
         while (it != end && *it != ' ') {
             ++it;
         }
         if (it != m_it) {
-            str = std::string(m_it, it);
-            if (*it == ' ') {
+            str.assign(m_it, it);
+            if (it != end) {
                 ++it;
             }
             m_it = it;
@@ -145,10 +302,13 @@ public:
 
     bool operator>>(bool& flag)
     {
-        if (m_it != m_line.cend()) {
+        if (m_isBinary) {
+            return false;
+        }
+        if (m_it != lineEnd()) {
             flag = *m_it;
             m_it++;
-            if (*m_it == ' ') {
+            if (m_it != lineEnd() && *m_it == ' ') {
                 ++m_it;
             }
             return true;
@@ -158,9 +318,229 @@ public:
     }
 
 private:
+    enum : long
+    {
+        MAX_BINARY_RECORD_SIZE = BinaryRecord::HEADER_BYTES + (BinaryRecord::MAX_FIELDS + 1) / 2
+            + BinaryRecord::MAX_FIELDS * BinaryRecord::MAX_VARINT_BYTES,
+    };
+
+    const char* lineEnd() const
+    {
+        return m_line.data() + m_line.size();
+    }
+
+    /// @p dataEnd is the end of the readable memory after the line, which allows us to parse it block-wise
+#ifdef __SSE2__
+    /**
+     * Parse the hex number at the start of the 16 bytes at @p data into @p value
+     *
+     * @return the number of hex chars at @p data, @p value is only valid when that is less than 16
+     */
+    static unsigned parseHexNumber(const char* data, uint64_t* value)
+    {
+        const auto chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+        const auto isDigit =
+            _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+        const auto isLetter =
+            _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('f' + 1)));
+        const auto isHex = static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)));
+        const auto length = static_cast<unsigned>(__builtin_ctz(~isHex));
+        if (!length || length == 16) {
+            return length;
+        }
+
+        // the value of every char, zero after the end of the number
+        auto nibbles = _mm_sub_epi8(chars, _mm_or_si128(_mm_and_si128(isDigit, _mm_set1_epi8('0')),
+                                                        _mm_and_si128(isLetter, _mm_set1_epi8('a' - 10))));
+        const auto indices = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        nibbles = _mm_and_si128(nibbles, _mm_cmplt_epi8(indices, _mm_set1_epi8(static_cast<char>(length))));
+        // combine two nibbles into a byte, the first one is the more significant one
+        const auto bytes = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0xff)), 4),
+                                        _mm_srli_epi16(nibbles, 8));
+        uint64_t digits = 0;
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(&digits), _mm_packus_epi16(bytes, bytes));
+        // the 16 digits are in big endian order now, drop the zeros after the end of the number
+        *value = __builtin_bswap64(digits) >> (4 * (16 - length));
+        return length;
+    }
+#endif
+
+    void setLine(const char* begin, const char* end, const char* dataEnd)
+    {
+        m_line = std::string_view(begin, static_cast<size_t>(end - begin));
+        m_it = m_line.size() > 2 ? begin + 2 : end;
+        m_dataEnd = dataEnd;
+    }
+
+    bool readTokenizedRecord(BlockReader& in)
+    {
+        const TokenizedRecord* record = nullptr;
+        const uint64_t* fields = nullptr;
+        while (!(record = in.nextRecord(&fields))) {
+            if (!in.refill()) {
+                return false;
+            }
+        }
+        setLine(in.begin(), in.begin() + record->lineSize, in.end());
+        in.advance(lineEnd() + record->hasNewline);
+        m_isBinary = record->isBinary;
+        if (record->numFields == TokenizedRecord::NOT_TOKENIZED) {
+            m_fieldData = nullptr;
+        } else {
+            m_fieldData = fields;
+            m_numFields = record->numFields;
+            m_nextField = 0;
+        }
+        return true;
+    }
+
+    /**
+     * Parse all fields of the current text line as hex numbers into @p fields
+     *
+     * Unlike readHex, this does not report errors. Lines that readHex would parse
+     * differently, e.g. with consecutive spaces, are rejected too.
+     */
+    bool tokenizeHexFields(std::vector<uint64_t>* fields, uint32_t* numFields) const
+    {
+        const auto oldSize = fields->size();
+        auto it = m_it;
+        const auto end = lineEnd();
+        while (it != end) {
+            const auto start = it;
+            uint64_t hex = 0;
+            for (; it != end && *it != ' '; ++it) {
+                const char c = *it;
+                if ('0' <= c && c <= '9') {
+                    hex = hex * 16 + static_cast<uint64_t>(c - '0');
+                } else if ('a' <= c && c <= 'f') {
+                    hex = hex * 16 + static_cast<uint64_t>(c - 'a' + 10);
+                } else {
+                    fields->resize(oldSize);
+                    return false;
+                }
+            }
+            if (it == start) {
+                fields->resize(oldSize);
+                return false;
+            }
+            fields->push_back(hex);
+            if (it != end) {
+                ++it;
+            }
+        }
+        *numFields = static_cast<uint32_t>(fields->size() - oldSize);
+        return true;
+    }
+
+    bool readBinaryRecord(std::istream& in)
+    {
+        auto* buffer = in.rdbuf();
+        m_buffer.clear();
+        const bool decoded = decodeBinaryRecord([this, buffer]() -> int {
+            const auto byte = buffer->sbumpc();
+            if (byte == std::istream::traits_type::eof()) {
+                return -1;
+            }
+            m_buffer.push_back(static_cast<char>(byte));
+            return byte;
+        });
+        m_line = m_buffer;
+        if (!decoded) {
+            in.setstate(std::ios::eofbit | std::ios::failbit);
+        }
+        return decoded;
+    }
+
+    bool readBinaryRecord(BlockReader& in)
+    {
+        const auto* it = in.begin();
+        const auto* end = in.end();
+        const bool decoded = decodeBinaryRecord([&it, end]() -> int {
+            return it != end ? static_cast<unsigned char>(*it++) : -1;
+        });
+        m_line = std::string_view(in.begin(), static_cast<size_t>(it - in.begin()));
+        in.advance(it);
+        m_hasError = !decoded;
+        return decoded;
+    }
+
+    /**
+     * Decode the fields of a binary record.
+     *
+     * @p nextByte returns the next byte of the record, or -1 at the end of the input
+     */
+    template <typename NextByte>
+    bool decodeBinaryRecord(NextByte nextByte)
+    {
+        m_isBinary = true;
+        m_fieldData = m_fields;
+        m_nextField = 0;
+        m_numFields = 0;
+
+        const auto tag = nextByte();
+        const auto header = nextByte();
+        if (header == -1) {
+            return false;
+        }
+
+        const auto numFields = static_cast<unsigned>(header & BinaryRecord::FIELD_COUNT_MASK);
+        uint8_t descriptors[(BinaryRecord::MAX_FIELDS + 1) / 2] = {};
+        if (header & BinaryRecord::DELTA_FLAG) {
+            for (unsigned i = 0; i < (numFields + 1) / 2; ++i) {
+                const auto byte = nextByte();
+                if (byte == -1) {
+                    fprintf(stderr, "unexpected end of binary record: %x\n", tag);
+                    return false;
+                }
+                descriptors[i] = static_cast<uint8_t>(byte);
+            }
+        }
+
+        for (unsigned i = 0; i < numFields; ++i) {
+            uint64_t value = 0;
+            unsigned shift = 0;
+            while (true) {
+                const auto byte = nextByte();
+                if (byte == -1) {
+                    fprintf(stderr, "unexpected end of binary record: %x\n", tag);
+                    return false;
+                } else if (shift >= 64) {
+                    fprintf(stderr, "varint overflow in binary record: %x\n", tag);
+                    return false;
+                }
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) {
+                    break;
+                }
+                shift += 7;
+            }
+            const auto descriptor = descriptors[i / 2] >> ((i % 2) * 4);
+            const auto channel = descriptor & 3;
+            if (channel != BinaryRecord::NoChannel) {
+                value = m_deltaHistories[channel].decode(value, descriptor >> 2);
+            }
+            m_fields[i] = value;
+        }
+        m_numFields = numFields;
+        return true;
+    }
+
     bool m_expectSizedStrings = false;
-    std::string m_line;
-    std::string::const_iterator m_it;
+    bool m_isBinary = false;
+    bool m_hasError = false;
+    // the line data when reading from an istream
+    std::string m_buffer;
+    std::string_view m_line;
+    const char* m_it = nullptr;
+    // the end of the readable memory after the line
+    const char* m_dataEnd = nullptr;
+    // decoded fields of the current binary record
+    uint64_t m_fields[BinaryRecord::MAX_FIELDS];
+    // the fields of the current record when it is binary or was tokenized ahead of time, else nullptr
+    const uint64_t* m_fieldData = nullptr;
+    unsigned m_numFields = 0;
+    unsigned m_nextField = 0;
+    BinaryRecord::DeltaHistory m_deltaHistories[BinaryRecord::NumChannels];
 };
 
 #endif // LINEREADER_H
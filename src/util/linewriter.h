@@ -17,10 +17,13 @@
 #include <cmath>
 #include <cstring>
 #include <string>
+#include <string_view>
 
 #include <errno.h>
 #include <unistd.h>
 
+#include "binaryrecord.h"
+
 /**
  * Custom buffered I/O writer for high performance and signal safety
  * See e.g.: https://bugs.kde.org/show_bug.cgi?id=393387
@@ -33,6 +36,18 @@ public:
         BUFFER_CAPACITY = PIPE_BUF
     };
 
+    /**
+     * Receives the buffered data instead of the file descriptor, e.g. to compress it
+     */
+    class Sink
+    {
+    public:
+        virtual ~Sink() = default;
+
+        /// @return false when the data could not be written
+        virtual bool write(const char* data, size_t size) = 0;
+    };
+
     LineWriter(int fd)
         : fd(fd)
         , buffer(new char[BUFFER_CAPACITY])
@@ -117,23 +132,64 @@ public:
             bufferSize += end - start;
         }
 
+        return writeRaw(line);
+    }
+
+    /**
+     * write @p data verbatim to the buffer, e.g. a binary record as returned by LineReader::line()
+     *
+     * this must not be used for binary records with delta encoded fields, as those
+     * depend on the previous records of the stream they were read from
+     */
+    bool writeRaw(std::string_view data)
+    {
+        const auto length = data.length();
         if (availableSpace() < length) {
             if (!flush()) {
                 return false;
             }
             if (availableSpace() < length) {
-                ssize_t ret = 0;
-                do {
-                    ret = ::write(fd, line.data(), length);
-                } while (ret < 0 && errno == EINTR);
-                return ret >= 0;
+                return writeOut(data.data(), length);
             }
         }
-        memcpy(out(), line.data(), length);
+        memcpy(out(), data.data(), length);
         bufferSize += length;
         return true;
     }
 
+    /**
+     * Encode subsequent calls to writeHexLine as binary records instead of text lines.
+     *
+     * Only enable this after the version line was written and when the file format
+     * version is at least BinaryRecord::FIRST_FILE_FORMAT_VERSION.
+     * See binaryrecord.h for a description of the encoding.
+     */
+    void setBinaryRecords(bool binaryRecords)
+    {
+        this->binaryRecords = binaryRecords;
+    }
+
+    bool writesBinaryRecords() const
+    {
+        return binaryRecords;
+    }
+
+    /// the delta histories of the binary records written so far, i.e. the state for the next record
+    const BinaryRecord::DeltaHistory* currentDeltaHistories() const
+    {
+        return deltaHistories;
+    }
+
+    /**
+     * Pass the buffered data to @p sink when flushing, instead of writing it to the file descriptor.
+     *
+     * The sink must outlive this writer, or get reset before it is destroyed.
+     */
+    void setSink(Sink* sink)
+    {
+        this->sink = sink;
+    }
+
     /**
      * write one of the common heaptrack output lines to the buffer
      *
@@ -141,10 +197,17 @@ public:
      * @arg args are all printed as hex numbers without leading 0x prefix
      *
      * e.g.: i 561072a1cf63 1 1c 18 70
+     *
+     * when binary records are enabled, the same data is written as a binary record instead
+     * and arguments wrapped in BinaryRecord::Delta get delta encoded
      */
     template <typename... T>
     bool writeHexLine(const char type, T... args)
     {
+        if (binaryRecords) {
+            return writeBinaryRecord(type, args...);
+        }
+
         constexpr const int numArgs = sizeof...(T);
         constexpr const int maxHexCharsPerArg = 16; // 2^64 == 16^16
         constexpr const int maxCharsForArgs = numArgs * maxHexCharsPerArg;
@@ -176,6 +239,72 @@ public:
         return true;
     }
 
+    template <typename... T>
+    bool writeBinaryRecord(const char type, T... args)
+    {
+        constexpr const int numArgs = sizeof...(T);
+        static_assert(numArgs <= BinaryRecord::MAX_FIELDS, "too many fields for a binary record");
+        constexpr const bool hasDelta = (std::is_same<T, BinaryRecord::Delta>::value || ...);
+        constexpr const int descriptorBytes = hasDelta ? (numArgs + 1) / 2 : 0;
+        constexpr const int totalMaxBytes =
+            BinaryRecord::HEADER_BYTES + descriptorBytes + numArgs * BinaryRecord::MAX_VARINT_BYTES;
+        static_assert(totalMaxBytes < BUFFER_CAPACITY, "cannot write record larger than buffer capacity");
+        assert(!(type & BinaryRecord::TYPE_FLAG));
+
+        if (totalMaxBytes > availableSpace() && !flush()) {
+            return false;
+        }
+
+        auto* buffer = out();
+        const auto* start = buffer;
+
+        *buffer = static_cast<char>(type | BinaryRecord::TYPE_FLAG);
+        ++buffer;
+
+        *buffer = static_cast<char>(numArgs | (hasDelta ? BinaryRecord::DELTA_FLAG : 0));
+        ++buffer;
+
+        auto* descriptors = buffer;
+        memset(descriptors, 0, descriptorBytes);
+        buffer += descriptorBytes;
+
+        unsigned field = 0;
+        ((buffer = writeField(buffer, descriptors, field++, args)), ...);
+
+        bufferSize += buffer - start;
+
+        return true;
+    }
+
+    template <typename V>
+    static char* writeField(char* buffer, char* /*descriptors*/, unsigned /*field*/, V value)
+    {
+        return writeVarint(buffer, value);
+    }
+
+    char* writeField(char* buffer, char* descriptors, unsigned field, BinaryRecord::Delta value)
+    {
+        assert(value.channel != BinaryRecord::NoChannel && value.channel < BinaryRecord::NumChannels);
+        unsigned slot = 0;
+        const auto encoded = deltaHistories[value.channel].encode(value.value, &slot);
+        descriptors[field / 2] |= static_cast<char>((value.channel | (slot << 2)) << ((field % 2) * 4));
+        return writeVarint(buffer, encoded);
+    }
+
+    template <typename V>
+    static char* writeVarint(char* buffer, V value)
+    {
+        static_assert(std::is_unsigned<V>::value, "can only encode unsigned numbers as varint");
+
+        while (value >= 0x80) {
+            *buffer = static_cast<char>(value | 0x80);
+            ++buffer;
+            value >>= 7;
+        }
+        *buffer = static_cast<char>(value);
+        return buffer + 1;
+    }
+
     inline static unsigned clz(unsigned V)
     {
         return __builtin_clz(V);
@@ -229,6 +358,11 @@ public:
         return buffer + requiredBufSize;
     }
 
+    static char* writeHexNumber(char* buffer, BinaryRecord::Delta value)
+    {
+        return writeHexNumber(buffer, value.value);
+    }
+
     template <typename V>
     static char* writeHexNumbers(char* buffer, V value)
     {
@@ -252,12 +386,7 @@ public:
             return true;
         }
 
-        ssize_t ret = 0;
-        do {
-            ret = ::write(fd, buffer.get(), bufferSize);
-        } while (ret < 0 && errno == EINTR);
-
-        if (ret < 0) {
+        if (!writeOut(buffer.get(), bufferSize)) {
             return false;
         }
 
@@ -280,6 +409,19 @@ public:
     }
 
 private:
+    bool writeOut(const char* data, size_t size)
+    {
+        if (sink) {
+            return sink->write(data, size);
+        }
+
+        ssize_t ret = 0;
+        do {
+            ret = ::write(fd, data, size);
+        } while (ret < 0 && errno == EINTR);
+        return ret >= 0;
+    }
+
     size_t availableSpace() const
     {
         return BUFFER_CAPACITY - bufferSize;
@@ -292,6 +434,9 @@ private:
 
     int fd = -1;
     size_t bufferSize = 0;
+    bool binaryRecords = false;
+    Sink* sink = nullptr;
+    BinaryRecord::DeltaHistory deltaHistories[BinaryRecord::NumChannels];
     std::unique_ptr<char[]> buffer;
 };
 
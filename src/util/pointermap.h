@@ -8,8 +8,10 @@
 #define POINTERMAP_H
 
 #include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <vector>
 
 #include <tsl/robin_map.h>
@@ -19,7 +21,12 @@
 
 #include <sys/types.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "indices.h"
+#include "spillfile.h"
 
 /**
  * Information for a single call to an allocation function for big allocations.
@@ -53,9 +60,20 @@ struct hash<IndexedAllocationInfo>
 
 struct AllocationInfoSet
 {
-    AllocationInfoSet()
+    enum : size_t
+    {
+        DEFAULT_RESERVED_SIZE = 625000
+    };
+
+    explicit AllocationInfoSet(size_t reservedSize = DEFAULT_RESERVED_SIZE)
     {
-        set.reserve(625000);
+        set.reserve(reservedSize);
+    }
+
+    /// @return the approximate number of bytes used by the set
+    uint64_t memoryUsage() const
+    {
+        return set.bucket_count() * (sizeof(IndexedAllocationInfo) + sizeof(size_t));
     }
 
     bool add(uint64_t size, TraceIndex traceIndex, AllocationInfoIndex* allocationIndex)
@@ -74,6 +92,314 @@ struct AllocationInfoSet
     tsl::robin_set<IndexedAllocationInfo> set;
 };
 
+/**
+ * An open-addressing hash table of the 16bit small pointer parts of a page to their allocation indices.
+ *
+ * The slots are split into groups of 16 and every slot has a control byte that is either empty,
+ * deleted or holds 7 bits of the hash of its key. Lookups compare the control bytes of a whole
+ * group at once, with SSE2 where available, and only look at the keys whose hash bits match.
+ * Tables with less than 16 slots pad their only group with sentinel control bytes.
+ *
+ * All data lives in a single allocation: the control bytes, followed by the keys and the values.
+ * That are 7 bytes per slot, and up to 15/16 of the slots are used.
+ */
+class PointerPage
+{
+public:
+    PointerPage() = default;
+    PointerPage(PointerPage&&) = default;
+    PointerPage& operator=(PointerPage&&) = default;
+
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    uint32_t size() const
+    {
+        return m_size;
+    }
+
+    /// @return the number of bytes allocated for the slots
+    uint64_t byteSize() const
+    {
+        return byteSize(m_capacity);
+    }
+
+    /// insert @p value for @p key, or overwrite the existing value of @p key
+    void insert(uint16_t key, AllocationInfoIndex value)
+    {
+        const auto hash = hashOf(key);
+        const auto slot = find(hash, key);
+        if (slot != NOT_FOUND) {
+            values()[slot] = value;
+            return;
+        }
+
+        auto target = findInsertSlot(hash);
+        if (target == NOT_FOUND || (!m_growthLeft && controls()[target] == EMPTY)) {
+            grow();
+            target = findInsertSlot(hash);
+        }
+        if (controls()[target] == EMPTY) {
+            --m_growthLeft;
+        }
+        setSlot(target, hash, key, value);
+        ++m_size;
+    }
+
+    /// remove @p key and @return its value, the bool is false when the key wasn't found
+    std::pair<AllocationInfoIndex, bool> take(uint16_t key)
+    {
+        const auto slot = find(hashOf(key), key);
+        if (slot == NOT_FOUND) {
+            return {{}, false};
+        }
+
+        const auto value = values()[slot];
+        // probing stops at groups with an empty slot, so we only need a tombstone in full groups
+        if (matchEmpty(slot / GROUP_SIZE)) {
+            controls()[slot] = EMPTY;
+            ++m_growthLeft;
+        } else {
+            controls()[slot] = DELETED;
+        }
+        --m_size;
+
+        // give memory back after a page got mostly freed
+        if (m_capacity > MIN_CAPACITY && m_size < m_capacity / 8) {
+            rehash(capacityFor(m_size * 2));
+        }
+        return {value, true};
+    }
+
+    /// @return the raw data of all slots, of size byteSize
+    const char* data() const
+    {
+        return m_data.get();
+    }
+
+    bool isLoaded() const
+    {
+        return m_data || !m_capacity;
+    }
+
+    /// free the slots, they must be restored via @c load before the page can be used again
+    void unload()
+    {
+        m_data.reset();
+    }
+
+    /// restore the slots from @p data, which must be a copy of the former @c data
+    void load(const char* data)
+    {
+        m_data.reset(new char[byteSize()]);
+        memcpy(m_data.get(), data, byteSize());
+    }
+
+private:
+    enum : int8_t
+    {
+        EMPTY = -128,
+        DELETED = -2,
+        SENTINEL = -1,
+    };
+    enum : uint32_t
+    {
+        GROUP_SIZE = 16,
+        MIN_CAPACITY = 4,
+        NOT_FOUND = std::numeric_limits<uint32_t>::max(),
+        // the lower bits of the hash select the group, the upper 7 bits go into the control byte
+        GROUP_HASH_BITS = 25,
+    };
+
+    uint32_t numGroups() const
+    {
+        return (m_capacity + GROUP_SIZE - 1) / GROUP_SIZE;
+    }
+
+    static uint32_t controlsSize(uint32_t capacity)
+    {
+        return (capacity + GROUP_SIZE - 1) / GROUP_SIZE * GROUP_SIZE;
+    }
+
+    static uint64_t byteSize(uint32_t capacity)
+    {
+        return controlsSize(capacity) + uint64_t(capacity) * (sizeof(uint16_t) + sizeof(AllocationInfoIndex));
+    }
+
+    static uint32_t maxSize(uint32_t capacity)
+    {
+        return capacity - capacity / 16 - (capacity < GROUP_SIZE);
+    }
+
+    /// @return the capacity for @p size slots, 4 or 8 for tiny pages and otherwise whole groups growing by 1/8
+    static uint32_t capacityFor(uint32_t size)
+    {
+        uint32_t capacity = MIN_CAPACITY;
+        while (maxSize(capacity) < size) {
+            capacity = capacity < GROUP_SIZE ? capacity * 2
+                                             : (capacity / GROUP_SIZE + std::max(1u, capacity / GROUP_SIZE / 8)) * GROUP_SIZE;
+        }
+        return capacity;
+    }
+
+    static uint32_t hashOf(uint16_t key)
+    {
+        return key * 0x9e3779b1u;
+    }
+
+    static int8_t controlOf(uint32_t hash)
+    {
+        return static_cast<int8_t>(hash >> GROUP_HASH_BITS);
+    }
+
+    uint32_t groupOf(uint32_t hash) const
+    {
+        // map the hash onto the groups without a division, the number of groups is no power of two
+        return static_cast<uint32_t>((uint64_t(hash & ((1u << GROUP_HASH_BITS) - 1)) * numGroups())
+                                     >> GROUP_HASH_BITS);
+    }
+
+    uint32_t nextGroup(uint32_t group) const
+    {
+        return group + 1 == numGroups() ? 0 : group + 1;
+    }
+
+    int8_t* controls() const
+    {
+        return reinterpret_cast<int8_t*>(m_data.get());
+    }
+
+    uint16_t* keys() const
+    {
+        return reinterpret_cast<uint16_t*>(m_data.get() + controlsSize(m_capacity));
+    }
+
+    AllocationInfoIndex* values() const
+    {
+        // the capacity is even, so this is aligned too
+        return reinterpret_cast<AllocationInfoIndex*>(m_data.get() + controlsSize(m_capacity)
+                                                      + m_capacity * sizeof(uint16_t));
+    }
+
+    /// @return a bit mask of the slots in @p group whose control byte equals @p control
+    uint32_t match(uint32_t group, int8_t control) const
+    {
+        const auto* groupControls = controls() + group * GROUP_SIZE;
+#ifdef __SSE2__
+        const auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(groupControls));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(control))));
+#else
+        uint32_t mask = 0;
+        for (uint32_t i = 0; i < GROUP_SIZE; ++i) {
+            mask |= uint32_t(groupControls[i] == control) << i;
+        }
+        return mask;
+#endif
+    }
+
+    uint32_t matchEmpty(uint32_t group) const
+    {
+        return match(group, EMPTY);
+    }
+
+    /// @return a bit mask of the slots in @p group that are empty or deleted
+    uint32_t matchFree(uint32_t group) const
+    {
+        const auto* groupControls = controls() + group * GROUP_SIZE;
+#ifdef __SSE2__
+        const auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(groupControls));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmplt_epi8(bytes, _mm_set1_epi8(SENTINEL))));
+#else
+        uint32_t mask = 0;
+        for (uint32_t i = 0; i < GROUP_SIZE; ++i) {
+            mask |= uint32_t(groupControls[i] < SENTINEL) << i;
+        }
+        return mask;
+#endif
+    }
+
+    uint32_t find(uint32_t hash, uint16_t key) const
+    {
+        if (!m_capacity) {
+            return NOT_FOUND;
+        }
+        const auto control = controlOf(hash);
+        auto group = groupOf(hash);
+        while (true) {
+            for (auto matches = match(group, control); matches; matches &= matches - 1) {
+                const auto slot = group * GROUP_SIZE + __builtin_ctz(matches);
+                if (keys()[slot] == key) {
+                    return slot;
+                }
+            }
+            if (matchEmpty(group)) {
+                return NOT_FOUND;
+            }
+            group = nextGroup(group);
+        }
+    }
+
+    uint32_t findInsertSlot(uint32_t hash) const
+    {
+        if (!m_capacity) {
+            return NOT_FOUND;
+        }
+        auto group = groupOf(hash);
+        while (true) {
+            if (const auto matches = matchFree(group)) {
+                return group * GROUP_SIZE + __builtin_ctz(matches);
+            }
+            group = nextGroup(group);
+        }
+    }
+
+    void setSlot(uint32_t slot, uint32_t hash, uint16_t key, AllocationInfoIndex value)
+    {
+        controls()[slot] = controlOf(hash);
+        keys()[slot] = key;
+        values()[slot] = value;
+    }
+
+    void grow()
+    {
+        if (m_capacity && m_size <= maxSize(m_capacity) / 2) {
+            // there are lots of tombstones, get rid of them
+            rehash(m_capacity);
+        } else {
+            rehash(capacityFor(m_size + 1));
+        }
+    }
+
+    void rehash(uint32_t capacity)
+    {
+        auto oldData = std::move(m_data);
+        const auto oldCapacity = m_capacity;
+        const auto* oldControls = reinterpret_cast<const int8_t*>(oldData.get());
+        const auto* oldKeys = reinterpret_cast<const uint16_t*>(oldData.get() + controlsSize(oldCapacity));
+        const auto* oldValues = reinterpret_cast<const AllocationInfoIndex*>(
+            oldData.get() + controlsSize(oldCapacity) + oldCapacity * sizeof(uint16_t));
+
+        m_capacity = capacity;
+        m_data.reset(new char[byteSize()]);
+        memset(controls(), EMPTY, m_capacity);
+        memset(controls() + m_capacity, SENTINEL, controlsSize(m_capacity) - m_capacity);
+        for (uint32_t slot = 0; slot < oldCapacity; ++slot) {
+            if (oldControls[slot] >= 0) {
+                const auto hash = hashOf(oldKeys[slot]);
+                setSlot(findInsertSlot(hash), hash, oldKeys[slot], oldValues[slot]);
+            }
+        }
+        m_growthLeft = maxSize(m_capacity) - m_size;
+    }
+
+    std::unique_ptr<char[]> m_data;
+    uint32_t m_capacity = 0;
+    uint32_t m_size = 0;
+    uint32_t m_growthLeft = 0;
+};
+
 /**
  * A low-memory-overhead map of 64bit pointer addresses to 32bit allocation
  * indices.
@@ -83,10 +409,13 @@ struct AllocationInfoSet
  * 16bit small part by dividing the address by some number (PageSize below) and
  * keeping the result as the big part and the residue as the small part.
  *
- * The big part of the address is used for a hash map to lookup the Indices
- * structure where we aggregate common pointers in two memory-efficient vectors,
- * one for the 16bit small pointer pairs, and one for the 32bit allocation
- * indices.
+ * The big part of the address is used for a hash map to lookup the PointerPage,
+ * a flat hash table of the 16bit small parts to the 32bit allocation indices.
+ * Adding and taking pointers thus is O(1), and densely used pages need about
+ * 8 bytes per live pointer.
+ *
+ * Optionally, the least recently used pages get moved into a SpillFile to bound
+ * the heap usage, see setMemoryBudget.
  */
 class PointerMap
 {
@@ -111,23 +440,40 @@ public:
         map.reserve(1024);
     }
 
+    /**
+     * Keep at most @p maxHeapSize bytes of pointer pages on the heap, the least recently used ones
+     * get moved to @p spillFile once we exceed that. A @p maxHeapSize of zero disables spilling.
+     */
+    void setMemoryBudget(uint64_t maxHeapSize, SpillFile* spillFile)
+    {
+        m_maxHeapSize = spillFile && spillFile->isValid() ? maxHeapSize : 0;
+        m_spillFile = spillFile;
+    }
+
+    /// @return the number of bytes of the pointer pages on the heap
+    uint64_t heapSize() const
+    {
+        return m_heapSize;
+    }
+
+    uint64_t peakHeapSize() const
+    {
+        return m_peakHeapSize;
+    }
+
     void addPointer(const uint64_t ptr, const AllocationInfoIndex allocationIndex)
     {
         const SplitPointer pointer(ptr);
 
         auto mapIt = map.find(pointer.big);
         if (mapIt == map.end()) {
-            mapIt = map.insert(mapIt, std::make_pair(pointer.big, Indices()));
-        }
-        auto& indices = mapIt.value();
-        auto pageIt = std::lower_bound(indices.smallPtrParts.begin(), indices.smallPtrParts.end(), pointer.small);
-        auto allocationIt = indices.allocationIndices.begin() + distance(indices.smallPtrParts.begin(), pageIt);
-        if (pageIt == indices.smallPtrParts.end() || *pageIt != pointer.small) {
-            indices.smallPtrParts.insert(pageIt, pointer.small);
-            indices.allocationIndices.insert(allocationIt, allocationIndex);
-        } else {
-            *allocationIt = allocationIndex;
+            mapIt = map.insert(mapIt, std::make_pair(pointer.big, Page()));
         }
+        auto& page = mapIt.value();
+        use(page);
+        const auto oldHeapSize = heapSize(page);
+        page.pointers.insert(pointer.small, allocationIndex);
+        addHeapSize(heapSize(page) - oldHeapSize);
     }
 
     std::pair<AllocationInfoIndex, bool> takePointer(const uint64_t ptr)
@@ -138,28 +484,100 @@ public:
         if (mapIt == map.end()) {
             return {{}, false};
         }
-        auto& indices = mapIt.value();
-        auto pageIt = std::lower_bound(indices.smallPtrParts.begin(), indices.smallPtrParts.end(), pointer.small);
-        if (pageIt == indices.smallPtrParts.end() || *pageIt != pointer.small) {
-            return {{}, false};
-        }
-        auto allocationIt = indices.allocationIndices.begin() + distance(indices.smallPtrParts.begin(), pageIt);
-        auto index = *allocationIt;
-        indices.allocationIndices.erase(allocationIt);
-        indices.smallPtrParts.erase(pageIt);
-        if (indices.allocationIndices.empty()) {
+        auto& page = mapIt.value();
+        use(page);
+        const auto oldHeapSize = heapSize(page);
+        const auto allocation = page.pointers.take(pointer.small);
+        if (page.pointers.empty()) {
+            m_heapSize -= oldHeapSize;
             map.erase(mapIt);
+        } else {
+            m_heapSize -= oldHeapSize - heapSize(page);
         }
-        return {index, true};
+        return allocation;
     }
 
 private:
-    struct Indices
+    struct Page
     {
-        std::vector<uint16_t> smallPtrParts;
-        std::vector<AllocationInfoIndex> allocationIndices;
+        PointerPage pointers;
+        // where the pointers got spilled to, if they did
+        uint64_t spillOffset = SpillFile::INVALID_OFFSET;
+        uint64_t lastUse = 0;
     };
-    tsl::robin_map<uint64_t, Indices> map;
+
+    static uint64_t heapSize(const Page& page)
+    {
+        return page.pointers.isLoaded() ? page.pointers.byteSize() : 0;
+    }
+
+    void addHeapSize(uint64_t size)
+    {
+        m_heapSize += size;
+        if (m_heapSize > m_peakHeapSize) {
+            m_peakHeapSize = m_heapSize;
+        }
+        if (m_maxHeapSize && m_heapSize > m_maxHeapSize) {
+            spill();
+        }
+    }
+
+    /// mark @p page as recently used and read it back in when it got spilled
+    void use(Page& page)
+    {
+        page.lastUse = ++m_clock;
+        if (page.spillOffset == SpillFile::INVALID_OFFSET) {
+            return;
+        }
+
+        page.pointers.load(m_spillFile->data(page.spillOffset));
+        m_spillFile->free(page.spillOffset, page.pointers.byteSize());
+        page.spillOffset = SpillFile::INVALID_OFFSET;
+        // don't spill anything here, the page is about to get modified
+        m_heapSize += heapSize(page);
+        if (m_heapSize > m_peakHeapSize) {
+            m_peakHeapSize = m_heapSize;
+        }
+    }
+
+    /// move the least recently used pages into the spill file, until we are well below the budget again
+    void spill()
+    {
+        std::vector<std::pair<uint64_t, uint64_t>> candidates;
+        for (auto it = map.begin(); it != map.end(); ++it) {
+            if (it->second.spillOffset == SpillFile::INVALID_OFFSET && !it->second.pointers.empty()) {
+                candidates.push_back({it->second.lastUse, it->first});
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        const auto targetHeapSize = m_maxHeapSize / 4 * 3;
+        for (const auto& candidate : candidates) {
+            if (m_heapSize <= targetHeapSize) {
+                break;
+            }
+            auto& page = map.find(candidate.second).value();
+            const auto size = page.pointers.byteSize();
+            const auto offset = m_spillFile->allocate(size);
+            if (offset == SpillFile::INVALID_OFFSET) {
+                // the spill file is full, keep everything else on the heap
+                m_maxHeapSize = 0;
+                break;
+            }
+            memcpy(m_spillFile->data(offset), page.pointers.data(), size);
+            m_heapSize -= heapSize(page);
+            page.spillOffset = offset;
+            page.pointers.unload();
+        }
+        m_spillFile->release();
+    }
+
+    tsl::robin_map<uint64_t, Page> map;
+    uint64_t m_heapSize = 0;
+    uint64_t m_peakHeapSize = 0;
+    uint64_t m_maxHeapSize = 0;
+    SpillFile* m_spillFile = nullptr;
+    uint64_t m_clock = 0;
 };
 
 #endif // POINTERMAP_H
@@ -0,0 +1,190 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#ifndef SPILLFILE_H
+#define SPILLFILE_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * A temporary, memory-mapped file to move rarely used data out of the heap
+ *
+ * The file gets unlinked directly after creation, so it disappears once we exit.
+ * The data in it is backed by the file instead of anonymous memory, which allows
+ * the kernel to write it out and reclaim the memory when it runs low.
+ *
+ * Blocks are allocated in power-of-two size classes, freed blocks get reused.
+ */
+class SpillFile
+{
+public:
+    /// create the file in @p directory, or in $TMPDIR resp. /tmp if it is empty
+    explicit SpillFile(std::string directory = {})
+    {
+        if (directory.empty()) {
+            const auto* tmpDir = getenv("TMPDIR");
+            directory = tmpDir && tmpDir[0] ? tmpDir : "/tmp";
+        }
+        auto path = directory + "/heaptrack.spill.XXXXXX";
+        m_fd = mkstemp(&path[0]);
+        if (m_fd == -1) {
+            return;
+        }
+        unlink(path.c_str());
+
+        // reserve the address space once, such that the data never moves
+        m_data = mmap(nullptr, MAX_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (m_data == MAP_FAILED) {
+            m_data = nullptr;
+            close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+    ~SpillFile()
+    {
+        if (m_data) {
+            munmap(m_data, MAX_SIZE);
+        }
+        if (m_fd != -1) {
+            close(m_fd);
+        }
+    }
+
+    SpillFile(const SpillFile&) = delete;
+    SpillFile& operator=(const SpillFile&) = delete;
+
+    bool isValid() const
+    {
+        return m_fd != -1;
+    }
+
+    enum : uint64_t
+    {
+        INVALID_OFFSET = UINT64_MAX
+    };
+
+    /// @return the offset of a block of at least @p size bytes, or INVALID_OFFSET when the file cannot grow
+    uint64_t allocate(uint64_t size)
+    {
+        const auto sizeClass = sizeClassOf(size);
+        if (sizeClass < m_freeBlocks.size() && !m_freeBlocks[sizeClass].empty()) {
+            const auto offset = m_freeBlocks[sizeClass].back();
+            m_freeBlocks[sizeClass].pop_back();
+            addUsedSize(blockSize(sizeClass));
+            return offset;
+        }
+
+        const auto offset = m_fileSize;
+        const auto newFileSize = m_fileSize + blockSize(sizeClass);
+        if (newFileSize > m_mappedSize && !grow(newFileSize)) {
+            return INVALID_OFFSET;
+        }
+        m_fileSize = newFileSize;
+        addUsedSize(blockSize(sizeClass));
+        return offset;
+    }
+
+    /// free the block at @p offset, @p size must be the one passed to @c allocate
+    void free(uint64_t offset, uint64_t size)
+    {
+        const auto sizeClass = sizeClassOf(size);
+        if (sizeClass >= m_freeBlocks.size()) {
+            m_freeBlocks.resize(sizeClass + 1);
+        }
+        m_freeBlocks[sizeClass].push_back(offset);
+        m_usedSize -= blockSize(sizeClass);
+    }
+
+    char* data(uint64_t offset) const
+    {
+        return static_cast<char*>(m_data) + offset;
+    }
+
+    /// drop the pages of the file from our resident memory, they get read back on demand
+    void release()
+    {
+        if (m_mappedSize) {
+            madvise(m_data, m_mappedSize, MADV_DONTNEED);
+        }
+    }
+
+    uint64_t usedSize() const
+    {
+        return m_usedSize;
+    }
+
+    uint64_t peakUsedSize() const
+    {
+        return m_peakUsedSize;
+    }
+
+private:
+    static constexpr uint64_t MAX_SIZE = 1ull << 40;
+    static constexpr uint64_t GROW_SIZE = 64ull << 20;
+    static constexpr uint32_t MIN_SIZE_CLASS = 6;
+
+    static uint32_t sizeClassOf(uint64_t size)
+    {
+        auto sizeClass = MIN_SIZE_CLASS;
+        while (blockSize(sizeClass) < size) {
+            ++sizeClass;
+        }
+        return sizeClass;
+    }
+
+    static uint64_t blockSize(uint32_t sizeClass)
+    {
+        return uint64_t(1) << sizeClass;
+    }
+
+    void addUsedSize(uint64_t size)
+    {
+        m_usedSize += size;
+        if (m_usedSize > m_peakUsedSize) {
+            m_peakUsedSize = m_usedSize;
+        }
+    }
+
+    bool grow(uint64_t minSize)
+    {
+        if (!isValid()) {
+            return false;
+        }
+        auto newSize = m_mappedSize;
+        while (newSize < minSize) {
+            newSize += GROW_SIZE;
+        }
+        if (newSize > MAX_SIZE || ftruncate(m_fd, static_cast<off_t>(newSize)) != 0) {
+            return false;
+        }
+        auto* mapped = mmap(data(m_mappedSize), newSize - m_mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                            m_fd, static_cast<off_t>(m_mappedSize));
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        m_mappedSize = newSize;
+        return true;
+    }
+
+    int m_fd = -1;
+    void* m_data = nullptr;
+    uint64_t m_mappedSize = 0;
+    uint64_t m_fileSize = 0;
+    uint64_t m_usedSize = 0;
+    uint64_t m_peakUsedSize = 0;
+    // the offsets of the freed blocks, by their size class
+    std::vector<std::vector<uint64_t>> m_freeBlocks;
+};
+
+#endif // SPILLFILE_H
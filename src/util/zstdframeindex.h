@@ -0,0 +1,129 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#ifndef ZSTDFRAMEINDEX_H
+#define ZSTDFRAMEINDEX_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Index of the independent zstd frames that heaptrack_interpret --zstd writes.
+ *
+ * Every frame ends at a record boundary, which allows readers to decompress and
+ * tokenize the frames in parallel. This relies on heaptrack_interpret writing no
+ * delta encoded binary records, whose decoding would depend on the previous frames.
+ * The index gets appended to the data as a skippable zstd frame, which all zstd
+ * decoders ignore:
+ *
+ *   - SKIPPABLE_MAGIC and the size of the payload, as 32bit little endian numbers
+ *   - per frame: its compressed and decompressed size, as 64bit little endian numbers
+ *   - the number of frames, VERSION and FOOTER_MAGIC, as 32bit little endian numbers
+ *
+ * The footer at the very end allows readers to find the index without having to
+ * walk through all the frames. Indices of other versions are ignored, such data
+ * then gets decompressed sequentially.
+ */
+namespace ZstdFrameIndex {
+enum : uint32_t
+{
+    SKIPPABLE_MAGIC = 0x184D2A5E,
+    // "htfi" in little endian
+    FOOTER_MAGIC = 0x69667468,
+    // the first version had no version field and stored the delta histories at the start of every frame
+    VERSION = 2,
+    HEADER_SIZE = 8,
+    FOOTER_SIZE = 12,
+    ENTRY_SIZE = 16,
+};
+
+struct Frame
+{
+    uint64_t compressedSize = 0;
+    uint64_t decompressedSize = 0;
+};
+
+namespace detail {
+inline void append(std::string* data, uint64_t value, unsigned bytes)
+{
+    for (unsigned i = 0; i < bytes; ++i) {
+        data->push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+inline uint64_t read(const char* data, unsigned bytes)
+{
+    uint64_t value = 0;
+    for (unsigned i = 0; i < bytes; ++i) {
+        value |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+    }
+    return value;
+}
+}
+
+/// @return the skippable frame that stores the index of @p frames
+inline std::string serialize(const std::vector<Frame>& frames)
+{
+    std::string data;
+    const auto payloadSize = frames.size() * ENTRY_SIZE + FOOTER_SIZE;
+    data.reserve(HEADER_SIZE + payloadSize);
+    detail::append(&data, SKIPPABLE_MAGIC, 4);
+    detail::append(&data, payloadSize, 4);
+    for (const auto& frame : frames) {
+        detail::append(&data, frame.compressedSize, 8);
+        detail::append(&data, frame.decompressedSize, 8);
+    }
+    detail::append(&data, frames.size(), 4);
+    detail::append(&data, VERSION, 4);
+    detail::append(&data, FOOTER_MAGIC, 4);
+    return data;
+}
+
+/**
+ * Read the index at the end of the @p size bytes at @p data.
+ *
+ * @return the frames that precede the index, or an empty vector when the data has no valid index
+ */
+inline std::vector<Frame> parse(const char* data, uint64_t size)
+{
+    if (size < HEADER_SIZE + FOOTER_SIZE || detail::read(data + size - 4, 4) != FOOTER_MAGIC
+        || detail::read(data + size - 8, 4) != VERSION) {
+        return {};
+    }
+    const auto numFrames = detail::read(data + size - FOOTER_SIZE, 4);
+    const auto payloadSize = numFrames * ENTRY_SIZE + FOOTER_SIZE;
+    if (payloadSize + HEADER_SIZE > size) {
+        return {};
+    }
+    const auto indexOffset = size - payloadSize - HEADER_SIZE;
+    const auto* it = data + indexOffset;
+    if (detail::read(it, 4) != SKIPPABLE_MAGIC || detail::read(it + 4, 4) != payloadSize) {
+        return {};
+    }
+    it += HEADER_SIZE;
+
+    std::vector<Frame> frames(numFrames);
+    uint64_t compressedSize = 0;
+    for (auto& frame : frames) {
+        frame.compressedSize = detail::read(it, 8);
+        frame.decompressedSize = detail::read(it + 8, 8);
+        it += ENTRY_SIZE;
+        // the records of a frame get addressed with 32bit offsets
+        if (frame.decompressedSize > UINT32_MAX) {
+            return {};
+        }
+        compressedSize += frame.compressedSize;
+    }
+    // the frames must cover all of the data before the index
+    if (compressedSize != indexOffset) {
+        return {};
+    }
+    return frames;
+}
+}
+
+#endif // ZSTDFRAMEINDEX_H
@@ -9,12 +9,15 @@
 
 #include "tempfile.h"
 #include "tst_config.h"
+#include "util/linereader.h"
 
 #include <benchutil.h>
 
 #include <dlfcn.h>
 
 #include <iostream>
+#include <set>
+#include <sstream>
 
 static_assert(RTLD_NOW == 0x2, "RTLD_NOW needs to equal 0x2");
 
@@ -70,9 +73,16 @@ void runInjectTest(Load load, Unload unload)
 
     const auto contents = file.readContents();
     REQUIRE(!contents.empty());
-    REQUIRE(contents.find("\nA\n") != std::string::npos);
-    REQUIRE(contents.find("\n+") != std::string::npos);
-    REQUIRE(contents.find("\n-") != std::string::npos);
+
+    std::istringstream stream(contents);
+    LineReader reader;
+    std::set<char> modes;
+    while (reader.getLine(stream)) {
+        modes.insert(reader.mode());
+    }
+    REQUIRE(modes.count('A'));
+    REQUIRE(modes.count('+'));
+    REQUIRE(modes.count('-'));
 }
 }
 
@@ -0,0 +1,249 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "3rdparty/doctest.h"
+
+#include "analyze/accumulatedtracedata.h"
+#include "util/allocationsampler.h"
+#include "util/blockreader.h"
+#include "util/linewriter.h"
+
+#include <cinttypes>
+#include <cmath>
+#include <string>
+
+#include <fcntl.h>
+
+using namespace std;
+
+namespace {
+struct TestTraceData final : public AccumulatedTraceData
+{
+    void handleTimeStamp(int64_t /*oldStamp*/, int64_t /*newStamp*/, bool /*isFinalTimeStamp*/,
+                         const ParsePass /*pass*/) override
+    {
+    }
+
+    void handleAllocation(const AllocationInfo& info, const AllocationInfoIndex /*index*/) override
+    {
+        ++recordedAllocations;
+        estimatedAllocations += info.weight;
+    }
+
+    void handleDebuggee(const char* /*command*/) override
+    {
+    }
+
+    bool read(const string& data)
+    {
+        MemoryReader in(data.data(), data.size());
+        return AccumulatedTraceData::read(in, FirstPass, false);
+    }
+
+    using AccumulatedTraceData::read;
+
+    int64_t recordedAllocations = 0;
+    double estimatedAllocations = 0;
+};
+
+struct StringSink final : public LineWriter::Sink
+{
+    bool write(const char* data, size_t size) override
+    {
+        this->data.append(data, size);
+        return true;
+    }
+    string data;
+};
+}
+
+TEST_CASE ("sampled allocations") {
+    // sampled every 100 bytes on average, with two allocation infos on different traces:
+    // 50 bytes, i.e. a weight of about 2.54, and 1000 bytes, i.e. a weight of about 1
+    const string header = "v 10000 2\n"
+                          "P 64\n"
+                          "i 1000 0\n"
+                          "i 2000 0\n"
+                          "t 1 0\n"
+                          "t 2 0\n"
+                          "a 32 1\n"
+                          "a 3e8 2\n";
+    const auto smallWeight = AllocationSampler::weight(50, 100);
+    const auto largeWeight = AllocationSampler::weight(1000, 100);
+    REQUIRE(smallWeight > 2.5);
+    REQUIRE(smallWeight < 2.6);
+
+    SUBCASE ("temporary allocations") {
+        string data = header;
+        for (int i = 0; i < 10; ++i) {
+            data += "+ 0\n- 0\n";
+        }
+
+        TestTraceData traceData;
+        REQUIRE(traceData.read(data));
+        REQUIRE(traceData.samplingPeriod == 100);
+        REQUIRE(traceData.allocations.size() == 2);
+
+        // the weights must not be rounded individually, that would yield 30 allocations
+        const auto expectedCount = llround(10 * smallWeight);
+        CHECK(expectedCount == 25);
+        CHECK(traceData.recordedAllocations == 10);
+        CHECK(llround(traceData.estimatedAllocations) == expectedCount);
+        CHECK(traceData.totalCost.allocations == expectedCount);
+        CHECK(traceData.totalCost.temporary == expectedCount);
+        CHECK(traceData.totalCost.leaked == 0);
+        CHECK(traceData.totalCost.peak == llround(50 * smallWeight));
+
+        const auto& allocation = traceData.allocations[0];
+        CHECK(allocation.allocations == expectedCount);
+        CHECK(allocation.temporary == expectedCount);
+        CHECK(allocation.leaked == 0);
+        CHECK(traceData.allocations[1].allocations == 0);
+
+        // the size histogram of the GUI scales the recorded allocations per allocation info like this
+        const auto& info = traceData.allocationInfos[0];
+        CHECK(info.weightedCount(traceData.recordedAllocations) == expectedCount);
+        CHECK(info.weightedSize(traceData.recordedAllocations) == llround(10 * 50 * smallWeight));
+    }
+
+    SUBCASE ("leaked allocations") {
+        string data = header;
+        for (int i = 0; i < 3; ++i) {
+            data += "+ 0\n";
+        }
+        for (int i = 0; i < 4; ++i) {
+            data += "+ 1\n";
+        }
+        // free one of the small ones again, not directly after allocating it
+        data += "- 0\n";
+
+        TestTraceData traceData;
+        REQUIRE(traceData.read(data));
+        REQUIRE(traceData.allocations.size() == 2);
+
+        const auto smallSize = llround(50 * smallWeight);
+        const auto largeSize = llround(1000 * largeWeight);
+        const auto& small = traceData.allocations[0];
+        CHECK(small.allocations == llround(3 * smallWeight));
+        CHECK(small.temporary == 0);
+        CHECK(small.leaked == 2 * smallSize);
+        const auto& large = traceData.allocations[1];
+        CHECK(large.allocations == 4);
+        CHECK(large.leaked == 4 * largeSize);
+
+        CHECK(traceData.totalCost.allocations == small.allocations + large.allocations);
+        CHECK(traceData.totalCost.temporary == 0);
+        CHECK(traceData.totalCost.leaked == small.leaked + large.leaked);
+        CHECK(traceData.totalCost.peak == 3 * smallSize + 4 * largeSize);
+    }
+}
+
+TEST_CASE ("unsampled allocations") {
+    const string data = "v 10000 2\n"
+                        "i 1000 0\n"
+                        "t 1 0\n"
+                        "a 32 1\n"
+                        "+ 0\n"
+                        "- 0\n"
+                        "+ 0\n";
+
+    TestTraceData traceData;
+    REQUIRE(traceData.read(data));
+    CHECK(traceData.samplingPeriod == 0);
+    CHECK(traceData.totalCost.allocations == 2);
+    CHECK(traceData.totalCost.temporary == 1);
+    CHECK(traceData.totalCost.leaked == 50);
+    CHECK(traceData.totalCost.peak == 50);
+    CHECK(traceData.estimatedAllocations == 2);
+}
+
+TEST_CASE ("time checkpoints") {
+    // lots of binary records whose allocation indices are delta encoded, such that we get multiple checkpoints
+    constexpr uint32_t numInfos = 100;
+    constexpr uint32_t numTimeStamps = 60000;
+    constexpr uint32_t allocationsPerTimeStamp = 20;
+    StringSink sink;
+    {
+        // the sink gets all of the data, but the writer needs some file to write to
+        LineWriter writer(open("/dev/null", O_WRONLY));
+        REQUIRE(writer.canWrite());
+        writer.setSink(&sink);
+        writer.write("v 10000 %x\n", BinaryRecord::FIRST_FILE_FORMAT_VERSION);
+        writer.write("i 1000 0\nt 1 0\n");
+        writer.setBinaryRecords(true);
+        for (uint32_t i = 0; i < numInfos; ++i) {
+            writer.writeHexLine('a', uint64_t(i + 1), uint64_t(1));
+        }
+        uint32_t allocation = 0;
+        for (uint64_t timeStamp = 1; timeStamp <= numTimeStamps; ++timeStamp) {
+            writer.writeHexLine('c', timeStamp);
+            for (uint32_t i = 0; i < allocationsPerTimeStamp; ++i) {
+                const uint64_t index = (allocation++ * 37) % numInfos;
+                writer.writeHexLine('+', BinaryRecord::Delta {BinaryRecord::TraceChannel, index});
+            }
+        }
+        REQUIRE(writer.flush());
+        writer.setSink(nullptr);
+    }
+    const auto& data = sink.data;
+    REQUIRE(data.size() > 4 * 1024 * 1024);
+
+    // the allocations at and after the time stamp minTime
+    const int64_t minTime = numTimeStamps - 100;
+    const int64_t expectedAllocations = 101 * allocationsPerTimeStamp;
+
+    TestTraceData traceData;
+    REQUIRE(traceData.read(data));
+    REQUIRE(traceData.totalCost.allocations == numTimeStamps * allocationsPerTimeStamp);
+    REQUIRE(traceData.timeCheckpoints.size() > 3);
+
+    // continue from the last checkpoint before minTime, with the delta histories stored there
+    traceData.filterParameters.minTime = minTime;
+    MemoryReader in(data.data(), data.size());
+    REQUIRE(traceData.read(in, AccumulatedTraceData::FirstPass, true));
+    CHECK(traceData.totalCost.allocations == expectedAllocations);
+    CHECK(traceData.allocations.size() == 1);
+}
+
+TEST_CASE ("peak RSS within the time range") {
+    // the RSS peaks before the time range and then stays flat, such that no 'R' line follows within it
+    constexpr int64_t numTimeStamps = 100000;
+    string data = "v 10000 2\n"
+                  "i 1000 0\n"
+                  "t 1 0\n"
+                  "a 32 1\n"
+                  "c 0\n"
+                  "R 5000\n"
+                  "c 1\n"
+                  "R 3000\n";
+    char line[32];
+    for (int64_t timeStamp = 2; timeStamp <= numTimeStamps; ++timeStamp) {
+        snprintf(line, sizeof(line), "c %" PRIx64 "\n+ 0\n- 0\n", timeStamp);
+        data += line;
+    }
+
+    TestTraceData traceData;
+    REQUIRE(traceData.read(data));
+    CHECK(traceData.peakRSS == 0x5000);
+
+    // continue from a checkpoint, which skips the 'R' lines before it
+    const int64_t minTime = numTimeStamps - 100;
+    REQUIRE(!traceData.timeCheckpoints.empty());
+    REQUIRE(traceData.timeCheckpoints.back().timeStamp < minTime);
+    traceData.filterParameters.minTime = minTime;
+    MemoryReader in(data.data(), data.size());
+    REQUIRE(traceData.read(in, AccumulatedTraceData::FirstPass, true));
+    CHECK(traceData.totalCost.allocations == 101);
+    CHECK(traceData.peakRSS == 0x3000);
+
+    // and the same without the checkpoints to continue from
+    TestTraceData filteredData;
+    filteredData.filterParameters.minTime = minTime;
+    REQUIRE(filteredData.read(data));
+    CHECK(filteredData.totalCost.allocations == 101);
+    CHECK(filteredData.peakRSS == 0x3000);
+}
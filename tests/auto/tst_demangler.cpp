@@ -0,0 +1,98 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "3rdparty/doctest.h"
+
+#include "interpret/demangler.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+TEST_CASE ("demangle") {
+    REQUIRE(demangle("_Z3foov") == "foo()");
+    REQUIRE(demangle("_ZN3bar3bazEi") == "bar::baz(int)");
+    // not mangled, or not demangleable
+    REQUIRE(demangle("main") == "main");
+    REQUIRE(demangle("_Z") == "_Z");
+    REQUIRE(demangle("_Zfoo") == "_Zfoo");
+    REQUIRE(demangle("") == "");
+}
+
+TEST_CASE ("interned") {
+    deque<string> overflow;
+    const auto demangled = demangleInterned("_Z6interni", &overflow);
+    REQUIRE(demangled == "intern(int)");
+    // the second lookup returns the very same string
+    REQUIRE(demangleInterned("_Z6interni", &overflow).data() == demangled.data());
+    REQUIRE(demangleInterned("_Z6interni" + string(), &overflow).data() == demangled.data());
+    REQUIRE(overflow.empty());
+    REQUIRE(demangleCacheMemoryUsage() > 0);
+}
+
+TEST_CASE ("batch") {
+    vector<string> mangledNames;
+    for (int i = 0; i < 2000; ++i) {
+        const auto name = "batch" + to_string(i);
+        mangledNames.push_back("_Z" + to_string(name.size()) + name + "v");
+        // mix in other prefixes and duplicates
+        if (i % 3 == 0) {
+            mangledNames.push_back(name);
+        }
+        if (i % 5 == 0) {
+            mangledNames.push_back(mangledNames.front());
+        }
+    }
+
+    for (unsigned numThreads : {0u, 1u, 4u}) {
+        CAPTURE(numThreads);
+        deque<string> overflow;
+        const auto demangledNames = demangleBatch(mangledNames, numThreads, &overflow);
+        REQUIRE(demangledNames.size() == mangledNames.size());
+        for (size_t i = 0; i < mangledNames.size(); ++i) {
+            CAPTURE(mangledNames[i]);
+            REQUIRE(demangledNames[i] == demangle(mangledNames[i]));
+            REQUIRE(demangledNames[i].data() == demangleInterned(mangledNames[i], &overflow).data());
+        }
+        REQUIRE(overflow.empty());
+    }
+}
+
+TEST_CASE ("cache limit") {
+    deque<string> overflow;
+    const auto interned = demangleInterned("_Z7limitedv", &overflow);
+    const auto memoryUsage = demangleCacheMemoryUsage();
+    setDemangleCacheLimit(memoryUsage);
+
+    // new names don't get interned anymore once the cache is full
+    const auto demangled = demangleInterned("_Z8overflowv", &overflow);
+    REQUIRE(demangled == "overflow()");
+    REQUIRE(overflow.size() == 1);
+    REQUIRE(demangled.data() == overflow.back().data());
+    REQUIRE(demangle("_Z8overflowv") == "overflow()");
+    REQUIRE(demangleCacheMemoryUsage() == memoryUsage);
+
+    // but the interned ones are still shared
+    REQUIRE(demangleInterned("_Z7limitedv", &overflow).data() == interned.data());
+    REQUIRE(overflow.size() == 1);
+
+    // batches put the names that don't fit anymore into overflow too, across all threads
+    vector<string> mangledNames = {"_Z7limitedv"};
+    for (int i = 0; i < 1000; ++i) {
+        const auto name = "overflow" + to_string(i);
+        mangledNames.push_back("_Z" + to_string(name.size()) + name + "v");
+    }
+    const auto demangledNames = demangleBatch(mangledNames, 4, &overflow);
+    REQUIRE(demangledNames[0].data() == interned.data());
+    REQUIRE(overflow.size() == mangledNames.size());
+    for (size_t i = 1; i < mangledNames.size(); ++i) {
+        REQUIRE(demangledNames[i] == "overflow" + to_string(i - 1) + "()");
+    }
+    REQUIRE(demangleCacheMemoryUsage() == memoryUsage);
+}
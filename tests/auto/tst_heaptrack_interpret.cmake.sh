@@ -19,21 +19,65 @@ if [ ! -d "$SRC_DIR" ] || [ ! -d "$BIN_DIR" ]; then
 fi;
 
 temp_output_actual=$(mktemp)
-trap 'rm -- "$temp_output_actual"' EXIT
+temp_cache_dir=$(mktemp -d)
+trap 'rm -r -- "$temp_output_actual" "$temp_cache_dir"' EXIT
 
 unset DEBUGINFOD_URLS
-"$BIN_DIR/heaptrack_interpret" \
-    --sysroot "${SRC_DIR}/sysroot" \
-    --extra-paths "${SRC_DIR}/extra" \
-    --debug-paths "${SRC_DIR}/debug" \
-    < "${SRC_DIR}/heaptrack.test_sysroot.raw" \
-    > "$temp_output_actual"
-
-# verification step
-if diff -u "${SRC_DIR}/heaptrack.test_sysroot.expected" "$temp_output_actual"; then
-    echo "Test passed: Output matches expected result."
-    exit 0
-else
-    echo "Test failed: Output does not match expected result."
-    exit 1
+
+# the output must not depend on how many threads resolve the debug information
+# the first run fills the symbol cache, which all later runs use
+for threads in 0 1 4; do
+    "$BIN_DIR/heaptrack_interpret" \
+        --sysroot "${SRC_DIR}/sysroot" \
+        --extra-paths "${SRC_DIR}/extra" \
+        --debug-paths "${SRC_DIR}/debug" \
+        --threads "$threads" \
+        --cache-dir "$temp_cache_dir" \
+        < "${SRC_DIR}/heaptrack.test_sysroot.raw" \
+        > "$temp_output_actual"
+
+    # verification step
+    if ! diff -u "${SRC_DIR}/heaptrack.test_sysroot.expected" "$temp_output_actual"; then
+        echo "Test failed: Output with $threads threads does not match expected result."
+        exit 1
+    fi
+done
+
+# lazily resolving the debug information must not change the analysis of this small file
+PRINT="@PROJECT_BINARY_DIR@/@BIN_INSTALL_DIR@/heaptrack_print"
+if [ -x "$PRINT" ]; then
+    temp_output_lazy=$(mktemp)
+    trap 'rm -r -- "$temp_output_actual" "$temp_cache_dir" "$temp_output_lazy"' EXIT
+    "$BIN_DIR/heaptrack_interpret" \
+        --sysroot "${SRC_DIR}/sysroot" \
+        --extra-paths "${SRC_DIR}/extra" \
+        --debug-paths "${SRC_DIR}/debug" \
+        --no-cache \
+        --symbolize lazy \
+        < "${SRC_DIR}/heaptrack.test_sysroot.raw" \
+        > "$temp_output_lazy"
+    "$PRINT" -f "${SRC_DIR}/heaptrack.test_sysroot.expected" | tail -n +2 > "$temp_output_actual"
+    if ! "$PRINT" -f "$temp_output_lazy" | tail -n +2 | diff -u "$temp_output_actual" -; then
+        echo "Test failed: Lazy symbolization changes the analysis."
+        exit 1
+    fi
+
+    # writing and then reading the analysis cache must not change the analysis either
+    temp_cache_data_dir=$(mktemp -d)
+    trap 'rm -r -- "$temp_output_actual" "$temp_cache_dir" "$temp_output_lazy" "$temp_cache_data_dir"' EXIT
+    cp "${SRC_DIR}/heaptrack.test_sysroot.expected" "$temp_cache_data_dir/heaptrack.test_sysroot"
+    for run in write read; do
+        if ! "$PRINT" --analysis-cache -f "$temp_cache_data_dir/heaptrack.test_sysroot" | tail -n +2 \
+                | diff -u "$temp_output_actual" -; then
+            echo "Test failed: The analysis cache changes the analysis when trying to $run it."
+            exit 1
+        fi
+    done
+    if [ ! -f "$temp_cache_data_dir/heaptrack.test_sysroot.htcache" ]; then
+        echo "Test failed: No analysis cache was written."
+        exit 1
+    fi
 fi
+
+echo "Test passed: Output matches expected result."
+exit 0
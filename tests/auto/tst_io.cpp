@@ -9,10 +9,12 @@
 
 #include "util/linereader.h"
 #include "util/linewriter.h"
+#include "util/zstdframeindex.h"
 
 #include "tempfile.h"
 
 #include <limits>
+#include <vector>
 
 using namespace std;
 
@@ -176,3 +178,548 @@ TEST_CASE ("read line 32bit") {
     REQUIRE(idx == 0x0);
     REQUIRE(!(reader >> idx));
 }
+
+TEST_CASE ("binary records round trip") {
+    TempFile file;
+    REQUIRE(file.open());
+
+    LineWriter writer(file.fd);
+    REQUIRE(writer.canWrite());
+    REQUIRE(writer.writeHexLine('v', 0x10550u, 4u));
+    writer.setBinaryRecords(true);
+    REQUIRE(writer.writesBinaryRecords());
+    REQUIRE(writer.writeHexLine('t', 0u, 0ul, 1u, 1ul, 127u, 128ul, 16383u, 16384ul));
+    REQUIRE(writer.writeHexLine('u', std::numeric_limits<uint32_t>::max() - 1, std::numeric_limits<uint32_t>::max()));
+    REQUIRE(writer.writeHexLine('l', std::numeric_limits<uint64_t>::max() - 1, std::numeric_limits<uint64_t>::max()));
+    REQUIRE(writer.write("m 1 -\n"));
+    REQUIRE(writer.writeHexLine('+', 0x10u, 0x1a2u, 0x7f1234567890ul));
+    REQUIRE(writer.writeHexLine('c', 0u));
+    REQUIRE(writer.write("s "));
+    REQUIRE(writer.write(string("\x80\xff")));
+    REQUIRE(writer.write("\n"));
+    REQUIRE(writer.writeHexLine('-', 0x7f1234567890ul));
+    REQUIRE(writer.flush());
+
+    const auto contents = file.readContents();
+    // "+ 10 1a2 7f1234567890\n" takes 22 bytes as text, but only 2 + 1 + 2 + 7 bytes as binary record
+    REQUIRE(contents.find("m 1 -\n") != string::npos);
+    REQUIRE(contents.find("+ ") == string::npos);
+
+    stringstream stream(contents);
+    LineReader reader;
+    uint64_t value = 0;
+    string str;
+
+    REQUIRE(reader.getLine(stream));
+    REQUIRE(!reader.isBinary());
+    REQUIRE(reader.line() == "v 10550 4");
+    reader.setExpectedSizedStrings(true);
+
+    REQUIRE(reader.getLine(stream));
+    REQUIRE(reader.isBinary());
+    REQUIRE(reader.mode() == 't');
+    for (auto expected : {0_u64, 0_u64, 1_u64, 1_u64, 127_u64, 128_u64, 16383_u64, 16384_u64}) {
+        REQUIRE((reader >> value));
+        REQUIRE(value == expected);
+    }
+    REQUIRE(!(reader >> value));
+    REQUIRE(!(reader >> str));
+
+    REQUIRE(reader.getLine(stream));
+    REQUIRE(reader.mode() == 'u');
+    uint32_t idx = 0;
+    REQUIRE((reader >> idx));
+    REQUIRE(idx == std::numeric_limits<uint32_t>::max() - 1);
+    REQUIRE((reader >> idx));
+    REQUIRE(idx == std::numeric_limits<uint32_t>::max());
+    REQUIRE(!(reader >> idx));
+
+    REQUIRE(reader.getLine(stream));
+    REQUIRE(reader.mode() == 'l');
+    REQUIRE((reader >> value));
+    REQUIRE(value == std::numeric_limits<uint64_t>::max() - 1);
+    REQUIRE((reader >> value));
+    REQUIRE(value == std::numeric_limits<uint64_t>::max());
+    REQUIRE(!(reader >> value));
+
+    REQUIRE(reader.getLine(stream));
+    REQUIRE(!reader.isBinary());
+    REQUIRE(reader.mode() == 'm');
+    REQUIRE(reader.line() == "m 1 -");
+
+    REQUIRE(reader.getLine(stream));
+    REQUIRE(reader.mode() == '+');
+    REQUIRE(reader.line().size() == 12);
+    for (auto expected : {0x10_u64, 0x1a2_u64, 0x7f1234567890_u64}) {
+        REQUIRE((reader >> value));
+        REQUIRE(value == expected);
+    }
+    REQUIRE(!(reader >> value));
+
+    REQUIRE(reader.getLine(stream));
+    REQUIRE(reader.mode() == 'c');
+    REQUIRE((reader >> value));
+    REQUIRE(value == 0);
+    REQUIRE(!(reader >> value));
+
+    REQUIRE(reader.getLine(stream));
+    REQUIRE(!reader.isBinary());
+    REQUIRE(reader.mode() == 's');
+    REQUIRE((reader >> str));
+    REQUIRE(str == "\x80\xff");
+
+    REQUIRE(reader.getLine(stream));
+    REQUIRE(reader.mode() == '-');
+    REQUIRE((reader >> value));
+    REQUIRE(value == 0x7f1234567890_u64);
+
+    // end of data
+    REQUIRE(reader.getLine(stream));
+    REQUIRE(reader.mode() == '#');
+    REQUIRE(!reader.getLine(stream));
+}
+
+TEST_CASE ("binary records pass through") {
+    TempFile file;
+    REQUIRE(file.open());
+
+    LineWriter writer(file.fd);
+    writer.setBinaryRecords(true);
+    REQUIRE(writer.writeHexLine('c', 0x1234u));
+    REQUIRE(writer.writeHexLine('R', 0x5678ul));
+    REQUIRE(writer.flush());
+
+    const auto contents = file.readContents();
+    stringstream stream(contents);
+    LineReader reader;
+
+    TempFile copy;
+    REQUIRE(copy.open());
+    LineWriter copyWriter(copy.fd);
+    copyWriter.setBinaryRecords(true);
+    while (reader.getLine(stream)) {
+        if (reader.isBinary()) {
+            REQUIRE(copyWriter.writeRaw(reader.line()));
+        }
+    }
+    REQUIRE(copyWriter.flush());
+    REQUIRE(copy.readContents() == contents);
+}
+
+TEST_CASE ("truncated binary record") {
+    const string contents = "\xab\x03\x01\x02";
+    stringstream stream(contents);
+    LineReader reader;
+    REQUIRE(!reader.getLine(stream));
+}
+
+TEST_CASE ("block readers") {
+    using BinaryRecord::Delta;
+
+    TempFile file;
+    REQUIRE(file.open());
+    LineWriter writer(file.fd);
+    auto writeRecords = [&writer](bool binary) {
+        writer.setBinaryRecords(binary);
+        for (uint64_t i = 0; i < 20000; ++i) {
+            REQUIRE(writer.writeHexLine('+', i % 1024, Delta {BinaryRecord::PointerChannel, 0x7f1234560000 + i * 32}));
+            REQUIRE(writer.writeHexLine('-', Delta {BinaryRecord::PointerChannel, 0x7f1234560000 + i * 16}));
+            REQUIRE(writer.write("s 5 hello\n"));
+        }
+    };
+    writeRecords(true);
+    // a line that is larger than a block
+    REQUIRE(writer.write("s 30d40 "));
+    for (int i = 0; i < 10000; ++i) {
+        REQUIRE(writer.write("01234567890123456789"));
+    }
+    REQUIRE(writer.write("\n"));
+    writeRecords(true);
+    writeRecords(false);
+    // the last line has no trailing newline
+    REQUIRE(writer.write("# the end"));
+    REQUIRE(writer.flush());
+
+    auto readAll = [](auto getLine) {
+        LineReader reader;
+        reader.setExpectedSizedStrings(true);
+        vector<string> lines;
+        while (getLine(reader)) {
+            string line(1, reader.mode());
+            if (reader.mode() == 's') {
+                string str;
+                REQUIRE((reader >> str));
+                line += str;
+            } else if (reader.mode() == '#') {
+                line += reader.line();
+            } else {
+                uint64_t value = 0;
+                while (reader.readHex(value)) {
+                    line += ' ' + to_string(value);
+                }
+            }
+            lines.push_back(line);
+        }
+        return lines;
+    };
+
+    const auto contents = file.readContents();
+    stringstream stream(contents);
+    const auto expected = readAll([&stream](LineReader& reader) { return reader.getLine(stream); });
+    REQUIRE(expected.size() == 9 * 20000 + 2);
+    REQUIRE(expected.back() == "## the end");
+
+    auto mapped = openBlockReader(file.fileName);
+    REQUIRE(mapped);
+    REQUIRE(readAll([&mapped](LineReader& reader) { return reader.getLine(*mapped); }) == expected);
+    REQUIRE(mapped->readBytes() == contents.size());
+    REQUIRE(!mapped->hasError());
+
+    const auto fd = ::open(file.fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    REQUIRE(fd != -1);
+    FileDescriptorReader buffered(fd, true);
+    REQUIRE(readAll([&buffered](LineReader& reader) { return reader.getLine(buffered); }) == expected);
+    REQUIRE(buffered.readBytes() == contents.size());
+    REQUIRE(buffered.readInputBytes() == contents.size());
+}
+
+TEST_CASE ("hex fields") {
+    // numbers of all lengths, such that the vectorized parsing sees every possible end of a number,
+    // as well as empty fields and numbers that end at the end of the line
+    string contents;
+    vector<vector<uint64_t>> expected;
+    for (unsigned length = 1; length <= 16; ++length) {
+        const auto number = string("fedcba9876543210").substr(16 - length);
+        const auto value = stoull(number, nullptr, 16);
+        contents += "a " + number + ' ' + number + '\n';
+        expected.push_back({value, value});
+        contents += "t " + number + "  1\n";
+        expected.push_back({value, 0, 1});
+        contents += "i 0 " + number + " 3 4 " + number + " 5 6 7\n";
+        expected.push_back({0, value, 3, 4, value, 5, 6, 7});
+    }
+    contents += "+ 1";
+    expected.push_back({1});
+
+    auto readAll = [](auto getLine) {
+        LineReader reader;
+        vector<vector<uint64_t>> lines;
+        while (getLine(reader)) {
+            uint64_t fields[8];
+            const auto numFields = reader.parseHexFields(fields, 8);
+            lines.emplace_back(fields, fields + numFields);
+        }
+        return lines;
+    };
+
+    stringstream stream(contents);
+    REQUIRE(readAll([&stream](LineReader& reader) { return reader.getLine(stream); }) == expected);
+
+    MemoryReader in(contents.data(), contents.size());
+    REQUIRE(readAll([&in](LineReader& reader) { return reader.getLine(in); }) == expected);
+}
+
+TEST_CASE ("truncated binary record in a block reader") {
+    TempFile file;
+    REQUIRE(file.open());
+    REQUIRE(::write(file.fd, "\xab\x03\x01\x02", 4) == 4);
+
+    auto reader = openBlockReader(file.fileName);
+    REQUIRE(reader);
+    LineReader lineReader;
+    REQUIRE(!lineReader.getLine(*reader));
+    REQUIRE(!lineReader.getLine(*reader));
+}
+
+namespace {
+/// collects the written data in memory, split into frames at the points where we start a new one
+struct FrameSink : LineWriter::Sink
+{
+    bool write(const char* data, size_t size) override
+    {
+        frames.back().append(data, size);
+        return true;
+    }
+
+    void startFrame(const LineWriter& writer)
+    {
+        // the binary records of a frame can only be decoded with the state after the previous frames
+        deltaHistories.emplace_back(writer.currentDeltaHistories(),
+                                    writer.currentDeltaHistories() + BinaryRecord::NumChannels);
+        index.emplace_back();
+        frames.emplace_back();
+    }
+
+    vector<vector<BinaryRecord::DeltaHistory>> deltaHistories;
+    vector<ZstdFrameIndex::Frame> index;
+    vector<string> frames;
+};
+
+/// hands out blocks that were tokenized ahead of time
+class TokenizedReader : public BlockReader
+{
+public:
+    explicit TokenizedReader(vector<TokenizedBlock> blocks)
+        : m_blocks(std::move(blocks))
+    {
+        m_isTokenized = true;
+    }
+
+    bool refill() override
+    {
+        if (m_nextBlock == m_blocks.size()) {
+            return false;
+        }
+        m_bufferOffset += static_cast<uint64_t>(m_begin - m_bufferStart);
+        const auto& block = m_blocks[m_nextBlock++];
+        m_bufferStart = m_begin = block.data.get();
+        m_end = m_begin + block.size;
+        m_nextRecord = block.records.data();
+        m_recordsEnd = m_nextRecord + block.records.size();
+        m_nextField = block.fields.data();
+        return true;
+    }
+
+private:
+    vector<TokenizedBlock> m_blocks;
+    size_t m_nextBlock = 0;
+};
+}
+
+TEST_CASE ("tokenized frames") {
+    using BinaryRecord::Delta;
+
+    TempFile file;
+    REQUIRE(file.open());
+    LineWriter writer(file.fd);
+    FrameSink sink;
+    writer.setSink(&sink);
+    sink.startFrame(writer);
+    REQUIRE(writer.write("v 10650 4\n"));
+    writer.setBinaryRecords(true);
+    for (uint64_t i = 0; i < 10000; ++i) {
+        REQUIRE(writer.writeHexLine('+', i % 1024, Delta {BinaryRecord::PointerChannel, 0x7f1234560000 + i * 32}));
+        REQUIRE(writer.writeHexLine('-', Delta {BinaryRecord::PointerChannel, 0x7f1234560000 + i * 16}));
+        if (i % 100 == 0) {
+            writer.setBinaryRecords(false);
+            REQUIRE(writer.writeHexLine('c', i));
+            REQUIRE(writer.write("s 5 hello\n"));
+            // readHex parses an empty field as zero, which the tokenizer leaves to it
+            REQUIRE(writer.write("+ 1  2\n"));
+            REQUIRE(writer.write("- 1 x\n"));
+            writer.setBinaryRecords(true);
+        }
+        if (i % 777 == 0) {
+            REQUIRE(writer.flush());
+            sink.startFrame(writer);
+        }
+    }
+    REQUIRE(writer.write("# the end"));
+    REQUIRE(writer.flush());
+    writer.setSink(nullptr);
+
+    auto readAll = [](auto getLine, const BinaryRecord::DeltaHistory* deltaHistories = nullptr) {
+        LineReader reader;
+        reader.setExpectedSizedStrings(true);
+        if (deltaHistories) {
+            reader.setDeltaHistories(deltaHistories);
+        }
+        vector<string> lines;
+        while (getLine(reader)) {
+            string line(1, reader.mode());
+            if (reader.mode() == 's') {
+                string str;
+                REQUIRE((reader >> str));
+                line += str;
+            } else if (reader.mode() == '#') {
+                line += reader.line();
+            } else {
+                uint64_t value = 0;
+                while (reader.readHex(value)) {
+                    line += ' ' + to_string(value);
+                }
+            }
+            lines.push_back(line);
+        }
+        return lines;
+    };
+
+    string contents;
+    for (const auto& frame : sink.frames) {
+        contents += frame;
+    }
+    stringstream stream(contents);
+    const auto expected = readAll([&stream](LineReader& reader) { return reader.getLine(stream); });
+    REQUIRE(expected.size() == 2 * 10000 + 4 * 100 + 2);
+
+    // write and read the index, like heaptrack_interpret --zstd and heaptrack_print do
+    for (size_t i = 0; i < sink.frames.size(); ++i) {
+        sink.index[i].compressedSize = sink.frames[i].size();
+        sink.index[i].decompressedSize = sink.frames[i].size();
+    }
+    const auto withIndex = contents + ZstdFrameIndex::serialize(sink.index);
+    const auto frames = ZstdFrameIndex::parse(withIndex.data(), withIndex.size());
+    REQUIRE(frames.size() == sink.frames.size());
+    REQUIRE(ZstdFrameIndex::parse(withIndex.data(), withIndex.size() - 1).empty());
+    REQUIRE(ZstdFrameIndex::parse(contents.data(), contents.size()).empty());
+    // indices of other versions get ignored
+    auto otherVersion = withIndex;
+    otherVersion[otherVersion.size() - 8] = static_cast<char>(ZstdFrameIndex::VERSION + 1);
+    REQUIRE(ZstdFrameIndex::parse(otherVersion.data(), otherVersion.size()).empty());
+
+    vector<TokenizedBlock> blocks;
+    for (size_t i = 0; i < frames.size(); ++i) {
+        REQUIRE(frames[i].decompressedSize == sink.frames[i].size());
+        TokenizedBlock block;
+        block.size = sink.frames[i].size();
+        block.data.reset(new char[block.size]);
+        memcpy(block.data.get(), sink.frames[i].data(), block.size);
+
+        LineReader reader;
+        reader.setDeltaHistories(sink.deltaHistories[i].data());
+        MemoryReader in(block.data.get(), block.size);
+        REQUIRE(reader.tokenize(in, "+-c", &block));
+        blocks.push_back(std::move(block));
+    }
+    REQUIRE(blocks.front().records.front().numFields == TokenizedRecord::NOT_TOKENIZED);
+    REQUIRE(blocks.back().records.back().numFields == TokenizedRecord::NOT_TOKENIZED);
+
+    // copy the blocks, such that they can be skipped below
+    auto copyBlocks = [&blocks]() {
+        vector<TokenizedBlock> copies;
+        for (const auto& block : blocks) {
+            TokenizedBlock copy;
+            copy.size = block.size;
+            copy.data.reset(new char[copy.size]);
+            memcpy(copy.data.get(), block.data.get(), copy.size);
+            copy.records = block.records;
+            copy.fields = block.fields;
+            copies.push_back(std::move(copy));
+        }
+        return copies;
+    };
+
+    TokenizedReader tokenized(copyBlocks());
+    REQUIRE(readAll([&tokenized](LineReader& reader) { return reader.getLine(tokenized); }) == expected);
+    REQUIRE(tokenized.readBytes() == contents.size());
+
+    // skip to the time stamps, like AccumulatedTraceData does when reparsing a time range
+    struct Checkpoint
+    {
+        uint64_t offset;
+        size_t line;
+        BinaryRecord::DeltaHistory deltaHistories[BinaryRecord::NumChannels];
+    };
+    vector<Checkpoint> checkpoints;
+    {
+        MemoryReader in(contents.data(), contents.size());
+        LineReader reader;
+        reader.setExpectedSizedStrings(true);
+        for (size_t line = 1; reader.getLine(in); ++line) {
+            if (reader.mode() == 'c') {
+                Checkpoint checkpoint;
+                checkpoint.offset = in.readBytes();
+                checkpoint.line = line;
+                std::copy(reader.deltaHistories(), reader.deltaHistories() + BinaryRecord::NumChannels,
+                          checkpoint.deltaHistories);
+                checkpoints.push_back(checkpoint);
+            }
+        }
+    }
+    REQUIRE(checkpoints.size() == 100);
+
+    for (const auto& checkpoint : {checkpoints[1], checkpoints[42], checkpoints.back()}) {
+        const vector<string> remaining(expected.begin() + checkpoint.line, expected.end());
+
+        MemoryReader in(contents.data(), contents.size());
+        REQUIRE(in.skipTo(checkpoint.offset));
+        REQUIRE(in.readBytes() == checkpoint.offset);
+        REQUIRE(readAll([&in](LineReader& reader) { return reader.getLine(in); }, checkpoint.deltaHistories)
+                == remaining);
+
+        TokenizedReader tokenized(copyBlocks());
+        REQUIRE(tokenized.skipTo(checkpoint.offset));
+        REQUIRE(tokenized.readBytes() == checkpoint.offset);
+        REQUIRE(readAll([&tokenized](LineReader& reader) { return reader.getLine(tokenized); }) == remaining);
+    }
+
+    MemoryReader in(contents.data(), contents.size());
+    REQUIRE(!in.skipTo(contents.size() + 1));
+}
+
+TEST_CASE ("delta encoded fields") {
+    using BinaryRecord::Delta;
+
+    // some pointers from different arenas, mixed with far outliers
+    vector<uint64_t> pointers;
+    uint64_t state = 42;
+    for (unsigned i = 0; i < 10000; ++i) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        const uint64_t arenas[] = {0x55d0c0a01000, 0x7f1234560000, 0x7f98ab000000};
+        pointers.push_back(arenas[(state >> 60) % 3] + ((state >> 20) & 0xfffff0));
+        if (i % 1000 == 0) {
+            pointers.push_back(std::numeric_limits<uint64_t>::max() - i);
+            pointers.push_back(0);
+        }
+    }
+
+    TempFile file;
+    REQUIRE(file.open());
+    LineWriter writer(file.fd);
+    writer.setBinaryRecords(true);
+    uint32_t trace = 0;
+    for (auto ptr : pointers) {
+        trace = (trace + ptr % 7) % 100;
+        REQUIRE(writer.writeHexLine('+', ptr % 1024, Delta {BinaryRecord::TraceChannel, trace},
+                                    Delta {BinaryRecord::PointerChannel, ptr}));
+        REQUIRE(writer.writeHexLine('c', 1u));
+        REQUIRE(writer.writeHexLine('-', Delta {BinaryRecord::PointerChannel, ptr}));
+    }
+    REQUIRE(writer.flush());
+
+    const auto contents = file.readContents();
+    // a '+' record is at most 2 + 1 + 2 + 1 + 4 bytes for these values, plus 3 bytes for 'c'
+    // and 2 + 1 + 4 bytes for '-' - outliers left aside
+    REQUIRE(contents.size() < pointers.size() * 21);
+
+    stringstream stream(contents);
+    LineReader reader;
+    trace = 0;
+    for (auto ptr : pointers) {
+        trace = (trace + ptr % 7) % 100;
+        uint64_t value = 0;
+
+        REQUIRE(reader.getLine(stream));
+        REQUIRE(reader.mode() == '+');
+        REQUIRE((reader >> value));
+        REQUIRE(value == ptr % 1024);
+        REQUIRE((reader >> value));
+        REQUIRE(value == trace);
+        REQUIRE((reader >> value));
+        REQUIRE(value == ptr);
+
+        REQUIRE(reader.getLine(stream));
+        REQUIRE(reader.mode() == 'c');
+        REQUIRE((reader >> value));
+        REQUIRE(value == 1);
+
+        REQUIRE(reader.getLine(stream));
+        REQUIRE(reader.mode() == '-');
+        REQUIRE((reader >> value));
+        REQUIRE(value == ptr);
+    }
+}
+
+TEST_CASE ("delta encoded fields as text") {
+    using BinaryRecord::Delta;
+
+    TempFile file;
+    REQUIRE(file.open());
+    LineWriter writer(file.fd);
+    REQUIRE(writer.writeHexLine('+', 0x10u, Delta {BinaryRecord::TraceChannel, 0x1a2},
+                                Delta {BinaryRecord::PointerChannel, 0x7f1234567890}));
+    REQUIRE(writer.writeHexLine('-', Delta {BinaryRecord::PointerChannel, 0x7f1234567890}));
+    REQUIRE(writer.flush());
+
+    REQUIRE(file.readContents() == "+ 10 1a2 7f1234567890\n- 7f1234567890\n");
+}
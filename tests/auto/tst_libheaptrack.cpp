@@ -8,13 +8,20 @@
 #include "3rdparty/doctest.h"
 
 #include "track/libheaptrack.h"
+#include "track/timerinterval.h"
+#include "util/linereader.h"
 #include "util/linewriter.h"
 
 #include <cmath>
 #include <cstdio>
+#include <cstdlib>
+
+#include <dlfcn.h>
 
 #include <future>
 #include <iostream>
+#include <set>
+#include <sstream>
 #include <thread>
 #include <vector>
 
@@ -124,3 +131,317 @@ TEST_CASE ("api") {
         }
     }
 }
+
+TEST_CASE ("thread buffers") {
+    TempFile tmp; // opened/closed by heaptrack_init
+
+    setenv("HEAPTRACK_THREAD_BUFFERS", "1", 1);
+    heaptrack_init(tmp.fileName.c_str(), nullptr, nullptr, nullptr);
+    unsetenv("HEAPTRACK_THREAD_BUFFERS");
+
+    SUBCASE("multi-threaded")
+    {
+        // use a fixed number of threads, hardware_concurrency may be 1 or even 0 when unknown
+        constexpr unsigned numThreads = 4;
+        constexpr int numIterations = 10000;
+        {
+            vector<future<void>> futures;
+            for (unsigned i = 0; i < numThreads; ++i) {
+                futures.emplace_back(async(launch::async, []() {
+                    for (int i = 0; i < numIterations; ++i) {
+                        heaptrack_malloc(&i, i + 1);
+                        heaptrack_realloc(&i, i + 2, &i);
+                        heaptrack_free(&i);
+                    }
+                }));
+            }
+        }
+
+        heaptrack_stop();
+
+        istringstream contents(tmp.readContents());
+        LineReader reader;
+        uint64_t traces = 0;
+        uint64_t allocations = 0;
+        uint64_t deallocations = 0;
+        uint64_t traceCacheHits = 0;
+        set<uint64_t> livePointers;
+        while (reader.getLine(contents)) {
+            if (reader.mode() == 'v') {
+                unsigned int heaptrackVersion = 0;
+                unsigned int fileVersion = 0;
+                REQUIRE((reader >> heaptrackVersion));
+                REQUIRE((reader >> fileVersion));
+                reader.setExpectedSizedStrings(fileVersion >= 3);
+            } else if (reader.mode() == '#') {
+                const string prefix = "# trace cache hits: ";
+                if (reader.line().compare(0, prefix.size(), prefix) == 0) {
+                    traceCacheHits = stoull(string(reader.line().substr(prefix.size())));
+                }
+            } else if (reader.mode() == 't') {
+                uint64_t ip = 0;
+                uint64_t parentIndex = 0;
+                REQUIRE((reader >> ip));
+                REQUIRE((reader >> parentIndex));
+                // parents must always be written before their children
+                REQUIRE(parentIndex <= traces);
+                ++traces;
+            } else if (reader.mode() == '+') {
+                uint64_t size = 0;
+                uint64_t traceIndex = 0;
+                uint64_t ptr = 0;
+                REQUIRE((reader >> size));
+                REQUIRE((reader >> traceIndex));
+                REQUIRE((reader >> ptr));
+                REQUIRE(traceIndex > 0);
+                REQUIRE(traceIndex <= traces);
+                // events of a single thread must not get reordered
+                REQUIRE(livePointers.insert(ptr).second);
+                ++allocations;
+            } else if (reader.mode() == '-') {
+                uint64_t ptr = 0;
+                REQUIRE((reader >> ptr));
+                REQUIRE(livePointers.erase(ptr) == 1);
+                ++deallocations;
+            }
+        }
+
+        REQUIRE(allocations == 2 * numThreads * numIterations);
+        REQUIRE(deallocations == allocations);
+        REQUIRE(livePointers.empty());
+        // every thread allocates from the same two backtraces over and over again
+        REQUIRE(traceCacheHits > 0);
+    }
+
+    SUBCASE("unloaded modules")
+    {
+        // the module must not be loaded already, otherwise dlclose does not unload it
+        const char* moduleName = "libz.so.1";
+        if (dlopen(moduleName, RTLD_NOW | RTLD_NOLOAD)) {
+            heaptrack_stop();
+            MESSAGE(moduleName << " is loaded already");
+            return;
+        }
+
+        auto* handle = dlopen(moduleName, RTLD_NOW);
+        if (!handle) {
+            heaptrack_stop();
+            MESSAGE(moduleName << " is not available");
+            return;
+        }
+        heaptrack_invalidate_module_cache(nullptr);
+
+        constexpr int numAllocations = 100;
+        int data[numAllocations];
+        for (auto& i : data) {
+            heaptrack_malloc(&i, 1);
+        }
+
+        // like the dlclose hooks do
+        heaptrack_drain_events();
+        REQUIRE(dlclose(handle) == 0);
+        heaptrack_invalidate_module_cache(nullptr);
+
+        for (auto& i : data) {
+            heaptrack_free(&i);
+        }
+
+        heaptrack_stop();
+
+        // the allocations must be written while the module is still known, i.e. before it got unloaded
+        istringstream contents(tmp.readContents());
+        LineReader reader;
+        int allocations = 0;
+        int allocationsBeforeUnload = -1;
+        while (reader.getLine(contents)) {
+            if (reader.mode() == '+') {
+                ++allocations;
+            } else if (reader.mode() == 'm' && reader.line().compare(0, 6, "m 1 - ") == 0) {
+                allocationsBeforeUnload = allocations;
+            }
+        }
+        REQUIRE(allocations == numAllocations);
+        REQUIRE(allocationsBeforeUnload == numAllocations);
+    }
+}
+
+TEST_CASE ("sampling") {
+    TempFile tmp; // opened/closed by heaptrack_init
+
+    constexpr uint64_t samplingPeriod = 64 * 1024;
+    setenv("HEAPTRACK_SAMPLING_PERIOD", to_string(samplingPeriod).c_str(), 1);
+    heaptrack_init(tmp.fileName.c_str(), nullptr, nullptr, nullptr);
+    unsetenv("HEAPTRACK_SAMPLING_PERIOD");
+
+    constexpr int numIterations = 100000;
+    constexpr size_t allocationSize = 64;
+    vector<char> data(numIterations);
+    for (int i = 0; i < numIterations; ++i) {
+        heaptrack_malloc(&data[i], allocationSize);
+        if (i % 2) {
+            heaptrack_free(&data[i]);
+        }
+    }
+    // all of these are larger than the sampling period and thus always recorded
+    heaptrack_malloc(&data[0] - 1, samplingPeriod * 100);
+    heaptrack_free(&data[0] - 1);
+
+    heaptrack_stop();
+
+    istringstream contents(tmp.readContents());
+    LineReader reader;
+    uint64_t period = 0;
+    uint64_t allocations = 0;
+    uint64_t largeAllocations = 0;
+    set<uint64_t> livePointers;
+    while (reader.getLine(contents)) {
+        if (reader.mode() == 'v') {
+            unsigned int heaptrackVersion = 0;
+            unsigned int fileVersion = 0;
+            REQUIRE((reader >> heaptrackVersion));
+            REQUIRE((reader >> fileVersion));
+            reader.setExpectedSizedStrings(fileVersion >= 3);
+        } else if (reader.mode() == 'P') {
+            REQUIRE((reader >> period));
+        } else if (reader.mode() == '+') {
+            uint64_t size = 0;
+            uint64_t traceIndex = 0;
+            uint64_t ptr = 0;
+            REQUIRE((reader >> size));
+            REQUIRE((reader >> traceIndex));
+            REQUIRE((reader >> ptr));
+            REQUIRE(livePointers.insert(ptr).second);
+            if (size == allocationSize) {
+                ++allocations;
+            } else {
+                ++largeAllocations;
+            }
+        } else if (reader.mode() == '-') {
+            uint64_t ptr = 0;
+            REQUIRE((reader >> ptr));
+            // only the deallocations of sampled allocations get recorded
+            REQUIRE(livePointers.erase(ptr) == 1);
+        }
+    }
+
+    REQUIRE(period == samplingPeriod);
+    REQUIRE(largeAllocations == 1);
+    // we expect numIterations * allocationSize / samplingPeriod = ~98 samples
+    REQUIRE(allocations > 50);
+    REQUIRE(allocations < 200);
+}
+
+TEST_CASE ("timer interval") {
+    using std::chrono::microseconds;
+
+    SUBCASE("fixed")
+    {
+        TimerInterval interval(microseconds(1000), false);
+        interval.update(TimerInterval::BUSY_EVENTS * 10);
+        REQUIRE(interval.current() == microseconds(1000));
+        interval.update(0);
+        REQUIRE(interval.current() == microseconds(1000));
+    }
+
+    SUBCASE("adaptive")
+    {
+        TimerInterval interval(microseconds(1600), true);
+        REQUIRE(interval.current() == microseconds(1600));
+        for (int i = 0; i < 10; ++i) {
+            interval.update(TimerInterval::BUSY_EVENTS);
+        }
+        REQUIRE(interval.current() == microseconds(100));
+
+        // calm down again once the allocation rate drops
+        for (int i = 0; i < 10; ++i) {
+            interval.update(1);
+        }
+        REQUIRE(interval.current() == microseconds(1600));
+
+        for (int i = 0; i < 10; ++i) {
+            interval.update(0);
+        }
+        REQUIRE(interval.current() == microseconds(1600 * TimerInterval::SCALE));
+
+        // wake up from idling on the first event
+        interval.update(1);
+        REQUIRE(interval.current() < microseconds(1600 * TimerInterval::SCALE));
+    }
+
+    SUBCASE("minimum")
+    {
+        TimerInterval interval(microseconds(1), true);
+        REQUIRE(interval.current() == microseconds(TimerInterval::MIN_INTERVAL));
+        interval.update(TimerInterval::BUSY_EVENTS);
+        REQUIRE(interval.current() == microseconds(TimerInterval::MIN_INTERVAL));
+    }
+}
+
+TEST_CASE ("timer thread") {
+    TempFile tmp; // opened/closed by heaptrack_init
+
+    setenv("HEAPTRACK_TIMER_INTERVAL", "500", 1);
+    heaptrack_init(tmp.fileName.c_str(), nullptr, nullptr, nullptr);
+    unsetenv("HEAPTRACK_TIMER_INTERVAL");
+
+    vector<char> data(1000);
+    const auto end = chrono::steady_clock::now() + chrono::milliseconds(50);
+    while (chrono::steady_clock::now() < end) {
+        for (auto& byte : data) {
+            heaptrack_malloc(&byte, 1);
+            heaptrack_free(&byte);
+        }
+        this_thread::sleep_for(chrono::microseconds(100));
+    }
+
+    heaptrack_stop();
+
+    istringstream contents(tmp.readContents());
+    LineReader reader;
+    uint64_t lastTimestamp = 0;
+    int timestamps = 0;
+    int rssValues = 0;
+    while (reader.getLine(contents)) {
+        if (reader.mode() == 'c') {
+            uint64_t timestamp = 0;
+            REQUIRE((reader >> timestamp));
+            REQUIRE(timestamp >= lastTimestamp);
+            lastTimestamp = timestamp;
+            ++timestamps;
+        } else if (reader.mode() == 'R') {
+            ++rssValues;
+        }
+    }
+
+    REQUIRE(lastTimestamp >= 50);
+    // with the default interval of 10ms, we would only get about five timestamps
+    REQUIRE(timestamps > 10);
+    REQUIRE(rssValues > 0);
+}
+
+TEST_CASE ("timer thread while idle") {
+    TempFile tmp; // opened/closed by heaptrack_init
+
+    setenv("HEAPTRACK_TIMER_INTERVAL", "2000", 1);
+    heaptrack_init(tmp.fileName.c_str(), nullptr, nullptr, nullptr);
+    unsetenv("HEAPTRACK_TIMER_INTERVAL");
+
+    // the interval grows up to 32ms while nothing gets allocated, but the timestamps must keep coming
+    this_thread::sleep_for(chrono::milliseconds(200));
+
+    heaptrack_stop();
+
+    istringstream contents(tmp.readContents());
+    LineReader reader;
+    uint64_t lastTimestamp = 0;
+    int timestamps = 0;
+    while (reader.getLine(contents)) {
+        if (reader.mode() == 'c') {
+            REQUIRE((reader >> lastTimestamp));
+            ++timestamps;
+        }
+    }
+
+    REQUIRE(timestamps > 5);
+    REQUIRE(lastTimestamp >= 150);
+}
@@ -0,0 +1,67 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "3rdparty/doctest.h"
+
+#include "interpret/modulefragmentindex.h"
+
+#include <vector>
+
+using namespace std;
+
+TEST_CASE ("empty") {
+    ModuleFragmentIndex index;
+    REQUIRE(index.empty());
+    REQUIRE(index.find(0) == ModuleFragmentIndex::NOT_FOUND);
+    REQUIRE(index.find(1234) == ModuleFragmentIndex::NOT_FOUND);
+}
+
+TEST_CASE ("find") {
+    ModuleFragmentIndex index;
+    index.add(0x3000, 0x3fff, 2);
+    index.add(0x1000, 0x1fff, 0);
+    index.add(0x2000, 0x2800, 1);
+    REQUIRE(index.size() == 3);
+
+    REQUIRE(index.find(0xfff) == ModuleFragmentIndex::NOT_FOUND);
+    REQUIRE(index.find(0x1000) == 0);
+    REQUIRE(index.find(0x1fff) == 0);
+    REQUIRE(index.find(0x2000) == 1);
+    // the last hit must not be returned for addresses outside of it
+    REQUIRE(index.find(0x2801) == ModuleFragmentIndex::NOT_FOUND);
+    REQUIRE(index.find(0x3000) == 2);
+    REQUIRE(index.find(0x3800) == 2);
+    REQUIRE(index.find(0x4000) == ModuleFragmentIndex::NOT_FOUND);
+
+    SUBCASE ("add") {
+        // gets merged into the sorted ranges on the next lookup
+        index.add(0x800, 0x900, 3);
+        index.add(0x5000, 0x6000, 4);
+        REQUIRE(index.find(0x3800) == 2);
+        REQUIRE(index.find(0x850) == 3);
+        REQUIRE(index.find(0x5000) == 4);
+        REQUIRE(index.find(0x1800) == 0);
+
+        vector<uint32_t> ids;
+        index.forEach([&ids](uintptr_t /*start*/, uintptr_t /*end*/, uint32_t id) { ids.push_back(id); });
+        REQUIRE(ids == vector<uint32_t> {3, 0, 1, 2, 4});
+    }
+
+    SUBCASE ("remap") {
+        index.remap({ModuleFragmentIndex::NOT_FOUND, 0, 1});
+        REQUIRE(index.size() == 2);
+        REQUIRE(index.find(0x1800) == ModuleFragmentIndex::NOT_FOUND);
+        REQUIRE(index.find(0x2000) == 0);
+        REQUIRE(index.find(0x3000) == 1);
+    }
+
+    SUBCASE ("clear") {
+        index.clear();
+        REQUIRE(index.empty());
+        REQUIRE(index.find(0x1000) == ModuleFragmentIndex::NOT_FOUND);
+    }
+}
@@ -0,0 +1,362 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "3rdparty/doctest.h"
+
+#include "util/pointermap.h"
+#include "util/spillfile.h"
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace {
+// the range of the small pointer parts, see PointerMap::SplitPointer
+constexpr uint16_t PAGE_SIZE = std::numeric_limits<uint16_t>::max() / 4;
+
+AllocationInfoIndex indexOf(uint32_t index)
+{
+    AllocationInfoIndex ret;
+    ret.index = index;
+    return ret;
+}
+
+void requireContents(PointerPage& page, const unordered_map<uint16_t, uint32_t>& expected)
+{
+    REQUIRE(page.size() == expected.size());
+    for (const auto& entry : expected) {
+        // take and re-insert, there is no plain lookup
+        const auto taken = page.take(entry.first);
+        REQUIRE(taken.second);
+        REQUIRE(taken.first.index == entry.second);
+        page.insert(entry.first, taken.first);
+    }
+    REQUIRE(page.size() == expected.size());
+}
+
+// the sizes of the slot allocations for 4, 8 and 16 slots, see PointerPage::byteSize
+constexpr uint64_t BYTE_SIZE_4 = 16 + 4 * 6;
+constexpr uint64_t BYTE_SIZE_8 = 16 + 8 * 6;
+constexpr uint64_t BYTE_SIZE_16 = 16 + 16 * 6;
+}
+
+TEST_CASE ("pointer page") {
+    PointerPage page;
+    REQUIRE(page.empty());
+    REQUIRE(page.isLoaded());
+    REQUIRE(page.byteSize() == 0);
+    REQUIRE(!page.take(42).second);
+
+    SUBCASE ("tiny pages") {
+        // tiny pages pad their only group with sentinels, missing keys must still not be found
+        page.insert(1, indexOf(10));
+        REQUIRE(page.byteSize() == BYTE_SIZE_4);
+        REQUIRE(!page.take(2).second);
+        page.insert(2, indexOf(20));
+        page.insert(3, indexOf(30));
+        REQUIRE(page.byteSize() == BYTE_SIZE_4);
+        for (uint16_t key = 4; key < 100; ++key) {
+            REQUIRE(!page.take(key).second);
+        }
+
+        // at least one slot stays empty, so the fourth key grows the page
+        page.insert(4, indexOf(40));
+        REQUIRE(page.byteSize() == BYTE_SIZE_8);
+        for (uint16_t key = 5; key <= 8; ++key) {
+            page.insert(key, indexOf(key * 10));
+        }
+        REQUIRE(page.byteSize() == BYTE_SIZE_16);
+        requireContents(page, {{1, 10}, {2, 20}, {3, 30}, {4, 40}, {5, 50}, {6, 60}, {7, 70}, {8, 80}});
+    }
+
+    SUBCASE ("overwrite") {
+        page.insert(7, indexOf(1));
+        page.insert(7, indexOf(2));
+        REQUIRE(page.size() == 1);
+        const auto taken = page.take(7);
+        REQUIRE(taken.second);
+        REQUIRE(taken.first.index == 2);
+        REQUIRE(page.empty());
+        REQUIRE(!page.take(7).second);
+    }
+
+    SUBCASE ("grow and shrink") {
+        unordered_map<uint16_t, uint32_t> expected;
+        uint64_t lastByteSize = 0;
+        uint32_t numGrowths = 0;
+        // all small pointer parts of a page
+        const uint16_t numKeys = PAGE_SIZE;
+        for (uint16_t key = 0; key < numKeys; ++key) {
+            page.insert(key, indexOf(key + 1u));
+            expected[key] = key + 1u;
+            REQUIRE(page.byteSize() >= lastByteSize);
+            if (page.byteSize() > lastByteSize) {
+                ++numGrowths;
+                lastByteSize = page.byteSize();
+            }
+        }
+        REQUIRE(numGrowths > 10);
+        // 7 bytes per slot, and the capacity grows by 1/8 at a time
+        REQUIRE(page.byteSize() < numKeys * 7 * 5 / 4);
+        requireContents(page, expected);
+
+        const auto fullByteSize = page.byteSize();
+        for (uint16_t key = 0; key < numKeys; ++key) {
+            if (key % 64) {
+                const auto taken = page.take(key);
+                REQUIRE(taken.second);
+                REQUIRE(taken.first.index == key + 1u);
+                expected.erase(key);
+            }
+        }
+        // the page shrinks once it is mostly empty
+        REQUIRE(page.byteSize() < fullByteSize / 8);
+        requireContents(page, expected);
+
+        for (const auto& entry : expected) {
+            REQUIRE(page.take(entry.first).second);
+        }
+        REQUIRE(page.empty());
+        REQUIRE(page.byteSize() <= BYTE_SIZE_8);
+    }
+
+    SUBCASE ("tombstones") {
+        unordered_map<uint16_t, uint32_t> expected;
+        // fill the page such that its groups are full and taking keys leaves tombstones behind
+        const uint16_t numKeys = 1000;
+        for (uint16_t key = 0; key < numKeys; ++key) {
+            page.insert(key, indexOf(key));
+            expected[key] = key;
+        }
+        const auto byteSize = page.byteSize();
+
+        SUBCASE ("re-insert") {
+            // the tombstones get reused for the same keys
+            for (int round = 0; round < 100; ++round) {
+                for (uint16_t key = round; key < numKeys; key += 100) {
+                    REQUIRE(page.take(key).second);
+                    page.insert(key, indexOf(key + round));
+                    expected[key] = key + round;
+                }
+            }
+            REQUIRE(page.byteSize() == byteSize);
+            requireContents(page, expected);
+        }
+
+        SUBCASE ("churn") {
+            // replace the keys with new ones over and over, which must not grow the page
+            mt19937 engine(1234);
+            uniform_int_distribution<uint16_t> keyDistribution(0, PAGE_SIZE - 1);
+            vector<uint16_t> keys;
+            for (const auto& entry : expected) {
+                keys.push_back(entry.first);
+            }
+            for (uint32_t i = 0; i < 100000; ++i) {
+                auto& oldKey = keys[i % keys.size()];
+                const auto taken = page.take(oldKey);
+                REQUIRE(taken.second);
+                REQUIRE(taken.first.index == expected[oldKey]);
+                expected.erase(oldKey);
+
+                uint16_t newKey = 0;
+                do {
+                    newKey = keyDistribution(engine);
+                } while (expected.count(newKey));
+                page.insert(newKey, indexOf(i));
+                expected[newKey] = i;
+                oldKey = newKey;
+                REQUIRE(page.size() == numKeys);
+            }
+            REQUIRE(page.byteSize() == byteSize);
+            requireContents(page, expected);
+        }
+    }
+
+    SUBCASE ("unload and load") {
+        unordered_map<uint16_t, uint32_t> expected;
+        for (uint16_t key = 0; key < 500; key += 3) {
+            page.insert(key, indexOf(key * 2u));
+            expected[key] = key * 2u;
+        }
+        for (uint16_t key = 0; key < 500; key += 9) {
+            REQUIRE(page.take(key).second);
+            expected.erase(key);
+        }
+
+        const vector<char> data(page.data(), page.data() + page.byteSize());
+        const auto byteSize = page.byteSize();
+        page.unload();
+        REQUIRE(!page.isLoaded());
+        REQUIRE(page.size() == expected.size());
+        REQUIRE(page.byteSize() == byteSize);
+
+        page.load(data.data());
+        REQUIRE(page.isLoaded());
+        requireContents(page, expected);
+        page.insert(1, indexOf(1));
+        expected[1] = 1;
+        requireContents(page, expected);
+    }
+}
+
+TEST_CASE ("spill file") {
+    SpillFile file;
+    REQUIRE(file.isValid());
+    REQUIRE(file.usedSize() == 0);
+
+    // blocks are allocated in power of two size classes of at least 64 bytes
+    const auto a = file.allocate(10);
+    const auto b = file.allocate(100);
+    const auto c = file.allocate(64);
+    REQUIRE(a != SpillFile::INVALID_OFFSET);
+    REQUIRE(b != SpillFile::INVALID_OFFSET);
+    REQUIRE(c != SpillFile::INVALID_OFFSET);
+    REQUIRE(file.usedSize() == 64 + 128 + 64);
+
+    fill_n(file.data(a), 10, 'a');
+    fill_n(file.data(b), 100, 'b');
+    fill_n(file.data(c), 64, 'c');
+    // the data is backed by the file and survives dropping it from memory
+    file.release();
+    REQUIRE(count(file.data(a), file.data(a) + 10, 'a') == 10);
+    REQUIRE(count(file.data(b), file.data(b) + 100, 'b') == 100);
+    REQUIRE(count(file.data(c), file.data(c) + 64, 'c') == 64);
+
+    file.free(a, 10);
+    REQUIRE(file.usedSize() == 128 + 64);
+    REQUIRE(file.peakUsedSize() == 64 + 128 + 64);
+    // freed blocks get reused for the same size class only
+    const auto d = file.allocate(200);
+    REQUIRE(d != a);
+    REQUIRE(file.allocate(33) == a);
+
+    // larger blocks grow the file beyond its first mapping
+    const auto e = file.allocate(100 << 20);
+    REQUIRE(e != SpillFile::INVALID_OFFSET);
+    file.data(e)[(100 << 20) - 1] = 'e';
+    REQUIRE(count(file.data(c), file.data(c) + 64, 'c') == 64);
+
+    SpillFile invalid("/does/not/exist");
+    REQUIRE(!invalid.isValid());
+    REQUIRE(invalid.allocate(64) == SpillFile::INVALID_OFFSET);
+}
+
+TEST_CASE ("pointer map") {
+    PointerMap map;
+    unordered_map<uint64_t, uint32_t> expected;
+    mt19937_64 engine(42);
+
+    auto requireTakeAll = [&]() {
+        vector<uint64_t> pointers;
+        for (const auto& entry : expected) {
+            pointers.push_back(entry.first);
+        }
+        shuffle(pointers.begin(), pointers.end(), engine);
+        for (auto ptr : pointers) {
+            const auto taken = map.takePointer(ptr);
+            REQUIRE(taken.second);
+            REQUIRE(taken.first.index == expected[ptr]);
+            REQUIRE(!map.takePointer(ptr).second);
+        }
+        expected.clear();
+        REQUIRE(map.heapSize() == 0);
+    };
+
+    SUBCASE ("churn") {
+        // pointers spread over a couple of pages, like a heap that gets reused
+        uniform_int_distribution<uint64_t> pointerDistribution(0x10000, 0x10000 + 64 * PAGE_SIZE);
+        for (uint32_t i = 0; i < 200000; ++i) {
+            const auto ptr = pointerDistribution(engine) & ~uint64_t(7);
+            auto it = expected.find(ptr);
+            if (it == expected.end()) {
+                map.addPointer(ptr, indexOf(i));
+                expected[ptr] = i;
+            } else {
+                const auto taken = map.takePointer(ptr);
+                REQUIRE(taken.second);
+                REQUIRE(taken.first.index == it->second);
+                expected.erase(it);
+            }
+        }
+        REQUIRE(map.heapSize() > 0);
+        REQUIRE(map.peakHeapSize() >= map.heapSize());
+        requireTakeAll();
+    }
+
+    SUBCASE ("spilling") {
+        SpillFile spillFile;
+        REQUIRE(spillFile.isValid());
+        const uint64_t budget = 64 * 1024;
+        map.setMemoryBudget(budget, &spillFile);
+
+        const uint64_t numPages = 512;
+        uint32_t numSpills = 0;
+        uint32_t index = 0;
+        auto addPointers = [&](uint64_t pointersPerPage) {
+            for (uint64_t i = 0; i < pointersPerPage; ++i) {
+                for (uint64_t page = 0; page < numPages; ++page) {
+                    const auto ptr = (page * 3 + 100) * PAGE_SIZE + i * 16;
+                    if (expected.count(ptr)) {
+                        continue;
+                    }
+                    const auto heapSize = map.heapSize();
+                    map.addPointer(ptr, indexOf(++index));
+                    expected[ptr] = index;
+                    if (map.heapSize() < heapSize) {
+                        ++numSpills;
+                    }
+                    REQUIRE(map.heapSize() <= budget);
+                }
+            }
+        };
+
+        // every page gets used round-robin, which forces the least recently used ones out over and over
+        addPointers(64);
+        REQUIRE(numSpills > 10);
+        REQUIRE(spillFile.usedSize() > 0);
+        // only the page that triggers the spilling may exceed the budget, briefly
+        REQUIRE(map.peakHeapSize() > budget / 2);
+        REQUIRE(map.peakHeapSize() < budget + budget / 8);
+
+        // take half of the pointers, which reads the spilled pages back in
+        uint32_t numTaken = 0;
+        for (auto it = expected.begin(); it != expected.end();) {
+            if (numTaken++ % 2) {
+                ++it;
+                continue;
+            }
+            const auto taken = map.takePointer(it->first);
+            REQUIRE(taken.second);
+            REQUIRE(taken.first.index == it->second);
+            it = expected.erase(it);
+        }
+
+        // and add some more, then everything must still be there
+        numSpills = 0;
+        addPointers(96);
+        REQUIRE(numSpills > 10);
+        requireTakeAll();
+        REQUIRE(spillFile.usedSize() == 0);
+    }
+
+    SUBCASE ("invalid spill file") {
+        SpillFile spillFile("/does/not/exist");
+        map.setMemoryBudget(1024, &spillFile);
+        for (uint32_t i = 0; i < 10000; ++i) {
+            const auto ptr = uint64_t(i) * 4096;
+            map.addPointer(ptr, indexOf(i));
+            expected[ptr] = i;
+        }
+        // without a spill file the budget is ignored
+        REQUIRE(map.heapSize() > 1024);
+        requireTakeAll();
+    }
+}
@@ -0,0 +1,122 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "3rdparty/doctest.h"
+
+#include "interpret/symbolcache.h"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+struct Symbol
+{
+    uint64_t offset;
+    uint64_t size;
+    string name;
+};
+
+vector<Symbol> sortedSymbols(vector<Symbol> symbols)
+{
+    stable_sort(symbols.begin(), symbols.end(),
+                [](const Symbol& lhs, const Symbol& rhs) { return lhs.offset < rhs.offset; });
+    symbols.erase(unique(symbols.begin(), symbols.end(),
+                         [](const Symbol& lhs, const Symbol& rhs) {
+                             return lhs.offset == rhs.offset && lhs.size == rhs.size;
+                         }),
+                  symbols.end());
+    return symbols;
+}
+
+/// the straight forward lookup the symbol cache must be equivalent to, @p symbols must be sorted
+string findNaive(const vector<Symbol>& symbols, uint64_t relAddr)
+{
+    auto it = lower_bound(symbols.begin(), symbols.end(), relAddr,
+                          [](const Symbol& symbol, uint64_t addr) { return symbol.offset < addr; });
+    if (it != symbols.end() && it->offset == relAddr)
+        return it->name;
+    if (it == symbols.begin())
+        return {};
+    --it;
+    if (it->offset + it->size > relAddr || it->size == 0)
+        return it->name;
+    return {};
+}
+
+SymbolCache::Symbols toSymbols(const vector<Symbol>& symbols)
+{
+    SymbolCache::Symbols ret;
+    ret.reserve(symbols.size());
+    for (const auto& symbol : symbols) {
+        ret.add(symbol.offset, symbol.offset, symbol.size, symbol.name.c_str());
+    }
+    return ret;
+}
+}
+
+TEST_CASE ("empty") {
+    SymbolCache cache;
+    REQUIRE(!cache.hasSymbols("foo"));
+    cache.setSymbols("foo", {});
+    REQUIRE(cache.hasSymbols("foo"));
+    REQUIRE(!cache.findSymbol("foo", 0).isValid());
+    REQUIRE(!cache.findSymbol("foo", 1234).isValid());
+}
+
+TEST_CASE ("lookup") {
+    SymbolCache cache;
+    // the duplicates are in the order shown in the comment in SymbolCache::Symbols::finalize
+    cache.setSymbols("lib", toSymbols({{0x180, 0x3d8, "__memmove_avx_unaligned_erms"},
+                                       {0x130, 0x33, "__memmove_avx_unaligned"},
+                                       {0x180, 0x3d8, "__memcpy_avx_unaligned_erms"},
+                                       {0x130, 0x33, "__memcpy_avx_unaligned"},
+                                       {0x600, 0, "_Z3foov"}}));
+
+    auto symbol = cache.findSymbol("lib", 0x130);
+    REQUIRE(symbol.symname == "__memmove_avx_unaligned");
+    REQUIRE(symbol.offset == 0x130);
+    REQUIRE(symbol.size == 0x33);
+    REQUIRE(cache.findSymbol("lib", 0x162).symname == "__memmove_avx_unaligned");
+    REQUIRE(!cache.findSymbol("lib", 0x163).isValid());
+    REQUIRE(!cache.findSymbol("lib", 0x12f).isValid());
+    REQUIRE(cache.findSymbol("lib", 0x200).symname == "__memmove_avx_unaligned_erms");
+    // zero sized symbols extend to the next one, and get demangled
+    REQUIRE(cache.findSymbol("lib", 0x600).symname == "foo()");
+    REQUIRE(cache.findSymbol("lib", 0x10000).symname == "foo()");
+    // the cached demangled name is used the second time
+    REQUIRE(cache.findSymbol("lib", 0x600).symname == "foo()");
+
+    const auto& symbols = cache.symbols("lib");
+    REQUIRE(symbols.size() == 3);
+    REQUIRE(symbols.name(2) == string("_Z3foov"));
+}
+
+TEST_CASE ("random lookups") {
+    mt19937 randomGenerator(0);
+    // cover complete and incomplete levels of the search tree
+    for (size_t numSymbols : {1, 2, 3, 7, 8, 9, 100, 1000, 1023, 1024, 1025}) {
+        CAPTURE(numSymbols);
+        vector<Symbol> symbols;
+        for (size_t i = 0; i < numSymbols; ++i) {
+            const auto offset = randomGenerator() % (numSymbols * 16);
+            const auto size = randomGenerator() % 32;
+            symbols.push_back({offset, size, "sym" + to_string(i)});
+        }
+
+        SymbolCache cache;
+        cache.setSymbols("lib", toSymbols(symbols));
+        const auto sorted = sortedSymbols(symbols);
+        for (uint64_t relAddr = 0; relAddr < numSymbols * 16 + 64; ++relAddr) {
+            CAPTURE(relAddr);
+            REQUIRE(cache.findSymbol("lib", relAddr).symname == findNaive(sorted, relAddr));
+        }
+    }
+}
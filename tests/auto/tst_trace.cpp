@@ -8,6 +8,7 @@
 #include "3rdparty/doctest.h"
 
 #include "track/trace.h"
+#include "track/tracecache.h"
 #include "track/tracetree.h"
 
 #include "interpret/dwarfdiecache.h"
@@ -19,6 +20,7 @@
 #include <thread>
 
 #include <link.h>
+#include <signal.h>
 
 using namespace std;
 
@@ -53,6 +55,37 @@ bool __attribute__((noinline)) bar(Trace& trace, int depth)
     }
 }
 
+// two different callers of the same frames at the same stack address
+bool __attribute__((noinline)) fillViaA(Trace& trace, int depth)
+{
+    const auto ret = fill(trace, depth, 0);
+    asm volatile("" : : : "memory");
+    return ret;
+}
+
+bool __attribute__((noinline)) fillViaB(Trace& trace, int depth)
+{
+    const auto ret = fill(trace, depth, 0);
+    asm volatile("" : : : "memory");
+    return ret;
+}
+
+bool __attribute__((noinline)) fillWith(Trace& trace, Trace::Unwinder unwinder)
+{
+    Trace::setUnwinder(unwinder);
+    return trace.fill(0);
+}
+
+// filled by the signal handler, with the DWARF based unwinder and the frame pointer unwinder
+Trace g_signalTraces[2];
+bool g_signalTracesFilled[2] = {false, false};
+
+void fillFromSignalHandler(int)
+{
+    g_signalTracesFilled[0] = fillWith(g_signalTraces[0], Trace::Unwinder::Dwarf);
+    g_signalTracesFilled[1] = fillWith(g_signalTraces[1], Trace::Unwinder::FramePointer);
+}
+
 void validateTrace(const Trace& trace, int expectedSize)
 {
     SUBCASE("validate the trace size")
@@ -91,6 +124,114 @@ TEST_CASE ("getting backtrace traces") {
     }
 }
 
+TEST_CASE ("frame pointer backtraces") {
+    const auto defaultUnwinder = Trace::unwinder();
+    if (!Trace::setUnwinder(Trace::Unwinder::FramePointer)) {
+        MESSAGE("frame pointer unwinding is not supported on this platform");
+        return;
+    }
+
+    Trace trace;
+    REQUIRE(trace.fill(0));
+    const auto offset = trace.size();
+    REQUIRE(offset > 1);
+
+    for (int i = 0; i < 2 * Trace::MAX_SIZE; ++i) {
+        REQUIRE(fill(trace, i, 1));
+        const auto expectedSize = min(i + offset, static_cast<int>(Trace::MAX_SIZE) - 1);
+        validateTrace(trace, expectedSize);
+    }
+
+    // our own frames all have a frame pointer, so we must find the same frames as the DWARF based unwinder
+    const Trace::Unwinder unwinders[] = {Trace::Unwinder::Dwarf, Trace::Unwinder::FramePointer};
+    Trace traces[2];
+    for (int i = 0; i < 2; ++i) {
+        REQUIRE(fillWith(traces[i], unwinders[i]));
+    }
+    const auto& dwarfTrace = traces[0];
+    const auto& fpTrace = traces[1];
+    REQUIRE(fpTrace.size() > 2);
+    REQUIRE(fpTrace.size() <= dwarfTrace.size());
+    // the first two frames are within the different unwinders and fillWith
+    for (int i = 2; i < fpTrace.size(); ++i) {
+        REQUIRE(fpTrace[i] == dwarfTrace[i]);
+    }
+
+    Trace::setUnwinder(defaultUnwinder);
+}
+
+TEST_CASE ("frame pointer backtraces on an alternate signal stack") {
+    const auto defaultUnwinder = Trace::unwinder();
+    if (!Trace::setUnwinder(Trace::Unwinder::FramePointer)) {
+        MESSAGE("frame pointer unwinding is not supported on this platform");
+        return;
+    }
+
+    // the signal stack is not part of the stack of the thread
+    vector<char> signalStack(4 * SIGSTKSZ);
+    stack_t stack = {};
+    stack.ss_sp = signalStack.data();
+    stack.ss_size = signalStack.size();
+    stack_t oldStack;
+    REQUIRE(sigaltstack(&stack, &oldStack) == 0);
+
+    struct sigaction action = {};
+    action.sa_handler = &fillFromSignalHandler;
+    action.sa_flags = SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    struct sigaction oldAction;
+    REQUIRE(sigaction(SIGUSR1, &action, &oldAction) == 0);
+
+    REQUIRE(raise(SIGUSR1) == 0);
+
+    sigaction(SIGUSR1, &oldAction, nullptr);
+    sigaltstack(&oldStack, nullptr);
+    Trace::setUnwinder(defaultUnwinder);
+
+    REQUIRE(g_signalTracesFilled[0]);
+    REQUIRE(g_signalTracesFilled[1]);
+    const auto& dwarfTrace = g_signalTraces[0];
+    const auto& fpTrace = g_signalTraces[1];
+    // the walk continues on the stack of the thread after the signal trampoline
+    REQUIRE(fpTrace.size() > 5);
+    // it must not read anything but the known stacks, so all frames it finds are real ones
+    // the first four frames are within the different unwinders, fillWith and its two call sites in the signal handler
+    for (int i = 4; i < fpTrace.size(); ++i) {
+        REQUIRE(find(dwarfTrace.begin(), dwarfTrace.end(), fpTrace[i]) != dwarfTrace.end());
+    }
+}
+
+TEST_CASE ("incremental backtraces") {
+    const auto defaultUnwinder = Trace::unwinder();
+    if (!Trace::setUnwinder(Trace::Unwinder::IncrementalDwarf)) {
+        MESSAGE("incremental unwinding is not supported by this backend");
+        return;
+    }
+
+    auto unwind = [](Trace::Unwinder unwinder, bool viaA, int depth) {
+        Trace::setUnwinder(unwinder);
+        Trace trace;
+        REQUIRE((viaA ? fillViaA(trace, depth) : fillViaB(trace, depth)));
+        return vector<Trace::ip_t>(trace.begin(), trace.end());
+    };
+
+    // the frames below fillViaA and fillViaB are identical, but we must not reuse the wrong callers
+    const Trace::Unwinder unwinders[] = {Trace::Unwinder::Dwarf, Trace::Unwinder::IncrementalDwarf};
+    for (int depth : {0, 3, 3, 10, 2 * Trace::MAX_SIZE, 1}) {
+        for (bool viaA : {true, false, true, true, false, false}) {
+            vector<Trace::ip_t> traces[2];
+            for (int i = 0; i < 2; ++i) {
+                traces[i] = unwind(unwinders[i], viaA, depth);
+            }
+            REQUIRE(traces[0].size() == traces[1].size());
+            // the first frame is within the unwinder
+            REQUIRE(equal(traces[0].begin() + 1, traces[0].end(), traces[1].begin() + 1));
+        }
+    }
+
+    Trace::setUnwinder(defaultUnwinder);
+}
+
 TEST_CASE ("tracetree indexing") {
     TraceTree tree;
 
@@ -175,6 +316,92 @@ TEST_CASE ("tracetree indexing") {
     }
 }
 
+TEST_CASE ("tracetree wide fan-out") {
+    TraceTree tree;
+    vector<pair<uintptr_t, uint32_t>> ipsToParent;
+    auto callback = [&ipsToParent](uintptr_t ip, uint32_t parentIndex) {
+        ipsToParent.push_back({ip, parentIndex});
+        return true;
+    };
+
+    // many leaves below the same parent move the children from the inline array to a hash table
+    const uintptr_t numLeaves = 10000;
+    vector<uint32_t> indices;
+    Trace trace;
+    for (uintptr_t leaf = 0; leaf < numLeaves; ++leaf) {
+        // spread the leaves in both directions, the inline children are kept sorted
+        trace.fillTestData(3, 100 + (leaf % 2 ? leaf : numLeaves * 2 - leaf));
+        const auto index = tree.index(trace, callback);
+        REQUIRE(index == ipsToParent.size());
+        indices.push_back(index);
+    }
+    // 3 shared nodes and one for each leaf
+    REQUIRE(ipsToParent.size() == 3 + numLeaves);
+
+    // indexing the same traces again must not create any new nodes
+    for (uintptr_t leaf = 0; leaf < numLeaves; ++leaf) {
+        trace.fillTestData(3, 100 + (leaf % 2 ? leaf : numLeaves * 2 - leaf));
+        REQUIRE(tree.index(trace, callback) == indices[leaf]);
+        REQUIRE(ipsToParent[indices[leaf] - 1].second == 3);
+    }
+    REQUIRE(ipsToParent.size() == 3 + numLeaves);
+
+    tree.clear();
+    ipsToParent.clear();
+    REQUIRE(tree.index(trace, callback) == 4);
+    REQUIRE(ipsToParent.size() == 4);
+}
+
+TEST_CASE ("tracecache") {
+    TraceTree tree;
+    TraceCache cache;
+    uint32_t numNodes = 0;
+    auto callback = [&numNodes](uintptr_t, uint32_t) {
+        ++numNodes;
+        return true;
+    };
+    auto index = [&](const Trace& trace) {
+        const auto key = TraceCache::key(trace);
+        auto index = cache.find(key);
+        if (!index) {
+            index = tree.index(trace, callback);
+            cache.insert(key, index);
+        }
+        return index;
+    };
+
+    Trace trace;
+    vector<uint32_t> indices;
+    for (uintptr_t i = 1; i <= 100; ++i) {
+        const uintptr_t ips[] = {i, i % 7 + 1000, 2000};
+        trace.fillTestData(begin(ips), end(ips));
+        indices.push_back(index(trace));
+    }
+    REQUIRE(cache.hits() == 0);
+    REQUIRE(cache.misses() == 100);
+    const auto nodes = numNodes;
+
+    // cached traces resolve to the same index without touching the tree
+    for (uintptr_t i = 1; i <= 100; ++i) {
+        const uintptr_t ips[] = {i, i % 7 + 1000, 2000};
+        trace.fillTestData(begin(ips), end(ips));
+        REQUIRE(index(trace) == indices[i - 1]);
+    }
+    REQUIRE(cache.hits() == 100);
+    REQUIRE(numNodes == nodes);
+
+    // parts of a cached trace are distinct traces
+    const uintptr_t shorter[] = {1000 + 1 % 7, 2000};
+    trace.fillTestData(begin(shorter), end(shorter));
+    REQUIRE(cache.find(TraceCache::key(trace)) == 0);
+
+    cache.clear();
+    REQUIRE(cache.hits() == 0);
+    REQUIRE(cache.misses() == 0);
+    trace.fillTestData(begin(shorter), end(shorter));
+    REQUIRE(cache.find(TraceCache::key(trace)) == 0);
+}
+
 struct CallbackData
 {
     Dwfl* dwfl = nullptr;
@@ -249,16 +476,50 @@ TEST_CASE ("symbolizing") {
             REQUIRE(cuDie->dieName(&scopes[0]) == "foo");
             auto loc = callSourceLocation(&scopes[0], files, cuDie->cudie());
             // called from bar
-            REQUIRE(loc.line == 52);
+            REQUIRE(loc.line == 54);
 
             REQUIRE(cuDie->dieName(&scopes[1]) == "asdf");
             loc = callSourceLocation(&scopes[1], files, cuDie->cudie());
             // called from foo
-            REQUIRE(loc.line == 44);
+            REQUIRE(loc.line == 46);
+        }
+
+        // the inline scope table of the CU yields the same chain, starting with the subprogram
+        const auto chain = cache.findInlineScopeChain(cuDie, offset);
+        REQUIRE(chain.size() == scopes.size() + 1);
+        REQUIRE(cuDie->dieName(&chain.front()->die) == dieName);
+        for (size_t k = 0; k < scopes.size(); ++k) {
+            REQUIRE(dwarf_dieoffset(&chain[k + 1]->die) == dwarf_dieoffset(&scopes[k]));
+        }
+        if (!scopes.empty()) {
+            REQUIRE(cuDie->callSourceLocation(chain[1]).line == 54);
+            REQUIRE(cuDie->callSourceLocation(chain[2]).line == 46);
         }
 
         if (isDebugBuild) {
             ++j;
         }
     }
+
+    // demangling the names of the scope chains at once yields the same names
+    DwarfDieCache batchCache(data.mod);
+    for (uint i = 0; i < 6 + j; ++i) {
+        auto addr = reinterpret_cast<Dwarf_Addr>(trace[i]);
+        auto cuDie = cache.findCuDie(addr);
+        auto batchCuDie = batchCache.findCuDie(addr);
+        REQUIRE(batchCuDie);
+
+        auto offset = addr - batchCuDie->bias();
+        std::vector<Dwarf_Die> dies;
+        for (auto* scope : batchCache.findInlineScopeChain(batchCuDie, offset))
+            dies.push_back(scope->die);
+        batchCuDie->demangleDieNames(dies, 4);
+
+        const auto chain = batchCache.findInlineScopeChain(batchCuDie, offset);
+        const auto expected = cache.findInlineScopeChain(cuDie, offset);
+        REQUIRE(chain.size() == expected.size());
+        for (size_t k = 0; k < chain.size(); ++k) {
+            REQUIRE(batchCuDie->dieName(&chain[k]->die) == cuDie->dieName(&expected[k]->die));
+        }
+    }
 }
@@ -4,34 +4,194 @@
     SPDX-License-Identifier: LGPL-2.1-or-later
 */
 
+#include <src/analyze/tracefilereader.h>
 #include <src/util/linereader.h>
 
+#ifdef BENCH_LINEREADER_ZSTD
+#include <src/interpret/zstdframewriter.h>
+
+#include <fcntl.h>
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
 
-int main()
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+namespace {
+// the byte counter filter of the former AccumulatedTraceData::read
+class byte_counter
+{
+public:
+    using char_type = char;
+    using category = boost::iostreams::multichar_input_filter_tag;
+
+    uint64_t bytes() const
+    {
+        return m_bytes;
+    }
+
+    template <typename Source>
+    std::streamsize read(Source& src, char* str, std::streamsize size)
+    {
+        auto const readsize = boost::iostreams::read(src, str, size);
+        if (readsize == -1)
+            return -1;
+        m_bytes += readsize;
+        return readsize;
+    }
+
+private:
+    uint64_t m_bytes = 0;
+};
+
+template <typename Input>
+uint64_t parse(Input& in)
 {
+    uint64_t ret = 0;
+    LineReader reader;
+    while (reader.getLine(in)) {
+        uint64_t hex;
+        while (reader.readHex(hex)) {
+            ret += hex;
+        }
+    }
+    return ret;
+}
+
+/// the former path: a filtering stream with byte counters and getline into a string
+uint64_t parseStream(const std::string& fileName)
+{
+    const bool isCompressed = fileName.size() > 3 && fileName.compare(fileName.size() - 3, 3, ".gz") == 0;
+    std::ifstream file(fileName, std::ios_base::in | std::ios_base::binary);
+    boost::iostreams::filtering_istream in;
+    in.push(byte_counter());
+    if (isCompressed) {
+        in.push(boost::iostreams::gzip_decompressor());
+    }
+    in.push(byte_counter());
+    in.push(file);
+
+    uint64_t ret = 0;
+    LineReader reader;
+    const auto uncompressedCount = in.component<byte_counter>(0);
+    const auto compressedCount = in.component<byte_counter>(in.size() - 2);
+    uint64_t bytes = 0;
+    while (reader.getLine(in)) {
+        bytes = compressedCount->bytes() + uncompressedCount->bytes();
+        uint64_t hex;
+        while (reader.readHex(hex)) {
+            ret += hex;
+        }
+    }
+    return ret + (bytes & 1);
+}
+
+/// the new path, parsing the mapped or decompressed blocks in place
+uint64_t parseBlocks(const std::string& fileName, unsigned numThreads = 0)
+{
+    auto in = openTraceFile(fileName, numThreads);
+    uint64_t ret = 0;
+    LineReader reader;
+    uint64_t bytes = 0;
+    while (reader.getLine(*in)) {
+        bytes = in->readInputBytes() + in->readBytes();
+        uint64_t hex;
+        while (reader.readHex(hex)) {
+            ret += hex;
+        }
+    }
+    return ret + (bytes & 1);
+}
+
+template <typename Parse>
+void bench(const char* name, int iterations, Parse parse)
+{
+    const auto start = std::chrono::steady_clock::now();
+    uint64_t ret = 0;
+    for (int i = 0; i < iterations; ++i) {
+        ret += parse();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    std::cout << name << ": " << std::chrono::duration<double, std::milli>(end - start).count() / iterations
+              << "ms per iteration (" << ret << ")\n";
+}
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 2) {
+        std::cerr << "usage: bench_linereader [ITERATIONS]\n";
+        return 1;
+    }
+    const int iterations = argc > 1 ? atoi(argv[1]) : 100;
+
     std::string contents;
     contents.reserve(5400000);
     for (int i = 0; i < 100000; ++i) {
-        contents.append("0 1 2 3\n");
-        contents.append("102 345 678 9ab\n");
-        contents.append("102345 6789ab cdef01 23456789\n");
+        contents.append("+ 1 2 3\n");
+        contents.append("- 345 678 9ab\n");
+        contents.append("c 6789ab cdef01 23456789\n");
     }
 
-    uint64_t ret = 0;
-    for (int i = 0; i < 1000; ++i) {
+    bench("in memory", iterations, [&contents]() {
         std::istringstream in(contents);
-        LineReader reader;
-        while (reader.getLine(in)) {
-            uint64_t hex;
-            while (reader.readHex(hex)) {
-                ret += hex;
+        return parse(in);
+    });
+
+    const std::string fileName = std::string(P_tmpdir) + "/bench_linereader." + std::to_string(getpid());
+    const auto gzFileName = fileName + ".gz";
+    {
+        std::ofstream(fileName, std::ios_base::binary) << contents;
+        std::ofstream gzFile(gzFileName, std::ios_base::binary);
+        boost::iostreams::filtering_ostream out;
+        out.push(boost::iostreams::gzip_compressor());
+        out.push(gzFile);
+        out << contents;
+    }
+
+    bench("file, filtering stream", iterations, [&fileName]() { return parseStream(fileName); });
+    bench("file, mapped", iterations, [&fileName]() { return parseBlocks(fileName); });
+    bench("gzip file, filtering stream", iterations, [&gzFileName]() { return parseStream(gzFileName); });
+    bench("gzip file, decompressed blocks", iterations, [&gzFileName]() { return parseBlocks(gzFileName); });
+
+#ifdef BENCH_LINEREADER_ZSTD
+    // like heaptrack_interpret --zstd, with small frames to get some parallelism out of our small file
+    const auto zstdFileName = fileName + ".zst";
+    {
+        const auto fd = open(zstdFileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ZstdFrameWriter frameWriter(fd, 256 * 1024);
+        // pass whole lines, like the LineWriter does
+        size_t pos = 0;
+        while (pos < contents.size()) {
+            const auto end = contents.find('\n', std::min(contents.size() - 1, pos + 8 * 1024)) + 1;
+            frameWriter.write(contents.data() + pos, end - pos);
+            pos = end;
+            if (frameWriter.isFrameFull()) {
+                frameWriter.endFrame();
             }
         }
+        frameWriter.finish();
+        close(fd);
+    }
+
+    bench("zstd file, decompressed blocks", iterations, [&zstdFileName]() { return parseBlocks(zstdFileName, 1); });
+    for (unsigned numThreads : {2u, 4u, 8u}) {
+        const auto name = "zstd file, " + std::to_string(numThreads) + " threads";
+        bench(name.c_str(), iterations,
+              [&zstdFileName, numThreads]() { return parseBlocks(zstdFileName, numThreads); });
     }
+    remove(zstdFileName.c_str());
+#endif
 
-    std::cout << ret << '\n';
+    remove(fileName.c_str());
+    remove(gzFileName.c_str());
     return 0;
 }
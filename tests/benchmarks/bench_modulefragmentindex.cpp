@@ -0,0 +1,169 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#include "src/interpret/modulefragmentindex.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchutil.h>
+
+namespace {
+/// the previous lookup of heaptrack_interpret, a binary search over the sorted fragments
+struct LegacyFragments
+{
+    struct Fragment
+    {
+        std::string fileName;
+        uintptr_t addressStart;
+        uintptr_t fragmentStart;
+        uintptr_t fragmentEnd;
+        size_t moduleIndex;
+
+        bool operator<(const Fragment& other) const
+        {
+            return fragmentStart < other.fragmentStart;
+        }
+    };
+
+    void add(const std::string& fileName, uintptr_t start, uintptr_t end, uint32_t id)
+    {
+        fragments.push_back({fileName, start, start, end, id});
+        std::sort(fragments.begin(), fragments.end());
+    }
+
+    uint32_t find(uintptr_t address) const
+    {
+        auto it = std::lower_bound(
+            fragments.begin(), fragments.end(), address,
+            [](const Fragment& fragment, const uintptr_t address) -> bool { return fragment.fragmentEnd < address; });
+        if (it != fragments.end() && it->fragmentStart <= address && it->fragmentEnd >= address) {
+            return it->moduleIndex;
+        }
+        return ModuleFragmentIndex::NOT_FOUND;
+    }
+
+    std::vector<Fragment> fragments;
+};
+
+struct Index
+{
+    void add(const std::string& fileName, uintptr_t start, uintptr_t end, uint32_t id)
+    {
+        // the interpreter stores the names separately, indexed by the id
+        fileNames.push_back(fileName);
+        index.add(start, end, id);
+        // look something up, like the interpreter does between two dlopen calls
+        index.find(start);
+    }
+
+    uint32_t find(uintptr_t address)
+    {
+        return index.find(address);
+    }
+
+    std::vector<std::string> fileNames;
+    ModuleFragmentIndex index;
+};
+
+struct Range
+{
+    uintptr_t start;
+    uintptr_t end;
+};
+
+struct Input
+{
+    std::vector<Range> fragments;
+    std::vector<uintptr_t> lookups;
+};
+
+Input generateInput(size_t numModules, size_t numLookups)
+{
+    std::mt19937_64 randomGenerator(0);
+    Input input;
+    // every module consists of a few fragments, in the order the modules got loaded
+    for (size_t i = 0; i < numModules; ++i) {
+        uintptr_t start = 0x7f0000000000 + (randomGenerator() % (numModules * 64)) * 0x100000;
+        for (int j = 0; j < 4; ++j) {
+            const uintptr_t end = start + 0x1000 + randomGenerator() % 0x10000;
+            input.fragments.push_back({start, end});
+            start = end + 1;
+        }
+    }
+    // drop overlapping modules, they can't occur in practice
+    std::vector<Range> sorted = input.fragments;
+    std::sort(sorted.begin(), sorted.end(), [](const Range& lhs, const Range& rhs) { return lhs.start < rhs.start; });
+    input.fragments.erase(std::remove_if(input.fragments.begin(), input.fragments.end(),
+                                         [&sorted](const Range& range) {
+                                             auto it = std::lower_bound(sorted.begin(), sorted.end(), range.start,
+                                                                        [](const Range& range, uintptr_t start) {
+                                                                            return range.start < start;
+                                                                        });
+                                             return (it != sorted.begin() && std::prev(it)->end >= range.start)
+                                                 || (std::next(it) != sorted.end() && std::next(it)->start <= range.end);
+                                         }),
+                          input.fragments.end());
+
+    // consecutive addresses of a backtrace often come from the same module
+    input.lookups.reserve(numLookups);
+    while (input.lookups.size() < numLookups) {
+        const auto& fragment = input.fragments[randomGenerator() % input.fragments.size()];
+        const auto runLength = 1 + randomGenerator() % 8;
+        for (size_t i = 0; i < runLength; ++i) {
+            input.lookups.push_back(fragment.start + randomGenerator() % (fragment.end - fragment.start + 0x100));
+        }
+    }
+    return input;
+}
+
+template <typename Fragments>
+void bench(const char* name, const Input& input)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    Fragments fragments;
+    for (size_t i = 0; i < input.fragments.size(); ++i) {
+        const auto& fragment = input.fragments[i];
+        fragments.add("/usr/lib/x86_64-linux-gnu/libmodule" + std::to_string(i / 4) + ".so", fragment.start,
+                      fragment.end, i);
+    }
+
+    const auto built = std::chrono::steady_clock::now();
+
+    size_t found = 0;
+    for (auto address : input.lookups) {
+        found += fragments.find(address) != ModuleFragmentIndex::NOT_FOUND;
+    }
+    escape(&found);
+
+    const auto end = std::chrono::steady_clock::now();
+    std::cout << name << ": " << std::chrono::duration<double, std::milli>(built - start).count() << "ms to build, "
+              << std::chrono::duration<double, std::nano>(end - built).count() / input.lookups.size()
+              << "ns per lookup, " << found << " found\n";
+}
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 3) {
+        std::cerr << "usage: bench_modulefragmentindex [MODULES] [LOOKUPS]\n";
+        return 1;
+    }
+
+    const size_t numModules = argc > 1 ? atoi(argv[1]) : 1000;
+    const size_t numLookups = argc > 2 ? atoi(argv[2]) : 10000000;
+    const auto input = generateInput(numModules, numLookups);
+
+    bench<LegacyFragments>("sorted fragments", input);
+    bench<Index>("interval index", input);
+    return 0;
+}
@@ -8,6 +8,7 @@
 
 #include "bench_pointers.h"
 #include "src/util/indices.h"
+#include "src/util/pointermap.h"
 
 struct PointerHashMap
 {
@@ -38,5 +39,11 @@ struct PointerHashMap
 int main()
 {
     benchPointers<PointerHashMap>();
+
+    for (uint32_t numLive : {10000u, 1000000u}) {
+        const auto events = generateChurn(numLive, 20000000);
+        benchChurn<PointerHashMap>("churn, hash map of pointers", events, numLive);
+        benchChurn<PointerMap>("churn, PointerMap", events, numLive);
+    }
     return 0;
 }
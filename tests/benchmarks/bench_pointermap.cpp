@@ -7,8 +7,34 @@
 #include "bench_pointers.h"
 #include "src/util/pointermap.h"
 
-int main()
+#include <cstring>
+
+int main(int argc, char** argv)
 {
-    benchPointers<PointerMap>();
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "legacy") && strcmp(argv[1], "flat"))) {
+        std::cerr << "usage: bench_pointermap [legacy|flat]\n";
+        return 1;
+    }
+    const bool legacy = argc == 1 || !strcmp(argv[1], "legacy");
+    const bool flat = argc == 1 || !strcmp(argv[1], "flat");
+
+    if (legacy) {
+        std::cerr << "sorted vectors per page:" << std::endl;
+        benchPointers<LegacyPointerMap>();
+    }
+    if (flat) {
+        std::cerr << "flat hash table per page:" << std::endl;
+        benchPointers<PointerMap>();
+    }
+
+    for (uint32_t numLive : {10000u, 1000000u}) {
+        const auto events = generateChurn(numLive, 20000000);
+        if (legacy) {
+            benchChurn<LegacyPointerMap>("churn, sorted vectors per page", events, numLive);
+        }
+        if (flat) {
+            benchChurn<PointerMap>("churn, flat hash table per page", events, numLive);
+        }
+    }
     return 0;
 }
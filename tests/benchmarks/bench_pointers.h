@@ -8,15 +8,108 @@
 #define BENCH_POINTERS
 
 #include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <iostream>
+#include <limits>
 #include <random>
 #include <vector>
 
 #include <malloc.h>
 
+#include <tsl/robin_map.h>
+
 #include "src/util/indices.h"
 
+/**
+ * The former PointerMap, which keeps the pointers of a page in two sorted vectors
+ */
+class LegacyPointerMap
+{
+    struct SplitPointer
+    {
+        enum
+        {
+            PageSize = std::numeric_limits<uint16_t>::max() / 4
+        };
+        SplitPointer(uint64_t ptr)
+            : big(ptr / PageSize)
+            , small(static_cast<uint16_t>(ptr % PageSize))
+        {
+        }
+        uint64_t big;
+        uint16_t small;
+    };
+
+public:
+    LegacyPointerMap()
+    {
+        map.reserve(1024);
+    }
+
+    void addPointer(const uint64_t ptr, const AllocationInfoIndex allocationIndex)
+    {
+        const SplitPointer pointer(ptr);
+
+        auto mapIt = map.find(pointer.big);
+        if (mapIt == map.end()) {
+            mapIt = map.insert(mapIt, std::make_pair(pointer.big, Indices()));
+        }
+        auto& indices = mapIt.value();
+        auto pageIt = std::lower_bound(indices.smallPtrParts.begin(), indices.smallPtrParts.end(), pointer.small);
+        auto allocationIt = indices.allocationIndices.begin() + distance(indices.smallPtrParts.begin(), pageIt);
+        if (pageIt == indices.smallPtrParts.end() || *pageIt != pointer.small) {
+            indices.smallPtrParts.insert(pageIt, pointer.small);
+            indices.allocationIndices.insert(allocationIt, allocationIndex);
+        } else {
+            *allocationIt = allocationIndex;
+        }
+    }
+
+    std::pair<AllocationInfoIndex, bool> takePointer(const uint64_t ptr)
+    {
+        const SplitPointer pointer(ptr);
+
+        auto mapIt = map.find(pointer.big);
+        if (mapIt == map.end()) {
+            return {{}, false};
+        }
+        auto& indices = mapIt.value();
+        auto pageIt = std::lower_bound(indices.smallPtrParts.begin(), indices.smallPtrParts.end(), pointer.small);
+        if (pageIt == indices.smallPtrParts.end() || *pageIt != pointer.small) {
+            return {{}, false};
+        }
+        auto allocationIt = indices.allocationIndices.begin() + distance(indices.smallPtrParts.begin(), pageIt);
+        auto index = *allocationIt;
+        indices.allocationIndices.erase(allocationIt);
+        indices.smallPtrParts.erase(pageIt);
+        if (indices.allocationIndices.empty()) {
+            map.erase(mapIt);
+        }
+        return {index, true};
+    }
+
+private:
+    struct Indices
+    {
+        std::vector<uint16_t> smallPtrParts;
+        std::vector<AllocationInfoIndex> allocationIndices;
+    };
+    tsl::robin_map<uint64_t, Indices> map;
+};
+
+/// @return the bytes allocated on the heap, including the large allocations that got mmapped
+inline size_t heapUsage()
+{
+    const auto info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+inline double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
 template <typename Map>
 void benchPointers()
 {
@@ -26,23 +119,24 @@ void benchPointers()
     constexpr uint32_t NUM_POINTERS = 10000000;
     {
         std::vector<uint64_t> pointers(NUM_POINTERS);
-        const auto baseline = mallinfo2().uordblks;
+        const auto baseline = heapUsage();
         std::cerr << "allocated vector:        \t" << baseline << std::endl;
         for (uint32_t i = 0; i < NUM_POINTERS; ++i) {
             pointers[i] = reinterpret_cast<uint64_t>(malloc(1));
         }
-        const auto allocated = (mallinfo2().uordblks - baseline);
+        const auto allocated = (heapUsage() - baseline);
         std::cerr << "allocated input pointers:\t" << allocated << std::endl;
         for (auto ptr : pointers) {
             free(reinterpret_cast<void*>(ptr));
         }
-        std::cerr << "freed input pointers:    \t" << (mallinfo2().uordblks - baseline) << std::endl;
+        std::cerr << "freed input pointers:    \t" << (heapUsage() - baseline) << std::endl;
         srand(0);
         std::shuffle(pointers.begin(), pointers.end(), randGenerator);
         malloc_trim(0);
-        std::cerr << "begin actual benchmark:  \t" << (mallinfo2().uordblks - baseline) << std::endl;
+        std::cerr << "begin actual benchmark:  \t" << (heapUsage() - baseline) << std::endl;
 
         {
+            auto start = std::chrono::steady_clock::now();
             Map map;
             for (auto ptr : pointers) {
                 AllocationInfoIndex index;
@@ -50,11 +144,13 @@ void benchPointers()
                 map.addPointer(ptr, index);
             }
 
-            const auto added = mallinfo2().uordblks - baseline;
+            const auto added = heapUsage() - baseline;
             std::cerr << "pointers added:          \t" << added << " ("
-                      << (float(added) * 100.f / static_cast<float>(allocated)) << "% overhead)" << std::endl;
+                      << (float(added) * 100.f / static_cast<float>(allocated)) << "% overhead, "
+                      << elapsedMs(start) << "ms)" << std::endl;
 
             std::shuffle(pointers.begin(), pointers.end(), randGenerator);
+            start = std::chrono::steady_clock::now();
             for (auto ptr : pointers) {
                 AllocationInfoIndex index;
                 index.index = static_cast<uint32_t>(ptr);
@@ -64,9 +160,10 @@ void benchPointers()
                 }
             }
 
-            std::cerr << "pointers removed:        \t" << mallinfo2().uordblks << std::endl;
+            std::cerr << "pointers removed:        \t" << heapUsage() << " (" << elapsedMs(start) << "ms)"
+                      << std::endl;
             malloc_trim(0);
-            std::cerr << "trimmed:                 \t" << mallinfo2().uordblks << std::endl;
+            std::cerr << "trimmed:                 \t" << heapUsage() << std::endl;
         }
     }
     if (matches != NUM_POINTERS) {
@@ -75,4 +172,91 @@ void benchPointers()
     }
 }
 
+struct PointerEvent
+{
+    uint64_t ptr;
+    bool isAllocation;
+};
+
+/**
+ * Record the pointers seen by a program that keeps @p numLive allocations alive while it
+ * allocates and frees @p numEvents times. Most allocations are short lived, and freed
+ * addresses get reused by the allocator, like in the traces we have to handle.
+ */
+inline std::vector<PointerEvent> generateChurn(uint32_t numLive, uint32_t numEvents)
+{
+    auto randGenerator = std::mt19937(0);
+    std::vector<PointerEvent> events;
+    events.reserve(numEvents + 2 * numLive);
+    std::vector<void*> live;
+    live.reserve(numLive);
+
+    auto allocate = [&]() {
+        // mostly small allocations, some larger ones
+        const auto size = randGenerator() % 4 ? 1 + randGenerator() % 64 : 1 + randGenerator() % 4096;
+        auto* ptr = malloc(size);
+        live.push_back(ptr);
+        events.push_back({reinterpret_cast<uint64_t>(ptr), true});
+    };
+    auto deallocate = [&](size_t index) {
+        std::swap(live[index], live.back());
+        free(live.back());
+        events.push_back({reinterpret_cast<uint64_t>(live.back()), false});
+        live.pop_back();
+    };
+
+    for (uint32_t i = 0; i < numLive; ++i) {
+        allocate();
+    }
+    while (events.size() < numEvents + numLive) {
+        const auto recent = std::min<size_t>(live.size(), 64);
+        deallocate(randGenerator() % 8 ? live.size() - 1 - randGenerator() % recent : randGenerator() % live.size());
+        allocate();
+    }
+    while (!live.empty()) {
+        deallocate(live.size() - 1);
+    }
+    return events;
+}
+
+/// replay @p events, which got recorded with @p numLive allocations via generateChurn
+template <typename Map>
+void benchChurn(const char* name, const std::vector<PointerEvent>& events, uint32_t numLive)
+{
+    malloc_trim(0);
+    const auto baseline = heapUsage();
+    const auto start = std::chrono::steady_clock::now();
+
+    uint64_t numFrees = 0;
+    uint64_t matches = 0;
+    size_t peakUsage = 0;
+    {
+        Map map;
+        for (size_t i = 0; i < events.size(); ++i) {
+            const auto& event = events[i];
+            AllocationInfoIndex index;
+            index.index = static_cast<uint32_t>(event.ptr);
+            if (event.isAllocation) {
+                map.addPointer(event.ptr, index);
+            } else {
+                ++numFrees;
+                auto allocation = map.takePointer(event.ptr);
+                if (allocation.second && allocation.first == index) {
+                    ++matches;
+                }
+            }
+            if (i == numLive) {
+                peakUsage = heapUsage() - baseline;
+            }
+        }
+    }
+
+    std::cerr << name << ":\t" << elapsedMs(start) << "ms for " << events.size() << " events, "
+              << float(peakUsage) / numLive << " bytes per live pointer" << std::endl;
+    if (matches != numFrees) {
+        std::cerr << "FAILED!";
+        abort();
+    }
+}
+
 #endif
@@ -0,0 +1,140 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#include "src/interpret/symbolcache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <malloc.h>
+
+#include <benchutil.h>
+
+namespace {
+/// the previous array-of-structs layout of SymbolCache::Symbols, with a binary search over it
+struct LegacySymbols
+{
+    struct Entry
+    {
+        uint64_t offset;
+        uint64_t value;
+        uint64_t size;
+        std::string symname;
+        bool demangled = false;
+    };
+
+    void add(uint64_t offset, uint64_t value, uint64_t size, const char* name)
+    {
+        entries.push_back({offset, value, size, name});
+    }
+
+    void finalize()
+    {
+        std::stable_sort(entries.begin(), entries.end(),
+                         [](const Entry& lhs, const Entry& rhs) { return lhs.offset < rhs.offset; });
+        entries.erase(std::unique(entries.begin(), entries.end(),
+                                  [](const Entry& lhs, const Entry& rhs) {
+                                      return lhs.offset == rhs.offset && lhs.size == rhs.size;
+                                  }),
+                      entries.end());
+    }
+
+    const Entry* find(uint64_t relAddr) const
+    {
+        auto it = std::lower_bound(entries.begin(), entries.end(), relAddr,
+                                   [](const Entry& entry, uint64_t addr) { return entry.offset < addr; });
+        if (it != entries.end() && it->offset == relAddr)
+            return &(*it);
+        if (it == entries.begin())
+            return nullptr;
+        --it;
+        if (it->offset <= relAddr && (it->offset + it->size > relAddr || (it->size == 0)))
+            return &(*it);
+        return nullptr;
+    }
+
+    std::vector<Entry> entries;
+};
+
+struct Input
+{
+    std::vector<uint64_t> offsets;
+    std::vector<std::string> names;
+    std::vector<uint64_t> lookups;
+};
+
+Input generateInput(size_t numSymbols, size_t numLookups)
+{
+    std::mt19937_64 randomGenerator(0);
+    Input input;
+    input.offsets.reserve(numSymbols);
+    input.names.reserve(numSymbols);
+    for (size_t i = 0; i < numSymbols; ++i) {
+        input.offsets.push_back(randomGenerator() % (numSymbols * 64));
+        // typical mangled C++ names are rather long and don't fit into the small string buffer
+        input.names.push_back("_ZN9namespace5Class" + std::to_string(i) + "8functionERKNSt7__cxx1112basic_string");
+    }
+    input.lookups.reserve(numLookups);
+    for (size_t i = 0; i < numLookups; ++i) {
+        input.lookups.push_back(randomGenerator() % (numSymbols * 64));
+    }
+    return input;
+}
+
+template <typename Symbols, typename IsFound>
+void bench(const char* name, const Input& input, IsFound isFound)
+{
+    malloc_trim(0);
+    const auto baseline = mallinfo2().uordblks;
+    const auto start = std::chrono::steady_clock::now();
+
+    Symbols symbols;
+    for (size_t i = 0; i < input.offsets.size(); ++i) {
+        symbols.add(input.offsets[i], input.offsets[i], 32, input.names[i].c_str());
+    }
+    symbols.finalize();
+
+    const auto built = std::chrono::steady_clock::now();
+    const auto memory = mallinfo2().uordblks - baseline;
+
+    size_t found = 0;
+    for (auto relAddr : input.lookups) {
+        found += isFound(symbols, relAddr);
+    }
+    escape(&found);
+
+    const auto end = std::chrono::steady_clock::now();
+    std::cout << name << ": " << (memory / 1024 / 1024) << "MB, "
+              << std::chrono::duration<double, std::milli>(built - start).count() << "ms to build, "
+              << std::chrono::duration<double, std::nano>(end - built).count() / input.lookups.size()
+              << "ns per lookup, " << found << " found\n";
+}
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 3) {
+        std::cerr << "usage: bench_symbolcache [SYMBOLS] [LOOKUPS]\n";
+        return 1;
+    }
+
+    const size_t numSymbols = argc > 1 ? atoi(argv[1]) : 500000;
+    const size_t numLookups = argc > 2 ? atoi(argv[2]) : 10000000;
+    const auto input = generateInput(numSymbols, numLookups);
+
+    bench<LegacySymbols>("array of structs", input, [](const LegacySymbols& symbols, uint64_t relAddr) {
+        return symbols.find(relAddr) != nullptr;
+    });
+    bench<SymbolCache::Symbols>("struct of arrays", input, [](const SymbolCache::Symbols& symbols, uint64_t relAddr) {
+        return symbols.find(relAddr) != SymbolCache::Symbols::NOT_FOUND;
+    });
+    return 0;
+}
@@ -20,37 +20,55 @@
 #include <boost/container/slist.hpp>
 
 #include "../../src/analyze/allocationdata.h"
+#include "../../src/track/tracetree.h"
 
 constexpr uint64_t MAX_TREE_DEPTH = 64;
-constexpr uint64_t NO_BRANCH_DEPTH = 4;
-constexpr uint64_t BRANCH_WIDTH = 8;
 constexpr uint64_t NUM_TRACES = 1000000;
 
-using Trace = std::array<uint64_t, MAX_TREE_DEPTH>;
+// ordered from the root to the leaf, unused trailing entries are END_OF_TRACE
+using IpTrace = std::array<uint64_t, MAX_TREE_DEPTH>;
+// zero is a valid ip in the generated traces
+constexpr uint64_t END_OF_TRACE = ~uint64_t(0);
 
-uint64_t generateIp(uint64_t level)
+struct TreeShape
 {
-    if (level % NO_BRANCH_DEPTH) {
+    uint64_t depth;
+    // only every n-th level branches out
+    uint64_t noBranchDepth;
+    uint64_t branchWidth;
+};
+
+// the default shape mimics a typical application, the others have to be selected explicitly
+constexpr TreeShape DEFAULT_SHAPE = {MAX_TREE_DEPTH, 4, 8};
+// shallow traces with a huge fan-out, like an event loop dispatching to many different handlers
+constexpr TreeShape WIDE_SHAPE = {8, 4, 100000};
+// deep recursion with hardly any branching
+constexpr TreeShape DEEP_SHAPE = {MAX_TREE_DEPTH, 32, 2};
+
+uint64_t generateIp(const TreeShape& shape, uint64_t level)
+{
+    if (level % shape.noBranchDepth) {
         return level;
     }
     static std::mt19937_64 engine(0);
-    static std::uniform_int_distribution<uint64_t> dist(0, BRANCH_WIDTH - 1);
+    std::uniform_int_distribution<uint64_t> dist(0, shape.branchWidth - 1);
     return dist(engine);
 }
 
-Trace generateTrace()
+IpTrace generateTrace(const TreeShape& shape)
 {
-    Trace trace;
-    for (uint64_t i = 0; i < MAX_TREE_DEPTH; ++i) {
-        trace[i] = generateIp(i);
+    IpTrace trace;
+    trace.fill(END_OF_TRACE);
+    for (uint64_t i = 0; i < shape.depth; ++i) {
+        trace[i] = generateIp(shape, i);
     }
     return trace;
 }
 
-std::vector<Trace> generateTraces()
+std::vector<IpTrace> generateTraces(const TreeShape& shape)
 {
-    std::vector<Trace> traces(NUM_TRACES);
-    std::generate(traces.begin(), traces.end(), generateTrace);
+    std::vector<IpTrace> traces(NUM_TRACES);
+    std::generate(traces.begin(), traces.end(), [&shape]() { return generateTrace(shape); });
     return traces;
 }
 
@@ -100,7 +118,7 @@ void setParents(boost::container::pmr::slist<Node<boost::container::pmr::slist>>
 }
 
 template <template <typename...> class Container, typename... Allocator>
-Container<Node<Container>> buildTree(const std::vector<Trace>& traces, const Allocator&... allocator)
+Container<Node<Container>> buildTree(const std::vector<IpTrace>& traces, const Allocator&... allocator)
 {
     auto findNode = [&](Container<Node<Container>>* nodes, uint64_t ip, const Node<Container>* parent) {
         auto it =
@@ -115,6 +133,9 @@ Container<Node<Container>> buildTree(const std::vector<Trace>& traces, const All
     for (const auto& trace : traces) {
         auto* nodes = &ret;
         for (const auto& ip : trace) {
+            if (ip == END_OF_TRACE) {
+                break;
+            }
             auto it = findNode(nodes, ip, parent);
             it->cost.allocations++;
             nodes = &it->children;
@@ -142,14 +163,14 @@ uint64_t numNodes(const Container<Node<Container>>& tree)
 }
 
 template <template <typename...> class Container>
-std::pair<uint64_t, uint64_t> run(const std::vector<Trace>& traces)
+std::pair<uint64_t, uint64_t> run(const std::vector<IpTrace>& traces)
 {
     const auto tree = buildTree<Container>(traces);
     return {tree.size(), numNodes(tree)};
 }
 
 template <>
-std::pair<uint64_t, uint64_t> run<boost::container::pmr::slist>(const std::vector<Trace>& traces)
+std::pair<uint64_t, uint64_t> run<boost::container::pmr::slist>(const std::vector<IpTrace>& traces)
 {
     boost::container::pmr::monotonic_buffer_resource mbr;
     const auto tree = buildTree<boost::container::pmr::slist>(traces, &mbr);
@@ -157,6 +178,28 @@ std::pair<uint64_t, uint64_t> run<boost::container::pmr::slist>(const std::vecto
 }
 }
 
+/// the tree used by the tracker to index backtraces
+std::pair<uint64_t, uint64_t> runTraceTree(const std::vector<IpTrace>& traces)
+{
+    TraceTree tree;
+    uint64_t numNodes = 0;
+    uint64_t leafIndexSum = 0;
+    Trace trace;
+    IpTrace leafToRoot;
+    for (const auto& ipTrace : traces) {
+        const auto depth = std::find(ipTrace.begin(), ipTrace.end(), END_OF_TRACE) - ipTrace.begin();
+        // the tracker skips null ips, so shift them all to keep the tree identical to the other containers
+        std::transform(std::make_reverse_iterator(ipTrace.begin() + depth), std::make_reverse_iterator(ipTrace.begin()),
+                       leafToRoot.begin(), [](uint64_t ip) { return ip + 1; });
+        trace.fillTestData(leafToRoot.begin(), leafToRoot.begin() + depth);
+        leafIndexSum += tree.index(trace, [&numNodes](uintptr_t, uint32_t) {
+            ++numNodes;
+            return true;
+        });
+    }
+    return {leafIndexSum, numNodes};
+}
+
 enum class Tag
 {
     QVector,
@@ -164,9 +207,10 @@ enum class Tag
     StdList,
     BoostSlist,
     BoostPmrSlist,
+    TraceTree,
 };
 
-std::pair<uint64_t, uint64_t> run(const std::vector<Trace>& traces, Tag tag)
+std::pair<uint64_t, uint64_t> run(const std::vector<IpTrace>& traces, Tag tag)
 {
     switch (tag) {
     case Tag::QVector:
@@ -179,14 +223,17 @@ std::pair<uint64_t, uint64_t> run(const std::vector<Trace>& traces, Tag tag)
         return Tree::run<boost::container::slist>(traces);
     case Tag::BoostPmrSlist:
         return Tree::run<boost::container::pmr::slist>(traces);
+    case Tag::TraceTree:
+        return runTraceTree(traces);
     }
     Q_UNREACHABLE();
 }
 
 int main(int argc, char** argv)
 {
-    if (argc != 2) {
-        std::cerr << "usage: bench_tree [QVector|std::vector|std::list|boost::slist|boost::pmr::slist]\n";
+    if (argc != 2 && argc != 3) {
+        std::cerr << "usage: bench_tree [QVector|std::vector|std::list|boost::slist|boost::pmr::slist|TraceTree] "
+                     "[default|wide|deep]\n";
         return 1;
     }
 
@@ -202,11 +249,25 @@ int main(int argc, char** argv)
             return Tag::BoostSlist;
         if (t == "boost::pmr::slist")
             return Tag::BoostPmrSlist;
+        if (t == "TraceTree")
+            return Tag::TraceTree;
         std::cerr << "unhandled tag: " << t << "\n";
         exit(1);
     }();
 
-    const auto traces = generateTraces();
+    const auto shape = [&]() {
+        auto s = std::string(argc == 3 ? argv[2] : "default");
+        if (s == "default")
+            return DEFAULT_SHAPE;
+        if (s == "wide")
+            return WIDE_SHAPE;
+        if (s == "deep")
+            return DEEP_SHAPE;
+        std::cerr << "unhandled shape: " << s << "\n";
+        exit(1);
+    }();
+
+    const auto traces = generateTraces(shape);
     const auto result = run(traces, tag);
     std::cout << result.first << ", " << result.second << std::endl;
     return 0;
@@ -0,0 +1,88 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+#include <src/track/trace.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <benchutil.h>
+
+// the DWARF based backend this binary got linked against
+#ifndef BENCH_UNWIND_DWARF_BACKEND
+#define BENCH_UNWIND_DWARF_BACKEND "dwarf"
+#endif
+
+namespace {
+struct Result
+{
+    std::chrono::nanoseconds elapsed;
+    int frames;
+};
+
+Result __attribute__((noinline)) unwindAt(int depth, int iterations)
+{
+    if (depth > 0) {
+        auto result = unwindAt(depth - 1, iterations);
+        // prevent tail calls, otherwise we would not build up a stack
+        clobber();
+        return result;
+    }
+
+    Trace trace;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        trace.fill(0);
+        escape(&trace);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    return {end - start, trace.size()};
+}
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2 || argc > 4) {
+        std::cerr << "usage: bench_unwind [dwarf|dwarf-incremental|fp] [DEPTH] [ITERATIONS]\n";
+        return 1;
+    }
+
+    const auto unwinder = std::string(argv[1]);
+    std::string backend;
+    if (unwinder == "dwarf") {
+        Trace::setUnwinder(Trace::Unwinder::Dwarf);
+        backend = BENCH_UNWIND_DWARF_BACKEND;
+    } else if (unwinder == "dwarf-incremental") {
+        if (!Trace::setUnwinder(Trace::Unwinder::IncrementalDwarf)) {
+            std::cerr << "incremental unwinding is not supported by " << BENCH_UNWIND_DWARF_BACKEND << "\n";
+            return 1;
+        }
+        backend = std::string(BENCH_UNWIND_DWARF_BACKEND) + " (incremental)";
+    } else if (unwinder == "fp") {
+        if (!Trace::setUnwinder(Trace::Unwinder::FramePointer)) {
+            std::cerr << "frame pointer unwinding is not supported on this platform\n";
+            return 1;
+        }
+        backend = "frame pointers";
+    } else {
+        std::cerr << "unhandled unwinder: " << unwinder << "\n";
+        return 1;
+    }
+
+    const int depth = argc > 2 ? atoi(argv[2]) : 32;
+    const int iterations = argc > 3 ? atoi(argv[3]) : 100000;
+
+    Trace::setup();
+    // warm up any caches of the unwinder
+    unwindAt(depth, 1);
+    const auto result = unwindAt(depth, iterations);
+
+    std::cout << backend << ": " << result.frames << " frames, "
+              << std::chrono::duration<double, std::nano>(result.elapsed).count() / iterations << "ns per backtrace\n";
+    return 0;
+}
@@ -0,0 +1,91 @@
+/*
+    SPDX-FileCopyrightText: 2026 The heaptrack developers
+
+    SPDX-License-Identifier: LGPL-2.1-or-later
+*/
+
+/**
+ * Exercises the shadow stack unwinder, run it via:
+ *
+ *   heaptrack --unwinder=shadow-stack ./shadowstack
+ *
+ * All allocations should be attributed to the full chain of instrumented
+ * functions leading to them, also after throwing exceptions through some of them.
+ */
+
+#include <cstdlib>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#define NOINLINE __attribute__((noinline))
+
+NOINLINE void* leaf(int size)
+{
+    return malloc(size);
+}
+
+NOINLINE void* recurse(int depth)
+{
+    if (depth == 0) {
+        return leaf(depth + 10);
+    }
+    auto* ret = recurse(depth - 1);
+    // prevent tail calls
+    asm volatile("" : : "r"(ret) : "memory");
+    return ret;
+}
+
+NOINLINE void throwing(int depth)
+{
+    if (depth == 0) {
+        throw std::runtime_error("unwind me");
+    }
+    throwing(depth - 1);
+    asm volatile("" : : : "memory");
+}
+
+NOINLINE void* afterException()
+{
+    try {
+        // the exit hooks of the unwound functions must still run
+        throwing(5);
+    } catch (const std::exception&) {
+    }
+    return leaf(20);
+}
+
+NOINLINE void allocate(std::vector<void*>* out)
+{
+    for (int i = 0; i < 10; ++i) {
+        out->push_back(recurse(i));
+        out->push_back(afterException());
+    }
+}
+
+int main()
+{
+    std::vector<void*> allocations;
+    allocations.reserve(1000);
+    allocate(&allocations);
+
+    std::vector<std::vector<void*>> threadAllocations(4);
+    std::vector<std::thread> threads;
+    for (auto& out : threadAllocations) {
+        out.reserve(100);
+        threads.emplace_back(allocate, &out);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (auto* ptr : allocations) {
+        free(ptr);
+    }
+    for (const auto& out : threadAllocations) {
+        for (auto* ptr : out) {
+            free(ptr);
+        }
+    }
+    return 0;
+}